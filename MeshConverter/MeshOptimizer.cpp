@@ -0,0 +1,390 @@
+#include "MeshOptimizer.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <unordered_map>
+
+#include "defines.h"
+
+namespace
+{
+	//color is not filled by the loader, so only the bytes until color are compared
+	const size_t VertexKeySize = offsetof(SVertex, color);
+
+	struct VertexKeyHash
+	{
+		const SVertex* vertexes;
+
+		size_t operator()(unsigned int index) const
+		{
+			//FNV-1a
+			const unsigned char* data = reinterpret_cast<const unsigned char*>(&vertexes[index]);
+			uint32_t hash = 2166136261u;
+			for (size_t i = 0; i < VertexKeySize; ++i)
+			{
+				hash ^= data[i];
+				hash *= 16777619u;
+			}
+			return hash;
+		}
+	};
+
+	struct VertexKeyEqual
+	{
+		const SVertex* vertexes;
+
+		bool operator()(unsigned int a, unsigned int b) const
+		{
+			return memcmp(&vertexes[a], &vertexes[b], VertexKeySize) == 0;
+		}
+	};
+
+	//FIFO cache modeled with timestamps. A vertex is in cache if it was added in the last cacheSize insertions
+	unsigned int UpdateCache(unsigned int vertex, std::vector<unsigned int>& cacheTimestamps, unsigned int& timestamp, unsigned int cacheSize)
+	{
+		if (timestamp - cacheTimestamps[vertex] > cacheSize)
+		{
+			cacheTimestamps[vertex] = timestamp++;
+			return 1;
+		}
+		return 0;
+	}
+}
+
+MeshOptimizer::MeshOptimizer(unsigned int cacheSize)
+	: m_cacheSize(cacheSize)
+{
+}
+
+MeshOptimizer::~MeshOptimizer()
+{
+}
+
+void MeshOptimizer::Optimize(VertexContainer& vertexes, IndexContainer& indexes)
+{
+	if (indexes.empty())
+		return;
+
+	TRAP(indexes.size() % 3 == 0);
+
+	size_t initialVertexCount = vertexes.size();
+	float initialACMR = ComputeACMR(indexes, (unsigned int)vertexes.size(), m_cacheSize);
+
+	RemoveDuplicateVertexes(vertexes, indexes);
+
+	IndexContainer cacheOptimizedIndexes;
+	std::vector<unsigned int> clusters;
+	OptimizeVertexCache(indexes, (unsigned int)vertexes.size(), cacheOptimizedIndexes, clusters);
+	OptimizeOverdraw(vertexes, cacheOptimizedIndexes, clusters);
+	indexes.swap(cacheOptimizedIndexes);
+
+	OptimizeVertexFetch(vertexes, indexes);
+
+	std::cout << "\tvertexes: " << initialVertexCount << " -> " << vertexes.size()
+		<< ", ACMR: " << initialACMR << " -> " << ComputeACMR(indexes, (unsigned int)vertexes.size(), m_cacheSize) << std::endl;
+}
+
+void MeshOptimizer::OptimizeIndexes(const VertexContainer& vertexes, IndexContainer& indexes)
+{
+	if (indexes.empty())
+		return;
+
+	TRAP(indexes.size() % 3 == 0);
+
+	IndexContainer cacheOptimizedIndexes;
+	std::vector<unsigned int> clusters;
+	OptimizeVertexCache(indexes, (unsigned int)vertexes.size(), cacheOptimizedIndexes, clusters);
+	OptimizeOverdraw(vertexes, cacheOptimizedIndexes, clusters);
+	indexes.swap(cacheOptimizedIndexes);
+}
+
+float MeshOptimizer::ComputeACMR(const IndexContainer& indexes, unsigned int vertexCount, unsigned int cacheSize)
+{
+	if (indexes.empty())
+		return 0.0f;
+
+	std::vector<unsigned int> cacheTimestamps(vertexCount, 0);
+	unsigned int timestamp = cacheSize + 1;
+	unsigned int misses = 0;
+
+	for (auto index : indexes)
+		misses += UpdateCache(index, cacheTimestamps, timestamp, cacheSize);
+
+	return float(misses) / float(indexes.size() / 3);
+}
+
+void MeshOptimizer::RemoveDuplicateVertexes(VertexContainer& vertexes, IndexContainer& indexes)
+{
+	VertexKeyHash hasher{ vertexes.data() };
+	VertexKeyEqual equal{ vertexes.data() };
+	std::unordered_map<unsigned int, unsigned int, VertexKeyHash, VertexKeyEqual> uniqueVertexes(vertexes.size(), hasher, equal);
+
+	std::vector<unsigned int> remap(vertexes.size());
+	VertexContainer newVertexes;
+	newVertexes.reserve(vertexes.size());
+
+	for (unsigned int i = 0; i < vertexes.size(); ++i)
+	{
+		auto it = uniqueVertexes.find(i);
+		if (it != uniqueVertexes.end())
+		{
+			remap[i] = it->second;
+			continue;
+		}
+
+		remap[i] = (unsigned int)newVertexes.size();
+		uniqueVertexes.emplace(i, remap[i]);
+		newVertexes.push_back(vertexes[i]);
+	}
+
+	for (auto& index : indexes)
+		index = remap[index];
+
+	//the keys point in the old container, so the swap happens after we are done with the map
+	uniqueVertexes.clear();
+	vertexes.swap(newVertexes);
+}
+
+void MeshOptimizer::OptimizeVertexCache(const IndexContainer& indexes, unsigned int vertexCount, IndexContainer& outIndexes, std::vector<unsigned int>& outClusters)
+{
+	unsigned int triangleCount = (unsigned int)indexes.size() / 3;
+
+	//vertex -> triangles adjacency
+	std::vector<unsigned int> liveTriangles(vertexCount, 0);
+	for (auto index : indexes)
+		++liveTriangles[index];
+
+	std::vector<unsigned int> adjacencyOffsets(vertexCount + 1, 0);
+	for (unsigned int v = 0; v < vertexCount; ++v)
+		adjacencyOffsets[v + 1] = adjacencyOffsets[v] + liveTriangles[v];
+
+	std::vector<unsigned int> adjacency(indexes.size());
+	std::vector<unsigned int> fillOffsets(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+	for (unsigned int t = 0; t < triangleCount; ++t)
+		for (unsigned int i = 0; i < 3; ++i)
+			adjacency[fillOffsets[indexes[t * 3 + i]]++] = t;
+
+	std::vector<unsigned int> cacheTimestamps(vertexCount, 0);
+	std::vector<bool> emitted(triangleCount, false);
+	std::vector<unsigned int> deadEndStack;
+	std::vector<unsigned int> candidates;
+
+	unsigned int timestamp = m_cacheSize + 1;
+	unsigned int cursor = 0;
+
+	outIndexes.clear();
+	outIndexes.reserve(indexes.size());
+	outClusters.clear();
+	outClusters.push_back(0);
+
+	bool hardBoundary = false;
+	int fanningVertex = GetNextVertex(candidates, liveTriangles, cacheTimestamps, timestamp, deadEndStack, cursor, hardBoundary);
+	while (fanningVertex >= 0)
+	{
+		candidates.clear();
+
+		//emit all the triangles of the fanning vertex
+		for (unsigned int a = adjacencyOffsets[fanningVertex]; a < adjacencyOffsets[fanningVertex + 1]; ++a)
+		{
+			unsigned int t = adjacency[a];
+			if (emitted[t])
+				continue;
+
+			for (unsigned int i = 0; i < 3; ++i)
+			{
+				unsigned int v = indexes[t * 3 + i];
+				outIndexes.push_back(v);
+				deadEndStack.push_back(v);
+				candidates.push_back(v);
+				--liveTriangles[v];
+				UpdateCache(v, cacheTimestamps, timestamp, m_cacheSize);
+			}
+			emitted[t] = true;
+		}
+
+		fanningVertex = GetNextVertex(candidates, liveTriangles, cacheTimestamps, timestamp, deadEndStack, cursor, hardBoundary);
+
+		//the cache is "broken" when we have to jump. These are the places where the triangle order can be changed safely
+		unsigned int emittedTriangles = (unsigned int)outIndexes.size() / 3;
+		if (hardBoundary && fanningVertex >= 0 && outClusters.back() != emittedTriangles)
+			outClusters.push_back(emittedTriangles);
+	}
+
+	TRAP(outIndexes.size() == indexes.size());
+}
+
+int MeshOptimizer::GetNextVertex(const std::vector<unsigned int>& candidates, const std::vector<unsigned int>& liveTriangles, const std::vector<unsigned int>& cacheTimestamps,
+	unsigned int timestamp, std::vector<unsigned int>& deadEndStack, unsigned int& cursor, bool& outHardBoundary)
+{
+	outHardBoundary = false;
+
+	//prefer the vertex that will still be in cache after all its triangles are emitted, and is the oldest in cache
+	int bestVertex = -1;
+	int bestPriority = -1;
+	for (auto v : candidates)
+	{
+		if (liveTriangles[v] == 0)
+			continue;
+
+		int priority = 0;
+		if (timestamp - cacheTimestamps[v] + 2 * liveTriangles[v] <= m_cacheSize)
+			priority = int(timestamp - cacheTimestamps[v]);
+
+		if (priority > bestPriority)
+		{
+			bestPriority = priority;
+			bestVertex = int(v);
+		}
+	}
+
+	if (bestVertex >= 0)
+		return bestVertex;
+
+	outHardBoundary = true;
+
+	//dead end. Try the recently used vertexes
+	while (!deadEndStack.empty())
+	{
+		unsigned int v = deadEndStack.back();
+		deadEndStack.pop_back();
+		if (liveTriangles[v] > 0)
+			return int(v);
+	}
+
+	//go on with the next vertex in the input order
+	for (; cursor < liveTriangles.size(); ++cursor)
+		if (liveTriangles[cursor] > 0)
+			return int(cursor);
+
+	return -1;
+}
+
+void MeshOptimizer::OptimizeOverdraw(const VertexContainer& vertexes, IndexContainer& indexes, const std::vector<unsigned int>& clusters)
+{
+	const float softBoundaryThreshold = 1.05f; //how much we accept to lose from the ACMR of a cluster when it's split
+	unsigned int triangleCount = (unsigned int)indexes.size() / 3;
+
+	//split the clusters at the points where the cache is as good as the average of the cluster
+	std::vector<unsigned int> softClusters;
+	std::vector<unsigned int> cacheTimestamps(vertexes.size(), 0);
+	unsigned int timestamp = m_cacheSize + 1;
+
+	for (unsigned int c = 0; c < clusters.size(); ++c)
+	{
+		unsigned int start = clusters[c];
+		unsigned int end = (c + 1 < clusters.size()) ? clusters[c + 1] : triangleCount;
+
+		timestamp += m_cacheSize + 1; //flush
+		unsigned int clusterMisses = 0;
+		for (unsigned int i = start * 3; i < end * 3; ++i)
+			clusterMisses += UpdateCache(indexes[i], cacheTimestamps, timestamp, m_cacheSize);
+
+		float clusterACMR = float(clusterMisses) / float(end - start);
+
+		timestamp += m_cacheSize + 1;
+		unsigned int softStart = start;
+		unsigned int misses = 0;
+		softClusters.push_back(start);
+		for (unsigned int t = start; t < end; ++t)
+		{
+			for (unsigned int i = 0; i < 3; ++i)
+				misses += UpdateCache(indexes[t * 3 + i], cacheTimestamps, timestamp, m_cacheSize);
+
+			if (t + 1 < end && float(misses) / float(t + 1 - softStart) <= clusterACMR * softBoundaryThreshold)
+			{
+				softStart = t + 1;
+				misses = 0;
+				timestamp += m_cacheSize + 1;
+				softClusters.push_back(softStart);
+			}
+		}
+	}
+
+	//sort the clusters so the ones facing away from the center of the mesh are drawn first. They are more likely to occlude the others
+	glm::vec3 meshCentroid(0.0f);
+	float meshArea = 0.0f;
+
+	struct ClusterInfo
+	{
+		unsigned int	Start;
+		unsigned int	End;
+		float			SortKey;
+	};
+
+	std::vector<ClusterInfo> clusterInfos(softClusters.size());
+	std::vector<glm::vec3> clusterCentroids(softClusters.size(), glm::vec3(0.0f));
+	std::vector<glm::vec3> clusterNormals(softClusters.size(), glm::vec3(0.0f));
+
+	for (unsigned int c = 0; c < softClusters.size(); ++c)
+	{
+		ClusterInfo& info = clusterInfos[c];
+		info.Start = softClusters[c];
+		info.End = (c + 1 < softClusters.size()) ? softClusters[c + 1] : triangleCount;
+
+		float clusterArea = 0.0f;
+		for (unsigned int t = info.Start; t < info.End; ++t)
+		{
+			const glm::vec3& p0 = vertexes[indexes[t * 3 + 0]].pos;
+			const glm::vec3& p1 = vertexes[indexes[t * 3 + 1]].pos;
+			const glm::vec3& p2 = vertexes[indexes[t * 3 + 2]].pos;
+
+			glm::vec3 normal = glm::cross(p1 - p0, p2 - p0); //length is 2 * area
+			float area = glm::length(normal);
+
+			clusterNormals[c] += normal;
+			clusterCentroids[c] += (p0 + p1 + p2) / 3.0f * area;
+			clusterArea += area;
+		}
+
+		meshCentroid += clusterCentroids[c];
+		meshArea += clusterArea;
+
+		if (clusterArea > 0.0f)
+			clusterCentroids[c] /= clusterArea;
+	}
+
+	if (meshArea > 0.0f)
+		meshCentroid /= meshArea;
+
+	for (unsigned int c = 0; c < clusterInfos.size(); ++c)
+	{
+		float normalLength = glm::length(clusterNormals[c]);
+		glm::vec3 normal = (normalLength > 0.0f) ? clusterNormals[c] / normalLength : glm::vec3(0.0f);
+		clusterInfos[c].SortKey = glm::dot(clusterCentroids[c] - meshCentroid, normal);
+	}
+
+	std::stable_sort(clusterInfos.begin(), clusterInfos.end(), [](const ClusterInfo& a, const ClusterInfo& b)
+	{
+		return a.SortKey > b.SortKey;
+	});
+
+	IndexContainer sortedIndexes;
+	sortedIndexes.reserve(indexes.size());
+	for (const auto& info : clusterInfos)
+		sortedIndexes.insert(sortedIndexes.end(), indexes.begin() + info.Start * 3, indexes.begin() + info.End * 3);
+
+	indexes.swap(sortedIndexes);
+}
+
+void MeshOptimizer::OptimizeVertexFetch(VertexContainer& vertexes, IndexContainer& indexes)
+{
+	//vertexes are placed in the order of the first use. Unused vertexes are dropped
+	const unsigned int unused = ~0u;
+	std::vector<unsigned int> remap(vertexes.size(), unused);
+	VertexContainer newVertexes;
+	newVertexes.reserve(vertexes.size());
+
+	for (auto& index : indexes)
+	{
+		if (remap[index] == unused)
+		{
+			remap[index] = (unsigned int)newVertexes.size();
+			newVertexes.push_back(vertexes[index]);
+		}
+		index = remap[index];
+	}
+
+	vertexes.swap(newVertexes);
+}
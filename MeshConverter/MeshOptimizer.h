@@ -0,0 +1,38 @@
+#pragma once
+
+#include <vector>
+
+#include "SVertex.h"
+
+//Optimizes the mesh for rendering. Runs on the loaded mesh before it is written to disk:
+// 1. joins identical vertices
+// 2. reorders the triangles for the post transform vertex cache (Tipsify, Sander et al. 2007)
+// 3. reorders the clusters of triangles created at step 2 to reduce overdraw
+// 4. reorders the vertices in the order they are used, for vertex fetch locality
+class MeshOptimizer
+{
+public:
+	typedef std::vector<SVertex> VertexContainer;
+	typedef std::vector<unsigned int> IndexContainer;
+
+	MeshOptimizer(unsigned int cacheSize = 16);
+	virtual ~MeshOptimizer();
+
+	void Optimize(VertexContainer& vertexes, IndexContainer& indexes);
+	//steps 2 and 3 only, for the LODs that share the vertexes of an optimized mesh
+	void OptimizeIndexes(const VertexContainer& vertexes, IndexContainer& indexes);
+
+	//average cache miss ratio (transformed vertices / triangle) with a FIFO cache of cacheSize. 0.5 is the best, 3 the worst
+	static float ComputeACMR(const IndexContainer& indexes, unsigned int vertexCount, unsigned int cacheSize);
+
+private:
+	void RemoveDuplicateVertexes(VertexContainer& vertexes, IndexContainer& indexes);
+	void OptimizeVertexCache(const IndexContainer& indexes, unsigned int vertexCount, IndexContainer& outIndexes, std::vector<unsigned int>& outClusters);
+	void OptimizeOverdraw(const VertexContainer& vertexes, IndexContainer& indexes, const std::vector<unsigned int>& clusters);
+	void OptimizeVertexFetch(VertexContainer& vertexes, IndexContainer& indexes);
+
+	int GetNextVertex(const std::vector<unsigned int>& candidates, const std::vector<unsigned int>& liveTriangles, const std::vector<unsigned int>& cacheTimestamps,
+		unsigned int timestamp, std::vector<unsigned int>& deadEndStack, unsigned int& cursor, bool& outHardBoundary);
+private:
+	unsigned int		m_cacheSize;
+};
@@ -0,0 +1,344 @@
+#include "MeshSimplifier.h"
+
+#include <algorithm>
+
+#include "defines.h"
+
+namespace
+{
+	struct CollapseGreater
+	{
+		template<class CollapseType>
+		bool operator()(const CollapseType& a, const CollapseType& b) const
+		{
+			return a.Error > b.Error;
+		}
+	};
+
+	bool PositionLess(const glm::vec3& a, const glm::vec3& b)
+	{
+		if (a.x != b.x)
+			return a.x < b.x;
+		if (a.y != b.y)
+			return a.y < b.y;
+		return a.z < b.z;
+	}
+
+	glm::vec3 TriangleNormal(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2)
+	{
+		return glm::cross(p1 - p0, p2 - p0); //length is 2 * area
+	}
+}
+
+MeshSimplifier::MeshSimplifier(const VertexContainer& vertexes)
+	: m_vertexes(vertexes)
+	, m_aliveTriangles(0)
+{
+}
+
+MeshSimplifier::~MeshSimplifier()
+{
+}
+
+float MeshSimplifier::Simplify(const IndexContainer& indexes, unsigned int targetTriangles, float maxError, IndexContainer& outIndexes)
+{
+	TRAP(indexes.size() % 3 == 0);
+	Init(indexes);
+
+	float biggestError = 0.0f;
+	while (m_aliveTriangles > targetTriangles && !m_heap.empty())
+	{
+		std::pop_heap(m_heap.begin(), m_heap.end(), CollapseGreater());
+		Collapse collapse = m_heap.back();
+		m_heap.pop_back();
+
+		//one of the vertexes changed after this collapse was pushed, a newer one is in the heap
+		if (collapse.FromVersion != m_versions[collapse.From] || collapse.ToVersion != m_versions[collapse.To])
+			continue;
+
+		if (collapse.Error > maxError)
+			break;
+
+		//it's pushed again when the neighbourhood changes
+		if (!IsCollapseValid(collapse.From, collapse.To))
+			continue;
+
+		ApplyCollapse(collapse.From, collapse.To);
+		biggestError = glm::max(biggestError, collapse.Error);
+	}
+
+	outIndexes.clear();
+	outIndexes.reserve(m_aliveTriangles * 3);
+	for (unsigned int t = 0; t < m_isTriangleAlive.size(); ++t)
+	{
+		if (m_isTriangleAlive[t])
+			outIndexes.insert(outIndexes.end(), m_triangles.begin() + t * 3, m_triangles.begin() + t * 3 + 3);
+	}
+
+	return biggestError;
+}
+
+void MeshSimplifier::Init(const IndexContainer& indexes)
+{
+	unsigned int triangleCount = (unsigned int)indexes.size() / 3;
+
+	m_triangles = indexes;
+	m_isTriangleAlive.assign(triangleCount, true);
+	m_aliveTriangles = triangleCount;
+	m_vertexTriangles.assign(m_vertexes.size(), std::vector<unsigned int>());
+	m_quadrics.assign(m_vertexes.size(), Quadric{ 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 });
+	m_versions.assign(m_vertexes.size(), 0);
+	m_heap.clear();
+
+	for (unsigned int t = 0; t < triangleCount; ++t)
+	{
+		const unsigned int* triangle = &m_triangles[t * 3];
+		if (triangle[0] == triangle[1] || triangle[1] == triangle[2] || triangle[0] == triangle[2])
+		{
+			m_isTriangleAlive[t] = false;
+			--m_aliveTriangles;
+			continue;
+		}
+
+		//the plane of the triangle, ax + by + cz + d = 0
+		const glm::vec3& p0 = m_vertexes[triangle[0]].pos;
+		glm::vec3 normal = TriangleNormal(p0, m_vertexes[triangle[1]].pos, m_vertexes[triangle[2]].pos);
+		float normalLength = glm::length(normal);
+
+		Quadric plane = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+		if (normalLength > 0.0f)
+		{
+			glm::dvec3 n = glm::dvec3(normal / normalLength);
+			double d = -glm::dot(n, glm::dvec3(p0));
+			plane = Quadric{ n.x * n.x, n.x * n.y, n.x * n.z, n.x * d, n.y * n.y, n.y * n.z, n.y * d, n.z * n.z, n.z * d, d * d };
+		}
+
+		for (unsigned int i = 0; i < 3; ++i)
+		{
+			m_vertexTriangles[triangle[i]].push_back(t);
+			AddQuadric(m_quadrics[triangle[i]], plane);
+		}
+	}
+
+	FindLockedVertexes();
+
+	std::vector<unsigned int> neighbours;
+	for (unsigned int v = 0; v < m_vertexes.size(); ++v)
+	{
+		GetNeighbours(v, neighbours);
+		for (auto n : neighbours)
+			PushCollapse(v, n);
+	}
+}
+
+void MeshSimplifier::FindLockedVertexes()
+{
+	m_isLocked.assign(m_vertexes.size(), false);
+	m_isSeam.assign(m_vertexes.size(), false);
+
+	//the vertexes with the same position are next to each other after the sort
+	std::vector<unsigned int> sortedVertexes(m_vertexes.size());
+	for (unsigned int v = 0; v < sortedVertexes.size(); ++v)
+		sortedVertexes[v] = v;
+
+	std::sort(sortedVertexes.begin(), sortedVertexes.end(), [this](unsigned int a, unsigned int b)
+	{
+		return PositionLess(m_vertexes[a].pos, m_vertexes[b].pos);
+	});
+
+	for (unsigned int first = 0; first < sortedVertexes.size();)
+	{
+		unsigned int last = first + 1;
+		while (last < sortedVertexes.size() && m_vertexes[sortedVertexes[last]].pos == m_vertexes[sortedVertexes[first]].pos)
+			++last;
+
+		for (unsigned int i = first; last - first > 1 && i < last; ++i)
+			m_isSeam[sortedVertexes[i]] = m_isLocked[sortedVertexes[i]] = true;
+
+		first = last;
+	}
+
+	//an edge used by one triangle is on the border, more than 2 is a non manifold edge
+	std::vector<uint64_t> edges;
+	edges.reserve(m_aliveTriangles * 3);
+	for (unsigned int t = 0; t < m_isTriangleAlive.size(); ++t)
+	{
+		if (!m_isTriangleAlive[t])
+			continue;
+
+		for (unsigned int i = 0; i < 3; ++i)
+		{
+			uint64_t a = m_triangles[t * 3 + i];
+			uint64_t b = m_triangles[t * 3 + (i + 1) % 3];
+			edges.push_back((a < b) ? ((a << 32) | b) : ((b << 32) | a));
+		}
+	}
+	std::sort(edges.begin(), edges.end());
+
+	for (unsigned int first = 0; first < edges.size();)
+	{
+		unsigned int last = first + 1;
+		while (last < edges.size() && edges[last] == edges[first])
+			++last;
+
+		if (last - first != 2)
+			m_isLocked[edges[first] >> 32] = m_isLocked[edges[first] & 0xFFFFFFFF] = true;
+
+		first = last;
+	}
+}
+
+void MeshSimplifier::GetNeighbours(unsigned int vertex, std::vector<unsigned int>& outNeighbours) const
+{
+	outNeighbours.clear();
+	for (auto t : m_vertexTriangles[vertex])
+	{
+		if (!m_isTriangleAlive[t])
+			continue;
+
+		for (unsigned int i = 0; i < 3; ++i)
+		{
+			unsigned int v = m_triangles[t * 3 + i];
+			if (v != vertex && std::find(outNeighbours.begin(), outNeighbours.end(), v) == outNeighbours.end())
+				outNeighbours.push_back(v);
+		}
+	}
+}
+
+void MeshSimplifier::PushCollapses(unsigned int vertex)
+{
+	std::vector<unsigned int> neighbours;
+	GetNeighbours(vertex, neighbours);
+	for (auto n : neighbours)
+	{
+		PushCollapse(vertex, n);
+		PushCollapse(n, vertex);
+	}
+}
+
+void MeshSimplifier::PushCollapse(unsigned int from, unsigned int to)
+{
+	if (m_isLocked[from] || m_isSeam[to])
+		return;
+
+	//the vertex stays where to is, so the error is of the planes of both vertexes measured from there
+	Quadric quadric = m_quadrics[from];
+	AddQuadric(quadric, m_quadrics[to]);
+
+	Collapse collapse;
+	collapse.Error = EvaluateQuadric(quadric, m_vertexes[to].pos);
+	collapse.From = from;
+	collapse.To = to;
+	collapse.FromVersion = m_versions[from];
+	collapse.ToVersion = m_versions[to];
+
+	m_heap.push_back(collapse);
+	std::push_heap(m_heap.begin(), m_heap.end(), CollapseGreater());
+}
+
+bool MeshSimplifier::IsCollapseValid(unsigned int from, unsigned int to) const
+{
+	//link condition: the only common neighbours are the opposite vertexes of the triangles of the edge, otherwise
+	//the collapse pinches the surface
+	std::vector<unsigned int> fromNeighbours;
+	std::vector<unsigned int> toNeighbours;
+	GetNeighbours(from, fromNeighbours);
+	GetNeighbours(to, toNeighbours);
+
+	unsigned int commonNeighbours = 0;
+	for (auto n : fromNeighbours)
+		commonNeighbours += (std::find(toNeighbours.begin(), toNeighbours.end(), n) != toNeighbours.end()) ? 1 : 0;
+
+	unsigned int edgeTriangles = 0;
+	for (auto t : m_vertexTriangles[from])
+	{
+		if (!m_isTriangleAlive[t])
+			continue;
+
+		const unsigned int* triangle = &m_triangles[t * 3];
+		bool hasTo = triangle[0] == to || triangle[1] == to || triangle[2] == to;
+		if (hasTo)
+		{
+			++edgeTriangles;
+			continue; //removed by the collapse
+		}
+
+		glm::vec3 positions[3];
+		glm::vec3 newPositions[3];
+		for (unsigned int i = 0; i < 3; ++i)
+		{
+			positions[i] = m_vertexes[triangle[i]].pos;
+			newPositions[i] = (triangle[i] == from) ? m_vertexes[to].pos : positions[i];
+		}
+
+		glm::vec3 normal = TriangleNormal(positions[0], positions[1], positions[2]);
+		glm::vec3 newNormal = TriangleNormal(newPositions[0], newPositions[1], newPositions[2]);
+		if (glm::dot(normal, newNormal) <= 0.0f)
+			return false;
+	}
+
+	return commonNeighbours <= edgeTriangles;
+}
+
+void MeshSimplifier::ApplyCollapse(unsigned int from, unsigned int to)
+{
+	AddQuadric(m_quadrics[to], m_quadrics[from]);
+
+	for (auto t : m_vertexTriangles[from])
+	{
+		if (!m_isTriangleAlive[t])
+			continue;
+
+		unsigned int* triangle = &m_triangles[t * 3];
+		if (triangle[0] == to || triangle[1] == to || triangle[2] == to)
+		{
+			m_isTriangleAlive[t] = false;
+			--m_aliveTriangles;
+			continue;
+		}
+
+		for (unsigned int i = 0; i < 3; ++i)
+		{
+			if (triangle[i] == from)
+				triangle[i] = to;
+		}
+		m_vertexTriangles[to].push_back(t);
+	}
+	m_vertexTriangles[from].clear();
+
+	std::vector<unsigned int>& toTriangles = m_vertexTriangles[to];
+	toTriangles.erase(std::remove_if(toTriangles.begin(), toTriangles.end(), [this](unsigned int t) { return !m_isTriangleAlive[t]; }), toTriangles.end());
+
+	//the quadric of to changed, so all its collapses have a new error
+	++m_versions[from];
+	++m_versions[to];
+	PushCollapses(to);
+}
+
+void MeshSimplifier::AddQuadric(Quadric& inOutQuadric, const Quadric& other)
+{
+	inOutQuadric.a2 += other.a2;
+	inOutQuadric.ab += other.ab;
+	inOutQuadric.ac += other.ac;
+	inOutQuadric.ad += other.ad;
+	inOutQuadric.b2 += other.b2;
+	inOutQuadric.bc += other.bc;
+	inOutQuadric.bd += other.bd;
+	inOutQuadric.c2 += other.c2;
+	inOutQuadric.cd += other.cd;
+	inOutQuadric.d2 += other.d2;
+}
+
+float MeshSimplifier::EvaluateQuadric(const Quadric& q, const glm::vec3& pos)
+{
+	//v^T * Q * v with v = (x, y, z, 1)
+	double x = pos.x;
+	double y = pos.y;
+	double z = pos.z;
+	double error = q.a2 * x * x + 2.0 * q.ab * x * y + 2.0 * q.ac * x * z + 2.0 * q.ad * x
+		+ q.b2 * y * y + 2.0 * q.bc * y * z + 2.0 * q.bd * y
+		+ q.c2 * z * z + 2.0 * q.cd * z
+		+ q.d2;
+
+	return (float)glm::max(error, 0.0);
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <vector>
+
+#include "SVertex.h"
+
+//Quadric error simplification (Garland, Heckbert 1997), used to build the LOD chain of a mesh.
+//An edge is collapsed into one of its vertexes, so a simplified mesh is only a new index buffer over the same vertexes
+//and all the LODs share the vertex buffer of the full mesh. The vertexes on the borders and on the attribute seams
+//(same position, other uv or normal) are never moved, so the silhouette of open meshes and the uv mapping don't tear
+class MeshSimplifier
+{
+public:
+	typedef std::vector<SVertex> VertexContainer;
+	typedef std::vector<unsigned int> IndexContainer;
+
+	MeshSimplifier(const VertexContainer& vertexes);
+	virtual ~MeshSimplifier();
+
+	//collapses edges until the mesh has at most targetTriangles or the cheapest collapse has an error over maxError.
+	//The error is the sum of the squared distances to the planes of the original triangles around the vertex, in the
+	//units of the mesh. Returns the biggest error of the collapses made
+	float Simplify(const IndexContainer& indexes, unsigned int targetTriangles, float maxError, IndexContainer& outIndexes);
+
+private:
+	//symmetric 4x4 matrix, the sum of the squared distances to a set of planes
+	struct Quadric
+	{
+		double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+	};
+
+	struct Collapse
+	{
+		float			Error;
+		unsigned int	From;
+		unsigned int	To;
+		unsigned int	FromVersion;
+		unsigned int	ToVersion;
+	};
+
+	void Init(const IndexContainer& indexes);
+	//the border and the seam vertexes can't be moved, the seam ones can't be the target of a collapse either
+	void FindLockedVertexes();
+	//the vertexes that share a live triangle with vertex
+	void GetNeighbours(unsigned int vertex, std::vector<unsigned int>& outNeighbours) const;
+	void PushCollapses(unsigned int vertex);
+	void PushCollapse(unsigned int from, unsigned int to);
+	//the triangles around from must not flip when from is moved in to, and the mesh must stay manifold
+	bool IsCollapseValid(unsigned int from, unsigned int to) const;
+	void ApplyCollapse(unsigned int from, unsigned int to);
+
+	static void AddQuadric(Quadric& inOutQuadric, const Quadric& other);
+	static float EvaluateQuadric(const Quadric& quadric, const glm::vec3& pos);
+private:
+	const VertexContainer&						m_vertexes;
+
+	IndexContainer								m_triangles; //3 indexes per triangle, rewritten by the collapses
+	std::vector<bool>							m_isTriangleAlive;
+	unsigned int								m_aliveTriangles;
+	std::vector<std::vector<unsigned int>>		m_vertexTriangles; //the triangles around every vertex, the dead ones are skipped
+
+	std::vector<Quadric>						m_quadrics;
+	std::vector<bool>							m_isLocked;
+	std::vector<bool>							m_isSeam;
+	std::vector<unsigned int>					m_versions; //changed when the neighbourhood of the vertex changes, the older collapses are skipped
+	std::vector<Collapse>						m_heap; //min heap on Error
+};
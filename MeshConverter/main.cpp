@@ -1,17 +1,24 @@
 #include <string>
-#include <unordered_set>
+#include <unordered_map>
 #include <vector>
 #include <fstream>
 #include <iostream>
 
 #include "MeshLoader.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
 #include "SVertex.h"
+#include "VertexCompression.h"
 
 #include "include/rapidxml/rapidxml.hpp"
 #include "defines.h"
 
 #pragma comment(lib, "assimp.lib")
 
+static const unsigned int s_defaultLodCount = 3; //LODs after the full mesh, when the mesh has no lods attribute
+static const float s_lodMaxError = 0.05f; //biggest distance of a simplified surface from the original, relative to the size of the mesh
+static const float s_lodMinReduction = 0.8f; //a LOD that keeps more of the triangles of the previous one ends the chain
+
 void ReadXmlFile(const std::string& xmlFile, char** fileContent)
 {
 	std::ifstream hXml(xmlFile, std::ifstream::in);
@@ -38,7 +45,44 @@ void ReadXmlFile(const std::string& xmlFile, char** fileContent)
 	hXml.close();
 }
 
-void Binarize(const std::string& file)
+//every LOD has half the triangles of the previous one. They are simplified from the full mesh, so the errors don't add up
+void BuildLods(const std::vector<SVertex>& vertices, const std::vector<unsigned int>& indexes, unsigned int maxLodCount, std::vector<std::vector<unsigned int>>& outLods)
+{
+	outLods.clear();
+	if (indexes.empty() || maxLodCount == 0)
+		return;
+
+	glm::vec3 boundsMin = vertices[indexes[0]].pos;
+	glm::vec3 boundsMax = boundsMin;
+	for (auto index : indexes)
+	{
+		boundsMin = glm::min(boundsMin, vertices[index].pos);
+		boundsMax = glm::max(boundsMax, vertices[index].pos);
+	}
+	float maxDistance = s_lodMaxError * glm::length(boundsMax - boundsMin);
+
+	MeshSimplifier simplifier(vertices);
+	MeshOptimizer optimizer;
+	unsigned int triangleCount = (unsigned int)indexes.size() / 3;
+	unsigned int prevTriangleCount = triangleCount;
+	for (unsigned int lod = 1; lod <= maxLodCount; ++lod)
+	{
+		std::vector<unsigned int> lodIndexes;
+		float error = simplifier.Simplify(indexes, triangleCount >> lod, maxDistance * maxDistance, lodIndexes);
+
+		unsigned int lodTriangleCount = (unsigned int)lodIndexes.size() / 3;
+		if (lodTriangleCount == 0 || lodTriangleCount > prevTriangleCount * s_lodMinReduction)
+			break;
+
+		optimizer.OptimizeIndexes(vertices, lodIndexes);
+		std::cout << "\tLOD " << lod << ": " << lodTriangleCount << " triangles, error: " << std::sqrt(error) << std::endl;
+
+		outLods.push_back(std::move(lodIndexes));
+		prevTriangleCount = lodTriangleCount;
+	}
+}
+
+void Binarize(const std::string& file, unsigned int maxLodCount)
 {
 	std::cout << "Binarize: " << file << "..." << std::endl;
 
@@ -49,6 +93,19 @@ void Binarize(const std::string& file)
 	MeshLoader loader;
 	loader.LoadInto(file, &vertices, &indexes);
 
+	MeshOptimizer optimizer;
+	optimizer.Optimize(vertices, indexes);
+
+	std::vector<std::vector<unsigned int>> lods;
+	BuildLods(vertices, indexes, maxLodCount, lods);
+
+	SCompactMeshHeader header;
+	std::vector<SCompactVertex> compactVertices;
+	CompressVertexes(vertices, compactVertices, header.boundsMin, header.boundsMax);
+	header.magic = COMPACT_MESH_LOD_MAGIC;
+	header.vertexCount = (uint32_t)compactVertices.size();
+	header.indexCount = (uint32_t)indexes.size();
+
 	std::size_t pos = file.find_first_of('.');
 	TRAP(pos != std::string::npos);
 
@@ -57,11 +114,20 @@ void Binarize(const std::string& file)
 
 	TRAP(outFile.is_open());
 
-	outFile << vertices.size();
-	outFile.write((const char*)vertices.data(), vertices.size() * sizeof(SVertex));
-	outFile << indexes.size();
+	outFile.write((const char*)&header, sizeof(SCompactMeshHeader));
+	outFile.write((const char*)compactVertices.data(), compactVertices.size() * sizeof(SCompactVertex));
 	outFile.write((const char*)indexes.data(), indexes.size() * sizeof(unsigned int));
 
+	uint32_t lodCount = (uint32_t)lods.size();
+	outFile.write((const char*)&lodCount, sizeof(uint32_t));
+	for (const auto& lod : lods)
+	{
+		uint32_t lodIndexCount = (uint32_t)lod.size();
+		outFile.write((const char*)&lodIndexCount, sizeof(uint32_t));
+	}
+	for (const auto& lod : lods)
+		outFile.write((const char*)lod.data(), lod.size() * sizeof(unsigned int));
+
 	outFile.close();
 }
 
@@ -76,16 +142,22 @@ int main(int argc, char** argv)
 
 	rapidxml::xml_node<char>* root = doc.first_node("meshes", 0, false);
 	TRAP(root);
-	std::unordered_set<std::string> meshList; //used for not binarize same mesh multiple times
+	std::unordered_map<std::string, unsigned int> meshList; //file -> LOD count, used for not binarize same mesh multiple times
 	for (auto child = root->first_node("mesh", 0, false); child != nullptr; child = child->next_sibling())
 	{
 		rapidxml::xml_attribute<char>* file = child->first_attribute("file", 0, false);
 		TRAP(file);
-		meshList.insert(std::string(file->value()));
+
+		unsigned int lodCount = s_defaultLodCount;
+		rapidxml::xml_attribute<char>* lods = child->first_attribute("lods", 0, false);
+		if (lods)
+			lodCount = (unsigned int)std::stoul(lods->value());
+
+		meshList.insert(std::make_pair(std::string(file->value()), lodCount));
 	}
 
 	for (auto it = meshList.begin(); it != meshList.end(); ++it)
-		Binarize(*it);
+		Binarize(it->first, it->second);
 
 	return 0;
 }
\ No newline at end of file
@@ -1,21 +1,53 @@
+#ifdef _WIN32
 #include <windows.h>
+#endif
 
 #include "rapidxml/rapidxml.hpp"
 #include "../VULKAN/defines.h"
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <string>
 #include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <atomic>
 
 #define SRCXML std::string("src/shaderlist.xml")
 #define SRCDIR std::string("src/")
 #define HEADERDIR std::string("headers/")
+#define CACHEFILE std::string("shaders.cache")
+
+//glslangValidator is shipped next to the shaders for windows. On other platforms it's taken from PATH
+#ifdef _WIN32
+#define COMPILEREXE std::string("src\\glslangValidator.exe")
+#else
+#define COMPILEREXE std::string("glslangValidator")
+#endif
 
 typedef rapidxml::xml_document<char> TXmlDoc;
 typedef rapidxml::xml_node<char>      TXmlNode;
 typedef rapidxml::xml_attribute<char> TXmlAttribute;
 
-TXmlNode* GetNodeVerbose(TXmlNode* parrent, char* name = nullptr)
+struct ShaderJob
+{
+    std::string     shaderFile;
+    std::string     outFile;
+    std::string     commandLine;
+    uint64_t        hash;
+};
+
+//out file -> hash of everything that went into it (source, includes, command line)
+typedef std::unordered_map<std::string, uint64_t> TShaderCache;
+
+std::mutex g_logMutex;
+
+TXmlNode* GetNodeVerbose(TXmlNode* parrent, const char* name = nullptr)
 {
     TXmlNode* node = parrent->first_node(name);
     if (!node)
@@ -24,16 +56,16 @@ TXmlNode* GetNodeVerbose(TXmlNode* parrent, char* name = nullptr)
     return node;
 }
 
-TXmlNode* GetNodeVerbose(TXmlDoc* parrent, char* name = nullptr)
+TXmlNode* GetNodeVerbose(TXmlDoc* parrent, const char* name = nullptr)
 {
     TXmlNode* node = parrent->first_node(name);
-    
+
     if (!node)
         std::cout << "ERROR: Node: " << name << " not found for node " << parrent->name() << "!" << std::endl;
     return node;
 }
 
-TXmlAttribute* GetAttributeVerbose(TXmlNode* parrent, char* name = nullptr)
+TXmlAttribute* GetAttributeVerbose(TXmlNode* parrent, const char* name = nullptr)
 {
     TXmlAttribute* att = parrent->first_attribute(name);
     if (!att)
@@ -49,6 +81,7 @@ void Pause()
 
 void NotifyShaderCompilingEnded()
 {
+#ifdef _WIN32
     HWND wndHandle =  FindWindow(WNDCLASSNAME, WNDNAME);
     if(wndHandle != NULL)
     {
@@ -65,13 +98,16 @@ void NotifyShaderCompilingEnded()
     {
         std::cout << "Notification skipped! Reason: Main app its not running" << std::endl;
     }
+#else
+    std::cout << "Notification skipped! Reason: not supported on this platform" << std::endl;
+#endif
 }
 
 
 bool ReadXmlFile(const std::string& xml, char** fileContent)
 {
     std::ifstream hXml (xml, std::ifstream::in);
-    
+
     if (!hXml.is_open())
     {
         std::cout << "Shader list its not found!" << std::endl;
@@ -101,6 +137,24 @@ bool ReadXmlFile(const std::string& xml, char** fileContent)
     return true;
 }
 
+bool ReadFile(const std::string& fileName, std::string& content)
+{
+    std::ifstream file(fileName, std::ios_base::in | std::ios_base::binary);
+    if (!file.is_open())
+        return false;
+
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    content = buffer.str();
+    return true;
+}
+
+bool FileExists(const std::string& fileName)
+{
+    std::ifstream file(fileName, std::ios_base::in | std::ios_base::binary);
+    return file.is_open();
+}
+
 void GetOutputDir(TXmlDoc& xml, std::string& outDir)
 {
     bool useDefault = true;
@@ -122,65 +176,229 @@ void GetOutputDir(TXmlDoc& xml, std::string& outDir)
     }
 }
 
-bool CompileShader(const char* const shaderFile, const char* const outFile, const std::string& outDir)
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//Incremental build
+//a shader is recompiled only if the hash of its source, of all the headers it includes and of the command line changed
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+//FNV-1a
+uint64_t HashData(const char* data, size_t size, uint64_t hash = 14695981039346656037ull)
+{
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+uint64_t HashString(const std::string& str, uint64_t hash)
+{
+    //hash the size too, so "ab" + "c" and "a" + "bc" differ
+    uint64_t size = str.size();
+    hash = HashData((const char*)&size, sizeof(size), hash);
+    return HashData(str.data(), str.size(), hash);
+}
+
+//collects the names of the files included with #include "file"
+void GetIncludes(const std::string& source, std::vector<std::string>& includes)
+{
+    std::istringstream stream(source);
+    std::string line;
+    while (std::getline(stream, line))
+    {
+        size_t pos = line.find_first_not_of(" \t");
+        if (pos == std::string::npos || line.compare(pos, 8, "#include") != 0)
+            continue;
+
+        size_t begin = line.find('"', pos + 8);
+        size_t end = (begin != std::string::npos) ? line.find('"', begin + 1) : std::string::npos;
+        if (end != std::string::npos)
+            includes.push_back(line.substr(begin + 1, end - begin - 1));
+    }
+}
+
+//hash the header and everything it includes. visited prevents include cycles and hashing a header twice
+bool HashIncludes(const std::string& source, std::vector<std::string>& visited, uint64_t& hash)
+{
+    std::vector<std::string> includes;
+    GetIncludes(source, includes);
+
+    for (const auto& include : includes)
+    {
+        bool alreadyHashed = false;
+        for (const auto& v : visited)
+            alreadyHashed |= v == include;
+        if (alreadyHashed)
+            continue;
+        visited.push_back(include);
+
+        //same search order as glslang: next to the source, then the include dir
+        std::string header;
+        if (!ReadFile(SRCDIR + include, header) && !ReadFile(SRCDIR + HEADERDIR + include, header))
+        {
+            std::cout << "ERROR: Include " << include << " not found!" << std::endl;
+            return false;
+        }
+
+        hash = HashString(include, hash);
+        hash = HashString(header, hash);
+        if (!HashIncludes(header, visited, hash))
+            return false;
+    }
+
+    return true;
+}
+
+bool ComputeShaderHash(ShaderJob& job)
+{
+    std::string source;
+    if (!ReadFile(SRCDIR + job.shaderFile, source))
+    {
+        std::cout << "ERROR: Shader " << job.shaderFile << " not found!" << std::endl;
+        return false;
+    }
+
+    job.hash = HashString(job.commandLine, 14695981039346656037ull);
+    job.hash = HashString(source, job.hash);
+
+    std::vector<std::string> visited;
+    return HashIncludes(source, visited, job.hash);
+}
+
+void LoadShaderCache(const std::string& cacheFile, TShaderCache& cache)
+{
+    std::ifstream file(cacheFile, std::ios_base::in);
+    if (!file.is_open())
+        return;
+
+    std::string outFile;
+    uint64_t hash;
+    while (file >> outFile >> std::hex >> hash)
+        cache[outFile] = hash;
+}
+
+void SaveShaderCache(const std::string& cacheFile, const TShaderCache& cache)
 {
-    STARTUPINFO startInfo;
-    ZeroMemory(&startInfo, sizeof(STARTUPINFO));
-    startInfo.cb = sizeof(startInfo);
+    std::ofstream file(cacheFile, std::ios_base::out | std::ios_base::trunc);
+    if (!file.is_open())
+    {
+        std::cout << "ERROR: Failed to write the shader cache " << cacheFile << std::endl;
+        return;
+    }
 
-    PROCESS_INFORMATION pInfo;
-    ZeroMemory(&pInfo, sizeof(PROCESS_INFORMATION));
+    for (const auto& entry : cache)
+        file << entry.first << " " << std::hex << entry.second << std::endl;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//Compile
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-    std::string outLocation = outDir + "/" + outFile;
-    std::string nonConstShaderFile = shaderFile;
+//defines are separated by spaces, NAME or NAME=VALUE. The same source can be compiled in more variants this way
+std::string BuildCommandLine(const std::string& shaderFile, const std::string& outLocation, const std::string& defines)
+{
 	std::string includeOption = " -I" + SRCDIR + HEADERDIR;
 	std::string outputOption = " -o " + outLocation;
-	std::string binaryOption = " -V " + SRCDIR + nonConstShaderFile;
+	std::string binaryOption = " -V " + SRCDIR + shaderFile;
 
-    std::string commandLine = SRCDIR;
-    commandLine += "glslangValidator.exe "; 
-    commandLine += binaryOption + outputOption + includeOption;
+    std::string defineOptions;
+    std::istringstream definesStream(defines);
+    std::string define;
+    while (definesStream >> define)
+        defineOptions += " -D" + define;
 
-    char data[128];
-    memcpy(data, commandLine.data(), commandLine.size());
-    data[commandLine.size()] = '\0';
+    return COMPILEREXE + binaryOption + outputOption + includeOption + defineOptions;
+}
 
-    BOOL result = CreateProcess(
-        NULL,
-        data,
-        NULL,
-        NULL,
-        FALSE,
-        0,
-        NULL,
-        NULL,
-        &startInfo,
-        &pInfo
-        );
+bool CompileShader(const ShaderJob& job, const std::string& outDir)
+{
+    //every job writes its output in its own log, so the output of parallel compiles doesn't get mixed
+    std::string logFile = outDir + "/" + job.outFile + ".log";
+    std::string commandLine = job.commandLine + " > " + logFile + " 2>&1";
 
-    DWORD exitCode = -1;
-    if(result)
-    {
-        WaitForSingleObject(pInfo.hProcess, INFINITE);
+    //the file is written only on success. Remove the old one, so a failed compile is never mistaken for an up to date one
+    std::remove((outDir + "/" + job.outFile).c_str());
 
-        GetExitCodeProcess(pInfo.hProcess, &exitCode);
+    int exitCode = std::system(commandLine.c_str());
 
-        CloseHandle(pInfo.hProcess);
-        CloseHandle(pInfo.hThread);
+    std::string log;
+    ReadFile(logFile, log);
+    std::remove(logFile.c_str());
+
+    {
+        std::lock_guard<std::mutex> lock(g_logMutex);
+        std::cout << log;
+        if (exitCode != 0)
+            std::cout << "ERROR! " << job.shaderFile << " shader failed to compile!" << std::endl;
     }
 
-    return (exitCode == 0);
+    return exitCode == 0;
+}
+
+bool CompileShaderJobs(const std::vector<ShaderJob>& jobs, const std::string& outDir, std::vector<bool>& outSucceeded)
+{
+    outSucceeded.assign(jobs.size(), false);
+    if (jobs.empty())
+        return true;
+
+    std::atomic<unsigned int> nextJob(0);
+    std::atomic<bool> failed(false);
+
+    //vector<bool> is packed, so the workers can't write it concurrently
+    std::vector<char> succeeded(jobs.size(), 0);
+
+    //no new job is started after the first failure, the ones in flight are let to finish
+    auto worker = [&]()
+    {
+        while (!failed)
+        {
+            unsigned int jobIndex = nextJob++;
+            if (jobIndex >= jobs.size())
+                break;
+
+            if (CompileShader(jobs[jobIndex], outDir))
+                succeeded[jobIndex] = 1;
+            else
+                failed = true;
+        }
+    };
+
+    unsigned int threadCount = std::thread::hardware_concurrency();
+    if (threadCount == 0)
+        threadCount = 1;
+    if (threadCount > jobs.size())
+        threadCount = (unsigned int)jobs.size();
+
+    std::vector<std::thread> threads;
+    threads.reserve(threadCount);
+    for (unsigned int i = 0; i < threadCount; ++i)
+        threads.push_back(std::thread(worker));
+
+    for (auto& thread : threads)
+        thread.join();
+
+    for (size_t i = 0; i < jobs.size(); ++i)
+        outSucceeded[i] = succeeded[i] != 0;
+
+    return !failed;
 }
 
-bool CompileAllShaders(TXmlDoc& xml, const std::string& outDir, const std::string& specificShader)
+bool CompileAllShaders(TXmlDoc& xml, const std::string& outDir, const std::string& specificShader, bool forceRebuild)
 {
     TXmlNode* shaderListNode = GetNodeVerbose(&xml, "shaderlist");
 
     if(!shaderListNode)
         return false;
 
+    std::string cacheFile = outDir + "/" + CACHEFILE;
+    TShaderCache cache;
+    if (!forceRebuild)
+        LoadShaderCache(cacheFile, cache);
+
+    std::vector<ShaderJob> jobs;
+    unsigned int nbUpToDateShaders = 0;
     TXmlNode* currShaderNode = shaderListNode->first_node();
-    unsigned int nbTotalCompiledShaders = 0;
     while(currShaderNode)
     {
         if ( std::string(currShaderNode->name()).compare("shader") == 0)
@@ -188,48 +406,94 @@ bool CompileAllShaders(TXmlDoc& xml, const std::string& outDir, const std::strin
             TXmlAttribute* fileNameAtt = GetAttributeVerbose(currShaderNode, "shaderfile");
             TXmlAttribute* outFileNameAtt = GetAttributeVerbose(currShaderNode, "out");
 
-            bool isValid = fileNameAtt && outFileNameAtt;
+            if (!fileNameAtt || !outFileNameAtt)
+                return false;
 
-            if(specificShader.empty() || (!specificShader.empty() && specificShader.compare(fileNameAtt->value()) == 0))
+            if(specificShader.empty() || specificShader.compare(fileNameAtt->value()) == 0)
             {
-                if(isValid)
-                    isValid &= CompileShader(fileNameAtt->value(), outFileNameAtt->value(), outDir);
+                TXmlAttribute* definesAtt = currShaderNode->first_attribute("defines"); //optional
 
-                if (isValid)
-                    ++nbTotalCompiledShaders;
-                else
+                ShaderJob job;
+                job.shaderFile = fileNameAtt->value();
+                job.outFile = outFileNameAtt->value();
+                job.commandLine = BuildCommandLine(job.shaderFile, outDir + "/" + job.outFile, (definesAtt) ? definesAtt->value() : "");
+                if (!ComputeShaderHash(job))
                 {
-                    std::cout << "ERROR! " << fileNameAtt->value() << " shader failed to compile! Aborting the rest of compilation process" << std::endl;
+                    std::cout << "ERROR! " << job.shaderFile << " shader failed to compile! Aborting the rest of compilation process" << std::endl;
                     return false;
                 }
+
+                auto it = cache.find(job.outFile);
+                if (it != cache.end() && it->second == job.hash && FileExists(outDir + "/" + job.outFile))
+                    ++nbUpToDateShaders;
+                else
+                    jobs.push_back(job);
             }
         }
 
         currShaderNode = currShaderNode->next_sibling();
     }
 
-    std::cout << "LOG: Number of compiled shaders: " << nbTotalCompiledShaders << std::endl;
-    return true;
+    std::vector<bool> succeeded;
+    bool result = CompileShaderJobs(jobs, outDir, succeeded);
+
+    //only the shaders that compiled go in the cache. The failed ones are retried next time
+    unsigned int nbTotalCompiledShaders = 0;
+    for (size_t i = 0; i < jobs.size(); ++i)
+    {
+        if (succeeded[i])
+        {
+            cache[jobs[i].outFile] = jobs[i].hash;
+            ++nbTotalCompiledShaders;
+        }
+        else
+        {
+            cache.erase(jobs[i].outFile);
+        }
+    }
+    SaveShaderCache(cacheFile, cache);
+
+    std::cout << "LOG: Number of compiled shaders: " << nbTotalCompiledShaders << ", up to date: " << nbUpToDateShaders << std::endl;
+    if (!result)
+        std::cout << "ERROR! Shader compilation failed! Aborted the rest of compilation process" << std::endl;
+
+    return result;
 }
 
+//usage: ShaderCompiler [-force] [-nopause] [shaderfile]
 int main(int argc, char* argv[])
 {
     char* xmlContent;
     std::string outputDir;
     std::string searchShader;
-    if(argc > 1)
-        searchShader = argv[1];
+    bool forceRebuild = false;
+    bool pause = true;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "-force")
+            forceRebuild = true;
+        else if (arg == "-nopause")
+            pause = false;
+        else
+            searchShader = arg;
+    }
 
+    int exitCode = 1;
     if (ReadXmlFile(SRCXML, &xmlContent))
     {
         TXmlDoc xml;
         xml.parse<rapidxml::parse_default>(xmlContent);
         GetOutputDir(xml, outputDir);
 
-        if (CompileAllShaders(xml, outputDir, searchShader))
+        if (CompileAllShaders(xml, outputDir, searchShader, forceRebuild))
+        {
             NotifyShaderCompilingEnded();
+            exitCode = 0;
+        }
     }
 
-    Pause();
-    return 0;
+    if (pause)
+        Pause();
+    return exitCode;
 }
\ No newline at end of file
@@ -2,6 +2,9 @@
 #extension GL_ARB_separate_shader_objects : enable
 #extension GL_ARB_shading_language_420pack : enable
 #extension GL_GOOGLE_include_directive : enable
+#ifdef BINDLESS
+#extension GL_EXT_nonuniform_qualifier : require
+#endif
 
 #include "DepthUtils.h.spv"
 
@@ -23,21 +26,28 @@ layout(set=1, binding=0) buffer MaterialParams
 	MaterialPropertis materials[];
 };
 
+#ifdef BINDLESS
+//all the textures of the material template, the index comes from the instance
+layout(set=2, binding=0) uniform sampler2D MaterialTextures[];
+#define GetTexture(index) MaterialTextures[nonuniformEXT(index)]
+#else
 layout(set=1, binding=1) uniform sampler2D BatchTextures[12];
+#define GetTexture(index) BatchTextures[index]
+#endif
 
 layout(location=0) in vec4 normal;
 layout(location=1) in vec4 worldPos;
 layout(location=2) in vec2 uv;
-layout(location=3) flat in uint BatchIndex;
+layout(location=3) flat in uint MaterialIndex;
 
 void main()
 {
-	MaterialPropertis Properties = materials[BatchIndex];
+	MaterialPropertis Properties = materials[MaterialIndex];
 	
 	const uint index = Properties.AlbedoTexture;
 	
-	vec2 lod = textureQueryLod(BatchTextures[index], uv);
-	albedo = texture(BatchTextures[index], uv, lod.x);
+	vec2 lod = textureQueryLod(GetTexture(index), uv);
+	albedo = texture(GetTexture(index), uv, lod.x);
 
 	out_specular = vec4(Properties.Roughness, Properties.K, Properties.F0, 0.0f);
 	out_normal = normal;
@@ -2,6 +2,9 @@
 #extension GL_ARB_separate_shader_objects : enable
 #extension GL_ARB_shading_language_420pack : enable
 #extension GL_GOOGLE_include_directive : enable
+#ifdef BINDLESS
+#extension GL_EXT_nonuniform_qualifier : require
+#endif
 
 #include "DepthUtils.h.spv"
 
@@ -25,23 +28,30 @@ layout(set=1, binding=0) buffer MaterialParams
 	MaterialPropertis materials[];
 };
 
+#ifdef BINDLESS
+//all the textures of the material template, the index comes from the instance
+layout(set=2, binding=0) uniform sampler2D MaterialTextures[];
+#define GetTexture(index) MaterialTextures[nonuniformEXT(index)]
+#else
 layout(set=1, binding=1) uniform sampler2D BatchTextures[12];
+#define GetTexture(index) BatchTextures[index]
+#endif
 
 layout(location=0) in vec4 normal;
 layout(location=1) in vec4 worldPos;
 layout(location=2) in vec2 uv;
-layout(location=3) flat in uint BatchIndex;
+layout(location=3) flat in uint MaterialIndex;
 layout(location=4) in mat3 TBN;
 
 void main()
 {
-	MaterialPropertis properties = materials[BatchIndex];
+	MaterialPropertis properties = materials[MaterialIndex];
 	uint albedoIndex = properties.AlbedoTexture;
 	uint normalMapIndex = properties.NormalMapTexture;
 	
-	vec2 lod = textureQueryLod(BatchTextures[albedoIndex], uv);
-	albedo = texture(BatchTextures[albedoIndex], uv, lod.x);
-	vec3 sNormal = texture(BatchTextures[normalMapIndex], uv).rgb;
+	vec2 lod = textureQueryLod(GetTexture(albedoIndex), uv);
+	albedo = texture(GetTexture(albedoIndex), uv, lod.x);
+	vec3 sNormal = texture(GetTexture(normalMapIndex), uv).rgb;
 	sNormal = normalize(sNormal * 2.0f - 1.0f); 
 	out_normal = vec4(normalize(TBN * sNormal), 0.0f);
 	out_position = worldPos;
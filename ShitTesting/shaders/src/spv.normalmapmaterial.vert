@@ -1,16 +1,25 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 #extension GL_ARB_shading_language_420pack : enable
+#extension GL_GOOGLE_include_directive : enable
 
-layout(location=0) in vec3 position;
+#include "VertexUtils.h.spv"
+
+//SCompactVertex
+layout(location=0) in vec4 in_position; //w - bitangent sign
 layout(location=1) in vec2 in_uv;
-layout(location=2) in vec3 in_normal;
-layout(location=3) in vec3 in_bitangent;
-layout(location=4) in vec3 in_tangent;
+layout(location=2) in vec2 in_normal; //octahedral
+layout(location=3) in vec2 in_tangent; //octahedral
 
 struct BatchCommons
 {
 	mat4 ModelMatrix;
+	vec4 MeshBoundsMin;
+	vec4 MeshBoundsExtent;
+	uint MaterialIndex; //in the materials table of the template
+	uint Padding0;
+	uint Padding1;
+	uint Padding2;
 };
 
 layout(set=0, binding=0) buffer BatchParams
@@ -18,6 +27,12 @@ layout(set=0, binding=0) buffer BatchParams
 	BatchCommons commonData[];
 };
 
+//filled by the cull shader. Maps the instance to the object index in the batch
+layout(std430, set=0, binding=1) readonly buffer BatchVisibleInstances
+{
+	uint visibleInstances[];
+};
+
 layout(push_constant) uniform PushConstants
 {
 	mat4 ProjViewMatrix;
@@ -29,20 +44,24 @@ layout(push_constant) uniform PushConstants
 layout(location=0) out vec4 normal;
 layout(location=1) out vec4 worldPos;
 layout(location=2) out vec2 uv;
-layout(location=3) out uint BatchIndex;
+layout(location=3) flat out uint MaterialIndex;
 layout(location=4) out mat3 TBN;
 void main()
 {
 	uv = in_uv;
-	BatchIndex = gl_InstanceIndex;
-	BatchCommons currentNode = commonData[BatchIndex];
+	BatchCommons currentNode = commonData[visibleInstances[gl_InstanceIndex]];
+	MaterialIndex = currentNode.MaterialIndex;
 	
+	vec3 position = DecodePosition(in_position, currentNode.MeshBoundsMin.xyz, currentNode.MeshBoundsExtent.xyz);
+	vec3 localNormal = OctahedralDecode(in_normal);
+	vec3 localTangent = OctahedralDecode(in_tangent);
+
 	mat3 transWM = inverse(transpose(mat3(currentNode.ModelMatrix)));
-	vec3 transNormal = transWM * in_normal;
+	vec3 transNormal = transWM * localNormal;
 	normal = vec4(normalize(transNormal), 0.0f);
 	
-	vec3 T = normalize( transWM * in_tangent.xyz);
-	vec3 B = normalize(transWM * in_bitangent.xyz);
+	vec3 T = normalize( transWM * localTangent);
+	vec3 B = normalize(transWM * DecodeBitangent(in_position, localNormal, localTangent));
 	vec3 N = normalize(transNormal);
 	
 	TBN = mat3(T, B, N);
@@ -1,10 +1,19 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 #extension GL_ARB_shading_language_420pack : enable
+#extension GL_GOOGLE_include_directive : enable
+
+#include "VertexUtils.h.spv"
 
 struct BatchCommons
 {
 	mat4 ModelMatrix;
+	vec4 MeshBoundsMin;
+	vec4 MeshBoundsExtent;
+	uint MaterialIndex; //in the materials table of the template
+	uint Padding0;
+	uint Padding1;
+	uint Padding2;
 };
 
 layout(std140, set = 0, binding = 0) buffer in_params
@@ -12,12 +21,18 @@ layout(std140, set = 0, binding = 0) buffer in_params
 	BatchCommons commons[];
 };
 
-layout(location=0) in vec3 position;
-layout(location=1) in vec2 in_uv;
-layout(location=2) in vec3 in_normal;
+layout(std430, set = 0, binding = 1) readonly buffer BatchVisibleInstances
+{
+	uint visibleInstances[];
+};
+
+//SCompactVertex, only the position is used
+layout(location=0) in vec4 in_position;
 
 
 void main()
 {
-    gl_Position = commons[gl_InstanceIndex].ModelMatrix * vec4(position, 1.0f);
+	BatchCommons currentNode = commons[visibleInstances[gl_InstanceIndex]];
+	vec3 position = DecodePosition(in_position, currentNode.MeshBoundsMin.xyz, currentNode.MeshBoundsExtent.xyz);
+    gl_Position = currentNode.ModelMatrix * vec4(position, 1.0f);
 }
\ No newline at end of file
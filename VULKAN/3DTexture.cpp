@@ -4,8 +4,9 @@
 #include "Input.h"
 
 #include <random>
+#include <chrono>
 C3DTextureRenderer::C3DTextureRenderer (VkRenderPass renderPass)
-    : CRenderer(renderPass)
+    : CRenderer(renderPass, "3DTextureRenderPass")
     , m_generateDescLayout(VK_NULL_HANDLE)
     , m_generateDescSet(VK_NULL_HANDLE)
     , m_outTexture(nullptr)
@@ -77,7 +78,7 @@ void C3DTextureRenderer::Render()
         vk::CmdBindDescriptorSets(cmdBuffer, m_generatePipeline.GetBindPoint(), m_generatePipeline.GetLayout(),0, 1, &m_generateDescSet, 0, nullptr);
         TRAP(m_width % 32 == 0 && m_height % 32 == 0);
         //vk::CmdDispatch(cmdBuffer, m_width / 32, 1, m_depth); //??
-        vk::CmdDispatch(cmdBuffer, 2048 / 32, 2048 / 32, 1);
+        Dispatch(cmdBuffer, 2048 / 32, 2048 / 32, 1);
 
         WaitComputeFinish();
         EndMarkerSection();
@@ -207,9 +208,9 @@ void C3DTextureRenderer::FillParams()
 
 void C3DTextureRenderer::UpdateParams()
 {
-    static DWORD startTime = GetTickCount();
-    DWORD now = GetTickCount();
-    float timeSec = float(now - startTime) / 1000;
+    static auto startTime = std::chrono::steady_clock::now();
+    auto now = std::chrono::steady_clock::now();
+    float timeSec = std::chrono::duration<float>(now - startTime).count();
     m_parameters.Globals.z = timeSec;
 
 	FogParameters* params = m_uniformBuffer->GetPtr<FogParameters*>();
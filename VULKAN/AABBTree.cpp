@@ -0,0 +1,426 @@
+#include "AABBTree.h"
+
+#include "defines.h"
+
+#include <algorithm>
+
+///////////////////////////////////////////////////////////////////////////////////
+//AABBTree
+///////////////////////////////////////////////////////////////////////////////////
+
+AABBTree::AABBTree(float fatMargin)
+	: m_root(NullNode)
+	, m_freeList(NullNode)
+	, m_fatMargin(fatMargin)
+{
+}
+
+AABBTree::~AABBTree()
+{
+}
+
+int AABBTree::Insert(const BoundingBox3D& bb, void* userData)
+{
+	int leaf = AllocateNode();
+	Node& node = m_nodes[leaf];
+	node.BB = BoundingBox3D(bb.Min - glm::vec3(m_fatMargin), bb.Max + glm::vec3(m_fatMargin));
+	node.UserData = userData;
+	node.Height = 0;
+
+	InsertLeaf(leaf);
+	return leaf;
+}
+
+void AABBTree::Remove(int proxy)
+{
+	TRAP(proxy >= 0 && proxy < (int)m_nodes.size() && m_nodes[proxy].IsLeaf());
+
+	RemoveLeaf(proxy);
+	FreeNode(proxy);
+}
+
+bool AABBTree::Update(int proxy, const BoundingBox3D& bb)
+{
+	TRAP(proxy >= 0 && proxy < (int)m_nodes.size() && m_nodes[proxy].IsLeaf());
+
+	if (m_nodes[proxy].BB.Contains(bb))
+		return false;
+
+	RemoveLeaf(proxy);
+	m_nodes[proxy].BB = BoundingBox3D(bb.Min - glm::vec3(m_fatMargin), bb.Max + glm::vec3(m_fatMargin));
+	InsertLeaf(proxy);
+
+	return true;
+}
+
+void AABBTree::Clear()
+{
+	m_nodes.clear();
+	m_root = NullNode;
+	m_freeList = NullNode;
+}
+
+void* AABBTree::GetUserData(int proxy) const
+{
+	TRAP(proxy >= 0 && proxy < (int)m_nodes.size());
+	return m_nodes[proxy].UserData;
+}
+
+const BoundingBox3D& AABBTree::GetFatBoundingBox(int proxy) const
+{
+	TRAP(proxy >= 0 && proxy < (int)m_nodes.size());
+	return m_nodes[proxy].BB;
+}
+
+BoundingBox3D AABBTree::GetBoundingBox() const
+{
+	if (m_root == NullNode)
+		return BoundingBox3D(glm::vec3(0.0f), glm::vec3(0.0f));
+
+	return m_nodes[m_root].BB;
+}
+
+int AABBTree::GetHeight() const
+{
+	return (m_root == NullNode) ? 0 : m_nodes[m_root].Height;
+}
+
+void AABBTree::QueryFrustum(const CFrustum& frustum, std::vector<void*>& outUserData) const
+{
+	if (m_root == NullNode)
+		return;
+
+	std::vector<int> stack;
+	stack.reserve(64);
+	stack.push_back(m_root);
+
+	while (!stack.empty())
+	{
+		int index = stack.back();
+		stack.pop_back();
+
+		const Node& node = m_nodes[index];
+		CollisionResult result = frustum.Collision(node.BB);
+		if (result == CollisionResult::Outside)
+			continue;
+
+		if (result == CollisionResult::Inside || node.IsLeaf())
+		{
+			CollectLeafs(index, outUserData);
+			continue;
+		}
+
+		stack.push_back(node.Left);
+		stack.push_back(node.Right);
+	}
+}
+
+void AABBTree::QueryOverlap(const BoundingBox3D& bb, std::vector<void*>& outUserData) const
+{
+	if (m_root == NullNode)
+		return;
+
+	std::vector<int> stack;
+	stack.reserve(64);
+	stack.push_back(m_root);
+
+	while (!stack.empty())
+	{
+		int index = stack.back();
+		stack.pop_back();
+
+		const Node& node = m_nodes[index];
+		if (!node.BB.Overlaps(bb))
+			continue;
+
+		if (bb.Contains(node.BB) || node.IsLeaf())
+		{
+			CollectLeafs(index, outUserData);
+			continue;
+		}
+
+		stack.push_back(node.Left);
+		stack.push_back(node.Right);
+	}
+}
+
+void AABBTree::RayCast(const glm::vec3& origin, const glm::vec3& dir, float maxDistance, std::vector<RayHit>& outHits) const
+{
+	if (m_root == NullNode)
+		return;
+
+	glm::vec3 invDir = 1.0f / dir;
+	size_t firstHit = outHits.size();
+
+	std::vector<int> stack;
+	stack.reserve(64);
+	stack.push_back(m_root);
+
+	while (!stack.empty())
+	{
+		int index = stack.back();
+		stack.pop_back();
+
+		const Node& node = m_nodes[index];
+		float distance;
+		if (!node.BB.RayIntersection(origin, invDir, maxDistance, distance))
+			continue;
+
+		if (node.IsLeaf())
+		{
+			RayHit hit;
+			hit.UserData = node.UserData;
+			hit.Distance = distance;
+			outHits.push_back(hit);
+			continue;
+		}
+
+		stack.push_back(node.Left);
+		stack.push_back(node.Right);
+	}
+
+	std::sort(outHits.begin() + firstHit, outHits.end(), [](const RayHit& a, const RayHit& b)
+	{
+		return a.Distance < b.Distance;
+	});
+}
+
+int AABBTree::AllocateNode()
+{
+	int index = m_freeList;
+	if (index == NullNode)
+	{
+		index = (int)m_nodes.size();
+		m_nodes.push_back(Node());
+	}
+	else
+	{
+		m_freeList = m_nodes[index].Parent;
+	}
+
+	Node& node = m_nodes[index];
+	node.UserData = nullptr;
+	node.Parent = NullNode;
+	node.Left = NullNode;
+	node.Right = NullNode;
+	node.Height = 0;
+
+	return index;
+}
+
+void AABBTree::FreeNode(int node)
+{
+	m_nodes[node].Parent = m_freeList;
+	m_nodes[node].Height = -1;
+	m_freeList = node;
+}
+
+void AABBTree::InsertLeaf(int leaf)
+{
+	if (m_root == NullNode)
+	{
+		m_root = leaf;
+		m_nodes[leaf].Parent = NullNode;
+		return;
+	}
+
+	int sibling = FindBestSibling(m_nodes[leaf].BB);
+	int oldParent = m_nodes[sibling].Parent;
+
+	//AllocateNode can grow m_nodes, so no references are kept before it
+	int newParent = AllocateNode();
+	Node& parent = m_nodes[newParent];
+	parent.Parent = oldParent;
+	parent.BB = BoundingBox3D::Combine(m_nodes[leaf].BB, m_nodes[sibling].BB);
+	parent.Height = m_nodes[sibling].Height + 1;
+	parent.Left = sibling;
+	parent.Right = leaf;
+
+	if (oldParent != NullNode)
+	{
+		if (m_nodes[oldParent].Left == sibling)
+			m_nodes[oldParent].Left = newParent;
+		else
+			m_nodes[oldParent].Right = newParent;
+	}
+	else
+	{
+		m_root = newParent;
+	}
+
+	m_nodes[sibling].Parent = newParent;
+	m_nodes[leaf].Parent = newParent;
+
+	RefitAncestors(newParent);
+}
+
+void AABBTree::RemoveLeaf(int leaf)
+{
+	if (leaf == m_root)
+	{
+		m_root = NullNode;
+		return;
+	}
+
+	int parent = m_nodes[leaf].Parent;
+	int grandParent = m_nodes[parent].Parent;
+	int sibling = (m_nodes[parent].Left == leaf) ? m_nodes[parent].Right : m_nodes[parent].Left;
+
+	//the sibling takes the place of the parent
+	if (grandParent != NullNode)
+	{
+		if (m_nodes[grandParent].Left == parent)
+			m_nodes[grandParent].Left = sibling;
+		else
+			m_nodes[grandParent].Right = sibling;
+
+		m_nodes[sibling].Parent = grandParent;
+		FreeNode(parent);
+		RefitAncestors(grandParent);
+	}
+	else
+	{
+		m_root = sibling;
+		m_nodes[sibling].Parent = NullNode;
+		FreeNode(parent);
+	}
+}
+
+//descend to the sibling with the smallest surface area increase. The area added to the ancestors is the inheritance cost
+int AABBTree::FindBestSibling(const BoundingBox3D& bb) const
+{
+	int index = m_root;
+	while (!m_nodes[index].IsLeaf())
+	{
+		const Node& node = m_nodes[index];
+		float area = node.BB.GetSurfaceArea();
+		float combinedArea = BoundingBox3D::Combine(node.BB, bb).GetSurfaceArea();
+
+		//cost of making a new parent for this node and the new leaf
+		float cost = 2.0f * combinedArea;
+		float inheritanceCost = 2.0f * (combinedArea - area);
+
+		auto descendCost = [&](int child)
+		{
+			const Node& childNode = m_nodes[child];
+			float childCost = BoundingBox3D::Combine(childNode.BB, bb).GetSurfaceArea();
+			if (!childNode.IsLeaf())
+				childCost -= childNode.BB.GetSurfaceArea();
+			return childCost + inheritanceCost;
+		};
+
+		float leftCost = descendCost(node.Left);
+		float rightCost = descendCost(node.Right);
+
+		if (cost < leftCost && cost < rightCost)
+			break;
+
+		index = (leftCost < rightCost) ? node.Left : node.Right;
+	}
+
+	return index;
+}
+
+void AABBTree::RefitAncestors(int node)
+{
+	while (node != NullNode)
+	{
+		node = Balance(node);
+
+		Node& n = m_nodes[node];
+		const Node& left = m_nodes[n.Left];
+		const Node& right = m_nodes[n.Right];
+		n.Height = 1 + glm::max(left.Height, right.Height);
+		n.BB = BoundingBox3D::Combine(left.BB, right.BB);
+
+		node = n.Parent;
+	}
+}
+
+//returns the node that took the place of node in the tree
+int AABBTree::Balance(int node)
+{
+	const Node& n = m_nodes[node];
+	if (n.IsLeaf() || n.Height < 2)
+		return node;
+
+	int balance = m_nodes[n.Right].Height - m_nodes[n.Left].Height;
+	if (balance > 1)
+		return Rotate(node, n.Right);
+	if (balance < -1)
+		return Rotate(node, n.Left);
+
+	return node;
+}
+
+//child is promoted in the place of node. The taller grandchild stays with child, the shorter one goes to node
+int AABBTree::Rotate(int node, int child)
+{
+	Node& a = m_nodes[node];
+	Node& x = m_nodes[child];
+
+	int f = x.Left;
+	int g = x.Right;
+
+	x.Left = node;
+	x.Parent = a.Parent;
+	a.Parent = child;
+
+	if (x.Parent != NullNode)
+	{
+		if (m_nodes[x.Parent].Left == node)
+			m_nodes[x.Parent].Left = child;
+		else
+			m_nodes[x.Parent].Right = child;
+	}
+	else
+	{
+		m_root = child;
+	}
+
+	int high = f;
+	int low = g;
+	if (m_nodes[g].Height > m_nodes[f].Height)
+	{
+		high = g;
+		low = f;
+	}
+
+	x.Right = high;
+	if (a.Left == child)
+		a.Left = low;
+	else
+		a.Right = low;
+	m_nodes[low].Parent = node;
+
+	a.BB = BoundingBox3D::Combine(m_nodes[a.Left].BB, m_nodes[a.Right].BB);
+	a.Height = 1 + glm::max(m_nodes[a.Left].Height, m_nodes[a.Right].Height);
+
+	x.BB = BoundingBox3D::Combine(a.BB, m_nodes[high].BB);
+	x.Height = 1 + glm::max(a.Height, m_nodes[high].Height);
+
+	return child;
+}
+
+void AABBTree::CollectLeafs(int node, std::vector<void*>& outUserData) const
+{
+	std::vector<int> stack;
+	stack.reserve(64);
+	stack.push_back(node);
+
+	while (!stack.empty())
+	{
+		int index = stack.back();
+		stack.pop_back();
+
+		const Node& n = m_nodes[index];
+		if (n.IsLeaf())
+		{
+			outUserData.push_back(n.UserData);
+			continue;
+		}
+
+		stack.push_back(n.Left);
+		stack.push_back(n.Right);
+	}
+}
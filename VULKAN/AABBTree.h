@@ -0,0 +1,71 @@
+#pragma once
+
+#include "Geometry.h"
+
+#include <vector>
+
+//Dynamic bounding volume hierarchy. Leafs store a fattened box so small moves don't change the tree,
+//internal nodes are kept balanced with rotations on insert and remove
+class AABBTree
+{
+public:
+	struct RayHit
+	{
+		void*			UserData;
+		float			Distance; //where the ray enters the fat box of the leaf
+	};
+
+	static const int NullNode = -1;
+
+	AABBTree(float fatMargin = 0.1f);
+	virtual ~AABBTree();
+
+	//returns the proxy used to identify the leaf
+	int Insert(const BoundingBox3D& bb, void* userData);
+	void Remove(int proxy);
+	//returns true if the leaf was reinserted. Nothing happens while bb fits in the fat box of the leaf
+	bool Update(int proxy, const BoundingBox3D& bb);
+	void Clear();
+
+	void* GetUserData(int proxy) const;
+	const BoundingBox3D& GetFatBoundingBox(int proxy) const;
+	bool IsEmpty() const { return m_root == NullNode; }
+	BoundingBox3D GetBoundingBox() const;
+	int GetHeight() const;
+
+	//subtrees fully inside the frustum are accepted without testing their leafs
+	void QueryFrustum(const CFrustum& frustum, std::vector<void*>& outUserData) const;
+	void QueryOverlap(const BoundingBox3D& bb, std::vector<void*>& outUserData) const;
+	//hits are sorted front to back
+	void RayCast(const glm::vec3& origin, const glm::vec3& dir, float maxDistance, std::vector<RayHit>& outHits) const;
+
+private:
+	struct Node
+	{
+		BoundingBox3D	BB;
+		void*			UserData;
+		int				Parent; //next free node when the node is not used
+		int				Left;
+		int				Right;
+		int				Height; //0 for leafs, -1 for free nodes
+
+		bool IsLeaf() const { return Left == NullNode; }
+	};
+
+	int AllocateNode();
+	void FreeNode(int node);
+
+	void InsertLeaf(int leaf);
+	void RemoveLeaf(int leaf);
+	int FindBestSibling(const BoundingBox3D& bb) const;
+	void RefitAncestors(int node);
+	int Balance(int node);
+	int Rotate(int node, int child);
+
+	void CollectLeafs(int node, std::vector<void*>& outUserData) const;
+private:
+	std::vector<Node>			m_nodes;
+	int							m_root;
+	int							m_freeList;
+	float						m_fatMargin;
+};
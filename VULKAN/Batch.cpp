@@ -6,60 +6,212 @@
 #include "Renderer.h"
 #include "Texture.h"
 #include "Material.h"
+#include "QueryManager.h"
+#include "ShadowRenderer.h"
+#include "CommandRecorder.h"
+#include "ScatterUploader.h"
+#include "Scene.h"
+#include "glm/gtc/matrix_access.hpp"
 
 #include <iostream>
-#include <unordered_set>
+#include <algorithm>
+
+//must match BatchCommons in the batch vertex shaders
+struct BatchCommons
+{
+	glm::mat4 ModelMtx;
+	glm::vec4 MeshBoundsMin; //the positions of SCompactVertex are quantized in the bounds of the mesh
+	glm::vec4 MeshBoundsExtent;
+	uint32_t MaterialIndex; //in the materials table of the template
+	uint32_t Padding[3];
+};
+
+//must match CullData in batchcull.comp
+struct BatchCullData
+{
+	glm::vec3	BoundsMin;
+	uint32_t	CommandIndex; //of LOD 0
+	glm::vec3	BoundsMax;
+	uint32_t	VisibilityFlags;
+	uint32_t	LodCount;
+	uint32_t	Padding[3];
+};
+
+struct BatchCullParams
+{
+	glm::vec4	FrustumPlanes[CFrustum::PLCount]; //xyz - normal, w - distance
+	glm::vec4	LodCameraPos; //xyz - camera position, w - the LOD scale, see Batch::Cull
+	uint32_t	ObjectsCount;
+	uint32_t	VisibilityMask;
+	uint32_t	UpdateLods; //the solid pass keeps the LOD of every object for the next frame
+};
+
+static const uint32_t s_cullGroupSize = 64; //local_size_x in batchcull.comp
+//an object is drawn with LOD 0 while its bounding sphere covers this much of the half height of the screen, every
+//next LOD (half the triangles) is used at half the size
+static const float s_lodScreenSize = 0.25f;
+
+static bool IsShadowSubpass(SubpassIndex index)
+{
+	return uint32_t(index) >= uint32_t(SubpassIndex::ShadowPass) && uint32_t(index) < uint32_t(SubpassIndex::ShadowPass) + SHADOWSPLITS;
+}
+
+static uint32_t GetShadowSplit(SubpassIndex index)
+{
+	TRAP(IsShadowSubpass(index));
+	return uint32_t(index) - uint32_t(SubpassIndex::ShadowPass);
+}
+
+//doubles the capacity until it fits, so a batch that grows one object at a time rarely recreates its buffers
+static uint32_t GrowCapacity(uint32_t capacity, uint32_t neededSize)
+{
+	capacity = glm::max(capacity, 16u);
+	while (capacity < neededSize)
+		capacity *= 2;
+
+	return capacity;
+}
+
+//interleaves the bits of the position of the center in bounds, 10 bits per axis. Close cells have close codes
+static uint32_t ComputeMortonCell(const BoundingBox3D& bb, const BoundingBox3D& bounds)
+{
+	glm::vec3 extent = glm::max(bounds.Max - bounds.Min, glm::vec3(1e-5f));
+	glm::vec3 center = (bb.Min + bb.Max) * 0.5f;
+	glm::uvec3 cell = glm::uvec3(glm::clamp((center - bounds.Min) / extent, 0.0f, 1.0f) * 1023.0f);
+
+	uint32_t code = 0;
+	for (uint32_t bit = 0; bit < 10; ++bit)
+		for (uint32_t axis = 0; axis < 3; ++axis)
+			code |= ((cell[axis] >> bit) & 1u) << (bit * 3 + axis);
+
+	return code;
+}
+
+//64 bit key of a draw, the draws of a subpass are recorded in its order:
+//63..60 subpass | 59..48 pipeline | 47..24 depth | 23..0 batch (its descriptor sets)
+//The draws of a pipeline are consecutive, so it's bound once, and inside a pipeline they go front to back, so less is overdrawn
+static uint64_t MakeDrawSortKey(SubpassIndex subpassIndex, uint32_t pipeline, uint32_t depth, uint32_t batch)
+{
+	TRAP(pipeline < (1u << 12) && depth < (1u << 24) && batch < (1u << 24));
+	return (uint64_t(subpassIndex) << 60) | (uint64_t(pipeline) << 48) | (uint64_t(depth) << 24) | uint64_t(batch);
+}
+
+//the linear depth of the center of the box, clamped to [nearDepth, farDepth] and quantized to 24 bits.
+//The bounds of a batch are the union of all its objects, so it's only a coarse front to back order between the batches
+static uint32_t QuantizeDepth(const BoundingBox3D& bounds, const glm::vec4& depthPlane, float nearDepth, float farDepth)
+{
+	glm::vec3 center = (bounds.Min + bounds.Max) * 0.5f;
+	float depth = glm::clamp(glm::dot(depthPlane, glm::vec4(center, 1.0f)), nearDepth, farDepth);
+
+	return uint32_t((depth - nearDepth) / (farDepth - nearDepth) * float((1u << 24) - 1));
+}
+
+//the planes of the clip volume of a shadow split (vulkan clip space, 0 <= z <= w). The near plane is dropped,
+//so the volume is extended toward the light and the casters between the light and the split still cast shadows in it
+static void ExtractShadowCullPlanes(const glm::mat4& projView, TCullPlanes& outPlanes)
+{
+	glm::mat4 rows = glm::transpose(projView);
+
+	outPlanes[CFrustum::Near] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f); //always passes
+	outPlanes[CFrustum::Far] = rows[3] - rows[2];
+	outPlanes[CFrustum::Right] = rows[3] - rows[0];
+	outPlanes[CFrustum::Left] = rows[3] + rows[0];
+	outPlanes[CFrustum::Top] = rows[3] - rows[1];
+	outPlanes[CFrustum::Bottom] = rows[3] + rows[1];
+}
 
 BatchManager::BatchManager()
+	: m_projViewMatrix(1.0f)
 {
 }
 
 BatchManager::~BatchManager()
 {
-
+	for (auto pool : m_cullDescPools)
+		delete pool;
 }
 
-//we need a list of parameters here (we have to know the pipeline, how much uniform memory per batch, or do we use a fixed size. I dont know it seems not too optim)
-Batch* BatchManager::CreateNewBatch(MaterialTemplateBase* materialTemplate)
+void BatchManager::Initialize(CRenderer* renderer)
 {
-	return new Batch(materialTemplate);
+	m_cullDescLayout.AddBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT); //cull data table of the batch
+	m_cullDescLayout.AddBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT); //indirect commands
+	m_cullDescLayout.AddBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT); //visible instances
+	m_cullDescLayout.AddBinding(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT); //LOD of every object
+	m_cullDescLayout.Construct();
+
+	VkPushConstantRange pushConstRange;
+	pushConstRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstRange.offset = 0;
+	pushConstRange.size = sizeof(BatchCullParams);
+
+	m_cullPipeline.SetComputeShaderFile("batchcull.comp");
+	m_cullPipeline.AddPushConstant(pushConstRange);
+	m_cullPipeline.CreatePipelineLayout(m_cullDescLayout.Get());
+	m_cullPipeline.Init(renderer, VK_NULL_HANDLE, -1);
 }
 
-void BatchManager::Update()
+VkDescriptorSet BatchManager::AllocCullDescriptorSet()
 {
-	if (!m_inProgressBatches.empty())
+	DescriptorPool* pool = nullptr;
+	for (auto descPool : m_cullDescPools)
 	{
-		for (auto batch : m_inProgressBatches)
+		if (descPool->CanAllocate(m_cullDescLayout))
 		{
-			batch->Cleanup();
+			pool = descPool;
+			break;
 		}
+	}
 
-		m_inProgressBatches.clear();
-		MemoryManager::GetInstance()->FreeMemory(EMemoryContextType::BatchStaggingBuffer);
+	if (!pool)
+	{
+		pool = new DescriptorPool();
+		pool->Construct(m_cullDescLayout, 32);
+		m_cullDescPools.push_back(pool);
 	}
 
-	VkDeviceSize memoryNeeded = 0;
+	return pool->AllocateDescriptorSet(m_cullDescLayout);
+}
 
-	for (auto batch : m_batches)
+//we need a list of parameters here (we have to know the pipeline, how much uniform memory per batch, or do we use a fixed size. I dont know it seems not too optim)
+Batch* BatchManager::CreateNewBatch(MaterialTemplateBase* materialTemplate)
+{
+	return new Batch(materialTemplate);
+}
+
+void BatchManager::RetireDescriptorSets(const std::vector<VkDescriptorSet>& materialSets, VkDescriptorSet cullSet)
+{
+	RetiredDescriptorSets retired;
+	retired.FrameNumber = MemoryManager::GetInstance()->GetFrameAllocator()->GetFrameNumber();
+	retired.MaterialSets = materialSets;
+	retired.CullSet = cullSet;
+	m_retiredDescriptorSets.push_back(retired);
+}
+
+void BatchManager::ReleaseRetiredDescriptorSets()
+{
+	uint64_t frameNumber = MemoryManager::GetInstance()->GetFrameAllocator()->GetFrameNumber();
+	auto firstInUse = std::partition(m_retiredDescriptorSets.begin(), m_retiredDescriptorSets.end(), [frameNumber](const RetiredDescriptorSets& retired)
 	{
-		if (batch->NeedReconstruct())
-			memoryNeeded += batch->GetTotalBatchMemory();
-	}
+		return retired.FrameNumber + FRAMES_IN_FLIGHT <= frameNumber;
+	});
 
-	if (memoryNeeded > 0)
+	for (auto it = m_retiredDescriptorSets.begin(); it != firstInUse; ++it)
 	{
-		MemoryManager::GetInstance()->AllocMemory(EMemoryContextType::BatchStaggingBuffer, memoryNeeded);
-		MemoryManager::GetInstance()->MapMemoryContext(EMemoryContextType::IndirectDrawCmdBuffer);
-		for (auto batch : m_batches)
+		MaterialLibrary::GetInstance()->FreeDescriptors(it->MaterialSets);
+		for (auto pool : m_cullDescPools)
 		{
-			if (batch->NeedReconstruct())
-			{
-				batch->Construct();
-				m_inProgressBatches.push_back(batch);
-			}
+			if (pool->FreeDescriptorSet(it->CullSet))
+				break;
 		}
-		MemoryManager::GetInstance()->UnmapMemoryContext(EMemoryContextType::IndirectDrawCmdBuffer);
 	}
+
+	m_retiredDescriptorSets.erase(m_retiredDescriptorSets.begin(), firstInUse);
+}
+
+void BatchManager::Update()
+{
+	//the batches change only at the start of the frame, in PreRender, so here there is only the cleanup
+	ReleaseRetiredDescriptorSets();
 }
 
 void BatchManager::AddObject(Object* obj)
@@ -71,18 +223,20 @@ void BatchManager::AddObject(Object* obj)
 
 	if (it != m_batchesCategories.end())
 	{
-		//get a suitable batch
-		std::vector<Batch*> batches = it->second;
-		for (uint32_t i = 0; i < batches.size(); ++i)
+		//get a suitable batch. The last one is tried first, the others are usually full
+		const std::vector<Batch*>& batches = it->second;
+		for (uint32_t i = (uint32_t)batches.size(); i-- > 0;)
 			if (batches[i]->CanAddObject(obj))
 			{
 				batches[i]->AddObject(obj);
+				m_objectsBatch.emplace(obj, batches[i]);
 				return;
 			}
 
 		Batch* newBatch = CreateNewBatch(materialTemplate);
 		newBatch->AddObject(obj);
 		it->second.push_back(newBatch);
+		m_objectsBatch.emplace(obj, newBatch);
 
 		m_batches.push_back(newBatch);//keep all the batches in one place
 	}
@@ -90,75 +244,290 @@ void BatchManager::AddObject(Object* obj)
 	{
 		Batch* newBatch = CreateNewBatch(materialTemplate);
 		m_batchesCategories.emplace(materialTemplate, std::vector<Batch*>(1, newBatch));
+		m_templatesId.emplace(materialTemplate, (uint32_t)m_templatesId.size());
 		newBatch->AddObject(obj);
+		m_objectsBatch.emplace(obj, newBatch);
 
 		m_batches.push_back(newBatch); //keep all the batches in one place
 	}
 }
 
+void BatchManager::AddObjects(const std::vector<Object*>& objects)
+{
+	struct SortEntry
+	{
+		MaterialTemplateBase*	Template;
+		std::vector<CTexture*>	Textures; //sorted, the same set of textures gives the same key
+		uint32_t				Cell; //morton code of the center of the object in the bounds of all the objects
+		Object*					Obj;
+	};
+
+	if (objects.empty())
+		return;
+
+	BoundingBox3D sceneBounds = objects[0]->GetBoundingBox();
+	for (Object* obj : objects)
+	{
+		BoundingBox3D bb = obj->GetBoundingBox();
+		sceneBounds.Min = glm::min(sceneBounds.Min, bb.Min);
+		sceneBounds.Max = glm::max(sceneBounds.Max, bb.Max);
+	}
+
+	std::vector<SortEntry> entries(objects.size());
+	for (uint32_t i = 0; i < objects.size(); ++i)
+	{
+		Material* material = objects[i]->GetObjectMaterial();
+		SortEntry& entry = entries[i];
+		entry.Template = material->GetTemplate();
+		entry.Cell = ComputeMortonCell(objects[i]->GetBoundingBox(), sceneBounds);
+		entry.Obj = objects[i];
+		for (const auto& slot : material->GetTextureSlots())
+			entry.Textures.push_back(slot.texture);
+		std::sort(entry.Textures.begin(), entry.Textures.end());
+	}
+
+	//a batch is filled before the next one is started. The objects close in space are added one after the other, so
+	//the batches are compact and can be culled. Without bindless the objects with the same textures go first, so the
+	//textures are not spread over many batches
+	bool isBindless = MaterialLibrary::GetInstance()->IsBindless();
+	std::stable_sort(entries.begin(), entries.end(), [isBindless](const SortEntry& a, const SortEntry& b)
+	{
+		if (a.Template != b.Template)
+			return a.Template < b.Template;
+		if (!isBindless && a.Textures != b.Textures)
+			return a.Textures < b.Textures;
+		return a.Cell < b.Cell;
+	});
+
+	for (const auto& entry : entries)
+		AddObject(entry.Obj);
+}
+
+void BatchManager::RemoveObject(Object* obj)
+{
+	auto it = m_objectsBatch.find(obj);
+	TRAP(it != m_objectsBatch.end());
+
+	it->second->RemoveObject(obj);
+	m_objectsBatch.erase(it);
+}
+
+void BatchManager::OnObjectMoved(Object* obj)
+{
+	auto it = m_objectsBatch.find(obj);
+	if (it != m_objectsBatch.end())
+		it->second->OnObjectMoved(obj);
+}
+
 void BatchManager::RenderAll()
 {
-	for (auto category : m_batchesCategories)
+	//the last row of the projection gives the view depth, w of the clip space
+	std::vector<SortedDraw> draws;
+	SortDraws(SubpassIndex::Solid, glm::row(m_projViewMatrix, 3), ms_camera.GetNear(), ms_camera.GetFar(), draws);
+
+	//one job per material template, the draws of a template are consecutive and the jobs are executed in the order they were added.
+	//The secondary command buffers don't inherit any state, every job binds all it needs
+	for (auto first = draws.begin(); first != draws.end();)
 	{
-		const CGraphicPipeline& pipeline = category.first->GetPipeline();
-		vk::CmdBindPipeline(vk::g_vulkanContext.m_mainCommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.Get());
+		MaterialTemplateBase* materialTemplate = first->DrawBatch->GetMaterialTemplate();
+		auto last = std::find_if(first, draws.end(), [materialTemplate](const SortedDraw& draw)
+		{
+			return draw.DrawBatch->GetMaterialTemplate() != materialTemplate;
+		});
+
+		std::vector<Batch*> batches;
+		for (auto it = first; it != last; ++it)
+			batches.push_back(it->DrawBatch);
+		first = last;
 
-		for (Batch* batch : category.second)
+		CommandRecorder::GetInstance()->AddJob([materialTemplate, batches](VkCommandBuffer cmdBuffer)
 		{
-			batch->PrepareRendering(pipeline, SubpassIndex::Solid);
-			batch->Render(SubpassIndex::Solid);
-		}
+			const CGraphicPipeline& pipeline = materialTemplate->GetPipeline();
+			MeshManager::GetInstance()->GetGeometryPool()->Bind(cmdBuffer);
+			vk::CmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.Get());
+			materialTemplate->BindTextures(cmdBuffer);
+
+			for (Batch* batch : batches)
+			{
+				batch->PrepareRendering(cmdBuffer, pipeline, SubpassIndex::Solid);
+				batch->Render(cmdBuffer, SubpassIndex::Solid);
+			}
+		});
 	}
 }
 
-void BatchManager::RenderShadows()
+void BatchManager::RenderShadows(VkCommandBuffer cmdBuffer, uint32_t split)
 {
 	CGraphicPipeline* shadowPipeline = g_commonResources.GetAsPtr<CGraphicPipeline>(EResourceType_ShadowRenderPipeline);
+	MeshManager::GetInstance()->GetGeometryPool()->Bind(cmdBuffer);
 
-	for (auto& batch : m_batches)
+	//front to back from the light
+	const ShadowMapRenderer::SplitsArrayType& splits = g_commonResources.GetAs<ShadowMapRenderer::SplitsArrayType>(EResourceType_ShadowMapSplits);
+	SubpassIndex subpassIndex = SubpassIndex(uint32_t(SubpassIndex::ShadowPass) + split);
+	std::vector<SortedDraw> draws;
+	//the splits are orthographic, z of the clip space is already linear in [0, 1]
+	SortDraws(subpassIndex, glm::row(splits[split].ProjViewMatrix, 2), 0.0f, 1.0f, draws);
+
+	for (const auto& draw : draws)
 	{
-		batch->PrepareRendering(*shadowPipeline, SubpassIndex::ShadowPass);
-		batch->Render(SubpassIndex::ShadowPass);
+		draw.DrawBatch->PrepareRendering(cmdBuffer, *shadowPipeline, subpassIndex);
+		draw.DrawBatch->Render(cmdBuffer, subpassIndex);
 	}
+}
+
+void BatchManager::SortDraws(SubpassIndex subpassIndex, const glm::vec4& depthPlane, float nearDepth, float farDepth, std::vector<SortedDraw>& outDraws) const
+{
+	outDraws.resize(m_batches.size());
+	for (uint32_t i = 0; i < m_batches.size(); ++i)
+	{
+		Batch* batch = m_batches[i];
 
+		//all the shadow splits are drawn with the same pipeline
+		uint32_t pipeline = 0;
+		if (!IsShadowSubpass(subpassIndex))
+		{
+			auto it = m_templatesId.find(batch->GetMaterialTemplate());
+			TRAP(it != m_templatesId.end());
+			pipeline = it->second;
+		}
+
+		outDraws[i].Key = MakeDrawSortKey(subpassIndex, pipeline, QuantizeDepth(batch->GetBounds(), depthPlane, nearDepth, farDepth), i);
+		outDraws[i].DrawBatch = batch;
+	}
+
+	std::sort(outDraws.begin(), outDraws.end(), [](const SortedDraw& a, const SortedDraw& b)
+	{
+		return a.Key < b.Key;
+	});
 }
 
 void BatchManager::PreRender()
 {
-	MemoryManager::GetInstance()->MapMemoryContext(EMemoryContextType::IndirectDrawCmdBuffer);
+	glm::mat4 projMatrix;
+	PerspectiveMatrix(projMatrix);
+	ConvertToProjMatrix(projMatrix);
+	m_projViewMatrix = projMatrix * ms_camera.GetViewMatrix();
 
 	for (auto& batch : m_batches)
-		batch->PreRender();
+	{
+		batch->Update();
+		batch->PreRender(m_projViewMatrix);
+	}
 
-	MemoryManager::GetInstance()->UnmapMemoryContext(EMemoryContextType::IndirectDrawCmdBuffer);
+	for (const auto& category : m_batchesCategories)
+		category.first->UploadMaterials();
+}
 
+void BatchManager::Cull()
+{
+	VkCommandBuffer cmdBuffer = vk::g_vulkanContext.m_mainCommandBuffer;
+
+	StartDebugMarker("BatchCulling");
+	uint32_t timestampScope = QueryManager::GetInstance().BeginTimestamp("BatchCulling");
+	ComputeCullPlanes();
+	CullBatchesOnCPU();
+
+	//the indirect commands are reset by copies. They wait for the draws and the culling of the previous frames to stop using
+	//them, and for the scatter of the changed commands
+	VkMemoryBarrier resetBarrier;
+	cleanStructure(resetBarrier);
+	resetBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	resetBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	resetBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+	vk::CmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &resetBarrier, 0, nullptr, 0, nullptr);
+
+	for (auto& batch : m_batches)
+		batch->ResetIndirectCommands(cmdBuffer);
+
+	VkMemoryBarrier copyBarrier;
+	cleanStructure(copyBarrier);
+	copyBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	copyBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	copyBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	vk::CmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &copyBarrier, 0, nullptr, 0, nullptr);
+
+	vk::CmdBindPipeline(cmdBuffer, m_cullPipeline.GetBindPoint(), m_cullPipeline.Get());
+	for (auto& batch : m_batches)
+		batch->Cull(m_cullPipeline, m_cullPlanes);
+	QueryManager::GetInstance().EndTimestamp(timestampScope);
+
+	//the indirect commands and the visible instances are consumed by the draws of this frame, the LODs by the culling of the next one
+	VkMemoryBarrier cullBarrier;
+	cleanStructure(cullBarrier);
+	cullBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	cullBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	cullBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	vk::CmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &cullBarrier, 0, nullptr, 0, nullptr);
+	EndDebugMarker("BatchCulling");
+}
+
+//the objects of a batch are spread over the scene, so a batch is rejected only when none of them is in the camera frustum.
+//The tree uses fat boxes, so this never rejects a batch the GPU would draw. The shadow splits are culled only on GPU
+void BatchManager::CullBatchesOnCPU()
+{
+	for (auto& batch : m_batches)
+		batch->SetSubpassVisible(SubpassIndex::Solid, false);
+
+	std::vector<Object*> visibleObjects;
+	Scene::GetInstance()->FrustumCulling(ms_camera.GetFrustum(), visibleObjects);
+	for (auto obj : visibleObjects)
+	{
+		auto it = m_objectsBatch.find(obj);
+		if (it != m_objectsBatch.end())
+			it->second->SetSubpassVisible(SubpassIndex::Solid, true);
+	}
+}
+
+//every shadow split is culled with its own light volume, most casters land in only one split
+void BatchManager::ComputeCullPlanes()
+{
+	const CFrustum& frustum = ms_camera.GetFrustum();
+	TCullPlanes& solidPlanes = m_cullPlanes[uint32_t(SubpassIndex::Solid)];
+	for (uint32_t i = 0; i < CFrustum::PLCount; ++i)
+	{
+		const Plane& plane = frustum.GetPlane(i);
+		solidPlanes[i] = glm::vec4(plane.Normal, -glm::dot(plane.Normal, plane.Point));
+	}
+
+	const ShadowMapRenderer::SplitsArrayType& splits = g_commonResources.GetAs<ShadowMapRenderer::SplitsArrayType>(EResourceType_ShadowMapSplits);
+	for (uint32_t s = 0; s < SHADOWSPLITS; ++s)
+		ExtractShadowCullPlanes(splits[s].ProjViewMatrix, m_cullPlanes[uint32_t(SubpassIndex::ShadowPass) + s]);
 }
 
 ////////////////////////////////////////////////////////////////////
 //Batch
 ////////////////////////////////////////////////////////////////////
 
-uint32_t Batch::ms_memoryLimit = 4 << 20; //4 MB per batch
 uint32_t Batch::ms_texturesLimit = BATCH_MAX_TEXTURE;
-
-struct BatchCommons
-{
-	glm::mat4 ModelMtx;
-};
+uint32_t Batch::ms_objectsLimit = BATCH_MAX_OBJECTS;
 
 Batch::Batch(MaterialTemplateBase* materialTemplate)
-	: m_batchBuffer(nullptr)
-	, m_staggingBuffer(nullptr)
-	, m_indirectCommandBuffer(nullptr)
-	, m_batchStorageBuffer(nullptr)
-	, m_batchVertexBuffer(nullptr)
-	, m_batchIndexBuffer(nullptr)
-	, m_totalBatchMemory(0)
-	, m_needReconstruct(true)
-	, m_needCleanup(false)
-	, m_isReady(false)
+	: m_indirectCommandBuffer(nullptr)
+	, m_visibleInstancesBuffer(nullptr)
+	, m_drawCommandsTable(nullptr)
+	, m_commonsTable(nullptr)
+	, m_cullTable(nullptr)
+	, m_lodsTable(nullptr)
+	, m_frameNumber(0)
+	, m_frameCommandsCount(0)
+	, m_bounds(glm::vec3(0.0f), glm::vec3(0.0f))
 	, m_materialTemplate(materialTemplate)
+	, m_objectsCapacity(0)
+	, m_commandsCapacity(0)
+	, m_instancesCapacity(0)
+	, m_instancesCount(0)
+	, m_needInstanceRanges(false)
+	, m_needNewDescriptors(false)
+	, m_needCommandsUpload(false)
+	, m_isReady(false)
 {
+	for (auto& subpass : m_subpasses)
+	{
+		subpass.IndirectCommands = nullptr;
+		subpass.VisibleInstances = nullptr;
+		subpass.CullDescriptorSet = VK_NULL_HANDLE;
+		subpass.IsVisible = true;
+	}
 }
 
 Batch::~Batch()
@@ -168,240 +537,361 @@ Batch::~Batch()
 
 void Batch::AddObject(Object* obj)
 {
-	m_objects.push_back(obj);
-	
-	auto it = m_batchMeshes.find(obj->GetObjectMesh());
-	if (it == m_batchMeshes.end())
-	{
-		std::vector<VkDeviceSize> sizes(2);
-		Mesh* mesh = obj->GetObjectMesh();
-		
-		m_batchMeshes[obj->GetObjectMesh()] = MeshBufferInfo(); //should be filled at reconstuct
-
-		sizes[0] = mesh->GetVerticesMemorySize(); //first part of memory will be vertexes
-		sizes[1] = mesh->GetIndicesMemorySize();  //second part will be indexes
-
-		m_totalBatchMemory += MemoryManager::ComputeTotalSize(sizes);
-		
-		if (m_totalBatchMemory > ms_memoryLimit)
-			std::cout << "Warning!! Batch uses too much memory!! Maybe the batch contains only one detailed object. In this case we create descriptor sets for texture that are not used" << std::endl;
-	}
+	//the textures are indexed now, so CanAddObject counts the textures of the pending objects too
+	if (IndexTextures(obj))
+		m_needNewDescriptors = true;
 
-	m_needReconstruct = true;
+	m_pendingObjects.push_back(obj);
 }
 
-bool Batch::CanAddObject(Object* obj)
+void Batch::RemoveObject(Object* obj)
 {
-	auto it = m_batchMeshes.find(obj->GetObjectMesh());
-	if (it == m_batchMeshes.end())
+	auto pendingIt = std::find(m_pendingObjects.begin(), m_pendingObjects.end(), obj);
+	if (pendingIt != m_pendingObjects.end())
 	{
-		std::vector<VkDeviceSize> newObjMeshSizes(2);
-		newObjMeshSizes[0] = obj->GetObjectMesh()->GetVerticesMemorySize();
-		newObjMeshSizes[1] = obj->GetObjectMesh()->GetIndicesMemorySize();
-
-		VkDeviceSize newMeshSize = MemoryManager::ComputeTotalSize(newObjMeshSizes);
-
-		if (newMeshSize + m_totalBatchMemory > ms_memoryLimit)
-			return false;
+		m_pendingObjects.erase(pendingIt);
+		return;
 	}
 
-	Material* material = obj->GetObjectMaterial();
-	TRAP(material->GetTemplate() == m_materialTemplate);
+	auto it = m_objectsSlot.find(obj);
+	TRAP(it != m_objectsSlot.end());
+
+	//the cull data of the slot is cleared by the next PreRender, so the cull shader skips it
+	uint32_t slot = it->second;
+	m_objects[slot] = nullptr;
+	m_freeSlots.push_back(slot);
+	m_objectsSlot.erase(it);
+	MarkSlotDirty(slot);
 
-	std::unordered_set<CTexture*> textures; 
-	for (Object* obj : m_objects)
+	auto meshIt = m_batchMeshes.find(obj->GetObjectMesh());
+	TRAP(meshIt != m_batchMeshes.end());
+	if (--meshIt->second.ObjectsCount == 0)
 	{
-		const auto& textureSlots = obj->GetObjectMaterial()->GetTextureSlots();
-		for (const auto& slot : textureSlots)
-			textures.insert(slot.texture);
+		for (uint32_t lod = 0; lod < meshIt->second.LodCount; ++lod)
+			m_drawCommands[meshIt->second.CommandIndex + lod].indexCount = 0;
+		m_freeCommands.push_back(meshIt->second);
+		m_batchMeshes.erase(meshIt);
 	}
 
-	const auto& objTextSlots = material->GetTextureSlots();
-	for (const auto& slot : objTextSlots)
-		textures.insert(slot.texture);
-
-	return textures.size() <= ms_texturesLimit;
+	m_needInstanceRanges = true;
 }
 
-void Batch::Construct()
+void Batch::OnObjectMoved(Object* obj)
 {
-	BuildMeshBuffers();
-	InitSubpasses();
-	IndexTextures();
-	UpdateGraphicsInterface();
-	m_needReconstruct = false;
-
-	m_debugMarkerName = m_materialTemplate->GetName() + "_" + std::to_string(m_totalBatchMemory % 100);
+	//the pending objects are written when they are inserted
+	auto it = m_objectsSlot.find(obj);
+	if (it != m_objectsSlot.end())
+		MarkSlotDirty(it->second);
 }
 
-void Batch::UpdateIndirectCmdBuffer(SubpassInfo& subpass)
+bool Batch::CanAddObject(Object* obj)
 {
-	std::unordered_map<Mesh*, std::vector<Object*>> buckets; //object buckets based on the mesh they use
-	std::vector<Object*>& subpassObjects = subpass.VisibleObjects;
-	
-	for (auto obj : subpassObjects)
-	{
-		auto& bucket = buckets[obj->GetObjectMesh()];
-		bucket.push_back(obj);
-	}
+	Material* material = obj->GetObjectMaterial();
+	TRAP(material->GetTemplate() == m_materialTemplate);
+
+	//a batch is culled and sorted as a whole, so it's kept small
+	if (m_objectsSlot.size() + m_pendingObjects.size() >= ms_objectsLimit)
+		return false;
 
-	subpassObjects.clear();
-	subpass.IndirectCommandsNumber = 0;
+	//the textures are in the array of the material template and the meshes in the geometry pool, only the objects limit the batch
+	if (MaterialLibrary::GetInstance()->IsBindless())
+		return true;
 
-	uint32_t instances = 0;
-	VkDrawIndexedIndirectCommand* indCmd = subpass.IndirectCommands->GetPtr<VkDrawIndexedIndirectCommand*>();
-	for (const auto& bucket : buckets)
+	//m_batchTextures has all the textures indexed so far, the ones of the removed objects keep their index too.
+	//Only the textures of obj are looked up, a texture can be in more slots of the material
+	const auto& objTextSlots = material->GetTextureSlots();
+	uint32_t newTextures = 0;
+	for (uint32_t i = 0; i < objTextSlots.size(); ++i)
 	{
-		auto meshInfoIt = m_batchMeshes.find(bucket.first);// find the info for mesh
-		TRAP(meshInfoIt != m_batchMeshes.end()); //every time we have to find the info in the map
-		const MeshBufferInfo& buffInfo = meshInfoIt->second;
-		indCmd->firstIndex = buffInfo.firstIndex;
-		indCmd->indexCount = buffInfo.indexCount;
-		indCmd->vertexOffset = buffInfo.vertexOffset;
-		indCmd->firstInstance = instances;
-		indCmd->instanceCount = (uint32_t)bucket.second.size();
+		CTexture* texture = objTextSlots[i].texture;
+		if (m_texturesIndex.find(texture) != m_texturesIndex.end())
+			continue;
 
-		subpassObjects.insert(subpassObjects.end(), bucket.second.begin(), bucket.second.end());
-		++subpass.IndirectCommandsNumber;
+		bool isRepeated = false;
+		for (uint32_t j = 0; j < i && !isRepeated; ++j)
+			isRepeated = objTextSlots[j].texture == texture;
 
-		instances += (uint32_t)bucket.second.size();
-		++indCmd;
+		if (!isRepeated)
+			++newTextures;
 	}
 
+	return m_batchTextures.size() + newTextures <= ms_texturesLimit;
 }
 
-bool Batch::UpdateVisibleObjects(SubpassInfo& subpass)
+void Batch::Update()
 {
-	auto lastVisible = std::stable_partition(m_objects.begin(), m_objects.end(), [&subpass](const Object* obj)
+	//an object waits only for the upload of its own mesh, the rest of the batch is drawn meanwhile
+	auto firstPending = std::partition(m_pendingObjects.begin(), m_pendingObjects.end(), [](Object* obj)
 	{
-		return obj->CheckVisibility((VisibilityType)subpass.VisibilityMask);
+		return obj->GetObjectMesh()->IsInGeometryPool();
 	});
 
-	if ((lastVisible - m_objects.begin()) == subpass.VisibleObjects.size()) //i feel like its a week condition, but lets put it in practice
-		return false; //visible objects didnt change 
+	for (auto it = m_pendingObjects.begin(); it != firstPending; ++it)
+		InsertObject(*it);
+	m_pendingObjects.erase(m_pendingObjects.begin(), firstPending);
+
+	if (m_objects.empty())
+		return;
 
-	auto& visObjects = subpass.VisibleObjects;
-	visObjects.clear();
-	visObjects.insert(visObjects.end(), m_objects.begin(), lastVisible);
+	if (m_needInstanceRanges)
+	{
+		UpdateInstanceRanges();
+		m_needInstanceRanges = false;
+		m_needCommandsUpload = true;
+		m_debugMarkerName = m_materialTemplate->GetName() + "_" + std::to_string(m_objectsSlot.size());
+	}
 
-	return true;
+	//only the buffers and the descriptors, the geometry stays where it is in the pool
+	if (m_objects.size() > m_objectsCapacity || m_drawCommands.size() > m_commandsCapacity || m_instancesCount > m_instancesCapacity || m_needNewDescriptors)
+	{
+		ReleaseSubpasses();
+		if (!InitSubpasses())
+		{
+			//not drawn until there is memory for the new tables, it's tried again next frame
+			m_isReady = false;
+			return;
+		}
+		UpdateGraphicsInterface();
+		m_needNewDescriptors = false;
+
+		//the new tables are empty, and the new indirect commands are not drawn before the next PreRender and Cull
+		for (uint32_t slot = 0; slot < m_objects.size(); ++slot)
+			MarkSlotDirty(slot);
+		m_needCommandsUpload = true;
+		m_frameNumber = UINT64_MAX;
+	}
+
+	m_isReady = true;
 }
 
-void Batch::BuildMeshBuffers()
+void Batch::InsertObject(Object* obj)
 {
-	std::vector<VkDeviceSize> subBuffersSizes(2);
-
-	subBuffersSizes[0] = subBuffersSizes[1] = 0;//unnecessary i think
-
-	for (const auto& meshBuffer : m_batchMeshes)
+	uint32_t slot;
+	if (!m_freeSlots.empty())
+	{
+		slot = m_freeSlots.back();
+		m_freeSlots.pop_back();
+	}
+	else
 	{
-		Mesh* mesh = meshBuffer.first;
-		subBuffersSizes[0] += (VkDeviceSize)mesh->GetVerticesMemorySize(); //in first part of the memory we keep the vertices
-		subBuffersSizes[1] += (VkDeviceSize)mesh->GetIndicesMemorySize(); //in the second part of the memory we keep the indices
+		slot = (uint32_t)m_objects.size();
+		m_objects.push_back(nullptr);
+		m_objectsCommandIndex.push_back(0);
+		m_isSlotDirty.push_back(false);
 	}
 
-	m_batchBuffer = MemoryManager::GetInstance()->CreateBuffer(EMemoryContextType::DeviceLocalBuffer, subBuffersSizes, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
-	m_staggingBuffer = MemoryManager::GetInstance()->CreateBuffer(EMemoryContextType::BatchStaggingBuffer, subBuffersSizes, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+	m_objects[slot] = obj;
+	m_objectsSlot.emplace(obj, slot);
+	m_objectsCommandIndex[slot] = AddMeshReference(obj->GetObjectMesh());
+	MarkSlotDirty(slot);
 
-	MemoryManager::GetInstance()->MapMemoryContext(EMemoryContextType::BatchStaggingBuffer);
-	
-	m_batchVertexBuffer = m_batchBuffer->CreateSubbuffer(subBuffersSizes[0]);
-	m_batchIndexBuffer = m_batchBuffer->CreateSubbuffer(subBuffersSizes[1]);
-	BufferHandle* staggingVertexBuffer = m_staggingBuffer->CreateSubbuffer(subBuffersSizes[0]);
-	BufferHandle* staggingIndexBuffer = m_staggingBuffer->CreateSubbuffer(subBuffersSizes[1]);
+	m_needInstanceRanges = true;
+}
+
+void Batch::MarkSlotDirty(uint32_t slot)
+{
+	if (m_isSlotDirty[slot])
+		return;
+
+	m_isSlotDirty[slot] = true;
+	m_dirtySlots.push_back(slot);
+}
 
-	SVertex* vertexMemory = staggingVertexBuffer->GetPtr<SVertex*>();
-	uint32_t* indexMemory = staggingIndexBuffer->GetPtr<uint32_t*>();
+uint32_t Batch::AddMeshReference(Mesh* mesh)
+{
+	auto it = m_batchMeshes.find(mesh);
+	if (it != m_batchMeshes.end())
+	{
+		++it->second.ObjectsCount;
+		return it->second.CommandIndex;
+	}
 
-	uint32_t vertexOffset = 0;
-	uint32_t indexOffset = 0;
+	MeshInfo meshInfo;
+	meshInfo.LodCount = mesh->GetLodCount();
+	meshInfo.ObjectsCount = 1;
 
-	for (const auto& meshBuffer : m_batchMeshes)
+	auto freeIt = std::find_if(m_freeCommands.begin(), m_freeCommands.end(), [&meshInfo](const MeshInfo& freeCommands)
 	{
-		Mesh* mesh = meshBuffer.first;
-		mesh->CopyLocalData(vertexMemory, indexMemory);
-		
-		//we partially fill indirect command structure
-		MeshBufferInfo info;
-		info.firstIndex = indexOffset;
-		info.vertexOffset = vertexOffset;
-		info.indexCount = mesh->GetIndexCount();
+		return freeCommands.LodCount == meshInfo.LodCount;
+	});
 
-		m_batchMeshes[mesh] = info;
+	if (freeIt != m_freeCommands.end())
+	{
+		meshInfo.CommandIndex = freeIt->CommandIndex;
+		m_freeCommands.erase(freeIt);
+	}
+	else
+	{
+		meshInfo.CommandIndex = (uint32_t)m_drawCommands.size();
+		m_drawCommands.resize(m_drawCommands.size() + meshInfo.LodCount);
+	}
 
-		vertexOffset += mesh->GetVertexCount();
-		indexOffset += mesh->GetIndexCount();
-		vertexMemory += mesh->GetVertexCount();
-		indexMemory += mesh->GetIndexCount();
+	//the mesh is referenced where it is in the geometry pool, all the batches share the same buffers. The LODs are
+	//ranges of the indices of the mesh and use the same vertexes
+	const GeometryPool::Allocation& poolAlloc = mesh->GetPoolAllocation();
+	for (uint32_t lod = 0; lod < meshInfo.LodCount; ++lod)
+	{
+		VkDrawIndexedIndirectCommand& cmd = m_drawCommands[meshInfo.CommandIndex + lod];
+		cmd.firstIndex = poolAlloc.m_firstIndex + mesh->GetLod(lod).FirstIndex;
+		cmd.indexCount = mesh->GetLod(lod).IndexCount;
+		cmd.vertexOffset = (int32_t)poolAlloc.m_vertexOffset;
+		cmd.firstInstance = 0;
+		cmd.instanceCount = 0;
 	}
 
-	MemoryManager::GetInstance()->UnmapMemoryContext(EMemoryContextType::BatchStaggingBuffer);
+	m_batchMeshes.emplace(mesh, meshInfo);
+	return meshInfo.CommandIndex;
+}
 
-	VkCommandBuffer cmdBuffer = vk::g_vulkanContext.m_mainCommandBuffer;
+void Batch::UpdateInstanceRanges()
+{
+	//every command gets a range as big as the objects of its mesh, any of them can be drawn with any LOD.
+	//The cull shader compacts the visible ones at the start of the range
+	m_instancesCount = 0;
+	for (const auto& meshInfo : m_batchMeshes)
+	{
+		for (uint32_t lod = 0; lod < meshInfo.second.LodCount; ++lod)
+		{
+			m_drawCommands[meshInfo.second.CommandIndex + lod].firstInstance = m_instancesCount;
+			m_instancesCount += meshInfo.second.ObjectsCount;
+		}
+	}
+}
 
-	VkBufferMemoryBarrier copyBarrier;
-	copyBarrier = m_batchVertexBuffer->CreateMemoryBarrier(VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT);
+void Batch::ResetIndirectCommands(VkCommandBuffer cmdBuffer)
+{
+	if (!m_isReady || !HasFrameData() || m_frameCommandsCount == 0)
+		return;
 
-	VkBufferCopy copyRegion;
-	cleanStructure(copyRegion);
-	copyRegion.srcOffset = m_staggingBuffer->GetOffset();
-	copyRegion.dstOffset = m_batchBuffer->GetOffset();
-	copyRegion.size = m_staggingBuffer->GetSize();
+	//not culled or drawn this frame
+	if (HasPendingUploads())
+	{
+		m_frameNumber = UINT64_MAX;
+		return;
+	}
 
-	vk::CmdCopyBuffer(cmdBuffer, m_staggingBuffer->Get(), m_batchBuffer->Get(), 1, &copyRegion);
-	vk::CmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 0, nullptr, 1, &copyBarrier, 0, nullptr);
+	//instanceCount is 0 in every command. The cull shader increments it for every visible object
+	for (const auto& subpass : m_subpasses)
+	{
+		if (!subpass.IsVisible)
+			continue;
 
-	m_needCleanup = true;
+		VkBufferCopy region{ m_drawCommandsTable->GetOffset(), subpass.IndirectCommands->GetOffset(), m_frameCommandsCount * sizeof(VkDrawIndexedIndirectCommand) };
+		vk::CmdCopyBuffer(cmdBuffer, m_drawCommandsTable->Get(), subpass.IndirectCommands->Get(), 1, &region);
+	}
 }
 
-void Batch::InitSubpasses()
+void Batch::UpdateBounds()
 {
-	//first we allocate memory used by the subpass
-	/*
-		Storage buffer will look like this
-		C_C_C_C_C_C_C_S_S_S_S_S_S_S
-		|            |			  |
-		 Common part  Specific Part
-	*/
-	std::vector<VkDeviceSize> sizes(2);
-	sizes[0] = m_objects.size() * sizeof(BatchCommons);
-	sizes[1] = m_objects.size() * m_materialTemplate->GetDataStride();
-	
-	VkDeviceSize totalSize = MemoryManager::GetInstance()->ComputeTotalSize(sizes) * m_subpasses.size();
+	bool isEmpty = true;
+	for (auto obj : m_objects)
+	{
+		if (!obj)
+			continue;
 
-	VkDeviceSize indirectCmdSize = m_objects.size() * sizeof(VkDrawIndexedIndirectCommand);
-	VkDeviceSize indirectCmdsSizeTotal = indirectCmdSize * m_subpasses.size();
+		BoundingBox3D bb = obj->GetBoundingBox();
+		m_bounds.Min = (isEmpty) ? bb.Min : glm::min(m_bounds.Min, bb.Min);
+		m_bounds.Max = (isEmpty) ? bb.Max : glm::max(m_bounds.Max, bb.Max);
+		isEmpty = false;
+	}
 
-	m_batchStorageBuffer = MemoryManager::GetInstance()->CreateBuffer(EMemoryContextType::UniformBuffers, totalSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
-	m_indirectCommandBuffer = MemoryManager::GetInstance()->CreateBuffer(EMemoryContextType::IndirectDrawCmdBuffer, indirectCmdsSizeTotal, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
+	if (isEmpty)
+		m_bounds = BoundingBox3D(glm::vec3(0.0f), glm::vec3(0.0f));
+}
+
+bool Batch::InitSubpasses()
+{
+	m_objectsCapacity = GrowCapacity(m_objectsCapacity, (uint32_t)m_objects.size());
+	m_commandsCapacity = GrowCapacity(m_commandsCapacity, (uint32_t)m_drawCommands.size());
+	m_instancesCapacity = GrowCapacity(m_instancesCapacity, m_instancesCount);
+
+	//the object data tables are shared by the subpasses and only written by the scatter shader, see PreRender
+	m_commonsTable = MemoryManager::GetInstance()->CreateBuffer(EMemoryContextType::DeviceLocalBuffer, m_objectsCapacity * sizeof(BatchCommons), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+	m_cullTable = MemoryManager::GetInstance()->CreateBuffer(EMemoryContextType::DeviceLocalBuffer, m_objectsCapacity * sizeof(BatchCullData), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+	//not initialized, the cull shader clamps the LODs it reads
+	m_lodsTable = MemoryManager::GetInstance()->CreateBuffer(EMemoryContextType::DeviceLocalBuffer, m_objectsCapacity * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+
+	//then the memory used by the subpasses
+	VkDeviceSize indirectCmdSize = m_commandsCapacity * sizeof(VkDrawIndexedIndirectCommand);
+	VkDeviceSize instancesSize = m_instancesCapacity * sizeof(uint32_t);
+
+	//reset every frame from m_drawCommandsTable by a copy on the gpu, so the cpu never writes them
+	m_drawCommandsTable = MemoryManager::GetInstance()->CreateBuffer(EMemoryContextType::DeviceLocalBuffer, indirectCmdSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+	m_indirectCommandBuffer = MemoryManager::GetInstance()->CreateBuffer(EMemoryContextType::DeviceLocalBuffer, std::vector<VkDeviceSize>(m_subpasses.size(), indirectCmdSize), VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+	m_visibleInstancesBuffer = MemoryManager::GetInstance()->CreateBuffer(EMemoryContextType::DeviceLocalBuffer, std::vector<VkDeviceSize>(m_subpasses.size(), instancesSize), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+
+	if (!m_commonsTable || !m_cullTable || !m_lodsTable || !m_drawCommandsTable || !m_indirectCommandBuffer || !m_visibleInstancesBuffer)
+	{
+		ReleaseSubpasses();
+		m_objectsCapacity = m_commandsCapacity = m_instancesCapacity = 0;
+		return false;
+	}
 
 	auto mapVisibility = [](SubpassIndex index)
 	{
-		switch (index)
-		{
-		case SubpassIndex::Solid:
+		if (index == SubpassIndex::Solid)
 			return VisibilityType::InCameraFrustum;
-		case SubpassIndex::ShadowPass:
-			return VisibilityType::InShadowFrustum;
-		default:
-			TRAP(false);
-			return VisibilityType::Invalid;
-		};
 
+		TRAP(IsShadowSubpass(index));
+		return VisibilityType::InShadowFrustum;
 	};
 
 
 	for (uint32_t i = 0; i < uint32_t(SubpassIndex::Count); ++i)
 	{
 		SubpassInfo& subpass = m_subpasses[i];
-		subpass.CommonBuffer = m_batchStorageBuffer->CreateSubbuffer(sizes[0]);
-		subpass.SpecificBuffer = m_batchStorageBuffer->CreateSubbuffer(sizes[1]);
 		subpass.IndirectCommands = m_indirectCommandBuffer->CreateSubbuffer(indirectCmdSize);
+		subpass.VisibleInstances = m_visibleInstancesBuffer->CreateSubbuffer(instancesSize);
 		subpass.DescriptorSets = m_materialTemplate->GetNewDescriptorSets();
+		subpass.CullDescriptorSet = BatchManager::GetInstance()->AllocCullDescriptorSet();
 		subpass.VisibilityMask = mapVisibility((SubpassIndex)i);
-		subpass.VisibleObjects = m_objects; //TODO for now render all the objects
+	}
+	return true;
+}
+
+//the frames in flight can still use them, the buffers and the sets are freed later
+void Batch::ReleaseSubpasses()
+{
+	//the new tables get all the entries again
+	ScatterUploader* uploader = ScatterUploader::GetInstance();
+	uploader->DiscardUpdates(m_drawCommandsTable);
+	uploader->DiscardUpdates(m_commonsTable);
+	uploader->DiscardUpdates(m_cullTable);
+
+	if (m_indirectCommandBuffer)
+		MemoryManager::GetInstance()->FreeHandle(m_indirectCommandBuffer);
+
+	if (m_visibleInstancesBuffer)
+		MemoryManager::GetInstance()->FreeHandle(m_visibleInstancesBuffer);
+
+	if (m_drawCommandsTable)
+		MemoryManager::GetInstance()->FreeHandle(m_drawCommandsTable);
+
+	if (m_commonsTable)
+		MemoryManager::GetInstance()->FreeHandle(m_commonsTable);
+
+	if (m_cullTable)
+		MemoryManager::GetInstance()->FreeHandle(m_cullTable);
 
-		UpdateIndirectCmdBuffer(subpass);
+	if (m_lodsTable)
+		MemoryManager::GetInstance()->FreeHandle(m_lodsTable);
+
+	m_indirectCommandBuffer = nullptr;
+	m_visibleInstancesBuffer = nullptr;
+	m_drawCommandsTable = nullptr;
+	m_commonsTable = nullptr;
+	m_cullTable = nullptr;
+	m_lodsTable = nullptr;
+
+	for (auto& subpass : m_subpasses)
+	{
+		if (!subpass.DescriptorSets.empty())
+			BatchManager::GetInstance()->RetireDescriptorSets(subpass.DescriptorSets, subpass.CullDescriptorSet);
+
+		subpass.IndirectCommands = nullptr;
+		subpass.VisibleInstances = nullptr;
+		subpass.DescriptorSets.clear();
+		subpass.CullDescriptorSet = VK_NULL_HANDLE;
 	}
 }
 
@@ -409,28 +899,40 @@ void Batch::UpdateGraphicsInterface()
 {
 	std::vector<VkWriteDescriptorSet> wDesc;
 
+	//with bindless textures, m_batchTextures is empty and the textures are in the set of the material template
 	std::vector<VkDescriptorImageInfo> imageInfo;
 	for (const auto& text : m_batchTextures)
 		imageInfo.push_back(text->GetTextureDescriptor());
 
 	//fill with default textures
 	std::vector<VkDescriptorImageInfo> defaultTextures;
-	for (uint32_t i = (uint32_t)m_batchTextures.size(); i < ms_texturesLimit; ++i)
+	for (uint32_t i = (uint32_t)m_batchTextures.size(); !m_batchTextures.empty() && i < ms_texturesLimit; ++i)
 		defaultTextures.push_back(m_batchTextures[0]->GetTextureDescriptor());
 
-	VkDescriptorBufferInfo commonBuffInfo[uint32_t(SubpassIndex::Count)];
-	VkDescriptorBufferInfo specificBuffInfo[uint32_t(SubpassIndex::Count)];
+	VkDescriptorBufferInfo commonBuffInfo = m_commonsTable->GetDescriptor();
+	VkDescriptorBufferInfo specificBuffInfo = m_materialTemplate->GetMaterialsTable()->GetDescriptor();
+	VkDescriptorBufferInfo cullDataBuffInfo = m_cullTable->GetDescriptor();
+	VkDescriptorBufferInfo lodsBuffInfo = m_lodsTable->GetDescriptor();
+	VkDescriptorBufferInfo instancesBuffInfo[uint32_t(SubpassIndex::Count)];
+	VkDescriptorBufferInfo indirectCmdBuffInfo[uint32_t(SubpassIndex::Count)];
 
 	for (uint32_t i = 0; i < uint32_t(SubpassIndex::Count); ++i)
 	{
 		auto& subpass = m_subpasses[i];
-		commonBuffInfo[i] = subpass.CommonBuffer->GetDescriptor();
-		wDesc.push_back(InitUpdateDescriptor(subpass.DescriptorSets[DescriptorIndex::Common], 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, &commonBuffInfo[i]));
+		instancesBuffInfo[i] = subpass.VisibleInstances->GetDescriptor();
+		indirectCmdBuffInfo[i] = subpass.IndirectCommands->GetDescriptor();
 
-		specificBuffInfo[i] = subpass.SpecificBuffer->GetDescriptor();
-		wDesc.push_back(InitUpdateDescriptor(subpass.DescriptorSets[DescriptorIndex::Specific], 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, &specificBuffInfo[i]));
+		wDesc.push_back(InitUpdateDescriptor(subpass.DescriptorSets[DescriptorIndex::Common], 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, &commonBuffInfo));
+		wDesc.push_back(InitUpdateDescriptor(subpass.DescriptorSets[DescriptorIndex::Common], 1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, &instancesBuffInfo[i]));
+		wDesc.push_back(InitUpdateDescriptor(subpass.DescriptorSets[DescriptorIndex::Specific], 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, &specificBuffInfo));
 
-		wDesc.push_back(InitUpdateDescriptor(subpass.DescriptorSets[DescriptorIndex::Specific], 1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 0, imageInfo));
+		wDesc.push_back(InitUpdateDescriptor(subpass.CullDescriptorSet, 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, &cullDataBuffInfo));
+		wDesc.push_back(InitUpdateDescriptor(subpass.CullDescriptorSet, 1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, &indirectCmdBuffInfo[i]));
+		wDesc.push_back(InitUpdateDescriptor(subpass.CullDescriptorSet, 2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, &instancesBuffInfo[i]));
+		wDesc.push_back(InitUpdateDescriptor(subpass.CullDescriptorSet, 3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, &lodsBuffInfo));
+
+		if (!imageInfo.empty())
+			wDesc.push_back(InitUpdateDescriptor(subpass.DescriptorSets[DescriptorIndex::Specific], 1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 0, imageInfo));
 
 		if (!defaultTextures.empty())
 			wDesc.push_back(InitUpdateDescriptor(subpass.DescriptorSets[DescriptorIndex::Specific], 1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, (uint32_t)m_batchTextures.size(), defaultTextures));
@@ -439,125 +941,187 @@ void Batch::UpdateGraphicsInterface()
 	vk::UpdateDescriptorSets(vk::g_vulkanContext.m_device, (uint32_t)wDesc.size(), wDesc.data(), 0, nullptr);
 }
 
-void Batch::IndexTextures()
+bool Batch::IndexTextures(Object* obj)
 {
+	bool bindless = MaterialLibrary::GetInstance()->IsBindless();
+	bool textureAdded = false;
+
 	//idk man. this is some fucked up shit
-	for (Object* obj : m_objects)
+	Material* mat = obj->GetObjectMaterial();
+	std::vector<IndexedTexture> slots = mat->GetTextureSlots();
+	std::vector<IndexedTexture> newSlots = slots; //THIS HERE
+	for (unsigned int i = 0; i < slots.size(); ++i)
 	{
-		Material* mat = obj->GetObjectMaterial();
-		std::vector<IndexedTexture> slots = mat->GetTextureSlots();
-		std::vector<IndexedTexture> newSlots = slots; //THIS HERE
-		for (unsigned int i = 0; i < slots.size(); ++i)
+		if (bindless)
 		{
-			auto it = std::find_if(m_batchTextures.begin(), m_batchTextures.end(), [&](const CTexture* elem)
-			{
-				return elem == slots[i].texture;
-			});
-
-			if (it != m_batchTextures.end())
-			{
-				newSlots[i].index = uint32_t(it - m_batchTextures.begin());
-			}
-			else
-			{
-				newSlots[i].index = (uint32_t)m_batchTextures.size();
-				m_batchTextures.push_back(slots[i].texture);
-			}
+			newSlots[i].index = m_materialTemplate->RegisterTexture(slots[i].texture);
+			continue;
 		}
 
-		mat->SetTextureSlots(newSlots);
+		auto it = m_texturesIndex.find(slots[i].texture);
+		if (it != m_texturesIndex.end())
+		{
+			newSlots[i].index = it->second;
+		}
+		else
+		{
+			newSlots[i].index = (uint32_t)m_batchTextures.size();
+			m_texturesIndex.emplace(slots[i].texture, newSlots[i].index);
+			m_batchTextures.push_back(slots[i].texture);
+			textureAdded = true;
+		}
 	}
-}
 
-void Batch::Cleanup()
-{
-	MemoryManager::GetInstance()->FreeHandle( m_staggingBuffer);
-
-	m_staggingBuffer = nullptr;
-
-	m_needCleanup = false;
-	m_isReady = true;
+	mat->SetTextureSlots(newSlots);
+	m_materialTemplate->UpdateMaterial(mat); //the texture indexes are in the material data
+	return textureAdded;
 }
 
 void Batch::Destruct()
 {
 	m_isReady = false;
 
-	if (!m_batchBuffer)
-		MemoryManager::GetInstance()->FreeHandle(m_batchBuffer);
-
-	if (!m_indirectCommandBuffer)
-		MemoryManager::GetInstance()->FreeHandle(m_indirectCommandBuffer);
-
-	if (!m_batchStorageBuffer)
-		MemoryManager::GetInstance()->FreeHandle(m_batchStorageBuffer);
+	ReleaseSubpasses();
 
 	m_materialTemplate = nullptr;
 
 	m_objects.clear();
-
-	// TODO m_batchDescriptorSets i dont know how to approach the problem with descriptor sets being cleared and new construction being allocated. even if a batch is deleted, descriptors remain untill de descriptor pool is deleted
+	m_freeSlots.clear();
+	m_objectsSlot.clear();
+	m_pendingObjects.clear();
+	m_dirtySlots.clear();
+	m_isSlotDirty.clear();
 }
 
-void Batch::PreRender()
+void Batch::PreRender(const glm::mat4& projViewMatrix)
 {
 	if (!m_isReady)
 		return;
 
-	uint32_t stride = m_materialTemplate->GetDataStride();
+	m_frameNumber = MemoryManager::GetInstance()->GetFrameAllocator()->GetFrameNumber();
 
-	for (auto& subpass : m_subpasses)
+	//the tables keep the data of the previous frames, only the added, removed and moved objects are written.
+	//Visibility is decided on GPU (see Cull)
+	ScatterUploader* uploader = ScatterUploader::GetInstance();
+	for (auto slot : m_dirtySlots)
 	{
-		if (UpdateVisibleObjects(subpass))
-			UpdateIndirectCmdBuffer(subpass);
-
-		BatchCommons* commonMem = subpass.CommonBuffer->GetPtr<BatchCommons*>();
-		uint8_t* materialMemory = subpass.SpecificBuffer->GetPtr<uint8_t*>();
+		m_isSlotDirty[slot] = false;
 
-		for (unsigned int i = 0; i < subpass.VisibleObjects.size(); ++i, ++commonMem, materialMemory += stride)
+		BatchCullData cullData;
+		Object* obj = m_objects[slot];
+		if (!obj)
 		{
-			Object* obj = subpass.VisibleObjects[i];
-			TRAP(obj->GetObjectMaterial()->GetTemplate() == m_materialTemplate);
-			commonMem->ModelMtx = obj->GetModelMatrix();
-			memcpy(materialMemory, obj->GetObjectMaterial()->GetData(), m_materialTemplate->GetDataStride());
+			//a free slot, the cull shader skips it
+			cleanStructure(cullData);
+			uploader->AddUpdate(m_cullTable, sizeof(BatchCullData), slot, &cullData);
+			continue;
 		}
 
+		TRAP(obj->GetObjectMaterial()->GetTemplate() == m_materialTemplate);
+		BatchCommons commons;
+		commons.ModelMtx = obj->GetModelMatrix();
+		BoundingBox3D meshBB = obj->GetObjectMesh()->GetBB();
+		commons.MeshBoundsMin = glm::vec4(meshBB.Min, 0.0f);
+		commons.MeshBoundsExtent = glm::vec4(meshBB.Max - meshBB.Min, 0.0f);
+		commons.MaterialIndex = m_materialTemplate->GetMaterialIndex(obj->GetObjectMaterial());
+		commons.Padding[0] = commons.Padding[1] = commons.Padding[2] = 0;
+
+		BoundingBox3D bb = obj->GetBoundingBox();
+		cullData.BoundsMin = bb.Min;
+		cullData.BoundsMax = bb.Max;
+		cullData.CommandIndex = m_objectsCommandIndex[slot];
+		cullData.VisibilityFlags = VisibilityType::InCameraFrustum | ((obj->GetIsShadowCaster()) ? VisibilityType::InShadowFrustum : 0);
+		cullData.LodCount = obj->GetObjectMesh()->GetLodCount();
+		cullData.Padding[0] = cullData.Padding[1] = cullData.Padding[2] = 0;
+
+		uploader->AddUpdate(m_commonsTable, sizeof(BatchCommons), slot, &commons);
+		uploader->AddUpdate(m_cullTable, sizeof(BatchCullData), slot, &cullData);
 	}
 
-	glm::mat4 projMatrix;
-	PerspectiveMatrix(projMatrix);
-	ConvertToProjMatrix(projMatrix);
+	//the bounds change only with the objects
+	if (!m_dirtySlots.empty())
+		UpdateBounds();
+	m_dirtySlots.clear();
+
+	//the commands change only with the meshes of the batch
+	if (m_needCommandsUpload)
+	{
+		for (uint32_t i = 0; i < m_drawCommands.size(); ++i)
+			uploader->AddUpdate(m_drawCommandsTable, sizeof(VkDrawIndexedIndirectCommand), i, &m_drawCommands[i]);
+		m_needCommandsUpload = false;
+	}
+	m_frameCommandsCount = (uint32_t)m_drawCommands.size();
 
-	m_batchParams.ProjViewMatrix = projMatrix * ms_camera.GetViewMatrix();
+	m_batchParams.ProjViewMatrix = projViewMatrix;
 	m_batchParams.ViewPos = glm::vec4(ms_camera.GetPos(), 1.0f);
 	m_batchParams.ShadowProjViewMatrix = g_commonResources.GetAs<glm::mat4>(EResourceType_ShadowProjViewMat);
 }
 
-void Batch::Render(SubpassIndex subpassIndex)
+bool Batch::HasFrameData() const
 {
-	if (!m_isReady)
+	return m_frameNumber == MemoryManager::GetInstance()->GetFrameAllocator()->GetFrameNumber();
+}
+
+bool Batch::HasPendingUploads() const
+{
+	ScatterUploader* uploader = ScatterUploader::GetInstance();
+	return uploader->HasPendingUpdates(m_drawCommandsTable) || uploader->HasPendingUpdates(m_commonsTable) || uploader->HasPendingUpdates(m_cullTable) ||
+		uploader->HasPendingUpdates(m_materialTemplate->GetMaterialsTable());
+}
+
+void Batch::Cull(const CComputePipeline& pipeline, const TSubpassCullPlanes& cullPlanes)
+{
+	if (!m_isReady || !HasFrameData())
 		return;
 
 	VkCommandBuffer cmdBuffer = vk::g_vulkanContext.m_mainCommandBuffer;
 
-	VkDeviceSize offset = 0;
-	vk::CmdBindVertexBuffers(cmdBuffer, 0, 1, &m_batchVertexBuffer->Get(), &offset);
-	vk::CmdBindIndexBuffer(cmdBuffer, m_batchIndexBuffer->Get(), m_batchIndexBuffer->GetOffset(), VK_INDEX_TYPE_UINT32);
+	//the LODs are picked from the size of the objects on the screen, for the shadows too. w is cot(fov / 2) / s_lodScreenSize,
+	//so the shader gets the LOD from log2(distance / (radius * w)) without the projection matrix
+	BatchCullParams params;
+	params.LodCameraPos = glm::vec4(ms_camera.GetPos(), 1.0f / (glm::tan(ms_camera.GetFOV() * 0.5f) * s_lodScreenSize));
+	params.ObjectsCount = (uint32_t)m_objects.size();
+
+	uint32_t groupsCount = params.ObjectsCount / s_cullGroupSize + ((params.ObjectsCount % s_cullGroupSize != 0) ? 1 : 0);
+	for (uint32_t i = 0; i < uint32_t(SubpassIndex::Count); ++i)
+	{
+		const SubpassInfo& subpass = m_subpasses[i];
+		if (!subpass.IsVisible)
+			continue; //not drawn either
+
+		params.VisibilityMask = subpass.VisibilityMask;
+		params.UpdateLods = (SubpassIndex(i) == SubpassIndex::Solid) ? 1 : 0;
+		std::copy(cullPlanes[i].begin(), cullPlanes[i].end(), params.FrustumPlanes);
+
+		vk::CmdBindDescriptorSets(cmdBuffer, pipeline.GetBindPoint(), pipeline.GetLayout(), 0, 1, &subpass.CullDescriptorSet, 0, nullptr);
+		vk::CmdPushConstants(cmdBuffer, pipeline.GetLayout(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(BatchCullParams), &params);
+		vk::CmdDispatch(cmdBuffer, groupsCount, 1, 1);
+	}
+}
+
+void Batch::Render(VkCommandBuffer cmdBuffer, SubpassIndex subpassIndex)
+{
+	if (!m_isReady || !HasFrameData())
+		return;
+
+	//the geometry pool is bound by the batch manager
 
-	std::string debugMarker = m_debugMarkerName + GetSubpassDebugMarker(subpassIndex);
 	const SubpassInfo& subpass = m_subpasses[uint32_t(subpassIndex)];
+	if (!subpass.IsVisible)
+		return;
+
+	std::string debugMarker = m_debugMarkerName + GetSubpassDebugMarker(subpassIndex);
 
-	StartDebugMarker(debugMarker);
-	vk::CmdDrawIndexedIndirect(cmdBuffer, subpass.IndirectCommands->Get(), subpass.IndirectCommands->GetOffset(), subpass.IndirectCommandsNumber, sizeof(VkDrawIndexedIndirectCommand));
-	EndDebugMarker(debugMarker);
+	StartDebugMarker(cmdBuffer, debugMarker);
+	vk::CmdDrawIndexedIndirect(cmdBuffer, subpass.IndirectCommands->Get(), subpass.IndirectCommands->GetOffset(), m_frameCommandsCount, sizeof(VkDrawIndexedIndirectCommand));
+	EndDebugMarker(cmdBuffer);
 }
 
-void Batch::PrepareRendering(const CGraphicPipeline& pipeline, SubpassIndex subpassIndex)
+void Batch::PrepareRendering(VkCommandBuffer cmdBuffer, const CGraphicPipeline& pipeline, SubpassIndex subpassIndex)
 {
-	if (!m_isReady)
+	if (!m_isReady || !HasFrameData())
 		return;
 	
-	VkCommandBuffer cmdBuffer = vk::g_vulkanContext.m_mainCommandBuffer;
 	const SubpassInfo& subpassInfo = m_subpasses[uint32_t(subpassIndex)];
 
 	if (subpassIndex == SubpassIndex::Solid)
@@ -566,18 +1130,23 @@ void Batch::PrepareRendering(const CGraphicPipeline& pipeline, SubpassIndex subp
 		vk::CmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.GetLayout(), 0, 1, &subpassInfo.DescriptorSets[0], 0, nullptr);
 
 	vk::CmdPushConstants(cmdBuffer, pipeline.GetLayout(), VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_GEOMETRY_BIT, 0, sizeof(BatchParams), &m_batchParams);
+
+	//the shadow geometry shader writes the triangles only in the layer of this split
+	if (IsShadowSubpass(subpassIndex))
+	{
+		uint32_t splitIndex = GetShadowSplit(subpassIndex);
+		vk::CmdPushConstants(cmdBuffer, pipeline.GetLayout(), VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_GEOMETRY_BIT, sizeof(BatchParams), sizeof(uint32_t), &splitIndex);
+	}
 }
 
 std::string Batch::GetSubpassDebugMarker(SubpassIndex subpass)
 {
-	switch (subpass)
-	{
-	case SubpassIndex::Solid:
+	if (subpass == SubpassIndex::Solid)
 		return "_solid";
-	case SubpassIndex::ShadowPass:
-		return "_shadow";
-	default:
-		TRAP(false);
-		return "_error";
-	}
+
+	if (IsShadowSubpass(subpass))
+		return "_shadow" + std::to_string(GetShadowSplit(subpass));
+
+	TRAP(false);
+	return "_error";
 }
@@ -5,6 +5,8 @@
 #include "DescriptorsUtils.h"
 #include "Singleton.h"
 
+#include <array>
+#include <unordered_map>
 #include <vector>
 
 class BufferHandle;
@@ -16,6 +18,16 @@ class Batch;
 class Material;
 class CTexture;
 
+enum class SubpassIndex
+{
+	ShadowPass, //the first shadow split. Every split has its own subpass, ShadowPass + split index
+	Solid = SHADOWSPLITS,
+	Count
+};
+
+typedef std::array<glm::vec4, CFrustum::PLCount> TCullPlanes; //xyz - normal, w - distance
+typedef std::array<TCullPlanes, uint32_t(SubpassIndex::Count)> TSubpassCullPlanes;
+
 class BatchManager : public Singleton<BatchManager>
 {
 public:
@@ -23,29 +35,66 @@ public:
 	virtual ~BatchManager();
 
 	void AddObject(Object* obj);
+	//for loading. The objects are sorted by material template and textures before they are packed in batches
+	void AddObjects(const std::vector<Object*>& objects);
+	//the object is not drawn from the next frame. Its batch keeps the slot for the next object
+	void RemoveObject(Object* obj);
+	//the data of the object is uploaded again at the start of the next frame. Does nothing for the objects not in a batch
+	void OnObjectMoved(Object* obj);
 
 	//we need a list of parameters here (we have to know the pipeline, how much uniform memory per batch, or do we use a fixed size. I dont know it seems not too optim)
 	Batch* CreateNewBatch(MaterialTemplateBase* materialTemplate);
 
+	void Initialize(CRenderer* renderer);
+
 	void Update();
 
+	//adds the draws of the solid pass to the CommandRecorder, sorted by their keys. A job per material template
 	void RenderAll();
-	void RenderShadows();
+	//the draws of a shadow split, recorded by a job of the shadow map renderer
+	void RenderShadows(VkCommandBuffer cmdBuffer, uint32_t split);
 	void PreRender();
+	//GPU frustum culling. Fills the indirect commands and the visible instances of every batch. Must be recorded outside a render pass.
+	//The batches with no object in the camera frustum are rejected before, with the tree of the scene
+	void Cull();
+
+	VkDescriptorSet AllocCullDescriptorSet();
+	//the sets can still be used by the frames in flight, they are freed FRAMES_IN_FLIGHT frames later
+	void RetireDescriptorSets(const std::vector<VkDescriptorSet>& materialSets, VkDescriptorSet cullSet);
 private:
+	struct SortedDraw
+	{
+		uint64_t	Key; //see MakeDrawSortKey
+		Batch*		DrawBatch;
+	};
+
+	void ComputeCullPlanes();
+	void CullBatchesOnCPU();
+	void ReleaseRetiredDescriptorSets();
+	//thread safe, the shadow splits are sorted by the jobs that record them.
+	//The depth of a batch is dot(depthPlane, center of its bounds), clamped to [nearDepth, farDepth]
+	void SortDraws(SubpassIndex subpassIndex, const glm::vec4& depthPlane, float nearDepth, float farDepth, std::vector<SortedDraw>& outDraws) const;
 private:
+	struct RetiredDescriptorSets
+	{
+		uint64_t						FrameNumber;
+		std::vector<VkDescriptorSet>	MaterialSets;
+		VkDescriptorSet					CullSet;
+	};
+
 	std::vector<Batch*>				m_batches;
-	std::vector<Batch*>				m_inProgressBatches;
+	std::unordered_map<Object*, Batch*>	m_objectsBatch;
 
 	typedef std::unordered_map<MaterialTemplateBase*, std::vector<Batch*>> TBatchMap;
 	TBatchMap						m_batchesCategories;
-};
-
-enum class SubpassIndex
-{
-	ShadowPass,
-	Solid,
-	Count
+	std::unordered_map<MaterialTemplateBase*, uint32_t>	m_templatesId; //in the order they got their first batch, the pipeline in the sort keys
+
+	CComputePipeline				m_cullPipeline;
+	DescriptorSetLayout				m_cullDescLayout;
+	std::vector<DescriptorPool*>	m_cullDescPools;
+	TSubpassCullPlanes				m_cullPlanes;
+	std::vector<RetiredDescriptorSets>	m_retiredDescriptorSets;
+	glm::mat4						m_projViewMatrix; //of the camera, computed once per frame by PreRender
 };
 
 class Batch
@@ -54,53 +103,74 @@ public:
 	Batch(MaterialTemplateBase* materialTemplate);
 	virtual ~Batch();
 
+	//the object is inserted at the start of a frame when its mesh is in the geometry pool. The other objects
+	//are drawn meanwhile and nothing is rebuilt, unless the buffers or the textures of the batch have to grow
 	void AddObject(Object* obj);
+	//the slot of the object is reused by the next added object
+	void RemoveObject(Object* obj);
+	void OnObjectMoved(Object* obj);
 	//TODO CanAddObject should return true if the batch has already an object with the same mesh as obj
 	bool CanAddObject(Object* obj);
 
-	void Construct();
 	void Destruct();
-	void Cleanup();
 
-	void PreRender();
-	void Render(SubpassIndex subpassIndex);
-	void PrepareRendering(const CGraphicPipeline& pipeline, SubpassIndex subpassIndex);
-
-	bool NeedReconstruct() const { return m_needReconstruct; }
-	bool NeedCleanup() const { return m_needCleanup; }
-
-	VkDeviceSize GetTotalBatchMemory() const { return m_totalBatchMemory; }
+	//applies the added and removed objects, before the data of the frame is written
+	void Update();
+	void PreRender(const glm::mat4& projViewMatrix);
+	//the indirect commands of the subpasses start from m_drawCommandsTable every frame. Recorded before Cull, between the
+	//barriers of BatchManager::Cull
+	void ResetIndirectCommands(VkCommandBuffer cmdBuffer);
+	void Cull(const CComputePipeline& pipeline, const TSubpassCullPlanes& cullPlanes);
+	//a subpass that is not visible is not culled or drawn this frame
+	void SetSubpassVisible(SubpassIndex subpassIndex, bool isVisible) { m_subpasses[uint32_t(subpassIndex)].IsVisible = isVisible; }
+	//can be called from the worker threads of the CommandRecorder
+	void Render(VkCommandBuffer cmdBuffer, SubpassIndex subpassIndex);
+	void PrepareRendering(VkCommandBuffer cmdBuffer, const CGraphicPipeline& pipeline, SubpassIndex subpassIndex);
+
+	MaterialTemplateBase* GetMaterialTemplate() const { return m_materialTemplate; }
+	//of all the objects in the slots, updated by PreRender
+	const BoundingBox3D& GetBounds() const { return m_bounds; }
 
 private:
-	struct MeshBufferInfo
-	{
-		uint32_t firstIndex;
-		uint32_t vertexOffset;
-		uint32_t indexCount;
-	};
-
 	struct SubpassInfo
 	{
 		uint8_t												VisibilityMask;
-		uint32_t											IndirectCommandsNumber;
-		BufferHandle*										CommonBuffer;
-		BufferHandle*										SpecificBuffer;
-		BufferHandle*										IndirectCommands;
+		bool												IsVisible; //some objects of the batch can be seen in the subpass
+		BufferHandle*										IndirectCommands; //device local, instanceCount is written by the cull shader
+		BufferHandle*										VisibleInstances; //object indexes, compacted per indirect command
 		std::vector<VkDescriptorSet>						DescriptorSets;
-		std::vector<Object*>								VisibleObjects;
+		VkDescriptorSet										CullDescriptorSet;
 	};
 
-	void BuildMeshBuffers();
-	void InitSubpasses();
+	void InsertObject(Object* obj);
+	//the data of the slot is written in the tables by the next PreRender
+	void MarkSlotDirty(uint32_t slot);
+	//returns the index of the first indirect command of the mesh (one per LOD), new commands if the mesh is not in the batch
+	uint32_t AddMeshReference(Mesh* mesh);
+	void UpdateInstanceRanges();
+
+	//returns false if there is no memory for the buffers, the batch has none then
+	bool InitSubpasses();
+	void ReleaseSubpasses();
 	void UpdateGraphicsInterface();
-	void IndexTextures();
+	//returns true if a texture was added to m_batchTextures
+	bool IndexTextures(Object* obj);
 
-	void UpdateIndirectCmdBuffer(SubpassInfo& subpass);
-	bool UpdateVisibleObjects(SubpassInfo& subpass);
+	void UpdateBounds();
+	//PreRender reset the indirect commands of this frame
+	bool HasFrameData() const;
+	//the ScatterUploader split an upload of the tables over frames, they have old or not written entries
+	bool HasPendingUploads() const;
 
 	std::string GetSubpassDebugMarker(SubpassIndex subpassIndex);
 private:
-	typedef std::unordered_map<Mesh*, MeshBufferInfo> TMeshMap;
+	struct MeshInfo
+	{
+		uint32_t	CommandIndex; //of LOD 0, the other LODs follow
+		uint32_t	LodCount;
+		uint32_t	ObjectsCount; //the size of the range of visible instances of every LOD command
+	};
+	typedef std::unordered_map<Mesh*, MeshInfo> TMeshMap;
 
 	struct BatchParams
 	{
@@ -109,32 +179,56 @@ private:
 		glm::vec4 ViewPos;
 	} m_batchParams;
 
-	BufferHandle*			m_batchBuffer;
-	BufferHandle*			m_staggingBuffer;
-	BufferHandle*			m_batchVertexBuffer;
-	BufferHandle*			m_batchIndexBuffer;
-	
 	//global handles for the memory
-	BufferHandle*			m_batchStorageBuffer;
 	BufferHandle*			m_indirectCommandBuffer;
+	BufferHandle*			m_visibleInstancesBuffer;
+	//m_drawCommands on the gpu (instanceCount 0), written by the ScatterUploader only when the commands change
+	BufferHandle*			m_drawCommandsTable;
+
+	//the data of all the objects, shared by the subpasses. Indexed with the object slot. Device local and kept between the
+	//frames, only the slots marked dirty are written (see ScatterUploader). The material data is in the table of the template
+	BufferHandle*			m_commonsTable;
+	BufferHandle*			m_cullTable;
+	BufferHandle*			m_lodsTable; //the LOD drawn last frame, written by the cull shader
+	std::vector<uint32_t>	m_dirtySlots;
+	std::vector<bool>		m_isSlotDirty; //indexed with the object slot
+	uint64_t				m_frameNumber; //of the last PreRender
+	uint32_t				m_frameCommandsCount; //the commands reset and culled this frame
+	BoundingBox3D			m_bounds;
 
 	MaterialTemplateBase*	m_materialTemplate;
 
-	std::vector<Object*>	m_objects;
-	VkDeviceSize			m_totalBatchMemory;
+	std::vector<Object*>	m_objects; //indexed with the object slot, nullptr for the free slots
+	std::vector<uint32_t>	m_freeSlots;
+	std::unordered_map<Object*, uint32_t>	m_objectsSlot;
+	std::vector<Object*>	m_pendingObjects; //added, waiting for their meshes to be in the geometry pool
+
+	//the buffers and the descriptors are sized for these. They grow by doubling, so adding objects rarely rebuilds them
+	uint32_t				m_objectsCapacity;
+	uint32_t				m_commandsCapacity;
+	uint32_t				m_instancesCapacity;
+	uint32_t				m_instancesCount; //the sum of the instance ranges of the commands
 
-	bool					m_needReconstruct;
-	bool					m_needCleanup;
+	bool					m_needInstanceRanges;
+	bool					m_needNewDescriptors;
+	bool					m_needCommandsUpload;
 	bool					m_isReady;
 
 	//need a buffer for uniforms. Also need to pack descriptors??
 	std::vector<CTexture*>						m_batchTextures;
+	std::unordered_map<CTexture*, uint32_t>		m_texturesIndex; //texture -> index in m_batchTextures
 	std::array<SubpassInfo, uint32_t(SubpassIndex::Count)> m_subpasses;
 
 	TMeshMap									m_batchMeshes;
+	//one command per LOD of every mesh. firstInstance is the start of the range of the command in the visible instances,
+	//every LOD can have all the objects of the mesh. The commands of the removed meshes draw nothing until they are
+	//reused by a mesh with the same LOD count
+	std::vector<VkDrawIndexedIndirectCommand>	m_drawCommands;
+	std::vector<MeshInfo>						m_freeCommands;
+	std::vector<uint32_t>						m_objectsCommandIndex; //indexed with the object slot
 
-	static uint32_t								ms_memoryLimit;
 	static uint32_t								ms_texturesLimit;
+	static uint32_t								ms_objectsLimit;
 
 	std::string									m_debugMarkerName;
 
@@ -0,0 +1,269 @@
+#include "Benchmark.h"
+
+#include "Camera.h"
+#include "QueryManager.h"
+#include "defines.h"
+#include "glm/gtc/constants.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//BenchmarkSettings
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+BenchmarkSettings::BenchmarkSettings()
+	: OutputFile("benchmark.csv")
+	, Frames(600)
+	, WarmupFrames(60)
+{
+}
+
+bool BenchmarkSettings::Parse(int argc, char* argv[])
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		const char* arg = argv[i];
+		const char* value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+		if (!value)
+			break;
+
+		if (strcmp(arg, "-benchmark") == 0)
+			SceneFile = value;
+		else if (strcmp(arg, "-frames") == 0)
+			Frames = (uint32_t)strtoul(value, nullptr, 10);
+		else if (strcmp(arg, "-warmup") == 0)
+			WarmupFrames = (uint32_t)strtoul(value, nullptr, 10);
+		else if (strcmp(arg, "-camera") == 0)
+			CameraFile = value;
+		else if (strcmp(arg, "-out") == 0)
+			OutputFile = value;
+		else
+			continue;
+
+		++i;
+	}
+
+	return !SceneFile.empty() && Frames > 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//Benchmark
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+Benchmark::Benchmark(const BenchmarkSettings& settings)
+	: m_settings(settings)
+	, m_currentFrame(0)
+	, m_nextGpuFrame(0)
+{
+	m_timings.reserve(m_settings.Frames + m_settings.WarmupFrames);
+
+	if (!m_settings.CameraFile.empty())
+		TRAP(LoadCameraPath());
+}
+
+Benchmark::~Benchmark()
+{
+}
+
+void Benchmark::BeginFrame()
+{
+	m_frameStart = std::chrono::high_resolution_clock::now();
+}
+
+void Benchmark::PlaceCamera(CCamera& camera, const glm::vec3& sceneMin, const glm::vec3& sceneMax)
+{
+	//the scene bounding box is known only after the first update
+	if (m_cameraPath.empty())
+		CreateOrbit(sceneMin, sceneMax);
+
+	CameraKey key = GetCameraKey(m_currentFrame);
+	camera.LookAt(key.Position, key.Target);
+}
+
+void Benchmark::EndFrame()
+{
+	std::chrono::duration<double, std::milli> cpuTime = std::chrono::high_resolution_clock::now() - m_frameStart;
+
+	FrameTiming timing;
+	timing.CpuMs = cpuTime.count();
+	timing.GpuMs = -1.0;
+	m_timings.push_back(timing);
+	++m_currentFrame;
+
+	CollectGpuTimings();
+}
+
+bool Benchmark::WriteResults()
+{
+	QueryManager::GetInstance().FlushTimestamps();
+	CollectGpuTimings();
+
+	std::ofstream file(m_settings.OutputFile, std::ios_base::out | std::ios_base::trunc);
+	if (!file.is_open())
+		return false;
+
+	std::vector<double> cpuTimes;
+	std::vector<double> gpuTimes;
+	for (uint32_t i = m_settings.WarmupFrames; i < m_timings.size(); ++i)
+	{
+		cpuTimes.push_back(m_timings[i].CpuMs);
+		if (m_timings[i].GpuMs >= 0.0)
+			gpuTimes.push_back(m_timings[i].GpuMs);
+	}
+
+	//summary first, the frames are for plotting. Times in milliseconds, warmup frames are not in the summary
+	file << std::fixed << std::setprecision(4);
+	file << "# scene," << m_settings.SceneFile << "\n";
+	file << "# frames," << cpuTimes.size() << ",warmup," << m_settings.WarmupFrames << "\n";
+	file << "stat,cpu_ms,gpu_ms\n";
+
+	Summary cpu = Summarize(cpuTimes);
+	Summary gpu = Summarize(gpuTimes);
+	file << "avg," << cpu.Average << "," << gpu.Average << "\n";
+	file << "min," << cpu.Min << "," << gpu.Min << "\n";
+	file << "p50," << cpu.P50 << "," << gpu.P50 << "\n";
+	file << "p90," << cpu.P90 << "," << gpu.P90 << "\n";
+	file << "p95," << cpu.P95 << "," << gpu.P95 << "\n";
+	file << "p99," << cpu.P99 << "," << gpu.P99 << "\n";
+	file << "max," << cpu.Max << "," << gpu.Max << "\n";
+
+	file << "\npass,avg_gpu_ms\n";
+	for (unsigned int i = 0; i < m_passNames.size(); ++i)
+		file << m_passNames[i] << "," << m_passTotals[i] / m_passCounts[i] << "\n";
+
+	file << "\nframe,cpu_ms,gpu_ms\n";
+	for (unsigned int i = 0; i < m_timings.size(); ++i)
+		file << i << "," << m_timings[i].CpuMs << "," << m_timings[i].GpuMs << "\n";
+
+	return file.good();
+}
+
+//one key per line: position x y z, target x y z. The keys are spread evenly over the run
+bool Benchmark::LoadCameraPath()
+{
+	std::ifstream file(m_settings.CameraFile);
+	if (!file.is_open())
+		return false;
+
+	std::string line;
+	while (std::getline(file, line))
+	{
+		std::istringstream stream(line);
+		CameraKey key;
+		if (stream >> key.Position.x >> key.Position.y >> key.Position.z >> key.Target.x >> key.Target.y >> key.Target.z)
+			m_cameraPath.push_back(key);
+	}
+
+	return !m_cameraPath.empty();
+}
+
+void Benchmark::CreateOrbit(const glm::vec3& sceneMin, const glm::vec3& sceneMax)
+{
+	const unsigned int keysCount = 64;
+
+	glm::vec3 center = (sceneMin + sceneMax) * 0.5f;
+	glm::vec3 extent = (sceneMax - sceneMin) * 0.5f;
+	float radius = glm::max(glm::length(glm::vec2(extent.x, extent.z)), 1.0f);
+	float height = center.y + glm::max(extent.y, radius * 0.25f);
+
+	for (unsigned int i = 0; i <= keysCount; ++i)
+	{
+		float angle = 2.0f * glm::pi<float>() * (float)i / (float)keysCount;
+
+		CameraKey key;
+		key.Position = glm::vec3(center.x + cos(angle) * radius, height, center.z + sin(angle) * radius);
+		key.Target = center;
+		m_cameraPath.push_back(key);
+	}
+}
+
+Benchmark::CameraKey Benchmark::GetCameraKey(uint32_t frame) const
+{
+	if (m_cameraPath.size() == 1)
+		return m_cameraPath[0];
+
+	uint32_t framesCount = m_settings.Frames + m_settings.WarmupFrames;
+	float t = (framesCount > 1) ? (float)frame / (float)(framesCount - 1) : 0.0f;
+	t *= (float)(m_cameraPath.size() - 1);
+
+	unsigned int index = glm::min((unsigned int)t, (unsigned int)m_cameraPath.size() - 2);
+	float blend = t - (float)index;
+
+	CameraKey key;
+	key.Position = glm::mix(m_cameraPath[index].Position, m_cameraPath[index + 1].Position, blend);
+	key.Target = glm::mix(m_cameraPath[index].Target, m_cameraPath[index + 1].Target, blend);
+	return key;
+}
+
+//a frame is resolved by the QueryManager TIMESTAMP_FRAMES frames after it was recorded
+void Benchmark::CollectGpuTimings()
+{
+	const auto& frames = QueryManager::GetInstance().GetResolvedFrames();
+	for (const auto& frame : frames)
+	{
+		if (frame.FrameNumber < m_nextGpuFrame)
+			continue;
+
+		m_nextGpuFrame = frame.FrameNumber + 1;
+		if (frame.FrameNumber >= m_timings.size())
+			continue;
+
+		bool warmup = frame.FrameNumber < m_settings.WarmupFrames;
+		for (const auto& result : frame.Results)
+		{
+			if (result.Depth == 0 && result.Name == "Frame")
+				m_timings[(size_t)frame.FrameNumber].GpuMs = result.DurationMs;
+
+			if (result.Depth != 1 || warmup)
+				continue;
+
+			auto it = std::find(m_passNames.begin(), m_passNames.end(), result.Name);
+			size_t index = it - m_passNames.begin();
+			if (it == m_passNames.end())
+			{
+				m_passNames.push_back(result.Name);
+				m_passTotals.push_back(0.0);
+				m_passCounts.push_back(0);
+			}
+
+			m_passTotals[index] += result.DurationMs;
+			++m_passCounts[index];
+		}
+	}
+}
+
+//nearest rank percentiles
+Benchmark::Summary Benchmark::Summarize(std::vector<double> values)
+{
+	Summary summary;
+	cleanStructure(summary);
+	if (values.empty())
+		return summary;
+
+	std::sort(values.begin(), values.end());
+
+	auto percentile = [&values](double p)
+	{
+		size_t rank = (size_t)ceil(p / 100.0 * (double)values.size());
+		return values[(rank > 0) ? rank - 1 : 0];
+	};
+
+	double total = 0.0;
+	for (double value : values)
+		total += value;
+
+	summary.Average = total / (double)values.size();
+	summary.Min = values.front();
+	summary.P50 = percentile(50.0);
+	summary.P90 = percentile(90.0);
+	summary.P95 = percentile(95.0);
+	summary.P99 = percentile(99.0);
+	summary.Max = values.back();
+	return summary;
+}
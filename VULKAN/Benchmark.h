@@ -0,0 +1,84 @@
+#pragma once
+
+#include "glm/glm.hpp"
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+class CCamera;
+
+struct BenchmarkSettings
+{
+	std::string		SceneFile;
+	std::string		OutputFile;
+	std::string		CameraFile; //empty for an orbit around the scene
+	uint32_t		Frames;
+	uint32_t		WarmupFrames; //rendered but not part of the summary
+
+	BenchmarkSettings();
+	//-benchmark scene.xml [-frames N] [-warmup N] [-camera path.txt] [-out results.csv]. Returns false if there is no -benchmark
+	bool Parse(int argc, char* argv[]);
+};
+
+//Drives the headless mode. Every frame the camera is placed on the scripted path with a fixed time step,
+//so two runs on the same machine render exactly the same frames. Timings are written when the run ends
+class Benchmark
+{
+public:
+	Benchmark(const BenchmarkSettings& settings);
+	virtual ~Benchmark();
+
+	const BenchmarkSettings& GetSettings() const { return m_settings; }
+	float GetFrameTime() const { return 1.0f / 60.0f; }
+	bool IsFinished() const { return m_currentFrame >= m_settings.Frames + m_settings.WarmupFrames; }
+
+	//the cpu time of a frame is measured from BeginFrame to EndFrame
+	void BeginFrame();
+	void PlaceCamera(CCamera& camera, const glm::vec3& sceneMin, const glm::vec3& sceneMax);
+	void EndFrame();
+	//the gpu must be idle
+	bool WriteResults();
+private:
+	struct CameraKey
+	{
+		glm::vec3	Position;
+		glm::vec3	Target;
+	};
+
+	struct FrameTiming
+	{
+		double		CpuMs;
+		double		GpuMs; //negative if the gpu has no timestamps
+	};
+
+	struct Summary
+	{
+		double		Average;
+		double		Min;
+		double		P50;
+		double		P90;
+		double		P95;
+		double		P99;
+		double		Max;
+	};
+
+	bool LoadCameraPath();
+	void CreateOrbit(const glm::vec3& sceneMin, const glm::vec3& sceneMax);
+	CameraKey GetCameraKey(uint32_t frame) const;
+	void CollectGpuTimings();
+
+	static Summary Summarize(std::vector<double> values);
+private:
+	BenchmarkSettings									m_settings;
+	std::vector<CameraKey>								m_cameraPath;
+	std::vector<FrameTiming>							m_timings;
+	uint32_t											m_currentFrame;
+	uint64_t											m_nextGpuFrame; //first frame number not collected from the QueryManager
+
+	std::vector<std::string>							m_passNames;
+	std::vector<double>									m_passTotals;
+	std::vector<uint32_t>								m_passCounts;
+
+	std::chrono::high_resolution_clock::time_point		m_frameStart;
+};
@@ -60,6 +60,22 @@ void CCamera::Reset()
     m_dirty = true;
 }
 
+void CCamera::LookAt(const glm::vec3& position, const glm::vec3& target)
+{
+    glm::vec3 dir = target - position;
+    float length = glm::length(dir);
+    if (length < 0.0001f)
+        return;
+
+    //inverse of UpdateViewMatrix: yaw rotates -z around y, pitch lifts it around the right vector
+    dir /= length;
+    m_position = position;
+    m_angles[AnglesType_Roll] = 0.0f;
+    m_angles[AnglesType_Yaw] = atan2(-dir.x, -dir.z);
+    m_angles[AnglesType_Pitch] = asin(glm::clamp(dir.y, -1.0f, 1.0f));
+    m_dirty = true;
+}
+
 void CCamera::UpdateViewMatrix()
 {
     glm::vec3 j = glm::vec3(.0f, 1.0f, 0.0f);
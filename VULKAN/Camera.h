@@ -40,6 +40,8 @@ public:
     void Rotate(float x, float y);
     void Translate(glm::vec3 translateUnits);
     void Reset();
+    //places the camera without roll. Used by scripted cameras
+    void LookAt(const glm::vec3& position, const glm::vec3& target);
 
 	bool OnCameraKeyPressed(const KeyInput& key);
 private:
@@ -0,0 +1,225 @@
+#include "CommandRecorder.h"
+
+#include "QueryManager.h"
+
+#include "glm/glm.hpp"
+
+CommandRecorder::CommandRecorder()
+	: m_frameIndex(0)
+	, m_nextJob(0)
+	, m_finishedJobs(0)
+	, m_quit(false)
+	, m_isRecordingSubpass(false)
+{
+	cleanStructure(m_inheritance);
+}
+
+CommandRecorder::~CommandRecorder()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_quit = true;
+	}
+	m_jobsAdded.notify_all();
+
+	for (auto& worker : m_workers)
+		worker.join();
+
+	for (auto& context : m_workerContexts)
+		DestroyThreadContext(context);
+	DestroyThreadContext(m_mainContext);
+}
+
+void CommandRecorder::Init(uint32_t threadsCount)
+{
+	if (threadsCount == 0)
+		threadsCount = glm::max(std::thread::hardware_concurrency(), 2u) - 1;
+
+	CreateThreadContext(m_mainContext);
+
+	//the contexts are created before the threads start, the vector is never resized after
+	m_workerContexts.resize(threadsCount);
+	for (auto& context : m_workerContexts)
+		CreateThreadContext(context);
+
+	for (uint32_t i = 0; i < threadsCount; ++i)
+		m_workers.push_back(std::thread(&CommandRecorder::WorkerLoop, this, i));
+}
+
+void CommandRecorder::BeginFrame(uint32_t frameIndex)
+{
+	TRAP(!m_isRecordingSubpass);
+	m_frameIndex = frameIndex;
+
+	//the workers are idle between the subpasses
+	auto resetContext = [frameIndex](ThreadContext& context)
+	{
+		VULKAN_ASSERT(vk::ResetCommandPool(vk::g_vulkanContext.m_device, context.m_pools[frameIndex], 0));
+		context.m_usedCmdBuffers = 0;
+	};
+
+	for (auto& context : m_workerContexts)
+		resetContext(context);
+	resetContext(m_mainContext);
+}
+
+void CommandRecorder::BeginSubpass(VkRenderPass renderPass, uint32_t subpass, VkFramebuffer framebuffer)
+{
+	TRAP(!m_isRecordingSubpass);
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	m_inheritance.renderPass = renderPass;
+	m_inheritance.subpass = subpass;
+	m_inheritance.framebuffer = framebuffer;
+	m_inheritance.pipelineStatistics = QueryManager::GetInstance().GetStatisticsFlags(); //the frame statistics query is active
+	m_jobs.clear();
+	m_nextJob = 0;
+	m_finishedJobs = 0;
+	m_isRecordingSubpass = true;
+}
+
+void CommandRecorder::AddJob(const RecordFunction& record)
+{
+	TRAP(m_isRecordingSubpass);
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		Job job;
+		job.m_record = record;
+		job.m_cmdBuffer = VK_NULL_HANDLE;
+		m_jobs.push_back(job);
+	}
+	m_jobsAdded.notify_one();
+}
+
+void CommandRecorder::RecordOnMainThread(const std::function<void()>& record)
+{
+	TRAP(m_isRecordingSubpass);
+
+	VkCommandBuffer primary = vk::g_vulkanContext.m_mainCommandBuffer;
+	VkCommandBuffer cmdBuffer = BeginCommandBuffer(m_mainContext, m_inheritance);
+
+	vk::g_vulkanContext.m_mainCommandBuffer = cmdBuffer;
+	record();
+	vk::g_vulkanContext.m_mainCommandBuffer = primary;
+
+	VULKAN_ASSERT(vk::EndCommandBuffer(cmdBuffer));
+
+	//already recorded, the workers skip it
+	std::lock_guard<std::mutex> lock(m_mutex);
+	Job job;
+	job.m_cmdBuffer = cmdBuffer;
+	m_jobs.push_back(job);
+	++m_finishedJobs;
+}
+
+void CommandRecorder::ExecuteSubpass()
+{
+	TRAP(m_isRecordingSubpass);
+
+	std::vector<VkCommandBuffer> cmdBuffers;
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_jobFinished.wait(lock, [this]() { return m_finishedJobs == m_jobs.size(); });
+
+		cmdBuffers.reserve(m_jobs.size());
+		for (const auto& job : m_jobs)
+			cmdBuffers.push_back(job.m_cmdBuffer);
+
+		m_jobs.clear();
+		m_nextJob = 0;
+		m_finishedJobs = 0;
+	}
+
+	if (!cmdBuffers.empty())
+		vk::CmdExecuteCommands(vk::g_vulkanContext.m_mainCommandBuffer, (uint32_t)cmdBuffers.size(), cmdBuffers.data());
+
+	m_isRecordingSubpass = false;
+}
+
+void CommandRecorder::WorkerLoop(uint32_t threadIndex)
+{
+	ThreadContext& context = m_workerContexts[threadIndex];
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while (true)
+	{
+		m_jobsAdded.wait(lock, [this]()
+		{
+			while (m_nextJob < m_jobs.size() && !m_jobs[m_nextJob].m_record)
+				++m_nextJob;
+			return m_quit || m_nextJob < m_jobs.size();
+		});
+
+		if (m_quit)
+			return;
+
+		uint32_t jobIndex = m_nextJob++;
+		RecordFunction record = m_jobs[jobIndex].m_record;
+		VkCommandBufferInheritanceInfo inheritance = m_inheritance;
+		lock.unlock();
+
+		VkCommandBuffer cmdBuffer = BeginCommandBuffer(context, inheritance);
+		record(cmdBuffer);
+		VULKAN_ASSERT(vk::EndCommandBuffer(cmdBuffer));
+
+		lock.lock();
+		m_jobs[jobIndex].m_cmdBuffer = cmdBuffer;
+		++m_finishedJobs;
+		m_jobFinished.notify_one();
+	}
+}
+
+void CommandRecorder::CreateThreadContext(ThreadContext& context)
+{
+	VkCommandPoolCreateInfo poolCrtInfo;
+	cleanStructure(poolCrtInfo);
+	poolCrtInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolCrtInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT; //reset as a whole every frame
+	poolCrtInfo.queueFamilyIndex = vk::g_vulkanContext.m_queueFamilyIndex;
+
+	for (auto& pool : context.m_pools)
+		VULKAN_ASSERT(vk::CreateCommandPool(vk::g_vulkanContext.m_device, &poolCrtInfo, nullptr, &pool));
+
+	context.m_usedCmdBuffers = 0;
+}
+
+void CommandRecorder::DestroyThreadContext(ThreadContext& context)
+{
+	//destroying the pool frees its command buffers
+	for (auto& pool : context.m_pools)
+	{
+		if (pool != VK_NULL_HANDLE)
+			vk::DestroyCommandPool(vk::g_vulkanContext.m_device, pool, nullptr);
+		pool = VK_NULL_HANDLE;
+	}
+}
+
+VkCommandBuffer CommandRecorder::BeginCommandBuffer(ThreadContext& context, const VkCommandBufferInheritanceInfo& inheritance)
+{
+	std::vector<VkCommandBuffer>& cmdBuffers = context.m_cmdBuffers[m_frameIndex];
+	if (context.m_usedCmdBuffers == cmdBuffers.size())
+	{
+		VkCommandBufferAllocateInfo allocInfo;
+		cleanStructure(allocInfo);
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.commandPool = context.m_pools[m_frameIndex];
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+		allocInfo.commandBufferCount = 1;
+
+		VkCommandBuffer newCmdBuffer;
+		VULKAN_ASSERT(vk::AllocateCommandBuffers(vk::g_vulkanContext.m_device, &allocInfo, &newCmdBuffer));
+		cmdBuffers.push_back(newCmdBuffer);
+	}
+
+	VkCommandBuffer cmdBuffer = cmdBuffers[context.m_usedCmdBuffers++];
+
+	VkCommandBufferBeginInfo beginInfo;
+	cleanStructure(beginInfo);
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	beginInfo.pInheritanceInfo = &inheritance;
+
+	VULKAN_ASSERT(vk::BeginCommandBuffer(cmdBuffer, &beginInfo));
+	return cmdBuffer;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "VulkanLoader.h"
+#include "Singleton.h"
+#include "defines.h"
+
+#include <array>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//Records the draws of a subpass in secondary command buffers, on worker threads. Every thread has its own command pool
+//per frame in flight, reset when the frame slot is reused, so the threads never share a pool.
+//The main thread waits for the jobs of the subpass and executes their buffers in the order the jobs were added
+class CommandRecorder : public Singleton<CommandRecorder>
+{
+	friend class Singleton<CommandRecorder>;
+public:
+	//records in the given secondary command buffer. Runs on a worker, so it must not use vk::g_vulkanContext.m_mainCommandBuffer
+	typedef std::function<void(VkCommandBuffer)> RecordFunction;
+
+	//0 threads means one less than the cores
+	void Init(uint32_t threadsCount = 0);
+	//the frame that used this slot is finished
+	void BeginFrame(uint32_t frameIndex);
+
+	//the render pass was started with VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS
+	void BeginSubpass(VkRenderPass renderPass, uint32_t subpass, VkFramebuffer framebuffer);
+	void AddJob(const RecordFunction& record);
+	//for the code that records in vk::g_vulkanContext.m_mainCommandBuffer. Recorded now, on the main thread,
+	//while m_mainCommandBuffer points to a secondary command buffer
+	void RecordOnMainThread(const std::function<void()>& record);
+	//waits for the jobs and executes them in the primary command buffer
+	void ExecuteSubpass();
+
+	bool IsRecordingSubpass() const { return m_isRecordingSubpass; }
+	uint32_t GetThreadsCount() const { return (uint32_t)m_workers.size(); }
+private:
+	CommandRecorder();
+	virtual ~CommandRecorder();
+
+	struct Job
+	{
+		RecordFunction		m_record;
+		VkCommandBuffer		m_cmdBuffer; //VK_NULL_HANDLE until it is recorded
+	};
+
+	//one per worker thread and one for the main thread
+	struct ThreadContext
+	{
+		std::array<VkCommandPool, FRAMES_IN_FLIGHT>					m_pools;
+		std::array<std::vector<VkCommandBuffer>, FRAMES_IN_FLIGHT>	m_cmdBuffers; //allocated on demand, reused every frame
+		uint32_t													m_usedCmdBuffers;
+
+		ThreadContext() : m_usedCmdBuffers(0) { m_pools.fill(VK_NULL_HANDLE); }
+	};
+
+	void WorkerLoop(uint32_t threadIndex);
+	void CreateThreadContext(ThreadContext& context);
+	void DestroyThreadContext(ThreadContext& context);
+	//begins the next free secondary command buffer of the thread
+	VkCommandBuffer BeginCommandBuffer(ThreadContext& context, const VkCommandBufferInheritanceInfo& inheritance);
+private:
+	std::vector<std::thread>			m_workers;
+	std::vector<ThreadContext>			m_workerContexts;
+	ThreadContext						m_mainContext;
+	uint32_t							m_frameIndex;
+
+	std::mutex							m_mutex;
+	std::condition_variable				m_jobsAdded;
+	std::condition_variable				m_jobFinished;
+	std::vector<Job>					m_jobs; //of the current subpass, in execution order
+	uint32_t							m_nextJob; //the first job not taken by a worker
+	uint32_t							m_finishedJobs;
+	bool								m_quit;
+
+	VkCommandBufferInheritanceInfo		m_inheritance;
+	bool								m_isRecordingSubpass;
+};
@@ -23,6 +23,20 @@ void EndDebugMarker(const std::string& markerName)
     m_markersStack.pop_back();
 }
 
+void StartDebugMarker(VkCommandBuffer cmdBuffer, const std::string& markerName)
+{
+    VkDebugMarkerMarkerInfoEXT marker;
+    cleanStructure(marker);
+    marker.sType = VK_STRUCTURE_TYPE_DEBUG_MARKER_MARKER_INFO_EXT;
+    marker.pMarkerName = markerName.data();
+    vk::CmdDebugMarkerBeginEXT(cmdBuffer, &marker);
+}
+
+void EndDebugMarker(VkCommandBuffer cmdBuffer)
+{
+    vk::CmdDebugMarkerEndEXT(cmdBuffer);
+}
+
 template<>
 VkDebugReportObjectTypeEXT GetDebugObjectType<VkImage>()
 {
@@ -6,6 +6,9 @@
 
 void StartDebugMarker(const std::string& markerName);
 void EndDebugMarker(const std::string& markerName);
+//for the secondary command buffers recorded on the worker threads. Not checked with the markers stack
+void StartDebugMarker(VkCommandBuffer cmdBuffer, const std::string& markerName);
+void EndDebugMarker(VkCommandBuffer cmdBuffer);
 
 #define BeginMarkerSection(label) { \
     const std::string markerName = label; \
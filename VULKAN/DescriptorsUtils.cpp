@@ -3,6 +3,8 @@
 #include "defines.h"
 #include "Utils.h"
 
+#include <algorithm>
+
 void NewDescriptorPool(const std::vector<VkDescriptorPoolSize>& poolSize, uint32_t maxSets, VkDescriptorPool* descPool)
 {
 	VkDescriptorPoolCreateInfo descPoolCi;
@@ -32,10 +34,11 @@ DescriptorSetLayout::~DescriptorSetLayout()
 	vk::DestroyDescriptorSetLayout(vk::g_vulkanContext.m_device, m_descSetLayoutHandle, nullptr);
 }
 
-void DescriptorSetLayout::AddBinding(unsigned int binding, VkDescriptorType type, VkShaderStageFlags flags, unsigned int count)
+void DescriptorSetLayout::AddBinding(unsigned int binding, VkDescriptorType type, VkShaderStageFlags flags, unsigned int count, VkDescriptorBindingFlagsEXT bindingFlags)
 {
 	TRAP(m_descSetLayoutHandle == VK_NULL_HANDLE && "Warning!! Layout is already created, this change will have no effect!");
 	m_bindings.push_back(CreateDescriptorBinding(binding, type, flags, count));
+	m_bindingFlags.push_back(bindingFlags);
 }
 
 void DescriptorSetLayout::Construct()
@@ -44,7 +47,27 @@ void DescriptorSetLayout::Construct()
 	if (m_descSetLayoutHandle != VK_NULL_HANDLE)
 		return;
 
-	NewDescriptorSetLayout(m_bindings, &m_descSetLayoutHandle);
+	bool hasBindingFlags = std::any_of(m_bindingFlags.begin(), m_bindingFlags.end(), [](VkDescriptorBindingFlagsEXT flags) { return flags != 0; });
+	if (!hasBindingFlags)
+	{
+		NewDescriptorSetLayout(m_bindings, &m_descSetLayoutHandle);
+		return;
+	}
+
+	VkDescriptorSetLayoutBindingFlagsCreateInfoEXT flagsCrtInfo;
+	cleanStructure(flagsCrtInfo);
+	flagsCrtInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+	flagsCrtInfo.bindingCount = (uint32_t)m_bindingFlags.size();
+	flagsCrtInfo.pBindingFlags = m_bindingFlags.data();
+
+	VkDescriptorSetLayoutCreateInfo crtInfo;
+	cleanStructure(crtInfo);
+	crtInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	crtInfo.pNext = &flagsCrtInfo;
+	crtInfo.bindingCount = (uint32_t)m_bindings.size();
+	crtInfo.pBindings = m_bindings.data();
+
+	VULKAN_ASSERT(vk::CreateDescriptorSetLayout(vk::g_vulkanContext.m_device, &crtInfo, nullptr, &m_descSetLayoutHandle));
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////
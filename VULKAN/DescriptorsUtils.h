@@ -17,8 +17,8 @@ public:
 
 	const std::vector<VkDescriptorSetLayoutBinding>& GetBindings() const { return m_bindings; }
 
-	//Construct
-	void AddBinding(unsigned int binding, VkDescriptorType type, VkShaderStageFlags flags, unsigned int count = 1);
+	//Construct. bindingFlags are from VK_EXT_descriptor_indexing, check that the device supports them
+	void AddBinding(unsigned int binding, VkDescriptorType type, VkShaderStageFlags flags, unsigned int count = 1, VkDescriptorBindingFlagsEXT bindingFlags = 0);
 	void Construct();
 
 	bool IsValid() const { return m_descSetLayoutHandle != VK_NULL_HANDLE; }
@@ -27,6 +27,7 @@ private:
 	DescriptorSetLayout& operator=(const DescriptorSetLayout&) = delete;
 
 	std::vector<VkDescriptorSetLayoutBinding>	m_bindings;
+	std::vector<VkDescriptorBindingFlagsEXT>	m_bindingFlags;
 	VkDescriptorSetLayout						m_descSetLayoutHandle;
 };
 
@@ -14,11 +14,11 @@ struct SFogParams
 
 CFogRenderer::CFogRenderer(VkRenderPass renderpass)
     : CRenderer(renderpass, "FogRenderPass")
-    , m_descriptorSet(VK_NULL_HANDLE)
     , m_descriptorLayout(VK_NULL_HANDLE)
+    , m_descriptorSet(VK_NULL_HANDLE)
     , m_sampler(VK_NULL_HANDLE)
+    , m_fogParamsOffset(FrameAllocator::InvalidOffset)
     , m_quad(nullptr)
-    , m_fogParamsBuffer(nullptr)
 {
 }
 
@@ -26,8 +26,6 @@ CFogRenderer::~CFogRenderer()
 {
     VkDevice dev = vk::g_vulkanContext.m_device;
 
-	MemoryManager::GetInstance()->FreeHandle(m_fogParamsBuffer);
-
     vk::DestroyDescriptorSetLayout(dev, m_descriptorLayout, nullptr);
     vk::DestroySampler(dev, m_sampler, nullptr);
 }
@@ -37,7 +35,6 @@ void CFogRenderer::Init()
     CRenderer::Init();
 
     AllocDescriptorSets(m_descriptorPool, m_descriptorLayout, &m_descriptorSet);
-	m_fogParamsBuffer = MemoryManager::GetInstance()->CreateBuffer(EMemoryContextType::UniformBuffers, sizeof(SFogParams), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
 
     m_pipline.SetVertexInputState(Mesh::GetVertexDesc());
     m_pipline.SetDepthTest(false);
@@ -63,8 +60,15 @@ void CFogRenderer::Init()
 
 void CFogRenderer::PreRender()
 {
-	VkDevice dev = vk::g_vulkanContext.m_device;
-	SFogParams* params = m_fogParamsBuffer->GetPtr<SFogParams*>();
+	FrameAllocator::Allocation paramsAlloc;
+	if (!MemoryManager::GetInstance()->GetFrameAllocator()->Allocate(sizeof(SFogParams), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, paramsAlloc))
+	{
+		m_fogParamsOffset = FrameAllocator::InvalidOffset;
+		return;
+	}
+	m_fogParamsOffset = paramsAlloc.m_offset;
+
+	SFogParams* params = (SFogParams*)paramsAlloc.m_ptr;
 	params->ViewMatrix = ms_camera.GetViewMatrix();
 }
 
@@ -72,12 +76,15 @@ void CFogRenderer::Render()
 {
     
     StartRenderPass();
-    VkCommandBuffer cmdBuff = vk::g_vulkanContext.m_mainCommandBuffer;
-    vk::CmdBindPipeline(cmdBuff, m_pipline.GetBindPoint(), m_pipline.Get());
-    vk::CmdBindDescriptorSets(cmdBuff, m_pipline.GetBindPoint(), m_pipline.GetLayout(), 0, 1, &m_descriptorSet, 0, nullptr);
-
-    m_quad->Render();
-    
+    //no fog this frame if the frame allocator had no room for the parameters
+    if (m_fogParamsOffset != FrameAllocator::InvalidOffset)
+    {
+        VkCommandBuffer cmdBuff = vk::g_vulkanContext.m_mainCommandBuffer;
+        vk::CmdBindPipeline(cmdBuff, m_pipline.GetBindPoint(), m_pipline.Get());
+        vk::CmdBindDescriptorSets(cmdBuff, m_pipline.GetBindPoint(), m_pipline.GetLayout(), 0, 1, &m_descriptorSet, 1, &m_fogParamsOffset);
+
+        m_quad->Render();
+    }
     EndRenderPass();
 }
 
@@ -90,11 +97,11 @@ void CFogRenderer::UpdateGraphicInterface()
 	imgInfo.imageView = positionImage->GetView();
     imgInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 
-    VkDescriptorBufferInfo bufInfo = m_fogParamsBuffer->GetDescriptor();
+    VkDescriptorBufferInfo bufInfo = MemoryManager::GetInstance()->GetFrameAllocator()->GetDescriptor(sizeof(SFogParams));
     std::vector<VkWriteDescriptorSet> wDesc;
 
     wDesc.push_back(InitUpdateDescriptor(m_descriptorSet, 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &imgInfo));
-    wDesc.push_back(InitUpdateDescriptor(m_descriptorSet, 1, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, &bufInfo));
+    wDesc.push_back(InitUpdateDescriptor(m_descriptorSet, 1, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, &bufInfo));
 
     vk::UpdateDescriptorSets(vk::g_vulkanContext.m_device, (uint32_t)wDesc.size(), wDesc.data(), 0, nullptr);
 }
@@ -103,7 +110,7 @@ void CFogRenderer::CreateDescriptorSetLayout()
 {
     std::vector<VkDescriptorSetLayoutBinding> bindings;
     bindings.push_back(CreateDescriptorBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT));
-    bindings.push_back(CreateDescriptorBinding(1, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT));
+    bindings.push_back(CreateDescriptorBinding(1, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_FRAGMENT_BIT));
 
     VkDescriptorSetLayoutCreateInfo crtInfo;
     cleanStructure(crtInfo);
@@ -118,5 +125,5 @@ void CFogRenderer::PopulatePoolInfo(std::vector<VkDescriptorPoolSize>& poolSize,
 {
     maxSets = 1;
     AddDescriptorType(poolSize, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1);
-    AddDescriptorType(poolSize, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1);
+    AddDescriptorType(poolSize, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1);
 }
\ No newline at end of file
@@ -23,7 +23,7 @@ private:
     VkDescriptorSet             m_descriptorSet;
     VkSampler                   m_sampler;
 
-    BufferHandle*               m_fogParamsBuffer;
+    uint32_t                    m_fogParamsOffset; //dynamic offset in the frame allocator
 
     CGraphicPipeline			m_pipline;
     Mesh*                       m_quad;
@@ -1,5 +1,7 @@
 #include "Geometry.h"
 
+#include <cstring>
+
 
 namespace Geometry
 {
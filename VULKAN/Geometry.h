@@ -90,6 +90,49 @@ struct BoundingBox3D
 
 		return n;
 	}
+
+	glm::vec3 GetCenter() const
+	{
+		return (Max + Min) / 2.0f;
+	}
+
+	float GetSurfaceArea() const
+	{
+		glm::vec3 d = Max - Min;
+		return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+	}
+
+	bool Contains(const BoundingBox3D& bb) const
+	{
+		return Min.x <= bb.Min.x && Min.y <= bb.Min.y && Min.z <= bb.Min.z
+			&& bb.Max.x <= Max.x && bb.Max.y <= Max.y && bb.Max.z <= Max.z;
+	}
+
+	bool Overlaps(const BoundingBox3D& bb) const
+	{
+		return Min.x <= bb.Max.x && Min.y <= bb.Max.y && Min.z <= bb.Max.z
+			&& bb.Min.x <= Max.x && bb.Min.y <= Max.y && bb.Min.z <= Max.z;
+	}
+
+	//slab test. invDir is 1 / ray direction. outDistance is the distance where the ray enters the box (0 if it starts inside)
+	bool RayIntersection(const glm::vec3& origin, const glm::vec3& invDir, float maxDistance, float& outDistance) const
+	{
+		glm::vec3 t0 = (Min - origin) * invDir;
+		glm::vec3 t1 = (Max - origin) * invDir;
+		glm::vec3 tMin = glm::min(t0, t1);
+		glm::vec3 tMax = glm::max(t0, t1);
+
+		float enter = glm::max(glm::max(tMin.x, tMin.y), glm::max(tMin.z, 0.0f));
+		float exit = glm::min(glm::min(tMax.x, tMax.y), glm::min(tMax.z, maxDistance));
+
+		outDistance = enter;
+		return enter <= exit;
+	}
+
+	static BoundingBox3D Combine(const BoundingBox3D& a, const BoundingBox3D& b)
+	{
+		return BoundingBox3D(glm::min(a.Min, b.Min), glm::max(a.Max, b.Max));
+	}
 };
 
 struct Plane
@@ -146,6 +189,7 @@ public:
 
 	void Update(glm::vec3 p, glm::vec3 dir, glm::vec3 up, glm::vec3 right, float fov);
 	glm::vec3 GetPoint(unsigned int p) const { return m_points[p]; }
+	const Plane& GetPlane(unsigned int p) const { return m_planes[p]; }
 
 	CollisionResult Collision(const BoundingBox3D& bb) const;
 private:
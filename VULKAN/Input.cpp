@@ -1,6 +1,8 @@
 #include "Input.h"
 
+#ifdef _WIN32
 #include <windowsx.h>
+#endif
 
 InputManager::InputManager()
 {
@@ -33,6 +35,7 @@ void InputManager::RegisterKeyboardEvent(WPARAM key)
 	m_keyboardInputs.push_back(KeyInput(key));
 }
 
+#ifdef _WIN32
 void InputManager::RegisterMouseEvent(MouseInput::Button b, MouseInput::ButtonState state, WPARAM wparam, LPARAM lparam)
 {
 	m_mouseInput.SetPoint(glm::uvec2(GET_X_LPARAM(lparam), GET_Y_LPARAM(lparam)));
@@ -51,6 +54,7 @@ void InputManager::SetMouseSpecialKeyState(WPARAM wparam)
 	else if (keyMask & MK_CONTROL)
 		m_mouseInput.SetSpecialKeyPressed(SpecialKey::Ctrl);
 }
+#endif
 
 void InputManager::Update()
 {
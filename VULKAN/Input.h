@@ -1,6 +1,28 @@
 #pragma once
 
+#ifdef _WIN32
 #include <windows.h>
+#else
+#include <cstdint>
+//the win32 names the input uses. Off Windows there is no window, so nothing ever gets registered
+typedef uintptr_t WPARAM;
+
+#define MK_SHIFT	0x0004
+#define MK_CONTROL	0x0008
+
+#define VK_TAB		0x09
+#define VK_SPACE	0x20
+#define VK_LEFT		0x25
+#define VK_UP		0x26
+#define VK_RIGHT	0x27
+#define VK_DOWN		0x28
+#define VK_F1		0x70
+#define VK_F2		0x71
+#define VK_F5		0x74
+#define VK_F6		0x75
+#define VK_OEM_PLUS	0xBB
+#define VK_OEM_MINUS	0xBD
+#endif
 
 #include "Singleton.h"
 #include "Callback.h"
@@ -92,13 +114,17 @@ public:
 	void MapMouseButton(MouseButtonsCallback cb);
 
 	void RegisterKeyboardEvent(WPARAM key);
+#ifdef _WIN32
 	void RegisterMouseEvent(MouseInput::Button b, MouseInput::ButtonState state, WPARAM wparam, LPARAM lparam);
+#endif
 	void Update();
 private:
 	InputManager();
 	virtual ~InputManager();
 
+#ifdef _WIN32
 	void SetMouseSpecialKeyState(WPARAM wparam);
+#endif
 private:
 	std::map<WPARAM, std::vector<KeyPressedCallback>>	m_keyboardMap;
 	std::vector<MouseButtonsCallback>					m_mouseMap;
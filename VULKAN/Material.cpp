@@ -2,6 +2,8 @@
 
 #include "Batch.h"
 #include "Object.h"
+#include "MemoryManager.h"
+#include "ScatterUploader.h"
 
 #include "DefaultMaterial.h"
 #include "NormalMapMaterial.h"
@@ -11,6 +13,10 @@
 ///////////////////////////////////////////////////////////////////////////////
 
 MaterialLibrary::MaterialLibrary()
+	: m_bindless(false)
+	, m_maxBindlessTextures(0)
+	, m_texturesLayout(nullptr)
+	, m_texturesPool(nullptr)
 {
 	m_materialTemplates.emplace("default", new MaterialTemplate<DefaultMaterial>("batch.vert", "defaultmaterial.frag", "default"));
 	m_materialTemplates.emplace("normalmap", new MaterialTemplate<NormalMapMaterial>("normalmapmaterial.vert", "normalmapmaterial.frag", "normalmap"));
@@ -20,6 +26,9 @@ MaterialLibrary::~MaterialLibrary()
 {
 	for (auto entry : m_materialTemplates)
 		delete entry.second;
+
+	for (auto pool : m_descriptorPools)
+		delete pool;
 }
 
 void MaterialLibrary::Initialize(CRenderer* renderer)
@@ -28,17 +37,40 @@ void MaterialLibrary::Initialize(CRenderer* renderer)
 	m_descriptorLayouts.resize(DescriptorIndex::Count);
 
 	m_descriptorLayouts[DescriptorIndex::Common] = new DescriptorSetLayout();
-	m_descriptorLayouts[DescriptorIndex::Common]->AddBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT);
+	m_descriptorLayouts[DescriptorIndex::Common]->AddBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT); //object data table of the batch
+	m_descriptorLayouts[DescriptorIndex::Common]->AddBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT); //visible instances
+
+	const VkPhysicalDeviceLimits& limits = vk::g_vulkanContext.m_limits;
+	m_maxBindlessTextures = glm::min(glm::min(limits.maxPerStageDescriptorSamplers, limits.maxPerStageDescriptorSampledImages), glm::min(limits.maxDescriptorSetSamplers, limits.maxDescriptorSetSampledImages));
+	m_maxBindlessTextures = glm::min(m_maxBindlessTextures, (uint32_t)BINDLESS_MAX_TEXTURE);
+	m_bindless = vk::g_vulkanContext.m_descriptorIndexing && m_maxBindlessTextures > BATCH_MAX_TEXTURE;
 
 	m_descriptorLayouts[DescriptorIndex::Specific] = new DescriptorSetLayout();
-	m_descriptorLayouts[DescriptorIndex::Specific]->AddBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT);
-	m_descriptorLayouts[DescriptorIndex::Specific]->AddBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, BATCH_MAX_TEXTURE);
+	m_descriptorLayouts[DescriptorIndex::Specific]->AddBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT); //materials table of the template
+	if (!m_bindless)
+		m_descriptorLayouts[DescriptorIndex::Specific]->AddBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, BATCH_MAX_TEXTURE);
 
 	for (unsigned int i = 0; i < DescriptorIndex::Count; ++i)
 		m_descriptorLayouts[i]->Construct();
 
+	if (m_bindless)
+	{
+		//the slots after the last registered texture are never written. New textures are written while older frames use the set
+		m_texturesLayout = new DescriptorSetLayout();
+		m_texturesLayout->AddBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, m_maxBindlessTextures, VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT);
+		m_texturesLayout->Construct();
+
+		m_texturesPool = new DescriptorPool();
+		m_texturesPool->Construct(*m_texturesLayout, (uint32_t)m_materialTemplates.size());
+	}
+
 	for (auto tmpl : m_materialTemplates)
+	{
 		tmpl.second->CreatePipeline(renderer);
+		tmpl.second->CreateMaterialsTable();
+		if (m_bindless)
+			tmpl.second->m_texturesDescSet = m_texturesPool->AllocateDescriptorSet(*m_texturesLayout);
+	}
 }
 
 std::vector<VkDescriptorSet> MaterialLibrary::AllocNewDescriptors()
@@ -57,6 +89,7 @@ std::vector<VkDescriptorSet> MaterialLibrary::AllocNewDescriptors()
 	{
 		pool = new DescriptorPool();
 		pool->Construct(m_descriptorLayouts, 10);//magic number again
+		m_descriptorPools.push_back(pool);
 	}
 
 	TRAP(pool);
@@ -71,6 +104,18 @@ std::vector<VkDescriptorSet> MaterialLibrary::AllocNewDescriptors()
 	return  newDescSets;
 }
 
+void MaterialLibrary::FreeDescriptors(const std::vector<VkDescriptorSet>& descSets)
+{
+	for (auto descSet : descSets)
+	{
+		for (auto pool : m_descriptorPools)
+		{
+			if (pool->FreeDescriptorSet(descSet))
+				break;
+		}
+	}
+}
+
 std::vector<VkDescriptorSetLayout> MaterialLibrary::GetDescriptorLayouts() const
 {
 	std::vector<VkDescriptorSetLayout> layouts;
@@ -80,6 +125,9 @@ std::vector<VkDescriptorSetLayout> MaterialLibrary::GetDescriptorLayouts() const
 		layouts.push_back(layout->Get());
 	}
 
+	if (m_bindless)
+		layouts.push_back(m_texturesLayout->Get()); //TexturesSetIndex
+
 	return layouts;
 }
 
@@ -95,13 +143,19 @@ MaterialTemplateBase::MaterialTemplateBase(const std::string& vertexShader, cons
 	: m_vertexShader(vertexShader)
 	, m_fragmentShader(fragmentShader)
 	, m_name(name)
+	, m_texturesDescSet(VK_NULL_HANDLE)
+	, m_materialsTable(nullptr)
 {
 
 }
 
 MaterialTemplateBase::~MaterialTemplateBase()
 {
-
+	if (m_materialsTable)
+	{
+		ScatterUploader::GetInstance()->DiscardUpdates(m_materialsTable);
+		MemoryManager::GetInstance()->FreeHandle(m_materialsTable);
+	}
 }
 
 void MaterialTemplateBase::CreatePipeline(CRenderer* renderer)
@@ -111,10 +165,15 @@ void MaterialTemplateBase::CreatePipeline(CRenderer* renderer)
 	pushConstRange.offset = 0;
 	pushConstRange.size = 256; //max push constant range(can get it from limits)
 
-	m_pipeline.SetVertexInputState(Mesh::GetVertexDesc());
+	//same source compiled with BINDLESS defined, see shaderlist.xml
+	std::string fragmentShader = GetFragmentShader();
+	if (MaterialLibrary::GetInstance()->IsBindless())
+		fragmentShader.insert(fragmentShader.rfind('.'), "_bindless");
+
+	m_pipeline.SetVertexInputState(Mesh::GetCompactVertexDesc());
 	m_pipeline.AddBlendState(CGraphicPipeline::CreateDefaultBlendState(), GBuffer_InputCnt);
 	m_pipeline.SetVertexShaderFile(GetVertexShader());
-	m_pipeline.SetFragmentShaderFile(GetFragmentShader());
+	m_pipeline.SetFragmentShaderFile(fragmentShader);
 	m_pipeline.SetCullMode(VK_CULL_MODE_BACK_BIT);
 	m_pipeline.AddPushConstant(pushConstRange);
 	m_pipeline.CreatePipelineLayout(MaterialLibrary::GetInstance()->GetDescriptorLayouts());
@@ -126,6 +185,83 @@ std::vector<VkDescriptorSet> MaterialTemplateBase::GetNewDescriptorSets()
 	return MaterialLibrary::GetInstance()->AllocNewDescriptors();
 }
 
+uint32_t MaterialTemplateBase::RegisterTexture(CTexture* texture)
+{
+	TRAP(m_texturesDescSet != VK_NULL_HANDLE && "Bindless textures are not supported");
+
+	auto it = m_texturesIndexes.find(texture);
+	if (it != m_texturesIndexes.end())
+		return it->second;
+
+	uint32_t index = (uint32_t)m_texturesIndexes.size();
+	TRAP(index < MaterialLibrary::GetInstance()->GetMaxBindlessTextures() && "Too many textures for this material template");
+	m_texturesIndexes.emplace(texture, index);
+
+	//no frame in flight uses this slot, so it can be written now
+	std::vector<VkDescriptorImageInfo> imageInfo(1, texture->GetTextureDescriptor());
+	VkWriteDescriptorSet wDesc = InitUpdateDescriptor(m_texturesDescSet, 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, index, imageInfo);
+	vk::UpdateDescriptorSets(vk::g_vulkanContext.m_device, 1, &wDesc, 0, nullptr);
+
+	return index;
+}
+
+void MaterialTemplateBase::BindTextures(VkCommandBuffer cmdBuffer) const
+{
+	if (m_texturesDescSet == VK_NULL_HANDLE)
+		return;
+
+	vk::CmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline.GetLayout(), MaterialLibrary::TexturesSetIndex, 1, &m_texturesDescSet, 0, nullptr);
+}
+
+void MaterialTemplateBase::CreateMaterialsTable()
+{
+	//only written by the scatter shader, see UploadMaterials
+	m_materialsTable = MemoryManager::GetInstance()->CreateBuffer(EMemoryContextType::DeviceLocalBuffer, MATERIAL_TABLE_SIZE * GetDataStride(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+	m_isMaterialDirty.resize(MATERIAL_TABLE_SIZE, false);
+}
+
+uint32_t MaterialTemplateBase::UpdateMaterial(Material* material)
+{
+	TRAP(material->GetTemplate() == this);
+
+	auto it = m_materialsIndexes.find(material);
+	if (it == m_materialsIndexes.end())
+	{
+		uint32_t newIndex = (uint32_t)m_materialsIndexes.size();
+		TRAP(newIndex < MATERIAL_TABLE_SIZE && "Too many materials for this material template");
+		it = m_materialsIndexes.emplace(material, newIndex).first;
+	}
+
+	//the data is read when it's uploaded, so a material changed more times in a frame is uploaded once
+	if (!m_isMaterialDirty[it->second])
+	{
+		m_isMaterialDirty[it->second] = true;
+		m_dirtyMaterials.push_back(material);
+	}
+
+	return it->second;
+}
+
+uint32_t MaterialTemplateBase::GetMaterialIndex(Material* material) const
+{
+	auto it = m_materialsIndexes.find(material);
+	TRAP(it != m_materialsIndexes.end() && "The material is not registered, call UpdateMaterial");
+
+	return it->second;
+}
+
+void MaterialTemplateBase::UploadMaterials()
+{
+	for (auto material : m_dirtyMaterials)
+	{
+		uint32_t index = GetMaterialIndex(material);
+		ScatterUploader::GetInstance()->AddUpdate(m_materialsTable, GetDataStride(), index, material->GetData());
+		m_isMaterialDirty[index] = false;
+	}
+
+	m_dirtyMaterials.clear();
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////////////////////
 //Material
 /////////////////////////////////////////////////////////////////////////////////////////////////////////	
@@ -13,6 +13,7 @@
 class CRenderer;
 class CTexture;
 class Material;
+class BufferHandle;
 class MaterialTemplateBase;
 
 enum DescriptorIndex
@@ -26,11 +27,20 @@ class MaterialLibrary : public Singleton<MaterialLibrary>
 {
 	friend class Singleton<MaterialLibrary>;
 public:
+	//with bindless textures, the set of the material template textures comes after the sets of the batch
+	static const uint32_t TexturesSetIndex = DescriptorIndex::Count;
+
 	void Initialize(CRenderer* renderer); //this should need some thoughts
 	std::vector<VkDescriptorSet> AllocNewDescriptors();
+	//the sets must not be used by any frame in flight
+	void FreeDescriptors(const std::vector<VkDescriptorSet>& descSets);
 
 	std::vector<VkDescriptorSetLayout> GetDescriptorLayouts() const;
 	MaterialTemplateBase* GetMaterialByName(const std::string& name) const;
+
+	//every material template has a texture array shared by all its batches, so batches are not split by their textures
+	bool IsBindless() const { return m_bindless; }
+	uint32_t GetMaxBindlessTextures() const { return m_maxBindlessTextures; }
 private:
 	MaterialLibrary();
 	virtual ~MaterialLibrary();
@@ -40,11 +50,17 @@ private:
 	std::vector<DescriptorPool*>								m_descriptorPools;
 
 	std::vector<DescriptorSetLayout*>							m_descriptorLayouts;
+
+	bool														m_bindless;
+	uint32_t													m_maxBindlessTextures;
+	DescriptorSetLayout*										m_texturesLayout;
+	DescriptorPool*												m_texturesPool;
 };
 
 
 class MaterialTemplateBase
 {
+	friend class MaterialLibrary;
 public:
 	MaterialTemplateBase(const std::string& vertexShader, const std::string& fragmentShader, const std::string& name);
 	virtual ~MaterialTemplateBase();
@@ -58,30 +74,58 @@ public:
 
 	std::vector<VkDescriptorSet> GetNewDescriptorSets();
 
+	//bindless only. Returns the index of the texture in the template array, the texture is added if it's new.
+	//Textures are never removed, so the index is the same for all the batches and all the frames
+	uint32_t RegisterTexture(CTexture* texture);
+	//bindless only, does nothing otherwise. Call it after the pipeline is bound
+	void BindTextures(VkCommandBuffer cmdBuffer) const;
+
+	//the parameters of all the materials of the template are in one device local table. Registers the material if it's new
+	//and uploads its data at the start of the next frame, call it again when the data changes. Returns the index in the table
+	uint32_t UpdateMaterial(Material* material);
+	uint32_t GetMaterialIndex(Material* material) const;
+	//scatters the data of the materials updated since the last call in the table
+	void UploadMaterials();
+	BufferHandle* GetMaterialsTable() const { return m_materialsTable; }
+
 	virtual const uint32_t GetDataStride() const = 0;
 	virtual Material* Create() = 0;
 	virtual Material* Create(Serializer* serializer) = 0;
 	virtual void Save(Material* mat, Serializer*) = 0;
 protected:
 
+private:
+	void CreateMaterialsTable();
 private:
 	std::string						m_vertexShader;
 	std::string						m_fragmentShader;
 	std::string						m_name;
 
 	CGraphicPipeline				m_pipeline;
+
+	VkDescriptorSet								m_texturesDescSet;
+	std::unordered_map<CTexture*, uint32_t>		m_texturesIndexes;
+
+	BufferHandle*								m_materialsTable;
+	std::unordered_map<Material*, uint32_t>		m_materialsIndexes;
+	std::vector<Material*>						m_dirtyMaterials;
+	std::vector<bool>							m_isMaterialDirty; //indexed with the material index
 };
 
 template<class MaterialType>
 class MaterialTemplate : public MaterialTemplateBase
 {
 public:
-	const uint32_t GetDataStride() const override { return sizeof(MaterialType::PropertiesType); }
+	const uint32_t GetDataStride() const override { return sizeof(typename MaterialType::PropertiesType); }
 
 	Material* Create(Serializer* serializer) override
 	{
 		MaterialType* material = new MaterialType(this);
-		material->Serialize(serializer);
+		if (!material->Serialize(serializer))
+		{
+			delete material;
+			return nullptr;
+		}
 		return material; 
 	}
 	Material* Create() override
@@ -181,6 +225,35 @@ public:
 		}
 	};
 
+	virtual void SaveBinary(Serializer* serializer, ISeriable* obj)
+	{
+		BASE* cobj = static_cast<BASE*>(obj);
+		MaterialTemplateBase* tmplMaterial = (cobj->*m_ptm)->GetTemplate();
+
+		serializer->WriteBinaryString(tmplMaterial->GetName());
+		tmplMaterial->Save(cobj->*m_ptm, serializer);
+	};
+
+	virtual void LoadBinary(Serializer* serializer, ISeriable* obj)
+	{
+		BASE* cobj = static_cast<BASE*>(obj);
+
+		std::string templateName;
+		serializer->ReadBinaryString(templateName);
+
+		cobj->*m_ptm = nullptr;
+		if (!templateName.empty() && !serializer->HasBinaryError())
+		{
+			MaterialTemplateBase* tmplMaterial = MaterialLibrary::GetInstance()->GetMaterialByName(templateName);
+			cobj->*m_ptm = tmplMaterial->Create(serializer);
+		}
+	};
+
+
+	virtual std::string GetLayoutTag() const
+	{
+		return m_label + ":" + typeid(Material*).name();
+	};
 private:
 	PtmType						m_ptm;
 	std::string					m_label;
@@ -2,6 +2,11 @@
 #include "Utils.h"
 
 #include <iostream>
+
+//the stages that read the buffers of the contexts with a shadow copy (uniforms, UI)
+static const VkPipelineStageFlags s_shadowCopyStages = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_GEOMETRY_SHADER_BIT |
+	VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+
 ///////////////////////////////////////////////////////////////////////////////////
 //BufferHandle
 ///////////////////////////////////////////////////////////////////////////////////
@@ -57,8 +62,8 @@ ImageHandle::ImageHandle(VkImage vkHandle, VkDeviceSize size, VkDeviceSize align
 	: HandleImpl<VkImage>(vkHandle, size, alignment, context)
 	, m_view(VK_NULL_HANDLE)
 	, m_format(imgInfo.format)
-	, m_dimensions(imgInfo.extent)
 	, m_layers(imgInfo.arrayLayers)
+	, m_dimensions(imgInfo.extent)
 {
 	CreateImageView(m_view, Get(), imgInfo);
 	if (m_layers > 1)
@@ -143,18 +148,671 @@ const VkImageView& ImageHandle::GetLayerView(uint32_t layer) const
 }
 
 ///////////////////////////////////////////////////////////////////////////////////
-//MemoryContext::MappedMemory
+//TLSFAllocator
 ///////////////////////////////////////////////////////////////////////////////////
-MappedMemory::MappedMemory(void* memPtr, MemoryContext* parentContext)
-	: m_memPtr(memPtr)
-	, m_parentMemoryContext(parentContext)
+
+static uint32_t FindLastSetBit(uint64_t value) //value must be != 0
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanReverse64(&index, value);
+	return (uint32_t)index;
+#else
+	return 63 - (uint32_t)__builtin_clzll(value);
+#endif
+}
+
+static uint32_t FindFirstSetBit(uint64_t value) //value must be != 0
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward64(&index, value);
+	return (uint32_t)index;
+#else
+	return (uint32_t)__builtin_ctzll(value);
+#endif
+}
+
+const uint32_t TLSFAllocator::InvalidBlock;
+
+TLSFAllocator::TLSFAllocator()
+	: m_totalSize(0)
+{
+	Reset();
+}
+
+TLSFAllocator::~TLSFAllocator()
+{
+}
+
+void TLSFAllocator::Init(VkDeviceSize size)
+{
+	Reset();
+	m_totalSize = size;
+
+	uint32_t block = NewBlock();
+	Block& b = m_blocks[block];
+	b.m_offset = 0;
+	b.m_size = size;
+	InsertFreeBlock(block);
+}
+
+void TLSFAllocator::Reset()
+{
+	m_blocks.clear();
+	m_unusedBlocks.clear();
+	m_flBitmap = 0;
+	m_slBitmaps.fill(0);
+	for (auto& lists : m_freeLists)
+		lists.fill(InvalidBlock);
+	m_totalSize = 0;
+}
+
+void TLSFAllocator::Mapping(VkDeviceSize size, uint32_t& fl, uint32_t& sl) const
+{
+	if (size < SmallBlockSize)
+	{
+		fl = 0;
+		sl = (uint32_t)size;
+		return;
+	}
+
+	uint32_t lastBit = FindLastSetBit(size);
+	sl = (uint32_t)(size >> (lastBit - SLIndexLog2)) ^ SLIndexCount;
+	fl = lastBit - FLIndexShift + 1;
+}
+
+uint32_t TLSFAllocator::FindFreeBlock(VkDeviceSize size) const
+{
+	//round up to the next list, so any block found there is big enough
+	if (size >= SmallBlockSize)
+		size += (VkDeviceSize(1) << (FindLastSetBit(size) - SLIndexLog2)) - 1;
+
+	uint32_t fl, sl;
+	Mapping(size, fl, sl);
+	if (fl >= FLIndexCount)
+		return InvalidBlock;
+
+	uint32_t slMap = m_slBitmaps[fl] & (~0u << sl);
+	if (slMap == 0)
+	{
+		uint64_t flMap = (fl + 1 < FLIndexCount) ? m_flBitmap & (~uint64_t(0) << (fl + 1)) : 0;
+		if (flMap == 0)
+			return InvalidBlock;
+
+		fl = FindFirstSetBit(flMap);
+		slMap = m_slBitmaps[fl];
+	}
+	sl = FindFirstSetBit(slMap);
+	return m_freeLists[fl][sl];
+}
+
+void TLSFAllocator::InsertFreeBlock(uint32_t block)
+{
+	Block& b = m_blocks[block];
+	uint32_t fl, sl;
+	Mapping(b.m_size, fl, sl);
+
+	uint32_t head = m_freeLists[fl][sl];
+	b.m_isFree = true;
+	b.m_prevFree = InvalidBlock;
+	b.m_nextFree = head;
+	if (head != InvalidBlock)
+		m_blocks[head].m_prevFree = block;
+
+	m_freeLists[fl][sl] = block;
+	m_flBitmap |= uint64_t(1) << fl;
+	m_slBitmaps[fl] |= 1u << sl;
+}
+
+void TLSFAllocator::RemoveFreeBlock(uint32_t block)
+{
+	Block& b = m_blocks[block];
+	uint32_t fl, sl;
+	Mapping(b.m_size, fl, sl);
+
+	if (b.m_prevFree != InvalidBlock)
+		m_blocks[b.m_prevFree].m_nextFree = b.m_nextFree;
+	if (b.m_nextFree != InvalidBlock)
+		m_blocks[b.m_nextFree].m_prevFree = b.m_prevFree;
+
+	if (m_freeLists[fl][sl] == block)
+	{
+		m_freeLists[fl][sl] = b.m_nextFree;
+		if (b.m_nextFree == InvalidBlock)
+		{
+			m_slBitmaps[fl] &= ~(1u << sl);
+			if (m_slBitmaps[fl] == 0)
+				m_flBitmap &= ~(uint64_t(1) << fl);
+		}
+	}
+
+	b.m_isFree = false;
+	b.m_prevFree = b.m_nextFree = InvalidBlock;
+}
+
+//block keeps the first "size" bytes, the rest goes in a new block (returned) that is not in any free list
+uint32_t TLSFAllocator::SplitBlock(uint32_t block, VkDeviceSize size)
+{
+	uint32_t remaining = NewBlock(); //can realloc m_blocks, so dont keep refs before this
+	Block& b = m_blocks[block];
+	Block& r = m_blocks[remaining];
+
+	r.m_offset = b.m_offset + size;
+	r.m_size = b.m_size - size;
+	r.m_prevPhys = block;
+	r.m_nextPhys = b.m_nextPhys;
+	if (b.m_nextPhys != InvalidBlock)
+		m_blocks[b.m_nextPhys].m_prevPhys = remaining;
+
+	b.m_size = size;
+	b.m_nextPhys = remaining;
+	return remaining;
+}
+
+void TLSFAllocator::MergeBlocks(uint32_t first, uint32_t second)
+{
+	Block& f = m_blocks[first];
+	Block& s = m_blocks[second];
+	TRAP(f.m_nextPhys == second && "Only physical neighbours can be merged");
+
+	f.m_size += s.m_size;
+	f.m_nextPhys = s.m_nextPhys;
+	if (s.m_nextPhys != InvalidBlock)
+		m_blocks[s.m_nextPhys].m_prevPhys = first;
+
+	ReleaseBlock(second);
+}
+
+uint32_t TLSFAllocator::NewBlock()
+{
+	uint32_t block;
+	if (!m_unusedBlocks.empty())
+	{
+		block = m_unusedBlocks.back();
+		m_unusedBlocks.pop_back();
+	}
+	else
+	{
+		block = (uint32_t)m_blocks.size();
+		m_blocks.push_back(Block());
+	}
+
+	Block& b = m_blocks[block];
+	b.m_offset = b.m_size = 0;
+	b.m_prevPhys = b.m_nextPhys = InvalidBlock;
+	b.m_prevFree = b.m_nextFree = InvalidBlock;
+	b.m_isFree = false;
+	return block;
+}
+
+void TLSFAllocator::ReleaseBlock(uint32_t block)
 {
+	m_blocks[block].m_size = 0; //so Grow doesn't take it for the last block
+	m_unusedBlocks.push_back(block);
+}
+
+bool TLSFAllocator::Allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& outOffset, VkDeviceSize& outSize, uint32_t& outBlock)
+{
+	if (size == 0)
+		size = 1;
+	if (alignment == 0)
+		alignment = 1;
+
+	//try first without padding. Most of the time the head of the list is already aligned
+	uint32_t block = FindFreeBlock(size);
+	if (block == InvalidBlock || m_blocks[block].m_offset % alignment != 0)
+		block = FindFreeBlock(size + alignment - 1);
+
+	if (block == InvalidBlock)
+		return false;
+
+	RemoveFreeBlock(block);
+
+	//put the front padding back to the free lists. Free blocks are always merged, so no need to check the neighbours
+	VkDeviceSize offset = m_blocks[block].m_offset;
+	VkDeviceSize padding = (offset % alignment != 0) ? alignment - (offset % alignment) : 0;
+	if (padding > 0)
+	{
+		uint32_t alignedBlock = SplitBlock(block, padding);
+		InsertFreeBlock(block);
+		block = alignedBlock;
+	}
+
+	if (m_blocks[block].m_size > size)
+	{
+		uint32_t remaining = SplitBlock(block, size);
+		InsertFreeBlock(remaining);
+	}
+
+	const Block& b = m_blocks[block];
+	outOffset = b.m_offset;
+	outSize = b.m_size;
+	outBlock = block;
+	return true;
+}
+
+void TLSFAllocator::Free(uint32_t block)
+{
+	TRAP(block < m_blocks.size() && !m_blocks[block].m_isFree && "Invalid block or double free");
+
+	uint32_t prev = m_blocks[block].m_prevPhys;
+	if (prev != InvalidBlock && m_blocks[prev].m_isFree)
+	{
+		RemoveFreeBlock(prev);
+		MergeBlocks(prev, block);
+		block = prev;
+	}
+
+	uint32_t next = m_blocks[block].m_nextPhys;
+	if (next != InvalidBlock && m_blocks[next].m_isFree)
+	{
+		RemoveFreeBlock(next);
+		MergeBlocks(block, next);
+	}
 
+	InsertFreeBlock(block);
 }
 
-MappedMemory::~MappedMemory()
+void TLSFAllocator::Grow(VkDeviceSize newSize)
 {
+	TRAP(newSize > m_totalSize);
+
+	//rare, a linear search for the last physical block is fine
+	uint32_t last = InvalidBlock;
+	for (uint32_t i = 0; i < (uint32_t)m_blocks.size(); ++i)
+	{
+		if (m_blocks[i].m_size > 0 && m_blocks[i].m_offset + m_blocks[i].m_size == m_totalSize)
+		{
+			last = i;
+			break;
+		}
+	}
+	TRAP(last != InvalidBlock);
+
+	uint32_t block = NewBlock();
+	Block& b = m_blocks[block];
+	b.m_offset = m_totalSize;
+	b.m_size = newSize - m_totalSize;
+	b.m_prevPhys = last;
+	m_blocks[last].m_nextPhys = block;
+	m_totalSize = newSize;
+
+	//merges it with the last block if that one is free
+	Free(block);
+}
+
+///////////////////////////////////////////////////////////////////////////////////
+//StagingRing
+///////////////////////////////////////////////////////////////////////////////////
+
+static VkDeviceSize AlignUp(VkDeviceSize value, VkDeviceSize alignment)
+{
+	return (alignment > 1) ? (value + alignment - 1) / alignment * alignment : value;
+}
+
+static bool IsCoherentMemoryType(uint32_t memoryTypeIndex)
+{
+	return (vk::g_vulkanContext.m_memProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+}
+
+//flush ranges must be multiple of nonCoherentAtomSize, or reach the end of the memory
+static VkMappedMemoryRange CreateFlushRange(VkDeviceMemory memory, VkDeviceSize memorySize, VkDeviceSize offset, VkDeviceSize size)
+{
+	VkDeviceSize atomSize = vk::g_vulkanContext.m_limits.nonCoherentAtomSize;
+	VkDeviceSize start = offset / atomSize * atomSize;
+	VkDeviceSize end = AlignUp(offset + size, atomSize);
+
+	VkMappedMemoryRange range;
+	cleanStructure(range);
+	range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+	range.memory = memory;
+	range.offset = start;
+	range.size = (end >= memorySize) ? VK_WHOLE_SIZE : end - start;
+	return range;
+}
+
+StagingRing::StagingRing()
+	: m_buffer(VK_NULL_HANDLE)
+	, m_memory(VK_NULL_HANDLE)
+	, m_mappedPtr(nullptr)
+	, m_size(0)
+	, m_isCoherent(true)
+	, m_head(0)
+	, m_tail(0)
+	, m_usedSize(0)
+	, m_unretiredSize(0)
+	, m_flushStart(0)
+	, m_unflushedSize(0)
+{
+}
+
+StagingRing::~StagingRing()
+{
+	TRAP(m_buffer == VK_NULL_HANDLE && "Destroy the ring while the device is alive");
+}
+
+void StagingRing::Init(VkDeviceSize size)
+{
+	VkDevice dev = vk::g_vulkanContext.m_device;
+
+	VkBufferCreateInfo crtInfo;
+	cleanStructure(crtInfo);
+	crtInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	crtInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	crtInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	crtInfo.size = size;
+	VULKAN_ASSERT(vk::CreateBuffer(dev, &crtInfo, nullptr, &m_buffer));
+
+	VkMemoryRequirements memReq;
+	vk::GetBufferMemoryRequirements(dev, m_buffer, &memReq);
+
+	VkMemoryAllocateInfo allocInfo;
+	cleanStructure(allocInfo);
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = memReq.size;
+	allocInfo.memoryTypeIndex = vk::SVUlkanContext::GetMemTypeIndex(memReq.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+	VULKAN_ASSERT(vk::AllocateMemory(dev, &allocInfo, nullptr, &m_memory));
+	VULKAN_ASSERT(vk::BindBufferMemory(dev, m_buffer, m_memory, 0));
+
+	void* mappedPtr = nullptr;
+	VULKAN_ASSERT(vk::MapMemory(dev, m_memory, 0, VK_WHOLE_SIZE, 0, &mappedPtr));
+	m_mappedPtr = (uint8_t*)mappedPtr;
+	m_isCoherent = IsCoherentMemoryType(allocInfo.memoryTypeIndex);
+
+	m_size = size;
+	m_head = m_tail = m_usedSize = m_unretiredSize = 0;
+	m_flushStart = m_unflushedSize = 0;
+	m_retirements.clear();
+}
+
+void StagingRing::Destroy()
+{
+	if (m_buffer == VK_NULL_HANDLE)
+		return;
+
+	VkDevice dev = vk::g_vulkanContext.m_device;
+	vk::UnmapMemory(dev, m_memory);
+	vk::DestroyBuffer(dev, m_buffer, nullptr);
+	vk::FreeMemory(dev, m_memory, nullptr);
+
+	m_buffer = VK_NULL_HANDLE;
+	m_memory = VK_NULL_HANDLE;
+	m_mappedPtr = nullptr;
+	m_retirements.clear();
+}
+
+bool StagingRing::FindRoom(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& outOffset) const
+{
+	if (size > m_size || m_usedSize == m_size)
+		return false;
+
+	VkDeviceSize offset = AlignUp(m_head, alignment);
+	if (m_head >= m_tail)
+	{
+		//free space is [head, end) and [0, tail). An allocation doesn't wrap, the end of the buffer is skipped
+		if (offset + size <= m_size)
+			outOffset = offset;
+		else if (size <= m_tail)
+			outOffset = 0;
+		else
+			return false;
+
+		return true;
+	}
+
+	outOffset = offset;
+	return offset + size <= m_tail;
+}
+
+bool StagingRing::Allocate(VkDeviceSize size, VkDeviceSize alignment, Allocation& outAllocation)
+{
+	TRAP(m_buffer != VK_NULL_HANDLE);
+
+	VkDeviceSize offset = 0;
+	for (unsigned int i = 0; i < 2; ++i)
+	{
+		if (m_usedSize == 0)
+			m_head = m_tail = m_flushStart = 0; //empty, start over so there is a single contiguous space
+
+		if (FindRoom(size, alignment, offset))
+			break;
+
+		if (i == 1)
+			return false;
+
+		Update();
+	}
+
+	VkDeviceSize end = offset + size;
+	VkDeviceSize usedSize = (offset >= m_head) ? end - m_head : (m_size - m_head) + end;
+	m_head = end;
+	m_usedSize += usedSize;
+	m_unretiredSize += usedSize;
+	m_unflushedSize += usedSize;
+
+	outAllocation.m_offset = offset;
+	outAllocation.m_size = size;
+	outAllocation.m_ptr = m_mappedPtr + offset;
+	return true;
+}
+
+VkDeviceSize StagingRing::GetMaxAllocation(VkDeviceSize alignment)
+{
+	Update();
+
+	if (m_usedSize == 0)
+		return m_size;
+	if (m_usedSize == m_size)
+		return 0;
+
+	VkDeviceSize offset = AlignUp(m_head, alignment);
+	if (m_head >= m_tail)
+		return glm::max((offset < m_size) ? m_size - offset : 0, m_tail);
+
+	return (offset < m_tail) ? m_tail - offset : 0;
+}
+
+void StagingRing::Retire(VkFence fence)
+{
+	if (m_unretiredSize == 0)
+		return;
+
+	Retirement retirement;
+	retirement.m_fence = fence;
+	retirement.m_end = m_head;
+	retirement.m_size = m_unretiredSize;
+	m_retirements.push_back(retirement);
+
+	m_unretiredSize = 0;
+}
+
+void StagingRing::Update()
+{
+	//in order. A later fence signaled first still waits for the older ones, the space is contiguous
+	while (!m_retirements.empty())
+	{
+		const Retirement& retirement = m_retirements.front();
+		if (vk::GetFenceStatus(vk::g_vulkanContext.m_device, retirement.m_fence) != VK_SUCCESS)
+			break;
+
+		m_tail = retirement.m_end;
+		m_usedSize -= retirement.m_size;
+		m_retirements.pop_front();
+	}
+}
+
+void StagingRing::Flush()
+{
+	if (m_unflushedSize == 0)
+		return;
+
+	if (!m_isCoherent)
+	{
+		//the skipped end of the buffer on wrap is flushed too, it's harmless
+		std::array<VkMappedMemoryRange, 2> ranges;
+		uint32_t rangesCount = 0;
+		if (m_unflushedSize >= m_size)
+			ranges[rangesCount++] = CreateFlushRange(m_memory, m_size, 0, m_size);
+		else if (m_head > m_flushStart)
+			ranges[rangesCount++] = CreateFlushRange(m_memory, m_size, m_flushStart, m_head - m_flushStart);
+		else
+		{
+			ranges[rangesCount++] = CreateFlushRange(m_memory, m_size, m_flushStart, m_size - m_flushStart);
+			if (m_head > 0)
+				ranges[rangesCount++] = CreateFlushRange(m_memory, m_size, 0, m_head);
+		}
+
+		VULKAN_ASSERT(vk::FlushMappedMemoryRanges(vk::g_vulkanContext.m_device, rangesCount, ranges.data()));
+	}
 
+	m_flushStart = m_head;
+	m_unflushedSize = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////
+//FrameAllocator
+///////////////////////////////////////////////////////////////////////////////////
+
+FrameAllocator::FrameAllocator()
+	: m_buffer(VK_NULL_HANDLE)
+	, m_memory(VK_NULL_HANDLE)
+	, m_mappedPtr(nullptr)
+	, m_regionSize(0)
+	, m_isCoherent(true)
+	, m_regionStart(0)
+	, m_regionOffset(0)
+	, m_flushedOffset(0)
+	, m_frameNumber(0)
+{
+}
+
+FrameAllocator::~FrameAllocator()
+{
+	TRAP(m_buffer == VK_NULL_HANDLE && "Destroy the allocator while the device is alive");
+}
+
+void FrameAllocator::Init(VkDeviceSize regionSize)
+{
+	VkDevice dev = vk::g_vulkanContext.m_device;
+	const VkPhysicalDeviceLimits& limits = vk::g_vulkanContext.m_limits;
+
+	//every region starts aligned for all the usages
+	VkDeviceSize alignment = glm::max(limits.minUniformBufferOffsetAlignment, limits.minStorageBufferOffsetAlignment);
+	m_regionSize = AlignUp(regionSize, alignment);
+	TRAP(m_regionSize * FRAMES_IN_FLIGHT <= UINT32_MAX && "Dynamic offsets are 32 bits");
+
+	VkBufferCreateInfo crtInfo;
+	cleanStructure(crtInfo);
+	crtInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	crtInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	crtInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
+	crtInfo.size = m_regionSize * FRAMES_IN_FLIGHT;
+	VULKAN_ASSERT(vk::CreateBuffer(dev, &crtInfo, nullptr, &m_buffer));
+
+	VkMemoryRequirements memReq;
+	vk::GetBufferMemoryRequirements(dev, m_buffer, &memReq);
+
+	VkMemoryAllocateInfo allocInfo;
+	cleanStructure(allocInfo);
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = memReq.size;
+	allocInfo.memoryTypeIndex = vk::SVUlkanContext::GetMemTypeIndex(memReq.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+	VULKAN_ASSERT(vk::AllocateMemory(dev, &allocInfo, nullptr, &m_memory));
+	VULKAN_ASSERT(vk::BindBufferMemory(dev, m_buffer, m_memory, 0));
+
+	void* mappedPtr = nullptr;
+	VULKAN_ASSERT(vk::MapMemory(dev, m_memory, 0, VK_WHOLE_SIZE, 0, &mappedPtr));
+	m_mappedPtr = (uint8_t*)mappedPtr;
+	m_isCoherent = IsCoherentMemoryType(allocInfo.memoryTypeIndex);
+
+	m_regionStart = 0;
+	m_regionOffset = 0;
+	m_flushedOffset = 0;
+}
+
+void FrameAllocator::Destroy()
+{
+	if (m_buffer == VK_NULL_HANDLE)
+		return;
+
+	VkDevice dev = vk::g_vulkanContext.m_device;
+	vk::UnmapMemory(dev, m_memory);
+	vk::DestroyBuffer(dev, m_buffer, nullptr);
+	vk::FreeMemory(dev, m_memory, nullptr);
+
+	m_buffer = VK_NULL_HANDLE;
+	m_memory = VK_NULL_HANDLE;
+	m_mappedPtr = nullptr;
+}
+
+void FrameAllocator::BeginFrame(uint32_t frameIndex)
+{
+	TRAP(frameIndex < FRAMES_IN_FLIGHT);
+	m_regionStart = m_regionSize * frameIndex;
+	m_regionOffset = 0;
+	m_flushedOffset = 0;
+	++m_frameNumber;
+}
+
+bool FrameAllocator::Allocate(VkDeviceSize size, VkBufferUsageFlags usage, Allocation& outAllocation)
+{
+	TRAP(m_buffer != VK_NULL_HANDLE);
+
+	VkDeviceSize offset = AlignUp(m_regionOffset, GetAlignment(usage));
+	if (offset + size > m_regionSize)
+		return false;
+
+	m_regionOffset = offset + size;
+
+	outAllocation.m_offset = (uint32_t)(m_regionStart + offset);
+	outAllocation.m_size = size;
+	outAllocation.m_ptr = m_mappedPtr + m_regionStart + offset;
+	return true;
+}
+
+VkDeviceSize FrameAllocator::GetFreeSize(VkBufferUsageFlags usage) const
+{
+	VkDeviceSize offset = AlignUp(m_regionOffset, GetAlignment(usage));
+	return (offset < m_regionSize) ? m_regionSize - offset : 0;
+}
+
+VkDeviceSize FrameAllocator::GetAlignment(VkBufferUsageFlags usage) const
+{
+	const VkPhysicalDeviceLimits& limits = vk::g_vulkanContext.m_limits;
+
+	VkDeviceSize alignment = 4;
+	if (usage & VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT)
+		alignment = glm::max(alignment, limits.minUniformBufferOffsetAlignment);
+	if (usage & VK_BUFFER_USAGE_STORAGE_BUFFER_BIT)
+		alignment = glm::max(alignment, limits.minStorageBufferOffsetAlignment);
+
+	return alignment;
+}
+
+VkDescriptorBufferInfo FrameAllocator::GetDescriptor(VkDeviceSize range) const
+{
+	TRAP(range <= m_regionSize);
+
+	VkDescriptorBufferInfo info;
+	info.buffer = m_buffer;
+	info.offset = 0;
+	info.range = range;
+	return info;
+}
+
+void FrameAllocator::Flush()
+{
+	if (m_flushedOffset == m_regionOffset)
+		return;
+
+	if (!m_isCoherent)
+	{
+		VkMappedMemoryRange range = CreateFlushRange(m_memory, m_regionSize * FRAMES_IN_FLIGHT, m_regionStart + m_flushedOffset, m_regionOffset - m_flushedOffset);
+		VULKAN_ASSERT(vk::FlushMappedMemoryRanges(vk::g_vulkanContext.m_device, 1, &range));
+	}
+
+	m_flushedOffset = m_regionOffset;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////
@@ -162,24 +820,22 @@ MappedMemory::~MappedMemory()
 ///////////////////////////////////////////////////////////////////////////////////
 
 MemoryContext::MemoryContext(EMemoryContextType type)
-	: m_memory(VK_NULL_HANDLE)
+	: m_lastBlockSize(0)
 	, m_totalSize(0)
 	, m_allocatedSize(0)
-	, m_memoryTypeIndex(-1)
+	, m_memoryTypeIndex(InvalidMemoryTypeIndex)
+	, m_isCoherent(true)
 	, m_contextType(type)
-	, m_mappedMemory(nullptr)
-	, m_memoryFlags(-1)
 {
-
+	cleanStructure(m_desc);
 }
 
 MemoryContext::~MemoryContext()
 {
-	if (m_memory != VK_NULL_HANDLE)
-		FreeMemory();
+	FreeMemory();
 }
 
-void MemoryContext::AllocateMemory(VkDeviceSize size, VkMemoryPropertyFlags flags)
+void MemoryContext::Init(const MemoryContextDesc& desc)
 {
 	uint32_t bitsType = -1;
 	VkDevice dev = vk::g_vulkanContext.m_device;
@@ -192,7 +848,7 @@ void MemoryContext::AllocateMemory(VkDeviceSize size, VkMemoryPropertyFlags flag
 		dummyCrtInfo.flags = 0;
 		dummyCrtInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 		dummyCrtInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
-		dummyCrtInfo.size = size;
+		dummyCrtInfo.size = desc.m_minBlockSize;
 
 		VkBuffer dummyBuffer;
 		VULKAN_ASSERT(vk::CreateBuffer(dev, &dummyCrtInfo, nullptr, &dummyBuffer));
@@ -232,30 +888,97 @@ void MemoryContext::AllocateMemory(VkDeviceSize size, VkMemoryPropertyFlags flag
 
 		bitsType = memReq.memoryTypeBits;
 	}
-	TRAP(m_memory == VK_NULL_HANDLE && "Free memory before allocate another one");
-	m_memoryTypeIndex = vk::SVUlkanContext::GetMemTypeIndex(bitsType, flags);
-	m_totalSize = size;
-	m_memoryFlags = flags;
+	TRAP(m_blocks.empty() && "Free memory before changing the context properties");
+	TRAP(desc.m_minBlockSize > 0 && desc.m_growthFactor >= 1.0f);
+	m_desc = desc;
+	m_memoryTypeIndex = vk::SVUlkanContext::GetMemTypeIndex(bitsType, m_desc.m_memoryFlags);
+	//the shadow copy is plain cpu memory, the copy to the real buffer is done by the gpu
+	m_isCoherent = HasShadowCopy() || IsCoherentMemoryType(m_memoryTypeIndex);
+}
+
+bool MemoryContext::AllocateMemory(VkDeviceSize size)
+{
+	return AllocateBlock(size) != nullptr;
+}
+
+VkDeviceSize MemoryContext::ComputeNextBlockSize(VkDeviceSize minSize) const
+{
+	VkDeviceSize blockSize = m_desc.m_minBlockSize;
+	if (m_lastBlockSize > 0)
+		blockSize = glm::max(blockSize, (VkDeviceSize)(m_lastBlockSize * m_desc.m_growthFactor));
+	if (m_desc.m_maxBlockSize > 0)
+		blockSize = glm::min(blockSize, m_desc.m_maxBlockSize);
+
+	blockSize = glm::max(blockSize, minSize);
+	if (m_desc.m_maxTotalSize > 0 && m_totalSize + blockSize > m_desc.m_maxTotalSize)
+	{
+		//try to fit what is left until the cap
+		VkDeviceSize remaining = (m_totalSize < m_desc.m_maxTotalSize) ? m_desc.m_maxTotalSize - m_totalSize : 0;
+		return (remaining >= minSize) ? remaining : 0;
+	}
+
+	return blockSize;
+}
+
+MemoryContext::MemoryBlock* MemoryContext::AllocateBlock(VkDeviceSize minSize)
+{
+	TRAP(m_memoryTypeIndex != InvalidMemoryTypeIndex && "Memory context was not initialized");
+	VkDeviceSize blockSize = ComputeNextBlockSize(minSize);
+	if (blockSize == 0)
+		return nullptr;
 
 	VkMemoryAllocateInfo allocInfo;
 	cleanStructure(allocInfo);
 	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocInfo.allocationSize = m_totalSize;
+	allocInfo.allocationSize = blockSize;
 	allocInfo.memoryTypeIndex = m_memoryTypeIndex;
-	VULKAN_ASSERT(vk::AllocateMemory(vk::g_vulkanContext.m_device, &allocInfo, nullptr, &m_memory));
 
-	m_chunks.insert(Chunk(0, m_totalSize));
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	if (vk::AllocateMemory(vk::g_vulkanContext.m_device, &allocInfo, nullptr, &memory) != VK_SUCCESS)
+		return nullptr; //out of device/host memory
+
+	MemoryBlock* block = new MemoryBlock();
+	block->m_memory = memory;
+	block->m_size = blockSize;
+	block->m_allocatedSize = 0;
+	block->m_mappedPtr = nullptr;
+	block->m_shadowMemory = (HasShadowCopy()) ? new uint8_t[(size_t)blockSize] : nullptr;
+	block->m_allocator.Init(blockSize);
+
+	//mapped until the block is freed
+	if (HasShadowCopy())
+		block->m_mappedPtr = block->m_shadowMemory;
+	else if (IsHostVisible())
+	{
+		void* mappedPtr = nullptr;
+		VULKAN_ASSERT(vk::MapMemory(vk::g_vulkanContext.m_device, block->m_memory, 0, VK_WHOLE_SIZE, 0, &mappedPtr));
+		block->m_mappedPtr = (uint8_t*)mappedPtr;
+	}
+
+	m_blocks.push_back(block);
+	m_totalSize += blockSize;
+	m_lastBlockSize = glm::max(m_lastBlockSize, blockSize);
+	return block;
+}
+
+void MemoryContext::FreeBlock(MemoryBlock* block)
+{
+	VkDevice dev = vk::g_vulkanContext.m_device;
+	if (block->m_mappedPtr && !block->m_shadowMemory)
+		vk::UnmapMemory(dev, block->m_memory);
+	vk::FreeMemory(dev, block->m_memory, nullptr);
+	delete[] block->m_shadowMemory;
+
+	m_totalSize -= block->m_size;
+	m_blocks.erase(std::find(m_blocks.begin(), m_blocks.end(), block));
+	delete block;
 }
 
 void MemoryContext::FreeMemory()
 {
-	if (m_memory == VK_NULL_HANDLE)
+	if (m_blocks.empty())
 		return;
 
-	TRAP(!IsMapped() && "Dont free memory if it's mapped!!");
-
-	VkDevice dev = vk::g_vulkanContext.m_device;
-
 	for (auto c : m_allocatedChunks)
 	{
 		Handle* h = c.first;
@@ -263,29 +986,13 @@ void MemoryContext::FreeMemory()
 		delete h;
 	}
 	m_allocatedChunks.clear();
-	m_chunks.clear();
-
-	vk::FreeMemory(dev, m_memory, nullptr);
-	m_memory = VK_NULL_HANDLE;
-}
-
-bool MemoryContext::MapMemory()
-{
-	TRAP(!IsMapped() && "Dont map memory if it is already mapped");
-	void* memPtr = nullptr;
-	VULKAN_ASSERT(vk::MapMemory(vk::g_vulkanContext.m_device, m_memory, 0, m_totalSize, 0, &memPtr));
-	m_mappedMemory = new MappedMemory(memPtr, this);
-	return memPtr != nullptr;
-}
+	m_dirtyHandles.clear();
 
-void MemoryContext::UnmapMemory()
-{
-	if (!IsMapped())
-		return;
+	while (!m_blocks.empty())
+		FreeBlock(m_blocks.back());
 
-	vk::UnmapMemory(vk::g_vulkanContext.m_device, m_memory);
-	delete m_mappedMemory;
-	m_mappedMemory = nullptr;
+	m_allocatedSize = 0;
+	m_lastBlockSize = 0;
 }
 
 bool MemoryContext::IsBufferMemory() const
@@ -299,63 +1006,55 @@ bool MemoryContext::IsBufferMemory() const
 		return true;
 	}
 }
-bool MemoryContext::CanMapMemory()
+
+bool MemoryContext::IsHostVisible() const
 {
-	return IsBufferMemory() && m_contextType != EMemoryContextType::DeviceLocalBuffer;
+	if (!IsBufferMemory())
+		return false;
+
+	return HasShadowCopy() || (m_desc.m_memoryFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0;
 }
 
-MemoryContext::Chunk MemoryContext::GetFreeChunk(VkDeviceSize size, VkDeviceSize alignment)
+bool MemoryContext::GetFreeChunk(VkDeviceSize size, VkDeviceSize alignment, Chunk& outChunk)
 {
-	auto found = m_chunks.begin();
-	for (; found != m_chunks.end(); ++found)
+	VkDeviceSize offset = 0;
+	VkDeviceSize chunkSize = 0;
+	uint32_t block = TLSFAllocator::InvalidBlock;
+
+	//newest blocks are the biggest ones, so try them first
+	for (auto it = m_blocks.rbegin(); it != m_blocks.rend(); ++it)
 	{
-		if (found->m_size >= size)
-			break; 
+		MemoryBlock* memBlock = *it;
+		if (memBlock->m_size - memBlock->m_allocatedSize < size)
+			continue;
+
+		if (memBlock->m_allocator.Allocate(size, alignment, offset, chunkSize, block))
+		{
+			outChunk = Chunk(offset, chunkSize, block, memBlock);
+			memBlock->m_allocatedSize += chunkSize;
+			return true;
+		}
 	}
-	TRAP(found != m_chunks.end() && "No chunk found for allocation! Too fragmented or not enough memory"); //try to resolve the fragmentation problem
-	TRAP(found->m_offset % alignment == 0 && "Something is wrong! All chunks should be stay aligned!! Maybe size is not from MemoryRequirments struct");
-	
-	if (size % alignment != 0)
-		size += alignment - (size % alignment);
 
-	Chunk foundChunk = *found;
-	m_chunks.erase(found);
-	
-	//split the chunk
-	Chunk allocChunk(foundChunk.m_offset, size);
-	Chunk newChunk(foundChunk.m_offset + allocChunk.m_size, foundChunk.m_size - allocChunk.m_size);
-	if (newChunk.m_size > 0)
-		m_chunks.insert(newChunk);
+	//no room, grow the context. Reserve space for alignment too
+	MemoryBlock* newBlock = AllocateBlock(size + alignment);
+	if (!newBlock || !newBlock->m_allocator.Allocate(size, alignment, offset, chunkSize, block))
+		return false;
 
-	return allocChunk;
+	outChunk = Chunk(offset, chunkSize, block, newBlock);
+	newBlock->m_allocatedSize += chunkSize;
+	return true;
 }
 
-void MemoryContext::FreeChunk(MemoryContext::Chunk chunk)
+void MemoryContext::FreeChunk(const MemoryContext::Chunk& chunk)
 {
-	Chunk newChunk = chunk;
-	auto prevChunk = std::find_if(m_chunks.begin(), m_chunks.end(), [&](const Chunk& other)
-	{
-		return other.m_offset + other.m_size == chunk.m_offset;
-	});
-	   
-	if (prevChunk != m_chunks.end())
-	{
-		newChunk = Chunk(prevChunk->m_offset, prevChunk->m_size + newChunk.m_size);
-		m_chunks.erase(prevChunk);
-	}
-
-	auto nextChunk = std::find_if(m_chunks.begin(), m_chunks.end(), [&](const Chunk& other)
-	{
-		return other.m_offset == chunk.m_offset + chunk.m_size;
-	});
+	MemoryBlock* memBlock = chunk.m_memoryBlock;
+	memBlock->m_allocator.Free(chunk.m_block);
+	memBlock->m_allocatedSize -= chunk.m_size;
 
-	if (nextChunk != m_chunks.end())
-	{
-		newChunk = Chunk(newChunk.m_offset, newChunk.m_size + nextChunk->m_size);
-		m_chunks.erase(nextChunk);
-	}
-	if (newChunk.m_size > 0)
-		m_chunks.insert(newChunk);
+	//give empty blocks back to the driver, but keep the last one so we don't alloc/free every frame
+	if (memBlock->m_allocatedSize == 0 && m_blocks.size() > 1)
+		FreeBlock(memBlock);
 }
 
 BufferHandle* MemoryContext::CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage)
@@ -365,7 +1064,7 @@ BufferHandle* MemoryContext::CreateBuffer(VkDeviceSize size, VkBufferUsageFlags
 	crtInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
 	crtInfo.flags = 0;
 	crtInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-	crtInfo.usage = usage;
+	crtInfo.usage = (HasShadowCopy()) ? usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT : usage;
 	crtInfo.size = size;
 
 	VkBuffer buffer;
@@ -374,14 +1073,20 @@ BufferHandle* MemoryContext::CreateBuffer(VkDeviceSize size, VkBufferUsageFlags
 	VkMemoryRequirements memReq;
 	vk::GetBufferMemoryRequirements(vk::g_vulkanContext.m_device, buffer, &memReq);
 
-	uint32_t buffMemIndex = vk::SVUlkanContext::GetMemTypeIndex(memReq.memoryTypeBits, m_memoryFlags);
+	uint32_t buffMemIndex = vk::SVUlkanContext::GetMemTypeIndex(memReq.memoryTypeBits, m_desc.m_memoryFlags);
 	TRAP(buffMemIndex == m_memoryTypeIndex && "Memory req for this buffer is not in the same heap");
 	//std::cout << "For buffer " << buffer << " in context memory " << (unsigned int)m_contextType << " buffer memory index: " << buffMemIndex << " with memory index: " << m_memoryTypeIndex << std::endl;
 
-	Chunk memoryChunk = GetFreeChunk(memReq.size, memReq.alignment);
+	Chunk memoryChunk;
+	if (!GetFreeChunk(memReq.size, memReq.alignment, memoryChunk))
+	{
+		std::cout << "Out of memory in context " << (unsigned int)m_contextType << " for a buffer of " << memReq.size << " bytes" << std::endl;
+		vk::DestroyBuffer(vk::g_vulkanContext.m_device, buffer, nullptr);
+		return nullptr;
+	}
 
 	//bind buffer to memory
-	VULKAN_ASSERT(vk::BindBufferMemory(vk::g_vulkanContext.m_device, buffer, m_memory, memoryChunk.m_offset));
+	VULKAN_ASSERT(vk::BindBufferMemory(vk::g_vulkanContext.m_device, buffer, memoryChunk.m_memoryBlock->m_memory, memoryChunk.m_offset));
 	VkDeviceSize alignment;
 	if (usage & (VK_BUFFER_USAGE_UNIFORM_TEXEL_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_TEXEL_BUFFER_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT))
 		alignment = memReq.alignment; //if is one of the above buffers, we use aligmnent when create sub buffers.
@@ -389,9 +1094,11 @@ BufferHandle* MemoryContext::CreateBuffer(VkDeviceSize size, VkBufferUsageFlags
 		alignment = 0; // for index and vertex buffers. It seems that these buffers dont have to be aligned when we suballocate
 
 	BufferHandle* hBufferHandle = new BufferHandle(buffer, size, alignment, this);
+	if (memoryChunk.m_memoryBlock->m_mappedPtr)
+		hBufferHandle->m_mappedPtr = memoryChunk.m_memoryBlock->m_mappedPtr + memoryChunk.m_offset;
 
 	m_allocatedChunks.emplace(hBufferHandle, memoryChunk);
-	m_allocatedSize += memReq.size;
+	m_allocatedSize += memoryChunk.m_size;
 
 	return hBufferHandle;
 }
@@ -405,16 +1112,22 @@ ImageHandle* MemoryContext::CreateImage(const VkImageCreateInfo& crtInfo, const
 	VkMemoryRequirements memReq;
 	vk::GetImageMemoryRequirements(dev, image, &memReq);
 
-	uint32_t imgMemIndex = vk::SVUlkanContext::GetMemTypeIndex(memReq.memoryTypeBits, m_memoryFlags);
+	uint32_t imgMemIndex = vk::SVUlkanContext::GetMemTypeIndex(memReq.memoryTypeBits, m_desc.m_memoryFlags);
 	TRAP(imgMemIndex == m_memoryTypeIndex && "Memory req for this image is not in the same heap");
 	
-	Chunk memoryChunk = GetFreeChunk(memReq.size, memReq.alignment);
+	Chunk memoryChunk;
+	if (!GetFreeChunk(memReq.size, memReq.alignment, memoryChunk))
+	{
+		std::cout << "Out of memory in context " << (unsigned int)m_contextType << " for image " << debugName << " of " << memReq.size << " bytes" << std::endl;
+		vk::DestroyImage(dev, image, nullptr);
+		return nullptr;
+	}
 	//bind image to memory
-	VULKAN_ASSERT(vk::BindImageMemory(dev, image, m_memory, memoryChunk.m_offset));
+	VULKAN_ASSERT(vk::BindImageMemory(dev, image, memoryChunk.m_memoryBlock->m_memory, memoryChunk.m_offset));
 
 	ImageHandle* hImageHandle = new ImageHandle(image, memReq.size, memReq.alignment, crtInfo, this);
 	m_allocatedChunks.emplace(hImageHandle, memoryChunk);
-	m_allocatedSize += memReq.size;
+	m_allocatedSize += memoryChunk.m_size;
 
 	if (!debugName.empty())
 		SetObjectDebugName(image, debugName);
@@ -432,11 +1145,82 @@ void MemoryContext::FreeHandle(Handle* handle)
 	}
 
 	Chunk chunk = found->second;
-	FreeChunk(chunk);
-	m_allocatedSize -= chunk.m_size;
 	m_allocatedChunks.erase(found);
+	//the dirty sub buffers go with their root
+	m_dirtyHandles.erase(std::remove_if(m_dirtyHandles.begin(), m_dirtyHandles.end(), [handle](Handle* dirty) { return dirty->GetRootParent() == handle; }), m_dirtyHandles.end());
+
+	//destroy the vulkan object before its memory block can be released
 	handle->FreeResources();
 	delete handle;
+
+	FreeChunk(chunk);
+	m_allocatedSize -= chunk.m_size;
+}
+
+void MemoryContext::MarkDirty(Handle* handle)
+{
+	TRAP(!handle->m_dirty);
+	handle->m_dirty = true;
+
+	//coherent host memory needs nothing, the flag stays set so GetPtr doesn't come here again
+	if (HasShadowCopy() || !IsCoherent())
+		m_dirtyHandles.push_back(handle);
+}
+
+VkDeviceSize MemoryContext::GetDirtySize() const
+{
+	VkDeviceSize totalSize = 0;
+	for (auto handle : m_dirtyHandles)
+		totalSize += (handle->GetSize() + 15) & ~VkDeviceSize(15);
+
+	return totalSize;
+}
+
+void MemoryContext::RecordShadowUploads(VkCommandBuffer cmdBuffer, VkBuffer staggingBuffer, const StagingRing::Allocation& stagging, VkDeviceSize& inOutStaggingOffset)
+{
+	if (m_dirtyHandles.empty())
+		return;
+
+	TRAP(HasShadowCopy() && IsBufferMemory());
+
+	for (auto handle : m_dirtyHandles)
+	{
+		VkDeviceSize size = handle->GetSize();
+		TRAP(inOutStaggingOffset + size <= stagging.m_size);
+
+		memcpy(stagging.m_ptr + inOutStaggingOffset, handle->m_mappedPtr, (size_t)size);
+
+		//the offset of a sub buffer is inside its root, which has the VkBuffer
+		VkBufferCopy region;
+		region.srcOffset = stagging.m_offset + inOutStaggingOffset;
+		region.dstOffset = handle->GetOffset();
+		region.size = size;
+		vk::CmdCopyBuffer(cmdBuffer, staggingBuffer, static_cast<BufferHandle*>(handle)->Get(), 1, &region);
+
+		handle->m_dirty = false;
+		inOutStaggingOffset += (size + 15) & ~VkDeviceSize(15);
+	}
+	m_dirtyHandles.clear();
+}
+
+void MemoryContext::FlushDirtyHandles()
+{
+	if (m_dirtyHandles.empty() || HasShadowCopy())
+		return;
+
+	TRAP(!IsCoherent());
+
+	std::vector<VkMappedMemoryRange> ranges;
+	ranges.reserve(m_dirtyHandles.size());
+	for (auto handle : m_dirtyHandles)
+	{
+		const Chunk& chunk = m_allocatedChunks[handle->GetRootParent()];
+		ranges.push_back(CreateFlushRange(chunk.m_memoryBlock->m_memory, chunk.m_memoryBlock->m_size, chunk.m_offset + handle->GetOffset(), handle->GetSize()));
+		handle->m_dirty = false;
+	}
+	m_dirtyHandles.clear();
+
+	VULKAN_ASSERT(vk::FlushMappedMemoryRanges(vk::g_vulkanContext.m_device, (uint32_t)ranges.size(), ranges.data()));
 }
 
 ///////////////////////////////////////////////////////////////////////////////////
@@ -444,22 +1228,43 @@ void MemoryContext::FreeHandle(Handle* handle)
 ///////////////////////////////////////////////////////////////////////////////////
 
 MemoryManager::MemoryManager()
+	: m_frameIndex(0)
 {
 	for (unsigned int i = 0; i < (unsigned int)EMemoryContextType::Count; ++i)
 	{
 		m_memoryContexts[i] = new MemoryContext((EMemoryContextType)i);
 	}
-	m_memoryContexts[(unsigned int)EMemoryContextType::StagginBuffer]->AllocateMemory(4 << 20, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-	m_memoryContexts[(unsigned int)EMemoryContextType::DeviceLocalBuffer]->AllocateMemory(64 << 20, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-	m_memoryContexts[(unsigned int)EMemoryContextType::Framebuffers]->AllocateMemory(256 << 20, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-	m_memoryContexts[(unsigned int)EMemoryContextType::Textures]->AllocateMemory(256 << 20, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-	m_memoryContexts[(unsigned int)EMemoryContextType::UniformBuffers]->AllocateMemory(64 << 20, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-	m_memoryContexts[(unsigned int)EMemoryContextType::IndirectDrawCmdBuffer]->AllocateMemory(2 << 20, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-	m_memoryContexts[(unsigned int)EMemoryContextType::UI]->AllocateMemory(2 << 20, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+	const VkMemoryPropertyFlags deviceMemory = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+	const VkDeviceSize MB = 1 << 20;
+
+	//flags, min block size, growth factor, max block size, cap, shadow copy
+	//the contexts written every frame by the cpu have a shadow copy, so the real buffers can be device local
+	const MemoryContextDesc descs[(unsigned int)EMemoryContextType::Count] =
+	{
+		{ deviceMemory,	16 * MB,	2.0f,	128 * MB,	0,			false },	//DeviceLocalBuffer
+		{ deviceMemory,	64 * MB,	2.0f,	256 * MB,	0,			false },	//Framebuffers
+		{ deviceMemory,	32 * MB,	2.0f,	256 * MB,	0,			false },	//Textures
+		{ deviceMemory,	4 * MB,		2.0f,	32 * MB,	256 * MB,	true },		//UniformBuffers
+		{ deviceMemory,	1 * MB,		2.0f,	8 * MB,		32 * MB,	true },		//UI
+	};
+
+	for (unsigned int i = 0; i < (unsigned int)EMemoryContextType::Count; ++i)
+		m_memoryContexts[i]->Init(descs[i]);
+
+	//bigger uploads are split over frames, so this caps the upload speed, not the resource size
+	m_stagingRing.Init(64 * MB);
+	m_frameAllocator.Init(16 * MB);
 }
 
 MemoryManager::~MemoryManager()
 {
+	//FreeMemory releases all the handles, the pending ones too
+	for (auto& pendingHandles : m_pendingFreeHandles)
+		pendingHandles.clear();
+	m_stagingRing.Destroy();
+	m_frameAllocator.Destroy();
+
 	for (unsigned int i = 0; i < (unsigned int)EMemoryContextType::Count; ++i)
 	{
 		m_memoryContexts[i]->FreeMemory();
@@ -470,11 +1275,9 @@ MemoryManager::~MemoryManager()
 BufferHandle* MemoryManager::CreateBuffer(EMemoryContextType context, VkDeviceSize size, VkBufferUsageFlags usage)
 {
 	MemoryContext* memContext = m_memoryContexts[(unsigned int)context];
-	if (memContext->IsBufferMemory())
-		return memContext->CreateBuffer(size, usage);
-	
-	TRAP(false && "Trying to create a buffer in an image memory context!");
-	return nullptr;
+	TRAP(memContext->IsBufferMemory() && "Trying to create a buffer in an image memory context!");
+
+	return memContext->CreateBuffer(size, usage);
 }
 
 BufferHandle* MemoryManager::CreateBuffer(EMemoryContextType context, std::vector<VkDeviceSize> sizes, VkBufferUsageFlags usage)
@@ -495,45 +1298,107 @@ VkDeviceSize MemoryManager::ComputeTotalSize(const std::vector<VkDeviceSize>& si
 ImageHandle* MemoryManager::CreateImage(EMemoryContextType context, const VkImageCreateInfo& imgInfo, const std::string& debugName)
 {
 	MemoryContext* memContext = m_memoryContexts[(unsigned int)context];
-	if (!memContext->IsBufferMemory())
-		return memContext->CreateImage(imgInfo, debugName);
+	TRAP(!memContext->IsBufferMemory() && "Trying to create an image in a buffer memory context!");
 
-	TRAP(false && "Trying to create an image in a buffer memory context!");
-	return nullptr;
+	return memContext->CreateImage(imgInfo, debugName);
 }
 
 void MemoryManager::FreeHandle(Handle* handle)
 {
-	handle->GetMemoryContext()->FreeHandle(handle);
+	m_pendingFreeHandles[m_frameIndex].push_back(handle);
 }
 
-void MemoryManager::AllocMemory(EMemoryContextType context, VkDeviceSize size)
+void MemoryManager::ReleasePendingHandles(uint32_t frameIndex)
 {
-	m_memoryContexts[(unsigned int)context]->AllocateMemory(size, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT); //Let it be. for now its ok
+	for (auto handle : m_pendingFreeHandles[frameIndex])
+		handle->GetMemoryContext()->FreeHandle(handle);
+
+	m_pendingFreeHandles[frameIndex].clear();
 }
 
-void MemoryManager::FreeMemory(EMemoryContextType context)
+void MemoryManager::BeginFrame(uint32_t frameIndex)
 {
-	m_memoryContexts[(unsigned int)context]->FreeMemory();
+	TRAP(frameIndex < FRAMES_IN_FLIGHT);
+	m_frameIndex = frameIndex;
+	ReleasePendingHandles(m_frameIndex);
+	m_stagingRing.Update();
+	m_frameAllocator.BeginFrame(m_frameIndex);
 }
 
-bool MemoryManager::MapMemoryContext(EMemoryContextType context)
+void MemoryManager::EndFrame(VkFence frameFence)
 {
-	MemoryContext* memContext = m_memoryContexts[(unsigned int)context];
-	TRAP(memContext->CanMapMemory() && "Memory context cannot be mapped!!");
-	if (!memContext->CanMapMemory()) //this is not mappable
-		return false;
+	m_stagingRing.Retire(frameFence);
+}
+
+void MemoryManager::RecordFrameUploads(VkCommandBuffer cmdBuffer)
+{
+	VkDeviceSize totalSize = 0;
+	for (auto context : m_memoryContexts)
+		if (context->HasShadowCopy())
+			totalSize += context->GetDirtySize();
+
+	if (totalSize > 0)
+	{
+		//the real buffers are shared by all the frames, so the copies wait for the previous frames to stop reading them.
+		//Only the stages that use the shadow copied contexts are waited on, the rest of the previous frame (the attachment
+		//writes, the copy in the present image) still overlaps this one. Nothing is waited on when nothing changed, and only
+		//the written ranges are copied. The indirect commands are not here, they are reset on the gpu (see BatchManager::Cull)
+		VkMemoryBarrier preCopyBarrier;
+		cleanStructure(preCopyBarrier);
+		preCopyBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		preCopyBarrier.srcAccessMask = 0; //only reads to wait for
+		preCopyBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		vk::CmdPipelineBarrier(cmdBuffer, s_shadowCopyStages, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &preCopyBarrier, 0, nullptr, 0, nullptr);
+
+		//the frame can't go without its data, so these uploads are never split
+		StagingRing::Allocation stagging;
+		bool allocated = m_stagingRing.Allocate(totalSize, 16, stagging);
+		TRAP(allocated && "Not enough stagging memory for the frame uploads");
+
+		VkDeviceSize staggingOffset = 0;
+		for (auto context : m_memoryContexts)
+			if (context->HasShadowCopy())
+				context->RecordShadowUploads(cmdBuffer, m_stagingRing.GetBuffer(), stagging, staggingOffset);
+
+		VkMemoryBarrier postCopyBarrier;
+		cleanStructure(postCopyBarrier);
+		postCopyBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		postCopyBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		postCopyBarrier.dstAccessMask = VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+		vk::CmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, s_shadowCopyStages, 0, 1, &postCopyBarrier, 0, nullptr, 0, nullptr);
+	}
 
-	return memContext->MapMemory();
+	FlushHostWrites();
 }
 
-void MemoryManager::UnmapMemoryContext(EMemoryContextType context)
+void MemoryManager::FlushHostWrites()
 {
-	m_memoryContexts[(unsigned int)context]->UnmapMemory();
+	for (auto context : m_memoryContexts)
+		if (!context->IsCoherent())
+			context->FlushDirtyHandles();
+
+	m_stagingRing.Flush();
+	m_frameAllocator.Flush();
 }
 
-bool MemoryManager::IsMemoryMapped(EMemoryContextType context) const
+void MemoryManager::AllocMemory(EMemoryContextType context, VkDeviceSize size)
 {
-	return m_memoryContexts[(unsigned int)context]->IsMapped();
+	bool allocated = m_memoryContexts[(unsigned int)context]->AllocateMemory(size);
+	TRAP(allocated && "Failed to preallocate memory for context");
+}
+
+void MemoryManager::FreeMemory(EMemoryContextType context)
+{
+	MemoryContext* memContext = m_memoryContexts[(unsigned int)context];
+
+	//FreeMemory releases all the handles of the context, so forget the pending ones
+	for (auto& pendingHandles : m_pendingFreeHandles)
+	{
+		pendingHandles.erase(std::remove_if(pendingHandles.begin(), pendingHandles.end(), [memContext](Handle* h)
+		{
+			return h->GetMemoryContext() == memContext;
+		}), pendingHandles.end());
+	}
+	memContext->FreeMemory();
 }
 
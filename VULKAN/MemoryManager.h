@@ -5,24 +5,19 @@
 #include "defines.h"
 
 #include <vector>
-#include <set>
 #include <utility>
 #include <array>
 #include <algorithm>
+#include <deque>
 #include <unordered_map>
 #include <string>
 
 enum class EMemoryContextType
 {
-	StagginBuffer, //used for stagging. After a copy from stage -> device is complete the memory should be freed by application
 	DeviceLocalBuffer,
-	MeshStaggingBuffer,
 	Framebuffers, //device local memory
 	Textures, //device local memory
-	StaggingTextures, //device local for stagging textures
 	UniformBuffers,
-	IndirectDrawCmdBuffer,
-	BatchStaggingBuffer,
 	UI,
 	Count
 };
@@ -37,25 +32,31 @@ public:
 	Handle* GetRootParent() { return ((m_parent)? m_parent->GetRootParent() : this); }
 	MemoryContext* GetMemoryContext() { return m_memoryContext; }
 
+	//the memory of the host visible contexts is mapped for their whole life, so this is only a pointer read.
+	//The handle is marked dirty: uploaded if the context has a shadow copy, flushed if the memory is not coherent
 	template<class RetType>
 	RetType GetPtr();
 
 protected:
 	Handle(VkDeviceSize size, VkDeviceSize alignment, MemoryContext* context)
 		: m_size(size)
-		, m_alignment(alignment)
 		, m_offset(0)
+		, m_alignment(alignment)
 		, m_parent(nullptr)
 		, m_memoryContext(context)
+		, m_mappedPtr(nullptr)
+		, m_dirty(false)
 	{
 	}
 
 	Handle(Handle* parrent, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize offset)
 		: m_size(size)
-		, m_alignment(alignment)
 		, m_offset(offset)
+		, m_alignment(alignment)
 		, m_parent(parrent)
 		, m_memoryContext(parrent->m_memoryContext)
+		, m_mappedPtr((parrent->GetRootParent()->m_mappedPtr) ? parrent->GetRootParent()->m_mappedPtr + offset : nullptr)
+		, m_dirty(false)
 	{
 
 	}
@@ -71,6 +72,8 @@ protected:
 	Handle*						m_parent;
 
 	MemoryContext*				m_memoryContext;
+	uint8_t*					m_mappedPtr; //nullptr if the context is not host visible
+	bool						m_dirty; //written since the last upload/flush. Only this handle's range, all of it for a root
 };
 
 template<class VkType>
@@ -172,120 +175,310 @@ protected:
 	VkExtent3D						m_dimensions;
 };
 
-class MappedMemory
+//Two level segregated fit allocator. Only does the bookkeeping of offsets inside a memory range,
+//it doesn't know anything about vulkan memory. Allocate/Free are O(1) (bitmap search + free lists)
+class TLSFAllocator
 {
-	friend class MemoryContext;
 public:
-	template<class T>
-	T GetPtr(Handle* handle);
+	static const uint32_t InvalidBlock = ~0u;
 
+	TLSFAllocator();
+	~TLSFAllocator();
 
+	void Init(VkDeviceSize size);
+	void Reset();
+
+	//returns false if there is no free block big enough (out of memory or too fragmented)
+	bool Allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& outOffset, VkDeviceSize& outSize, uint32_t& outBlock);
+	void Free(uint32_t block);
+	//the new range is added at the end. The allocated blocks keep their offsets
+	void Grow(VkDeviceSize newSize);
+
+	VkDeviceSize GetTotalSize() const { return m_totalSize; }
 private:
-	MappedMemory(void* memPtr, MemoryContext* parentContext);
-	virtual ~MappedMemory();
+	enum
+	{
+		SLIndexLog2 = 5,
+		SLIndexCount = 1 << SLIndexLog2,
+		FLIndexShift = SLIndexLog2,
+		FLIndexCount = 64,
+		SmallBlockSize = 1 << FLIndexShift
+	};
 
+	struct Block
+	{
+		VkDeviceSize	m_offset;
+		VkDeviceSize	m_size;
+		uint32_t		m_prevPhys;
+		uint32_t		m_nextPhys;
+		uint32_t		m_prevFree;
+		uint32_t		m_nextFree;
+		bool			m_isFree;
+	};
+
+	void Mapping(VkDeviceSize size, uint32_t& fl, uint32_t& sl) const;
+	uint32_t FindFreeBlock(VkDeviceSize size) const;
+	void InsertFreeBlock(uint32_t block);
+	void RemoveFreeBlock(uint32_t block);
+	uint32_t SplitBlock(uint32_t block, VkDeviceSize size);
+	void MergeBlocks(uint32_t first, uint32_t second);
+	uint32_t NewBlock();
+	void ReleaseBlock(uint32_t block);
 private:
-	MemoryContext*	m_parentMemoryContext;
-	void*			m_memPtr;
+	std::vector<Block>									m_blocks;
+	std::vector<uint32_t>								m_unusedBlocks; //indexes in m_blocks that can be reused
+
+	uint64_t											m_flBitmap;
+	std::array<uint32_t, FLIndexCount>					m_slBitmaps;
+	std::array<std::array<uint32_t, SLIndexCount>, FLIndexCount>	m_freeLists;
+
+	VkDeviceSize										m_totalSize;
+};
+
+//One buffer, persistently mapped, for the stagging of all the uploads. Allocations are taken linearly and given back
+//in the same order, when the fence of the submit that used them signals. No vulkan memory is allocated per upload
+class StagingRing
+{
+public:
+	struct Allocation
+	{
+		VkDeviceSize	m_offset; //inside the ring buffer
+		VkDeviceSize	m_size;
+		uint8_t*		m_ptr;
+	};
+
+	StagingRing();
+	~StagingRing();
+
+	void Init(VkDeviceSize size);
+	void Destroy();
+
+	VkBuffer GetBuffer() const { return m_buffer; }
+	VkDeviceSize GetSize() const { return m_size; }
+
+	//returns false if there is no room now. Upload less (see GetMaxAllocation) or try again in a next frame
+	bool Allocate(VkDeviceSize size, VkDeviceSize alignment, Allocation& outAllocation);
+	//the biggest allocation that fits now
+	VkDeviceSize GetMaxAllocation(VkDeviceSize alignment);
+
+	//the allocations made since the last call are given back when the fence signals.
+	//Don't reset the fence before the ring saw it signaled, or the space comes back only when it signals again
+	void Retire(VkFence fence);
+	//gives back the space of the signaled fences
+	void Update();
+	//makes the writes since the last flush visible to the gpu. Nothing to do for coherent memory. Call it before the submit
+	void Flush();
+private:
+	struct Retirement
+	{
+		VkFence			m_fence;
+		VkDeviceSize	m_end; //the tail moves here
+		VkDeviceSize	m_size; //used bytes, with padding and the unused end of the buffer on wrap
+	};
+
+	bool FindRoom(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& outOffset) const;
+private:
+	VkBuffer					m_buffer;
+	VkDeviceMemory				m_memory;
+	uint8_t*					m_mappedPtr;
+	VkDeviceSize				m_size;
+	bool						m_isCoherent;
+
+	VkDeviceSize				m_head; //next allocation
+	VkDeviceSize				m_tail; //oldest allocation in use
+	VkDeviceSize				m_usedSize;
+	VkDeviceSize				m_unretiredSize; //allocated since the last Retire
+	VkDeviceSize				m_flushStart; //first allocated byte not flushed
+	VkDeviceSize				m_unflushedSize;
+	std::deque<Retirement>		m_retirements;
+};
+
+//Memory for the data the cpu writes every frame (uniforms, per object data, indirect commands). One buffer, persistently mapped,
+//split in a region per frame in flight. A region is reused only after the fence of its frame was waited, so the cpu never writes
+//data the gpu still reads. Allocations are a pointer bump and are bound with dynamic offsets, the descriptors are written once
+class FrameAllocator
+{
+public:
+	struct Allocation
+	{
+		uint32_t		m_offset; //from the start of the buffer, it's the dynamic offset
+		VkDeviceSize	m_size;
+		uint8_t*		m_ptr;
+	};
+	//for the callers that keep the offset of an allocation that failed
+	static const uint32_t InvalidOffset = UINT32_MAX;
+
+	FrameAllocator();
+	~FrameAllocator();
+
+	void Init(VkDeviceSize regionSize);
+	void Destroy();
+
+	//the frame that used this region is finished
+	void BeginFrame(uint32_t frameIndex);
+
+	//the alignment comes from the usage (VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT).
+	//The allocation is valid only for the current frame. Returns false when the region of the frame is full; the buffer can't
+	//grow since the descriptors point at it, so the caller skips its work or keeps it for the next frame
+	bool Allocate(VkDeviceSize size, VkBufferUsageFlags usage, Allocation& outAllocation);
+	//what an allocation with this usage can still get this frame
+	VkDeviceSize GetFreeSize(VkBufferUsageFlags usage) const;
+	//for the descriptors of the *_DYNAMIC types. range is what the shader sees from the dynamic offset
+	VkDescriptorBufferInfo GetDescriptor(VkDeviceSize range) const;
+	//makes the allocations since the last flush visible to the gpu. Nothing to do for coherent memory. Call it before the submit
+	void Flush();
+
+	VkBuffer GetBuffer() const { return m_buffer; }
+	//counts the calls to BeginFrame. Tells if an allocation kept by the caller is from the current frame
+	uint64_t GetFrameNumber() const { return m_frameNumber; }
+private:
+	VkDeviceSize GetAlignment(VkBufferUsageFlags usage) const;
+private:
+	VkBuffer					m_buffer;
+	VkDeviceMemory				m_memory;
+	uint8_t*					m_mappedPtr;
+	VkDeviceSize				m_regionSize;
+	bool						m_isCoherent;
+
+	VkDeviceSize				m_regionStart;
+	VkDeviceSize				m_regionOffset; //next allocation, from m_regionStart
+	VkDeviceSize				m_flushedOffset; //from m_regionStart
+	uint64_t					m_frameNumber;
+};
+
+//how a memory context grows. A context starts with no memory and allocates blocks on demand
+struct MemoryContextDesc
+{
+	VkMemoryPropertyFlags	m_memoryFlags;
+	VkDeviceSize			m_minBlockSize; //size of the first block
+	float					m_growthFactor; //every new block is bigger than the last one with this factor
+	VkDeviceSize			m_maxBlockSize; //a block can be bigger than this only if a single resource needs it
+	VkDeviceSize			m_maxTotalSize; //cap for all the blocks of the context. 0 means no cap
+	bool					m_shadowCopy; //cpu writes go in a host copy and the dirty buffers are uploaded at the start of every frame. Frames in flight don't stomp each other data
 };
 
 class MemoryContext
 {
-	friend class MappedMemory;
 public:
 	MemoryContext(EMemoryContextType type);
 	virtual ~MemoryContext();
 
-	void AllocateMemory(VkDeviceSize size, VkMemoryPropertyFlags flags);
+	void Init(const MemoryContextDesc& desc);
+	//preallocate a block of at least this size. Blocks are allocated on demand anyway
+	bool AllocateMemory(VkDeviceSize size);
 	void FreeMemory();
 
+	//return nullptr if the context is out of memory
 	BufferHandle* CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage);
 	ImageHandle* CreateImage(const VkImageCreateInfo& crtInfo, const std::string& debugName = std::string());
 
 	void FreeHandle(Handle* handle);
 
-	bool CanMapMemory();
-	bool MapMemory();
-	void UnmapMemory();
 	bool IsBufferMemory() const;
-
-	bool IsMapped() const { return m_mappedMemory != nullptr; }
-	MappedMemory* GetMappedMemory() const { return (IsMapped()) ? m_mappedMemory : nullptr; }
+	//the cpu can write the buffers of this context, directly or through the shadow copy. The blocks are mapped when allocated
+	bool IsHostVisible() const;
+	bool IsCoherent() const { return m_isCoherent; }
+
+	VkDeviceSize GetTotalSize() const { return m_totalSize; }
+	VkDeviceSize GetAllocatedSize() const { return m_allocatedSize; }
+
+	bool HasShadowCopy() const { return m_desc.m_shadowCopy; }
+	//called once per handle, until its data is uploaded or flushed. Only the range of the handle is uploaded/flushed
+	void MarkDirty(Handle* handle);
+	VkDeviceSize GetDirtySize() const;
+	//copy the dirty ranges from the host copy in the staging allocation and record the copies staging -> real buffers
+	void RecordShadowUploads(VkCommandBuffer cmdBuffer, VkBuffer staggingBuffer, const StagingRing::Allocation& stagging, VkDeviceSize& inOutStaggingOffset);
+	//flush the dirty ranges of a non coherent context
+	void FlushDirtyHandles();
 private:
-	struct Chunk
+	//one vkAllocateMemory
+	struct MemoryBlock
 	{
-		Chunk() : m_offset(0), m_size(0){}
-		Chunk(VkDeviceSize offset, VkDeviceSize size) : m_offset(offset), m_size(size) {}
+		VkDeviceMemory		m_memory;
+		VkDeviceSize		m_size;
+		VkDeviceSize		m_allocatedSize;
+		uint8_t*			m_mappedPtr; //the shadow memory for contexts with shadow copy
+		uint8_t*			m_shadowMemory; //only for contexts with shadow copy
+		TLSFAllocator		m_allocator;
+	};
 
-		bool operator< (const Chunk& other) const { return m_offset < other.m_offset; }
-		bool operator!=(const Chunk& other) const { return m_offset != other.m_offset || m_size != other.m_size; }
+	struct Chunk
+	{
+		Chunk() : m_offset(0), m_size(0), m_block(TLSFAllocator::InvalidBlock), m_memoryBlock(nullptr){}
+		Chunk(VkDeviceSize offset, VkDeviceSize size, uint32_t block, MemoryBlock* memoryBlock) : m_offset(offset), m_size(size), m_block(block), m_memoryBlock(memoryBlock) {}
 
-		VkDeviceSize	m_offset;
+		VkDeviceSize	m_offset; //offset inside m_memoryBlock
 		VkDeviceSize	m_size;
+		uint32_t		m_block; //block index inside the allocator
+		MemoryBlock*	m_memoryBlock;
 	};
 
-	Chunk GetFreeChunk(VkDeviceSize size, VkDeviceSize alignment);
-	void FreeChunk(Chunk chunk);
+	bool GetFreeChunk(VkDeviceSize size, VkDeviceSize alignment, Chunk& outChunk);
+	void FreeChunk(const Chunk& chunk);
+
+	MemoryBlock* AllocateBlock(VkDeviceSize minSize);
+	void FreeBlock(MemoryBlock* block);
+	VkDeviceSize ComputeNextBlockSize(VkDeviceSize minSize) const;
 private:
+	static const uint32_t InvalidMemoryTypeIndex = UINT32_MAX; //until Init picks the memory type
+
 	std::unordered_map<Handle*, Chunk>					m_allocatedChunks;
-	std::set<Chunk>										m_chunks;
+	std::vector<Handle*>								m_dirtyHandles;
+	std::vector<MemoryBlock*>							m_blocks;
+	MemoryContextDesc									m_desc;
+	VkDeviceSize										m_lastBlockSize;
 
-	VkDeviceMemory										m_memory;
 	VkDeviceSize										m_totalSize;
 	VkDeviceSize										m_allocatedSize;
 	uint32_t											m_memoryTypeIndex;
-	MappedMemory*										m_mappedMemory;
-	VkMemoryPropertyFlags								m_memoryFlags;
+	bool												m_isCoherent;
 
 	EMemoryContextType									m_contextType;
 };
 
-template<class T>
-T MappedMemory::GetPtr(Handle* handle)
-{
-	//change this function is shit
-	auto& allocatedChunks = m_parentMemoryContext->m_allocatedChunks;
-	auto it = allocatedChunks.find(handle->GetRootParent());
-	if (it == allocatedChunks.end())
-	{
-		TRAP(false && "This Handle is not from this memory context");
-		return nullptr;
-	}
-
-	VkDeviceSize relativeOffset = handle->GetOffset(); //handle can be a child sub allocated from a bigger resource
-	const MemoryContext::Chunk& handleAllocatedChunk = it->second;
-	VkDeviceSize absoluteOffset = handleAllocatedChunk.m_offset;
-	uint8_t* bufferMemPtr = (uint8_t*)m_memPtr + absoluteOffset + relativeOffset;
-	return (T)bufferMemPtr;
-}
-
 template<class RetType>
 RetType Handle::GetPtr()
 {
-	MappedMemory* mapMem = m_memoryContext->GetMappedMemory();
-	TRAP(mapMem && "This memory for this handle is not mapped!!");
-	return mapMem->GetPtr<RetType>(this);
+	TRAP(m_mappedPtr && "The memory of this handle is not host visible!!");
+	//we don't know what the caller writes, so the whole range of this handle is uploaded/flushed. A sub buffer of a dirty
+	//root is already covered
+	if (!m_dirty && !GetRootParent()->m_dirty)
+		m_memoryContext->MarkDirty(this);
+
+	return (RetType)m_mappedPtr;
 }
 
 class MemoryManager : public Singleton<MemoryManager>
 {
 	friend class Singleton<MemoryManager>;
 public:
-	//use this function if dont want to suballocate
+	//use this function if dont want to suballocate. Returns nullptr if the context is out of memory
 	BufferHandle* CreateBuffer(EMemoryContextType context, VkDeviceSize size, VkBufferUsageFlags usage);
 	//use this function when you want to suballocate. This method will calculate a total size for you
 	BufferHandle* CreateBuffer(EMemoryContextType context, std::vector<VkDeviceSize> sizes, VkBufferUsageFlags usage);
+	//nullptr if the context is out of memory
 	ImageHandle* CreateImage(EMemoryContextType context, const VkImageCreateInfo& imgInfo, const std::string& debugName = std::string());
 
+	//the handle is released when the current frame slot is reused, so the frames in flight can still use it
 	void FreeHandle(Handle* handle);
 
+	//call it after the fence of the frame slot was waited, before it's reset
+	void BeginFrame(uint32_t frameIndex);
+	//record the uploads for the contexts with shadow copy. Must be executed before the frame command buffer.
+	//Flushes the host writes of the frame too, so call it after all the writes
+	void RecordFrameUploads(VkCommandBuffer cmdBuffer);
+	//makes the cpu writes to non coherent memory visible to the gpu (contexts, stagging ring, frame allocator). Call it before every submit that reads them
+	void FlushHostWrites();
+	//the stagging used by the frame is given back when this fence signals
+	void EndFrame(VkFence frameFence);
+
+	StagingRing* GetStagingRing() { return &m_stagingRing; }
+	FrameAllocator* GetFrameAllocator() { return &m_frameAllocator; }
+
+	//preallocate memory for a context. Contexts grow by themselves, this is useful for the ones that are freed after every use
 	void AllocMemory(EMemoryContextType type, VkDeviceSize size);
 	void FreeMemory(EMemoryContextType type);
 
-	bool MapMemoryContext(EMemoryContextType context); //TODO change to return the new mapped memory
-	void UnmapMemoryContext(EMemoryContextType context);
-	bool IsMemoryMapped(EMemoryContextType context) const;
-
 	static VkDeviceSize ComputeTotalSize(const std::vector<VkDeviceSize>& sizes);
 protected:
 	MemoryManager();
@@ -294,7 +487,14 @@ protected:
 	MemoryManager(const MemoryManager&);
 	MemoryManager& operator= (const MemoryManager&);
 
+private:
+	void ReleasePendingHandles(uint32_t frameIndex);
 private:
 	std::array<MemoryContext*, (size_t)EMemoryContextType::Count>	m_memoryContexts;
+
+	uint32_t														m_frameIndex;
+	std::array<std::vector<Handle*>, FRAMES_IN_FLIGHT>				m_pendingFreeHandles;
+	StagingRing														m_stagingRing;
+	FrameAllocator													m_frameAllocator;
 };
 
@@ -1,55 +1,287 @@
 #include "Mesh.h"
 
 #include <fstream>
+#include <iostream>
+#include <algorithm>
 
 #include "defines.h"
 #include "MeshLoader.h"
 #include "MemoryManager.h"
+#include "VertexCompression.h"
 
 
+static VkBufferMemoryBarrier CreateRangeBarrier(const VkDescriptorBufferInfo& range, VkAccessFlags srcAccess, VkAccessFlags dstAccess)
+{
+	VkBufferMemoryBarrier barrier;
+	cleanStructure(barrier);
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.srcAccessMask = srcAccess;
+	barrier.dstAccessMask = dstAccess;
+	barrier.buffer = range.buffer;
+	barrier.offset = range.offset;
+	barrier.size = range.range;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+
+	return barrier;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+//GeometryPool
+////////////////////////////////////////////////////////////////////////////////////////
+
+GeometryPool::GeometryPool()
+	: m_buffer(nullptr)
+	, m_vertexBuffer(nullptr)
+	, m_indexBuffer(nullptr)
+	, m_vertexStride(0)
+	, m_maxVertexes(0)
+	, m_maxIndices(0)
+	, m_isGrowing(false)
+	, m_growFrameNumber(0)
+{
+}
+
+GeometryPool::~GeometryPool()
+{
+}
+
+void GeometryPool::Init(uint32_t vertexStride, uint32_t maxVertexes, uint32_t maxIndices)
+{
+	m_vertexStride = vertexStride;
+	bool created = CreateBuffers(maxVertexes, maxIndices);
+	TRAP(created && "No memory for the geometry pool");
+
+	m_vertexAllocator.Init(maxVertexes);
+	m_indexAllocator.Init(maxIndices);
+}
+
+bool GeometryPool::CreateBuffers(uint32_t maxVertexes, uint32_t maxIndices)
+{
+	std::vector<VkDeviceSize> sizes(2);
+	sizes[0] = (VkDeviceSize)maxVertexes * m_vertexStride;
+	sizes[1] = (VkDeviceSize)maxIndices * sizeof(uint32_t);
+
+	//transfer src for the copy when it grows
+	BufferHandle* buffer = MemoryManager::GetInstance()->CreateBuffer(EMemoryContextType::DeviceLocalBuffer, sizes, VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+	if (!buffer)
+		return false;
+
+	m_buffer = buffer;
+	m_vertexBuffer = m_buffer->CreateSubbuffer(sizes[0]);
+	m_indexBuffer = m_buffer->CreateSubbuffer(sizes[1]);
+
+	m_maxVertexes = maxVertexes;
+	m_maxIndices = maxIndices;
+	return true;
+}
+
+void GeometryPool::Destroy()
+{
+	if (m_buffer)
+		MemoryManager::GetInstance()->FreeHandle(m_buffer);
+
+	m_buffer = m_vertexBuffer = m_indexBuffer = nullptr;
+}
+
+bool GeometryPool::Allocate(uint32_t vertexCount, uint32_t indexCount, Allocation& outAllocation)
+{
+	VkDeviceSize vertexOffset, indexOffset, allocatedSize;
+	uint32_t vertexBlock, indexBlock;
+	if (!m_vertexAllocator.Allocate(vertexCount, 1, vertexOffset, allocatedSize, vertexBlock))
+		return false;
+
+	if (!m_indexAllocator.Allocate(indexCount, 1, indexOffset, allocatedSize, indexBlock))
+	{
+		m_vertexAllocator.Free(vertexBlock);
+		return false;
+	}
+
+	outAllocation.m_vertexOffset = (uint32_t)vertexOffset;
+	outAllocation.m_firstIndex = (uint32_t)indexOffset;
+	outAllocation.m_vertexBlock = vertexBlock;
+	outAllocation.m_indexBlock = indexBlock;
+	return true;
+}
+
+void GeometryPool::Free(const Allocation& allocation)
+{
+	RetiredAllocation retired;
+	retired.FrameNumber = MemoryManager::GetInstance()->GetFrameAllocator()->GetFrameNumber();
+	retired.PoolAllocation = allocation;
+	m_retiredAllocations.push_back(retired);
+}
+
+void GeometryPool::Update()
+{
+	uint64_t frameNumber = MemoryManager::GetInstance()->GetFrameAllocator()->GetFrameNumber();
+	auto firstInUse = std::partition(m_retiredAllocations.begin(), m_retiredAllocations.end(), [frameNumber](const RetiredAllocation& retired)
+	{
+		return retired.FrameNumber + FRAMES_IN_FLIGHT <= frameNumber;
+	});
+
+	for (auto it = m_retiredAllocations.begin(); it != firstInUse; ++it)
+	{
+		m_vertexAllocator.Free(it->PoolAllocation.m_vertexBlock);
+		m_indexAllocator.Free(it->PoolAllocation.m_indexBlock);
+	}
+	m_retiredAllocations.erase(m_retiredAllocations.begin(), firstInUse);
+
+	//the frame with the copy is done
+	if (m_isGrowing && m_growFrameNumber + FRAMES_IN_FLIGHT <= frameNumber)
+		m_isGrowing = false;
+}
+
+bool GeometryPool::Grow(uint32_t vertexCount, uint32_t indexCount, VkCommandBuffer cmdBuffer)
+{
+	TRAP(!m_isGrowing);
+
+	BufferHandle* oldBuffer = m_buffer;
+	BufferHandle* oldVertexBuffer = m_vertexBuffer;
+	BufferHandle* oldIndexBuffer = m_indexBuffer;
+
+	uint32_t maxVertexes = glm::max(m_maxVertexes * 2, m_maxVertexes + vertexCount);
+	uint32_t maxIndices = glm::max(m_maxIndices * 2, m_maxIndices + indexCount);
+	VkDeviceSize oldVerticesSize = oldVertexBuffer->GetSize();
+	VkDeviceSize oldIndicesSize = oldIndexBuffer->GetSize();
+	if (!CreateBuffers(maxVertexes, maxIndices))
+		return false;
+
+	MemoryManager::GetInstance()->FreeHandle(oldBuffer); //the frames in flight still draw from it
+
+	m_vertexAllocator.Grow(maxVertexes);
+	m_indexAllocator.Grow(maxIndices);
+
+	//the uploads were acquired for the vertex input, the old content is copied after the draws of this queue
+	VkBufferMemoryBarrier srcBarriers[2] = {
+		CreateRangeBarrier(oldVertexBuffer->GetDescriptor(), 0, VK_ACCESS_TRANSFER_READ_BIT),
+		CreateRangeBarrier(oldIndexBuffer->GetDescriptor(), 0, VK_ACCESS_TRANSFER_READ_BIT)
+	};
+	vk::CmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 2, srcBarriers, 0, nullptr);
+
+	VkBufferCopy vertexRegion{ oldVertexBuffer->GetOffset(), m_vertexBuffer->GetOffset(), oldVerticesSize };
+	vk::CmdCopyBuffer(cmdBuffer, oldVertexBuffer->Get(), m_vertexBuffer->Get(), 1, &vertexRegion);
+	VkBufferCopy indexRegion{ oldIndexBuffer->GetOffset(), m_indexBuffer->GetOffset(), oldIndicesSize };
+	vk::CmdCopyBuffer(cmdBuffer, oldIndexBuffer->Get(), m_indexBuffer->Get(), 1, &indexRegion);
+
+	VkBufferMemoryBarrier dstBarriers[2] = {
+		CreateRangeBarrier(m_vertexBuffer->GetDescriptor(), VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT),
+		CreateRangeBarrier(m_indexBuffer->GetDescriptor(), VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_INDEX_READ_BIT)
+	};
+	vk::CmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 0, nullptr, 2, dstBarriers, 0, nullptr);
+
+	m_isGrowing = true;
+	m_growFrameNumber = MemoryManager::GetInstance()->GetFrameAllocator()->GetFrameNumber();
+	std::cout << "Geometry pool grown to " << maxVertexes << " vertexes and " << maxIndices << " indices" << std::endl;
+	return true;
+}
+
+VkDescriptorBufferInfo GeometryPool::GetVertexRange(const Allocation& allocation, uint32_t vertexCount) const
+{
+	VkDescriptorBufferInfo range{ m_vertexBuffer->Get(), m_vertexBuffer->GetOffset() + (VkDeviceSize)allocation.m_vertexOffset * m_vertexStride, (VkDeviceSize)vertexCount * m_vertexStride };
+	return range;
+}
+
+VkDescriptorBufferInfo GeometryPool::GetIndexRange(const Allocation& allocation, uint32_t indexCount) const
+{
+	VkDescriptorBufferInfo range{ m_indexBuffer->Get(), m_indexBuffer->GetOffset() + (VkDeviceSize)allocation.m_firstIndex * sizeof(uint32_t), (VkDeviceSize)indexCount * sizeof(uint32_t) };
+	return range;
+}
+
+void GeometryPool::Bind(VkCommandBuffer cmdBuffer) const
+{
+	VkDeviceSize offset = m_vertexBuffer->GetOffset();
+	vk::CmdBindVertexBuffers(cmdBuffer, 0, 1, &m_vertexBuffer->Get(), &offset);
+	vk::CmdBindIndexBuffer(cmdBuffer, m_indexBuffer->Get(), m_indexBuffer->GetOffset(), VK_INDEX_TYPE_UINT32);
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////
 //TransferMeshInfo
 ////////////////////////////////////////////////////////////////////////////////////////
 
 MeshManager::TransferMeshInfo::TransferMeshInfo(){}
 MeshManager::TransferMeshInfo::TransferMeshInfo(Mesh* mesh)
-	: m_stagginVertexBuffer(nullptr)
+	: m_mesh(mesh)
+	, m_meshBuffer(nullptr)
 	, m_toVertexBuffer(nullptr)
-	, m_staggingIndexBuffer(nullptr)
 	, m_toIndexBuffer(nullptr)
-	, m_meshBuffer(nullptr)
-	, m_staggingBuffer(nullptr)
-	, m_mesh(mesh)
+	, m_copiedSize(0)
+	, m_batch(TransferQueue::InvalidBatch)
 {
+	//the batched meshes are already allocated in the pool by MeshManager::Update
+	if (m_mesh->m_usedInBatching)
+	{
+		GeometryPool* pool = MeshManager::GetInstance()->GetGeometryPool();
+		m_vertexRange = pool->GetVertexRange(m_mesh->m_poolAllocation, m_mesh->GetVertexCount());
+		m_indexRange = pool->GetIndexRange(m_mesh->m_poolAllocation, m_mesh->GetIndexCount());
+		return;
+	}
 
 	m_meshBuffer = MemoryManager::GetInstance()->CreateBuffer(EMemoryContextType::DeviceLocalBuffer, m_mesh->MemorySizeNeeded(), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
-	m_staggingBuffer = MemoryManager::GetInstance()->CreateBuffer(EMemoryContextType::MeshStaggingBuffer, m_mesh->MemorySizeNeeded(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+	TRAP(m_meshBuffer && "No memory for the mesh");
 
 	m_toVertexBuffer = m_meshBuffer->CreateSubbuffer(m_mesh->GetVerticesMemorySize());
 	m_toIndexBuffer = m_meshBuffer->CreateSubbuffer(m_mesh->GetIndicesMemorySize());
-
-	m_stagginVertexBuffer = m_staggingBuffer->CreateSubbuffer(m_mesh->GetVerticesMemorySize());
-	m_staggingIndexBuffer = m_staggingBuffer->CreateSubbuffer(m_mesh->GetIndicesMemorySize());
+	m_vertexRange = m_toVertexBuffer->GetDescriptor();
+	m_indexRange = m_toIndexBuffer->GetDescriptor();
 }
 
-void MeshManager::TransferMeshInfo::BeginTransfer(VkCommandBuffer cmdBuffer)
+bool MeshManager::TransferMeshInfo::CopyNextPart()
 {
-	VkBufferCopy regions[2]; //i think we can use just a region and copy all the buffers
-	//copy vertexes
-	regions[0].size = m_stagginVertexBuffer->GetSize();
-	regions[0].srcOffset = m_stagginVertexBuffer->GetOffset();
-	regions[0].dstOffset = m_toVertexBuffer->GetOffset();
+	StagingRing* stagingRing = MemoryManager::GetInstance()->GetStagingRing();
+	const VkDeviceSize alignment = 16;
+
+	VkDeviceSize partSize = glm::min(m_mesh->MemorySizeNeeded() - m_copiedSize, stagingRing->GetMaxAllocation(alignment));
+	if (partSize == 0)
+		return false;
+
+	StagingRing::Allocation stagging;
+	bool allocated = stagingRing->Allocate(partSize, alignment, stagging);
+	TRAP(allocated);
+	m_mesh->CopyLocalData(stagging.m_ptr, m_copiedSize, partSize);
+
+	//the part can end in the vertexes, start in the indices or have a bit of both
+	VkDeviceSize verticesSize = m_mesh->GetVerticesMemorySize();
+	VkDeviceSize partEnd = m_copiedSize + partSize;
+	VkBufferCopy regions[2];
+	uint32_t regionsCount = 0;
+	if (m_copiedSize < verticesSize)
+	{
+		regions[regionsCount].srcOffset = stagging.m_offset;
+		regions[regionsCount].dstOffset = m_vertexRange.offset + m_copiedSize;
+		regions[regionsCount].size = glm::min(partEnd, verticesSize) - m_copiedSize;
+		++regionsCount;
+	}
+
+	if (partEnd > verticesSize)
+	{
+		VkDeviceSize indicesStart = glm::max(m_copiedSize, verticesSize);
+		regions[regionsCount].srcOffset = stagging.m_offset + indicesStart - m_copiedSize;
+		regions[regionsCount].dstOffset = m_indexRange.offset + indicesStart - verticesSize;
+		regions[regionsCount].size = partEnd - indicesStart;
+		++regionsCount;
+	}
+
+	VkCommandBuffer cmdBuffer = TransferQueue::GetInstance()->GetCommandBuffer();
+	vk::CmdCopyBuffer(cmdBuffer, stagingRing->GetBuffer(), m_vertexRange.buffer, regionsCount, regions);
 
-	//copy indices
-	regions[1].size = m_staggingIndexBuffer->GetSize();
-	regions[1].srcOffset = m_staggingIndexBuffer->GetOffset();
-	regions[1].dstOffset = m_toIndexBuffer->GetOffset();
+	m_copiedSize = partEnd;
+	return true;
+}
 
-	vk::CmdCopyBuffer(cmdBuffer, m_staggingBuffer->Get(), m_meshBuffer->Get(), 2, regions);
+bool MeshManager::TransferMeshInfo::IsCopied() const
+{
+	return m_copiedSize == m_mesh->MemorySizeNeeded();
 }
 
 void MeshManager::TransferMeshInfo::EndTransfer()
 {
+	if (!m_meshBuffer)
+	{
+		m_mesh->m_isInGeometryPool = true;
+		return;
+	}
+
 	m_mesh->m_meshBuffer = m_meshBuffer;
 	m_mesh->m_indexSubBuffer = m_toIndexBuffer;
 	m_mesh->m_vertexSubBuffer = m_toVertexBuffer;
@@ -61,12 +293,12 @@ void MeshManager::TransferMeshInfo::EndTransfer()
 
 MeshManager::MeshManager()
 {
-
+	m_geometryPool.Init(sizeof(SCompactVertex), GEOMETRY_POOL_VERTICES, GEOMETRY_POOL_INDICES);
 }
 
 MeshManager::~MeshManager()
 {
-
+	m_geometryPool.Destroy();
 }
 
 void MeshManager::RegisterForUploading(Mesh* m)
@@ -76,65 +308,92 @@ void MeshManager::RegisterForUploading(Mesh* m)
 
 void MeshManager::Update()
 {
-	if (!m_transferInProgress.empty()) //if I will use 2 different queue this is not a valid condition. I have to check if the transfers are finished
-	{
-		for (unsigned int i = 0; i < m_transferInProgress.size(); ++i)
-			m_transferInProgress[i].EndTransfer();
+	TransferQueue* transferQueue = TransferQueue::GetInstance();
 
-		m_transferInProgress.clear();
-		MemoryManager::GetInstance()->FreeMemory(EMemoryContextType::MeshStaggingBuffer);
+	//the copies run on the transfer queue. Until they are done the meshes are not rendered
+	unsigned int finishedCount = 0;
+	for (; finishedCount < m_transferInProgress.size(); ++finishedCount)
+	{
+		TransferQueue::BatchId batch = m_transferInProgress[finishedCount].m_batch;
+		if (batch == TransferQueue::InvalidBatch || !transferQueue->IsFinished(batch))
+			break;
 	}
 
-	if (!m_pendingMeshes.empty())
+	if (finishedCount > 0)
 	{
-		unsigned int staggingMemoryTotalSize = CalculateStagginMemorySize();
-		MemoryManager::GetInstance()->AllocMemory(EMemoryContextType::MeshStaggingBuffer, staggingMemoryTotalSize);
-		//
-		
-		TRAP(m_transferInProgress.empty() && "All transfer should be processed"); 
-		m_transferInProgress.reserve(m_pendingMeshes.size());
-
-		for (auto m : m_pendingMeshes)
+		std::vector<VkBufferMemoryBarrier> acquireBarriers;
+		acquireBarriers.reserve(finishedCount * 2);
+		for (unsigned int i = 0; i < finishedCount; ++i)
 		{
-			m_transferInProgress.push_back(TransferMeshInfo(m));
+			TransferMeshInfo& transInfo = m_transferInProgress[i];
+			acquireBarriers.push_back(CreateRangeBarrier(transInfo.m_vertexRange, 0, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT));
+			acquireBarriers.push_back(CreateRangeBarrier(transInfo.m_indexRange, 0, VK_ACCESS_INDEX_READ_BIT));
+			transferQueue->WaitOnGraphics(transInfo.m_batch, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
+			transInfo.EndTransfer();
 		}
 
-		MemoryManager::GetInstance()->MapMemoryContext(EMemoryContextType::MeshStaggingBuffer);
-		for (auto info : m_transferInProgress)
-			info.m_mesh->CopyLocalData(info.m_stagginVertexBuffer, info.m_staggingIndexBuffer);
+		for (auto& barrier : acquireBarriers)
+			transferQueue->AcquireBarrier(barrier);
 
-		MemoryManager::GetInstance()->UnmapMemoryContext(EMemoryContextType::MeshStaggingBuffer);
-		std::vector<VkBufferMemoryBarrier> copyBarriers;
-		copyBarriers.reserve(m_transferInProgress.size());
+		vk::CmdPipelineBarrier(vk::g_vulkanContext.m_mainCommandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 0, nullptr, (uint32_t)acquireBarriers.size(), acquireBarriers.data(), 0, nullptr);
+		m_transferInProgress.erase(m_transferInProgress.begin(), m_transferInProgress.begin() + finishedCount);
+	}
 
-		VkCommandBuffer cmdBuffer = vk::g_vulkanContext.m_mainCommandBuffer; //for now use this command buffer and the same queue. At home, try to create a transfer queue, with a different command buffer
-		for (unsigned int i = 0; i < m_transferInProgress.size(); ++i)
-		{
-			TransferMeshInfo& transInfo = m_transferInProgress[i];
-			copyBarriers.push_back(transInfo.m_toVertexBuffer->CreateMemoryBarrier(VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT));
-			copyBarriers.push_back(transInfo.m_toIndexBuffer->CreateMemoryBarrier(VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_INDEX_READ_BIT));
+	m_geometryPool.Update();
 
-			transInfo.BeginTransfer(cmdBuffer);
+	//a batched mesh that doesn't fit grows the pool. The transfers in progress write in the current buffer, so it waits for them,
+	//and the meshes wait for the copy to the new buffer. The pending meshes are started in order
+	unsigned int startedCount = 0;
+	for (; startedCount < m_pendingMeshes.size(); ++startedCount)
+	{
+		Mesh* m = m_pendingMeshes[startedCount];
+		if (m->m_usedInBatching)
+		{
+			if (m_geometryPool.IsGrowing())
+				break;
+
+			if (!m_geometryPool.Allocate(m->GetVertexCount(), m->GetIndexCount(), m->m_poolAllocation))
+			{
+				//without memory for a bigger pool the mesh waits, it's tried again next frame
+				if (m_transferInProgress.empty())
+					m_geometryPool.Grow(m->GetVertexCount(), m->GetIndexCount(), vk::g_vulkanContext.m_mainCommandBuffer);
+				break;
+			}
 		}
 
-		vk::CmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 0, nullptr, (uint32_t)copyBarriers.size(), copyBarriers.data(), 0, nullptr);
-		m_pendingMeshes.clear();
+		m_transferInProgress.push_back(TransferMeshInfo(m));
 	}
-}
+	m_pendingMeshes.erase(m_pendingMeshes.begin(), m_pendingMeshes.begin() + startedCount);
 
-unsigned int MeshManager::CalculateStagginMemorySize()
-{
-	unsigned int totalSize = 0;
-	for (auto m : m_pendingMeshes)
-		totalSize += m->MemorySizeNeeded();
+	//in order, as much as the stagging ring has room for. A mesh that doesn't fit is split over frames
+	std::vector<VkBufferMemoryBarrier> releaseBarriers;
+	for (auto& transInfo : m_transferInProgress)
+	{
+		if (transInfo.m_batch != TransferQueue::InvalidBatch)
+			continue;
+
+		if (!transInfo.CopyNextPart() || !transInfo.IsCopied())
+			break;
 
-	return totalSize + uint32_t(m_pendingMeshes.size()) * vk::g_vulkanContext.m_limits.minUniformBufferOffsetAlignment;
+		releaseBarriers.push_back(CreateRangeBarrier(transInfo.m_vertexRange, VK_ACCESS_TRANSFER_WRITE_BIT, 0));
+		releaseBarriers.push_back(CreateRangeBarrier(transInfo.m_indexRange, VK_ACCESS_TRANSFER_WRITE_BIT, 0));
+		transInfo.m_batch = transferQueue->GetCurrentBatch();
+	}
+
+	if (releaseBarriers.empty())
+		return;
+
+	for (auto& barrier : releaseBarriers)
+		transferQueue->ReleaseBarrier(barrier);
+
+	vk::CmdPipelineBarrier(transferQueue->GetCommandBuffer(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, (uint32_t)releaseBarriers.size(), releaseBarriers.data(), 0, nullptr);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////
 //Mesh
 ////////////////////////////////////////////////////////////////////////////////////////
 Mesh::InputVertexDescription* Mesh::ms_vertexDescription = nullptr;
+Mesh::InputVertexDescription* Mesh::ms_compactVertexDescription = nullptr;
 
 BEGIN_PROPERTY_MAP(Mesh)
 	IMPLEMENT_PROPERTY(std::string, Filename, "file", Mesh)
@@ -146,17 +405,19 @@ Mesh::Mesh()
 	, m_vertexSubBuffer(nullptr)
 	, m_indexSubBuffer(nullptr)
 	, m_usedInBatching(true)
+	, m_isInGeometryPool(false)
 {
 }
 
 Mesh::Mesh(const std::vector<SVertex>& vertexes, const std::vector<unsigned int>& indices)
 	: SeriableImpl<Mesh>("mesh")
+    , m_vertexes(vertexes)
+    , m_indices(indices)
 	, m_meshBuffer(nullptr)
 	, m_vertexSubBuffer(nullptr)
 	, m_indexSubBuffer(nullptr)
-    , m_vertexes(vertexes)
-    , m_indices(indices)
 	, m_usedInBatching(false)
+	, m_isInGeometryPool(false)
 {
     Create();
 }
@@ -167,6 +428,7 @@ Mesh::Mesh(const std::string filename) //use the binarized version
 	, m_vertexSubBuffer(nullptr)
 	, m_indexSubBuffer(nullptr)
 	, m_usedInBatching(false)
+	, m_isInGeometryPool(false)
 {
 	LoadFromFile(filename);
 }
@@ -176,6 +438,17 @@ void Mesh::LoadFromFile(const std::string filename)
 	std::fstream inFile(filename, std::ios_base::in | std::ios_base::binary);
 
 	TRAP(inFile.is_open());
+
+	//the old files start with the vertex count written as text
+	if (!isdigit(inFile.peek()))
+	{
+		LoadCompactFile(inFile);
+		inFile.close();
+
+		Create();
+		return;
+	}
+
 	unsigned int nbVertices;
 	unsigned int nbIndexes;
 	unsigned int bytesToRead;
@@ -194,18 +467,83 @@ void Mesh::LoadFromFile(const std::string filename)
 
 	inFile.close();
 
+	if (m_usedInBatching)
+	{
+		CompressVertexes(m_vertexes, m_compactVertexes, m_bbox.Min, m_bbox.Max);
+		m_vertexes.clear();
+		m_vertexes.shrink_to_fit();
+	}
+
 	Create();
 }
 
+void Mesh::LoadCompactFile(std::fstream& inFile)
+{
+	SCompactMeshHeader header;
+	inFile.read((char*)&header, sizeof(SCompactMeshHeader));
+	TRAP(inFile.gcount() == (std::streamsize)sizeof(SCompactMeshHeader));
+	TRAP(header.magic == COMPACT_MESH_MAGIC || header.magic == COMPACT_MESH_LOD_MAGIC);
+
+	unsigned int bytesToRead;
+	m_compactVertexes.resize(header.vertexCount);
+	bytesToRead = header.vertexCount * sizeof(SCompactVertex);
+	inFile.read((char*)m_compactVertexes.data(), bytesToRead);
+	TRAP(inFile.gcount() == (std::streamsize)bytesToRead);
+
+	m_indices.resize(header.indexCount);
+	bytesToRead = header.indexCount * sizeof(unsigned int);
+	inFile.read((char*)m_indices.data(), bytesToRead);
+	TRAP(inFile.gcount() == (std::streamsize)bytesToRead);
+
+	m_lods.clear();
+	m_lods.push_back(Lod{ 0, header.indexCount });
+
+	//the other pipelines draw only the full mesh
+	if (header.magic == COMPACT_MESH_LOD_MAGIC && m_usedInBatching)
+	{
+		uint32_t lodCount;
+		inFile.read((char*)&lodCount, sizeof(uint32_t));
+		TRAP(inFile.gcount() == (std::streamsize)sizeof(uint32_t));
+
+		std::vector<uint32_t> lodIndexCounts(lodCount);
+		bytesToRead = lodCount * sizeof(uint32_t);
+		inFile.read((char*)lodIndexCounts.data(), bytesToRead);
+		TRAP(inFile.gcount() == (std::streamsize)bytesToRead);
+
+		for (auto lodIndexCount : lodIndexCounts)
+		{
+			m_lods.push_back(Lod{ (uint32_t)m_indices.size(), lodIndexCount });
+			m_indices.resize(m_indices.size() + lodIndexCount);
+
+			bytesToRead = lodIndexCount * sizeof(unsigned int);
+			inFile.read((char*)(m_indices.data() + m_lods.back().FirstIndex), bytesToRead);
+			TRAP(inFile.gcount() == (std::streamsize)bytesToRead);
+		}
+	}
+
+	m_bbox = BoundingBox3D(header.boundsMin, header.boundsMax);
+
+	if (!m_usedInBatching)
+	{
+		DecompressVertexes(m_compactVertexes, header.boundsMin, header.boundsMax, m_vertexes);
+		m_compactVertexes.clear();
+		m_compactVertexes.shrink_to_fit();
+	}
+}
+
 
 void Mesh::Create()
 {
-	m_nbOfIndexes = (unsigned int)m_indices.size();
+	if (m_lods.empty())
+		m_lods.push_back(Lod{ 0, (uint32_t)m_indices.size() });
+	m_nbOfIndexes = m_lods[0].IndexCount;
 
-	if (!m_usedInBatching)
-		MeshManager::GetInstance()->RegisterForUploading(this);
+	//the batched meshes are uploaded in the geometry pool
+	MeshManager::GetInstance()->RegisterForUploading(this);
 
-	CreateBoundigBox();
+	//the compressed vertexes come with their quantization bounds
+	if (!m_usedInBatching)
+		CreateBoundigBox();
 }
 
 void Mesh::CreateBoundigBox()
@@ -227,25 +565,40 @@ unsigned int Mesh::MemorySizeNeeded() const
 
 unsigned int Mesh::GetVerticesMemorySize() const
 {
-	return uint32_t(m_vertexes.size()) * sizeof(SVertex);
+	return (m_usedInBatching) ? uint32_t(m_compactVertexes.size()) * sizeof(SCompactVertex) : uint32_t(m_vertexes.size()) * sizeof(SVertex);
 }
 unsigned int Mesh::GetIndicesMemorySize() const
 {
 	return uint32_t(m_indices.size()) * sizeof(unsigned int);
 }
 
-void Mesh::CopyLocalData(BufferHandle* stagginVertexBuffer, BufferHandle* staggingIndexBuffer)
+void Mesh::CopyLocalData(void* vboMemory, void* iboMemory)
 {
-	void* vertexMem = stagginVertexBuffer->GetPtr<void*>(); //for debug purpose only
-	void* indexMem = staggingIndexBuffer->GetPtr<void*>();
-	memcpy(vertexMem, m_vertexes.data(), GetVerticesMemorySize());
-	memcpy(indexMem, m_indices.data(), GetIndicesMemorySize());
+	memcpy(vboMemory, GetVertexData(), GetVerticesMemorySize());
+	memcpy(iboMemory, m_indices.data(), GetIndicesMemorySize());
 }
 
-void Mesh::CopyLocalData(void* vboMemory, void* iboMemory)
+void Mesh::CopyLocalData(void* dst, VkDeviceSize offset, VkDeviceSize size) const
 {
-	memcpy(vboMemory, m_vertexes.data(), GetVerticesMemorySize());
-	memcpy(iboMemory, m_indices.data(), GetIndicesMemorySize());
+	TRAP(offset + size <= MemorySizeNeeded());
+	uint8_t* dstPtr = (uint8_t*)dst;
+	VkDeviceSize verticesSize = GetVerticesMemorySize();
+	if (offset < verticesSize)
+	{
+		VkDeviceSize verticesPart = glm::min(size, verticesSize - offset);
+		memcpy(dstPtr, (const uint8_t*)GetVertexData() + offset, (size_t)verticesPart);
+		dstPtr += verticesPart;
+		offset += verticesPart;
+		size -= verticesPart;
+	}
+
+	if (size > 0)
+		memcpy(dstPtr, (const uint8_t*)m_indices.data() + offset - verticesSize, (size_t)size);
+}
+
+const void* Mesh::GetVertexData() const
+{
+	return (m_usedInBatching) ? (const void*)m_compactVertexes.data() : (const void*)m_vertexes.data();
 }
 
 void Mesh::Render(unsigned int numIndexes, unsigned int instances)
@@ -331,6 +684,45 @@ VkPipelineVertexInputStateCreateInfo& Mesh::GetVertexDesc()
     return ms_vertexDescription->vertexDescription; 
 }
 
+VkPipelineVertexInputStateCreateInfo& Mesh::GetCompactVertexDesc()
+{
+	if (!ms_compactVertexDescription)
+	{
+		ms_compactVertexDescription = new InputVertexDescription();
+		VkVertexInputBindingDescription& vibd = ms_compactVertexDescription->vibd;
+		cleanStructure(vibd);
+		vibd.binding = 0;
+		vibd.stride = sizeof(SCompactVertex);
+		vibd.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+		//position (w - bitangent sign), uv, normal, tangent, color
+		const VkFormat formats[] = { VK_FORMAT_R16G16B16A16_UNORM, VK_FORMAT_R16G16_SFLOAT, VK_FORMAT_R16G16_SNORM, VK_FORMAT_R16G16_SNORM, VK_FORMAT_R8G8B8A8_UNORM };
+		const uint32_t offsets[] = { offsetof(SCompactVertex, pos), offsetof(SCompactVertex, uv), offsetof(SCompactVertex, normal), offsetof(SCompactVertex, tangent), offsetof(SCompactVertex, color) };
+
+		std::vector<VkVertexInputAttributeDescription>& viad = ms_compactVertexDescription->viad;
+		viad.resize(sizeof(formats) / sizeof(VkFormat));
+		for (uint32_t i = 0; i < viad.size(); ++i)
+		{
+			cleanStructure(viad[i]);
+			viad[i].location = i;
+			viad[i].binding = 0;
+			viad[i].format = formats[i];
+			viad[i].offset = offsets[i];
+		}
+
+		VkPipelineVertexInputStateCreateInfo& vertexDescription = ms_compactVertexDescription->vertexDescription;
+		cleanStructure(vertexDescription);
+		vertexDescription.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+		vertexDescription.vertexBindingDescriptionCount = 1;
+		vertexDescription.pVertexBindingDescriptions = &vibd;
+		vertexDescription.vertexAttributeDescriptionCount = (uint32_t)viad.size();
+		vertexDescription.pVertexAttributeDescriptions = viad.data();
+	}
+	return ms_compactVertexDescription->vertexDescription;
+}
+
 Mesh::~Mesh()
 {
+	if (m_isInGeometryPool)
+		MeshManager::GetInstance()->GetGeometryPool()->Free(m_poolAllocation);
 }
\ No newline at end of file
@@ -2,21 +2,91 @@
 
 #include "VulkanLoader.h"
 #include <vector>
+#include <fstream>
 #include "glm/glm.hpp"
 #include "SVertex.h"
 #include "Singleton.h"
 #include "Serializer.h"
 #include "ResourceLoader.h"
 #include "Geometry.h"
+#include "TransferQueue.h"
+#include "MemoryManager.h"
 
 class Mesh;
 class BufferHandle;
+
+//One vertex buffer and one index buffer for all the batched meshes of a vertex format. Every mesh is suballocated once,
+//the indirect commands reference it with vertexOffset and firstIndex, so all the batches bind the same buffers
+class GeometryPool
+{
+public:
+	struct Allocation
+	{
+		uint32_t	m_vertexOffset; //in vertexes
+		uint32_t	m_firstIndex;
+		uint32_t	m_vertexBlock; //in the allocators of the pool
+		uint32_t	m_indexBlock;
+	};
+
+	GeometryPool();
+	~GeometryPool();
+
+	void Init(uint32_t vertexStride, uint32_t maxVertexes, uint32_t maxIndices);
+	void Destroy();
+
+	//returns false if the pool is full. The caller can grow it
+	bool Allocate(uint32_t vertexCount, uint32_t indexCount, Allocation& outAllocation);
+	//the ranges are reused FRAMES_IN_FLIGHT frames later, the frames in flight can still draw them
+	void Free(const Allocation& allocation);
+	//releases the freed allocations that are not used anymore. Once per frame
+	void Update();
+
+	//moves the pool to a buffer with room for at least vertexCount and indexCount more. The copy of the content is recorded
+	//in cmdBuffer (outside a render pass). Nothing can be written in the pool while IsGrowing, the copy would race with it
+	//Returns false if there is no memory for the bigger buffer, the pool is left as it was
+	bool Grow(uint32_t vertexCount, uint32_t indexCount, VkCommandBuffer cmdBuffer);
+	bool IsGrowing() const { return m_isGrowing; }
+
+	//the ranges of an allocation, in bytes, for the copies
+	VkDescriptorBufferInfo GetVertexRange(const Allocation& allocation, uint32_t vertexCount) const;
+	VkDescriptorBufferInfo GetIndexRange(const Allocation& allocation, uint32_t indexCount) const;
+
+	void Bind(VkCommandBuffer cmdBuffer) const;
+private:
+	bool CreateBuffers(uint32_t maxVertexes, uint32_t maxIndices);
+private:
+	struct RetiredAllocation
+	{
+		uint64_t		FrameNumber;
+		Allocation		PoolAllocation;
+	};
+
+	BufferHandle*		m_buffer;
+	BufferHandle*		m_vertexBuffer;
+	BufferHandle*		m_indexBuffer;
+	uint32_t			m_vertexStride;
+	uint32_t			m_maxVertexes;
+	uint32_t			m_maxIndices;
+
+	//the offsets are in vertexes and indices, not bytes
+	TLSFAllocator		m_vertexAllocator;
+	TLSFAllocator		m_indexAllocator;
+	std::vector<RetiredAllocation>	m_retiredAllocations;
+
+	bool				m_isGrowing;
+	uint64_t			m_growFrameNumber; //the frame that records the copy to the new buffer
+};
+
 class MeshManager : public Singleton<MeshManager>
 {
 	friend class Singleton<MeshManager>;
 public:
 	void RegisterForUploading(Mesh* m);
 	void Update();
+	bool HasTransfersInProgress() const { return !m_transferInProgress.empty(); }
+
+	//the batched meshes, one pool for SCompactVertex
+	GeometryPool* GetGeometryPool() { return &m_geometryPool; }
 
 private:
 	MeshManager();
@@ -24,9 +94,6 @@ private:
 
 	MeshManager(const MeshManager& other);
 	MeshManager& operator=(const MeshManager& other);
-
-	//
-	unsigned int CalculateStagginMemorySize();
 private:
 	class TransferMeshInfo
 	{
@@ -34,20 +101,26 @@ private:
 		TransferMeshInfo();
 		TransferMeshInfo(Mesh* mesh);
 
-		void BeginTransfer(VkCommandBuffer cmdBuffer);
+		//stages the next bytes of the mesh (vertexes then indices) and records their copy on the transfer queue.
+		//Returns false if the stagging ring has no room now
+		bool CopyNextPart();
+		bool IsCopied() const;
 		void EndTransfer();
 
-		Mesh*			m_mesh;
-		BufferHandle*	m_meshBuffer;
-		BufferHandle*	m_staggingBuffer;
-		BufferHandle*	m_stagginVertexBuffer;
-		BufferHandle*	m_toVertexBuffer;
-		BufferHandle*	m_staggingIndexBuffer;
-		BufferHandle*	m_toIndexBuffer;
+		Mesh*					m_mesh;
+		BufferHandle*			m_meshBuffer; //nullptr for the batched meshes, they go in the geometry pool
+		BufferHandle*			m_toVertexBuffer;
+		BufferHandle*			m_toIndexBuffer;
+		VkDescriptorBufferInfo	m_vertexRange; //where the copies write, in the mesh buffer or in the pool
+		VkDescriptorBufferInfo	m_indexRange;
+		VkDeviceSize			m_copiedSize;
+		TransferQueue::BatchId	m_batch; //the batch with the last part. InvalidBatch while there are parts left
 	};
 private:
 	std::vector<Mesh*>					m_pendingMeshes;
-	std::vector<TransferMeshInfo>		m_transferInProgress;
+	std::vector<TransferMeshInfo>		m_transferInProgress; //in upload order
+
+	GeometryPool						m_geometryPool;
 };
 
 
@@ -56,6 +129,13 @@ class Mesh : public SeriableImpl<Mesh>
 	friend class MeshManager;
 	friend class TransferMeshInfo;
 public:
+	//a range of the index buffer of the mesh. LOD 0 is the full mesh, the others are simplified over the same vertexes
+	struct Lod
+	{
+		uint32_t	FirstIndex;
+		uint32_t	IndexCount;
+	};
+
     Mesh();
     Mesh(const std::vector<SVertex>& vertexes, const std::vector<unsigned int>& indexes);
 
@@ -64,7 +144,9 @@ public:
     virtual ~Mesh();
     void Render(unsigned int numIndexes = -1, unsigned int instances = 1);
 
-    static VkPipelineVertexInputStateCreateInfo& Mesh::GetVertexDesc();
+    static VkPipelineVertexInputStateCreateInfo& GetVertexDesc();
+	//SCompactVertex, for the batch pipelines
+	static VkPipelineVertexInputStateCreateInfo& GetCompactVertexDesc();
     //for dynamic use of the mesh (UI)
     //VkDeviceMemory  GetVertexMemory() const { return m_vertexMemory; }
     
@@ -73,21 +155,33 @@ public:
 	unsigned int MemorySizeNeeded() const;
 	unsigned int GetVerticesMemorySize() const;
 	unsigned int GetIndicesMemorySize() const;
-	uint32_t GetVertexCount() const { return (uint32_t)m_vertexes.size(); }
-	uint32_t GetIndexCount() const { return (uint32_t)m_indices.size(); }
+	uint32_t GetVertexCount() const { return (uint32_t)(m_usedInBatching ? m_compactVertexes.size() : m_vertexes.size()); }
+	uint32_t GetIndexCount() const { return (uint32_t)m_indices.size(); } //of all the LODs
+	//the meshes that are not batched have only LOD 0
+	uint32_t GetLodCount() const { return (uint32_t)m_lods.size(); }
+	const Lod& GetLod(uint32_t lod) const { return m_lods[lod]; }
+
+	//batched meshes only. The mesh can be drawn from the geometry pool when its upload is finished
+	bool IsInGeometryPool() const { return m_isInGeometryPool; }
+	const GeometryPool::Allocation& GetPoolAllocation() const { return m_poolAllocation; }
 
-	void CopyLocalData(BufferHandle* stagginVertexBuffer, BufferHandle* staggingIndexBuffer);
 	void CopyLocalData(void* vboMemory, void* iboMemory);
+	//copies a range of the vertexes followed by the indices
+	void CopyLocalData(void* dst, VkDeviceSize offset, VkDeviceSize size) const;
 
 	void LoadFromFile(const std::string filename);
 private:
+	void LoadCompactFile(std::fstream& inFile);
+	const void* GetVertexData() const;
     void Create();
     void CreateBoundigBox();
 private:
 	DECLARE_PROPERTY(std::string, Filename, Mesh);
 
     std::vector<SVertex>			m_vertexes;
-    std::vector<unsigned int>		m_indices;
+	std::vector<SCompactVertex>		m_compactVertexes; //the batched meshes keep only these, quantized in m_bbox
+    std::vector<unsigned int>		m_indices; //the LODs one after the other
+	std::vector<Lod>				m_lods;
 
 	BufferHandle*					m_meshBuffer;
 	BufferHandle*					m_vertexSubBuffer;
@@ -97,6 +191,8 @@ private:
     unsigned int					m_nbOfIndexes;
 
 	bool							m_usedInBatching;
+	bool							m_isInGeometryPool;
+	GeometryPool::Allocation		m_poolAllocation;
 
     struct InputVertexDescription
     {
@@ -106,6 +202,7 @@ private:
     };
 
     static InputVertexDescription*            ms_vertexDescription;
+	static InputVertexDescription*            ms_compactVertexDescription;
 };
 
 template<typename BASE>
@@ -142,6 +239,36 @@ public:
 
 		ResourceLoader::GetInstance()->LoadMesh(&(cobj->*m_ptm));
 	};
+
+	virtual void SaveBinary(Serializer* serializer, ISeriable* obj)
+	{
+		BASE* cobj = static_cast<BASE*>(obj);
+
+		(cobj->*m_ptm)->SetName(m_label);
+		(cobj->*m_ptm)->Serialize(serializer);
+	};
+
+	virtual void LoadBinary(Serializer* serializer, ISeriable* obj)
+	{
+		BASE* cobj = static_cast<BASE*>(obj);
+
+		cobj->*m_ptm = new Mesh();
+
+		(cobj->*m_ptm)->SetName(m_label);
+		if (!(cobj->*m_ptm)->Serialize(serializer))
+		{
+			delete (cobj->*m_ptm);
+			cobj->*m_ptm = nullptr;
+			return;
+		}
+
+		ResourceLoader::GetInstance()->LoadMesh(&(cobj->*m_ptm));
+	};
+
+	virtual std::string GetLayoutTag() const
+	{
+		return m_label + ":" + typeid(Mesh*).name();
+	};
 private:
 	PtmType						m_ptm;
 	std::string					m_label;
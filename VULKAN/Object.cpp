@@ -10,6 +10,7 @@
 #include "Material.h"
 
 #include <cstdlib>
+#include <algorithm>
 
 
 //////////////////////////////////////////////////////////////////////
@@ -40,13 +41,30 @@ void ObjectSerializer::LoadContent()
 		Object* obj = new Object();
 		if (obj->Serialize(this))
 			m_objects.push_back(obj);
+		else
+			DeleteLoadedObject(obj);
+
+		//a broken snapshot is dropped whole, the caller loads the xml instead
+		if (HasBinaryError())
+		{
+			for (Object* loadedObj : m_objects)
+				DeleteLoadedObject(loadedObj);
+			m_objects.clear();
+			return;
+		}
 	}
 
 	for (Object* obj : m_objects)
-	{
 		Scene::GetInstance()->AddObject(obj);
-		BatchManager::GetInstance()->AddObject(obj);
-	}
+
+	BatchManager::GetInstance()->AddObjects(m_objects);
+}
+
+//the material is created for the object at load, the meshes and the textures belong to the ResourceLoader
+void ObjectSerializer::DeleteLoadedObject(Object* obj)
+{
+	delete obj->GetObjectMaterial();
+	delete obj;
 }
 
 void ObjectSerializer::AddObject(Object* obj)
@@ -56,6 +74,16 @@ void ObjectSerializer::AddObject(Object* obj)
 	BatchManager::GetInstance()->AddObject(obj);
 }
 
+void ObjectSerializer::RemoveObject(Object* obj)
+{
+	auto it = std::find(m_objects.begin(), m_objects.end(), obj);
+	TRAP(it != m_objects.end());
+
+	m_objects.erase(it);
+	Scene::GetInstance()->RemoveObject(obj);
+	BatchManager::GetInstance()->RemoveObject(obj);
+}
+
 //////////////////////////////////////////////////////////////////////
 //Object
 //////////////////////////////////////////////////////////////////////
@@ -99,9 +127,17 @@ glm::mat4 Object::GetModelMatrix()
         m_modelMatrix = m_modelMatrix * rotateMat;
         m_needComputeModelMtx = false;
 
+		//transform all the corners, Min and Max alone are not enough once the object is rotated
 		BoundingBox3D meshBB = GetObjectMesh()->GetBB();
-		m_boundingBox.Max = glm::vec3(m_modelMatrix * glm::vec4(meshBB.Max, 1.0f));
-		m_boundingBox.Min = glm::vec3(m_modelMatrix * glm::vec4(meshBB.Min, 1.0f));
+		std::vector<glm::vec3> bbPoints;
+		meshBB.Transform(m_modelMatrix, bbPoints);
+
+		m_boundingBox.Min = m_boundingBox.Max = bbPoints[0];
+		for (unsigned int i = 1; i < bbPoints.size(); ++i)
+		{
+			m_boundingBox.Min = glm::min(m_boundingBox.Min, bbPoints[i]);
+			m_boundingBox.Max = glm::max(m_boundingBox.Max, bbPoints[i]);
+		}
     }
 
     return m_modelMatrix;
@@ -116,6 +152,13 @@ void Object::ValidateResources()
 {
 }
 
+void Object::OnTransformChanged()
+{
+	m_needComputeModelMtx = true;
+	Scene::GetInstance()->OnObjectMoved(this);
+	BatchManager::GetInstance()->OnObjectMoved(this);
+}
+
 //////////////////////////////////////////////////////////////////////////
 //ObjectRenderer
 //////////////////////////////////////////////////////////////////////////
@@ -138,8 +181,7 @@ ObjectRenderer::~ObjectRenderer()
 
 void ObjectRenderer::Render()
 {
-    VkCommandBuffer cmd = vk::g_vulkanContext.m_mainCommandBuffer;
-    StartRenderPass();
+    StartRenderPass(VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
 	
 	BatchManager::GetInstance()->RenderAll();
 
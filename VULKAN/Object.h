@@ -32,37 +32,37 @@ public:
     void RotateX(float dir)
     {
         m_xRot += dir * glm::quarter_pi<float>();
-        m_needComputeModelMtx = true;
+        OnTransformChanged();
     }
 
     void RotateY(float dir)
     {
         m_yRot += dir * glm::quarter_pi<float>();
-        m_needComputeModelMtx = true;
+        OnTransformChanged();
     }
 
     void Translatez(float dir)
     {
         m_worldPosition += glm::vec3(.0f, .0f, dir);
-        m_needComputeModelMtx = true;
+        OnTransformChanged();
     }
 
     void TranslateX(float dir)
     {
         m_worldPosition += glm::vec3(dir, .0f, .0f);
-        m_needComputeModelMtx = true;
+        OnTransformChanged();
     }
 
     void SetScale(glm::vec3 scale)
     {
         m_scale = scale;
-        m_needComputeModelMtx = true;
+        OnTransformChanged();
     }
 
     void SetPosition(glm::vec3 pos)
     {
         m_worldPosition = pos;
-        m_needComputeModelMtx = true;
+        OnTransformChanged();
     }
 
     BoundingBox3D GetBoundingBox() const
@@ -71,12 +71,9 @@ public:
     }
 
     glm::mat4 GetModelMatrix();
-
-	bool CheckVisibility(VisibilityType type) const { return (m_visibilityMask & type) != 0; }
-	void SetVisibility(VisibilityType type) { m_visibilityMask = m_visibilityMask | type; }
-	void ResetVisibility(VisibilityType type) { m_visibilityMask = m_visibilityMask & (~type); }
 private:
     void ValidateResources();
+    void OnTransformChanged();
 
     friend class ObjectSerializer;
 private:
@@ -94,8 +91,6 @@ private:
 
     glm::mat4               m_modelMatrix;
 	BoundingBox3D			m_boundingBox;
-
-	uint8_t					m_visibilityMask;
 };
 
 class ObjectSerializer : public Serializer, public Singleton<ObjectSerializer>
@@ -110,7 +105,11 @@ public:
 
 	const std::vector<Object*>& GetObjects() const { return m_objects; }
 	void AddObject(Object* obj);
+	//the object is not deleted, the caller owns it after this
+	void RemoveObject(Object* obj);
 
+private:
+	void DeleteLoadedObject(Object* obj);
 private:
 	std::vector<Object*>		m_objects;
 };
@@ -8,6 +8,7 @@
 #include "UI.h"
 #include "Mesh.h"
 #include "Utils.h"
+#include "PipelineCache.h"
 #include "Texture.h"
 #include "Input.h"
 
@@ -262,7 +263,7 @@ void CParticleSystem::Init()
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 CParticlesRenderer::CParticlesRenderer(VkRenderPass renderPass)
-    : CRenderer(renderPass)
+    : CRenderer(renderPass, "ParticlesRenderPass")
     , m_needUpdate(true)
     , m_quad(nullptr)
     , m_simPaused(false)
@@ -315,7 +316,7 @@ void CParticlesRenderer::Render()
 
         unsigned int particles = system->GetSpawnedParticles();
         if(particles && !m_simPaused)
-            vk::CmdDispatch(buffer, particles, 1, 1);
+            Dispatch(buffer, particles, 1, 1);
 
         AddBufferBarier(computeDoneBarrier[i], system->GetParticlesBuffer(), VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_HOST_READ_BIT);
         
@@ -470,7 +471,7 @@ void CParticlesRenderer::CreateComputePipeline(CParticleSystem* system)
     pipelineCrtInfo.stage = shaderStage;
     pipelineCrtInfo.layout = m_computePipelineLayout;
 
-    VULKAN_ASSERT(vk::CreateComputePipelines(vk::g_vulkanContext.m_device, VK_NULL_HANDLE, 1, &pipelineCrtInfo, nullptr, &pipeline));
+    VULKAN_ASSERT(vk::CreateComputePipelines(vk::g_vulkanContext.m_device, PipelineCache::GetInstance()->Get(), 1, &pipelineCrtInfo, nullptr, &pipeline));
 
     system->SetUpdatePipeline(pipeline);
 }
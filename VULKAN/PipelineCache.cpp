@@ -0,0 +1,122 @@
+#include "PipelineCache.h"
+
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//PipelineCache
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+PipelineCache::PipelineCache()
+	: m_pipelineCache(VK_NULL_HANDLE)
+{
+}
+
+PipelineCache::~PipelineCache()
+{
+	if (m_pipelineCache != VK_NULL_HANDLE)
+		vk::DestroyPipelineCache(vk::g_vulkanContext.m_device, m_pipelineCache, nullptr);
+}
+
+void PipelineCache::Load(const std::string& fileName)
+{
+	TRAP(m_pipelineCache == VK_NULL_HANDLE && "Pipeline cache already loaded");
+	m_fileName = fileName;
+
+	std::vector<char> data;
+	std::ifstream cacheFile(m_fileName, std::ios_base::binary | std::ios_base::in);
+	if (cacheFile.is_open())
+	{
+		cacheFile.seekg(0, std::ios_base::end);
+		std::streamoff size = cacheFile.tellg();
+		cacheFile.seekg(0, std::ios_base::beg);
+
+		data.resize((size_t)size);
+		cacheFile.read(data.data(), size);
+		if (cacheFile.gcount() != size)
+			data.clear();
+	}
+
+	//the driver should reject a cache that is not its own, but some drivers crash instead. Better check it ourselves
+	if (!data.empty() && !IsCompatible(data))
+	{
+		std::cout << "Pipeline cache " << m_fileName << " was created by another device or driver. Ignoring it" << std::endl;
+		data.clear();
+	}
+
+	CreateCache(data);
+}
+
+void PipelineCache::Save()
+{
+	if (m_pipelineCache == VK_NULL_HANDLE || m_fileName.empty())
+		return;
+
+	VkDevice dev = vk::g_vulkanContext.m_device;
+	size_t size = 0;
+	VULKAN_ASSERT(vk::GetPipelineCacheData(dev, m_pipelineCache, &size, nullptr));
+	if (size == 0)
+		return;
+
+	std::vector<char> data(size);
+	VULKAN_ASSERT(vk::GetPipelineCacheData(dev, m_pipelineCache, &size, data.data()));
+
+	//write to a temp file first, so a crash while saving doesn't leave a broken cache behind
+	std::string tempFileName = m_fileName + ".tmp";
+	{
+		std::ofstream cacheFile(tempFileName, std::ios_base::binary | std::ios_base::out | std::ios_base::trunc);
+		if (!cacheFile.is_open())
+		{
+			std::cout << "Failed to write the pipeline cache " << tempFileName << std::endl;
+			return;
+		}
+		cacheFile.write(data.data(), size);
+	}
+
+	std::remove(m_fileName.c_str());
+	if (std::rename(tempFileName.c_str(), m_fileName.c_str()) != 0)
+		std::cout << "Failed to replace the pipeline cache " << m_fileName << std::endl;
+}
+
+bool PipelineCache::IsCompatible(const std::vector<char>& data) const
+{
+	//header layout is VkPipelineCacheHeaderVersionOne: length, version, vendorID, deviceID, pipelineCacheUUID
+	const size_t headerSize = 4 * sizeof(uint32_t) + VK_UUID_SIZE;
+	if (data.size() < headerSize)
+		return false;
+
+	uint32_t header[4];
+	memcpy(header, data.data(), sizeof(header));
+
+	VkPhysicalDeviceProperties props;
+	vk::GetPhysicalDeviceProperties(vk::g_vulkanContext.m_physicalDevice, &props);
+
+	if (header[0] < headerSize || header[1] != VK_PIPELINE_CACHE_HEADER_VERSION_ONE)
+		return false;
+	if (header[2] != props.vendorID || header[3] != props.deviceID)
+		return false;
+
+	return memcmp(data.data() + sizeof(header), props.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+void PipelineCache::CreateCache(const std::vector<char>& initialData)
+{
+	VkPipelineCacheCreateInfo cacheCrtInfo;
+	cleanStructure(cacheCrtInfo);
+	cacheCrtInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	cacheCrtInfo.initialDataSize = initialData.size();
+	cacheCrtInfo.pInitialData = (initialData.empty()) ? nullptr : initialData.data();
+
+	VkResult result = vk::CreatePipelineCache(vk::g_vulkanContext.m_device, &cacheCrtInfo, nullptr, &m_pipelineCache);
+	if (result != VK_SUCCESS && !initialData.empty())
+	{
+		//driver didn't like the data. Start with an empty cache
+		std::cout << "Pipeline cache " << m_fileName << " rejected by the driver" << std::endl;
+		cacheCrtInfo.initialDataSize = 0;
+		cacheCrtInfo.pInitialData = nullptr;
+		result = vk::CreatePipelineCache(vk::g_vulkanContext.m_device, &cacheCrtInfo, nullptr, &m_pipelineCache);
+	}
+	VULKAN_ASSERT(result);
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "VulkanLoader.h"
+#include "Singleton.h"
+
+#include <string>
+#include <vector>
+
+//one VkPipelineCache shared by every pipeline. It's loaded from disk at startup and written back at shutdown
+//so the driver doesn't have to compile all the pipelines from scratch every run (and on every shader reload)
+class PipelineCache : public Singleton<PipelineCache>
+{
+	friend class Singleton<PipelineCache>;
+public:
+	void Load(const std::string& fileName);
+	void Save();
+
+	VkPipelineCache Get() const { return m_pipelineCache; }
+
+private:
+	PipelineCache();
+	virtual ~PipelineCache();
+
+	bool IsCompatible(const std::vector<char>& data) const;
+	void CreateCache(const std::vector<char>& initialData);
+private:
+	VkPipelineCache			m_pipelineCache;
+	std::string				m_fileName;
+};
@@ -125,7 +125,7 @@ void PointLightRenderer2::Render()
 	vk::CmdBindPipeline(cmdBuffer, m_tileShadingPipeline.GetBindPoint(), m_tileShadingPipeline.Get());
 	vk::CmdBindDescriptorSets(cmdBuffer, m_tileShadingPipeline.GetBindPoint(), m_tileShadingPipeline.GetLayout(), 0, 1, &m_tileShadingDescSet, 0, nullptr);
 
-	vk::CmdDispatch(cmdBuffer, gridCellsX, gridCellsY, 1);
+	Dispatch(cmdBuffer, gridCellsX, gridCellsY, 1);
 
 	//here maybe we need a barrier to wait for compute to finish if the subpass dependecy doesnt work
 
@@ -0,0 +1,322 @@
+#include "QueryManager.h"
+
+#include "Utils.h"
+
+#include <bitset>
+#include <fstream>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//QueryManager
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+QueryManager::QueryManager()
+	: m_queryBuffer(VK_NULL_HANDLE)
+	, m_queryMemory(VK_NULL_HANDLE)
+	, m_queryBufferPtr(nullptr)
+	, m_occlusionQueryPool(VK_NULL_HANDLE)
+	, m_statisticsQueryPool(VK_NULL_HANDLE)
+	, m_statisticsFlags(0)
+	, m_registerQueries(0)
+	, m_bufferSize(256)
+	, m_canQuery(false)
+	, m_timestampsSupported(false)
+	, m_timestampMask(0)
+	, m_timestampPeriod(0.0)
+	, m_timestampFrame(0)
+	, m_openScopes(0)
+	, m_frameNumber(0)
+	, m_firstTick(0)
+{
+	VkDevice device = vk::g_vulkanContext.m_device;
+
+	VkQueryPipelineStatisticFlags  pipeStatsFlags = VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT;
+	std::bitset<32> bitSet (pipeStatsFlags);
+	m_statsQueryNum = (uint32_t)bitSet.count();
+
+	uint32_t stride = 2 * sizeof(uint32_t);
+	m_occlusionQueryOffset = stride * m_statsQueryNum;
+	m_maxQueries = (m_bufferSize - stride * m_statsQueryNum ) / stride;
+
+	VkQueryPoolCreateInfo queryPoolInfo;
+	cleanStructure(queryPoolInfo);
+	queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	queryPoolInfo.pNext = nullptr;
+	queryPoolInfo.pipelineStatistics = pipeStatsFlags;
+	queryPoolInfo.queryCount =  1;
+	queryPoolInfo.flags = 0;
+	queryPoolInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+	const VkPhysicalDeviceFeatures& features = vk::g_vulkanContext.m_features;
+	if (features.pipelineStatisticsQuery && features.inheritedQueries)
+	{
+		VULKAN_ASSERT(vk::CreateQueryPool(device, &queryPoolInfo, nullptr, &m_statisticsQueryPool));
+		m_statisticsFlags = pipeStatsFlags;
+	}
+
+	queryPoolInfo.queryType = VK_QUERY_TYPE_OCCLUSION;
+	queryPoolInfo.pipelineStatistics = 0;
+	queryPoolInfo.queryCount = m_maxQueries;
+	VULKAN_ASSERT(vk::CreateQueryPool(device, &queryPoolInfo, nullptr, &m_occlusionQueryPool));
+
+	AllocBufferMemory(m_queryBuffer, m_queryMemory, m_bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+	VULKAN_ASSERT(vk::MapMemory(device,  m_queryMemory, 0, m_bufferSize, 0, &m_queryBufferPtr));
+
+	CreateTimestampPools();
+}
+
+QueryManager::~QueryManager()
+{
+	//vk::UnmapMemory(vk::g_vulkanContext.m_device, m_queryMemory);
+}
+
+void QueryManager::Reset()
+{
+	VkCommandBuffer cmdBuffer = vk::g_vulkanContext.m_mainCommandBuffer;
+	if (m_statisticsFlags)
+		vk::CmdResetQueryPool(cmdBuffer, m_statisticsQueryPool, 0, m_statsQueryNum);
+	vk::CmdResetQueryPool(cmdBuffer, m_occlusionQueryPool, 0, m_registerQueries);
+
+	vk::CmdFillBuffer(cmdBuffer, m_queryBuffer, 0, m_bufferSize, 0);
+
+	m_registerQueries = 0;
+	m_canQuery = false;
+
+	if (!m_timestampsSupported)
+		return;
+
+	TRAP(m_openScopes == 0 && "A timestamp scope was not closed last frame");
+	m_timestampFrame = (m_timestampFrame + 1) % TIMESTAMP_FRAMES;
+	TimestampFrame& frame = m_timestampFrames[m_timestampFrame];
+	if (frame.QueriesCount > 0)
+		ResolveTimestamps(frame);
+
+	frame.Scopes.clear();
+	frame.QueriesCount = 0;
+	frame.FrameNumber = m_frameNumber++;
+	vk::CmdResetQueryPool(cmdBuffer, frame.Pool, 0, MAX_TIMESTAMPS);
+}
+
+uint32_t QueryManager::BeginQuery()
+{
+	VkCommandBuffer cmdBuffer = vk::g_vulkanContext.m_mainCommandBuffer;
+	TRAP(m_registerQueries < m_maxQueries);
+	uint32_t index = m_registerQueries++;
+	vk::CmdBeginQuery(cmdBuffer, m_occlusionQueryPool, index, 0);
+	return index;
+}
+
+void QueryManager::EndQuery(uint32_t index)
+{
+	VkCommandBuffer cmdBuffer = vk::g_vulkanContext.m_mainCommandBuffer;
+	vk::CmdEndQuery(cmdBuffer, m_occlusionQueryPool, index);
+}
+
+void QueryManager::GetQueries()
+{
+	VkCommandBuffer cmdBuffer = vk::g_vulkanContext.m_mainCommandBuffer;
+
+	if (m_statisticsFlags)
+		vk::CmdCopyQueryPoolResults(cmdBuffer, m_statisticsQueryPool, 0, m_statsQueryNum, m_queryBuffer, 0, 2 * sizeof(uint32_t), VK_QUERY_RESULT_WITH_AVAILABILITY_BIT | VK_QUERY_RESULT_WAIT_BIT );
+	vk::CmdCopyQueryPoolResults(cmdBuffer, m_occlusionQueryPool, 0, m_registerQueries, m_queryBuffer, m_occlusionQueryOffset, 2 * sizeof(uint32_t), VK_QUERY_RESULT_WITH_AVAILABILITY_BIT | VK_QUERY_RESULT_WAIT_BIT );
+	m_canQuery = true;
+}
+
+uint32_t QueryManager::GetResult(uint32_t index)
+{
+	TRAP(m_canQuery);
+	uint32_t* occlusionPtr = (uint32_t*)((uint8_t*)m_queryBufferPtr + m_occlusionQueryOffset);
+	bool isAvailable = (*(occlusionPtr + index + 1) != 0);
+	TRAP(isAvailable);
+	return *(occlusionPtr + index);
+}
+
+void QueryManager::StartStatistics()
+{
+	if (!m_statisticsFlags)
+		return;
+
+	VkCommandBuffer cmdBuffer = vk::g_vulkanContext.m_mainCommandBuffer;
+	vk::CmdBeginQuery(cmdBuffer, m_statisticsQueryPool, 0, 0);
+}
+
+void QueryManager::EndStatistics()
+{
+	if (!m_statisticsFlags)
+		return;
+
+	VkCommandBuffer cmdBuffer = vk::g_vulkanContext.m_mainCommandBuffer;
+	vk::CmdEndQuery(cmdBuffer, m_statisticsQueryPool, 0);
+}
+
+uint32_t QueryManager::BeginTimestamp(const std::string& name)
+{
+	if (!m_timestampsSupported)
+		return InvalidScope;
+
+	TimestampFrame& frame = m_timestampFrames[m_timestampFrame];
+	if (frame.QueriesCount + 2 > MAX_TIMESTAMPS)
+		return InvalidScope;
+
+	TimestampScope scope;
+	scope.Name = name;
+	scope.Depth = m_openScopes++;
+	scope.BeginQuery = frame.QueriesCount++;
+	scope.EndQuery = frame.QueriesCount++;
+	frame.Scopes.push_back(scope);
+
+	vk::CmdWriteTimestamp(vk::g_vulkanContext.m_mainCommandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, frame.Pool, scope.BeginQuery);
+	return (uint32_t)frame.Scopes.size() - 1;
+}
+
+void QueryManager::EndTimestamp(uint32_t scope)
+{
+	if (scope == InvalidScope)
+		return;
+
+	TimestampFrame& frame = m_timestampFrames[m_timestampFrame];
+	TRAP(scope < frame.Scopes.size() && m_openScopes > 0);
+	--m_openScopes;
+
+	vk::CmdWriteTimestamp(vk::g_vulkanContext.m_mainCommandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, frame.Pool, frame.Scopes[scope].EndQuery);
+}
+
+const std::vector<QueryManager::TimestampResult>& QueryManager::GetLastTimestamps() const
+{
+	static const std::vector<TimestampResult> empty;
+	return m_resolvedFrames.empty() ? empty : m_resolvedFrames.back().Results;
+}
+
+double QueryManager::GetTimestamp(const std::string& name) const
+{
+	double total = -1.0;
+	for (const auto& result : GetLastTimestamps())
+	{
+		if (result.Name != name)
+			continue;
+
+		total = (total < 0.0) ? result.DurationMs : total + result.DurationMs;
+	}
+
+	return total;
+}
+
+void QueryManager::FlushTimestamps()
+{
+	if (!m_timestampsSupported)
+		return;
+
+	//oldest first, the current frame is the last
+	for (uint32_t i = 1; i <= TIMESTAMP_FRAMES; ++i)
+	{
+		TimestampFrame& frame = m_timestampFrames[(m_timestampFrame + i) % TIMESTAMP_FRAMES];
+		if (frame.QueriesCount == 0)
+			continue;
+
+		ResolveTimestamps(frame);
+		frame.Scopes.clear();
+		frame.QueriesCount = 0;
+	}
+}
+
+bool QueryManager::ExportChromeTrace(const std::string& fileName) const
+{
+	std::ofstream file(fileName, std::ios_base::out | std::ios_base::trunc);
+	if (!file.is_open())
+		return false;
+
+	//the names are pass names, no escaping needed. Times are in microseconds
+	file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	bool first = true;
+	for (const auto& frame : m_resolvedFrames)
+	{
+		for (const auto& result : frame.Results)
+		{
+			file << (first ? "\n" : ",\n");
+			file << "{\"name\":\"" << result.Name << "\",\"cat\":\"gpu\",\"ph\":\"X\",\"pid\":0,\"tid\":0"
+				<< ",\"ts\":" << (frame.StartMs + result.StartMs) * 1000.0
+				<< ",\"dur\":" << result.DurationMs * 1000.0
+				<< ",\"args\":{\"frame\":" << frame.FrameNumber << ",\"depth\":" << result.Depth << "}}";
+			first = false;
+		}
+	}
+	file << "\n]}\n";
+
+	return file.good();
+}
+
+void QueryManager::CreateTimestampPools()
+{
+	VkPhysicalDevice physicalDevice = vk::g_vulkanContext.m_physicalDevice;
+	uint32_t queuePropCnt = 0;
+	vk::GetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queuePropCnt, nullptr);
+	std::vector<VkQueueFamilyProperties> queueProperties(queuePropCnt);
+	vk::GetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queuePropCnt, queueProperties.data());
+
+	uint32_t validBits = queueProperties[vk::g_vulkanContext.m_queueFamilyIndex].timestampValidBits;
+	m_timestampsSupported = validBits > 0 && vk::g_vulkanContext.m_limits.timestampPeriod > 0.0f;
+	if (!m_timestampsSupported)
+		return;
+
+	m_timestampMask = (validBits >= 64) ? ~0ull : ((1ull << validBits) - 1);
+	m_timestampPeriod = vk::g_vulkanContext.m_limits.timestampPeriod;
+
+	VkQueryPoolCreateInfo queryPoolInfo;
+	cleanStructure(queryPoolInfo);
+	queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	queryPoolInfo.queryCount = MAX_TIMESTAMPS;
+
+	for (auto& frame : m_timestampFrames)
+	{
+		VULKAN_ASSERT(vk::CreateQueryPool(vk::g_vulkanContext.m_device, &queryPoolInfo, nullptr, &frame.Pool));
+		frame.QueriesCount = 0;
+		frame.FrameNumber = 0;
+	}
+}
+
+void QueryManager::ResolveTimestamps(TimestampFrame& frame)
+{
+	//value and availability for every query
+	std::vector<uint64_t> data(frame.QueriesCount * 2);
+	VkResult result = vk::GetQueryPoolResults(vk::g_vulkanContext.m_device, frame.Pool, 0, frame.QueriesCount, data.size() * sizeof(uint64_t), data.data(),
+		2 * sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+	TRAP(result == VK_SUCCESS || result == VK_NOT_READY);
+
+	FrameTimestamps resolved;
+	resolved.FrameNumber = frame.FrameNumber;
+	resolved.StartMs = 0.0;
+	resolved.Results.reserve(frame.Scopes.size());
+
+	uint64_t frameStart = 0;
+	bool hasStart = false;
+	for (const auto& scope : frame.Scopes)
+	{
+		bool available = data[scope.BeginQuery * 2 + 1] != 0 && data[scope.EndQuery * 2 + 1] != 0;
+		if (!available) //the scope was never closed
+			continue;
+
+		uint64_t begin = data[scope.BeginQuery * 2] & m_timestampMask;
+		uint64_t end = data[scope.EndQuery * 2] & m_timestampMask;
+		if (!hasStart)
+		{
+			frameStart = begin;
+			hasStart = true;
+			if (m_resolvedFrames.empty() && m_firstTick == 0)
+				m_firstTick = begin;
+		}
+
+		TimestampResult timestamp;
+		timestamp.Name = scope.Name;
+		timestamp.Depth = scope.Depth;
+		timestamp.StartMs = (double)(int64_t)(begin - frameStart) * m_timestampPeriod / 1000000.0;
+		timestamp.DurationMs = (double)((end - begin) & m_timestampMask) * m_timestampPeriod / 1000000.0;
+		resolved.Results.push_back(timestamp);
+	}
+
+	if (!hasStart)
+		return;
+
+	resolved.StartMs = (double)(int64_t)(frameStart - m_firstTick) * m_timestampPeriod / 1000000.0;
+	m_resolvedFrames.push_back(resolved);
+	if (m_resolvedFrames.size() > TRACE_HISTORY)
+		m_resolvedFrames.pop_front();
+}
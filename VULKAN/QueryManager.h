@@ -0,0 +1,122 @@
+#pragma once
+
+#include "VulkanLoader.h"
+#include "defines.h"
+
+#include <array>
+#include <deque>
+#include <string>
+#include <vector>
+
+//Occlusion, pipeline statistics and timestamp queries.
+//Timestamps are recorded in a ring of query pools, one per frame. A frame is read back when its pool is reused,
+//TIMESTAMP_FRAMES frames later, so its command buffer is surely finished and nobody waits for the gpu
+class QueryManager
+{
+public:
+	struct TimestampResult
+	{
+		std::string		Name;
+		uint32_t		Depth;		//nesting level of the scope
+		double			StartMs;	//from the first timestamp of the frame
+		double			DurationMs;
+	};
+
+	struct FrameTimestamps
+	{
+		uint64_t						FrameNumber; //counts the calls to Reset
+		double							StartMs; //from the first resolved timestamp
+		std::vector<TimestampResult>	Results;
+	};
+
+	static const uint32_t InvalidScope = ~0u;
+
+	static QueryManager& GetInstance()
+	{
+		static QueryManager instance;
+		return instance;
+	}
+
+public:
+	QueryManager();
+	~QueryManager();
+
+	//call it first in the command buffer. Resolves the timestamps of the frame that used the same pool
+	void Reset();
+
+	uint32_t BeginQuery();
+	void EndQuery(uint32_t index);
+	void GetQueries();
+	uint32_t GetResult(uint32_t index);
+
+	//the statistics query is active while the secondary command buffers are executed, they must inherit these flags.
+	//0 if the device can't query statistics or execute secondaries in an active query, then the statistics are skipped
+	VkQueryPipelineStatisticFlags GetStatisticsFlags() const { return m_statisticsFlags; }
+	void StartStatistics();
+	void EndStatistics();
+
+	//scopes can be nested. Returns InvalidScope if timestamps are not supported or the frame is out of queries
+	uint32_t BeginTimestamp(const std::string& name);
+	void EndTimestamp(uint32_t scope);
+
+	bool HasTimestamps() const { return m_timestampsSupported; }
+	const std::vector<TimestampResult>& GetLastTimestamps() const;
+	//time spent in the scopes with this name in the last resolved frame. -1 if there is none
+	double GetTimestamp(const std::string& name) const;
+	//the last resolved frames, oldest first
+	const std::deque<FrameTimestamps>& GetResolvedFrames() const { return m_resolvedFrames; }
+	//resolves the frames still in the ring. The gpu must be idle
+	void FlushTimestamps();
+	//writes the resolved frames still in the history in the chrome://tracing format
+	bool ExportChromeTrace(const std::string& fileName) const;
+
+private:
+	static const uint32_t TIMESTAMP_FRAMES = FRAMES_IN_FLIGHT + 1;
+	static const uint32_t MAX_TIMESTAMPS = 256;
+	static const uint32_t TRACE_HISTORY = 300;
+
+	struct TimestampScope
+	{
+		std::string		Name;
+		uint32_t		Depth;
+		uint32_t		BeginQuery;
+		uint32_t		EndQuery;
+	};
+
+	struct TimestampFrame
+	{
+		VkQueryPool						Pool;
+		std::vector<TimestampScope>		Scopes;
+		uint32_t						QueriesCount;
+		uint64_t						FrameNumber;
+	};
+
+	void CreateTimestampPools();
+	void ResolveTimestamps(TimestampFrame& frame);
+private:
+	VkBuffer        m_queryBuffer;
+	VkDeviceMemory  m_queryMemory;
+	void*           m_queryBufferPtr;
+
+	VkQueryPool     m_occlusionQueryPool;
+	VkQueryPool     m_statisticsQueryPool;
+	VkQueryPipelineStatisticFlags	m_statisticsFlags;
+
+	uint32_t        m_maxQueries;
+	uint32_t        m_registerQueries;
+	uint32_t        m_occlusionQueryOffset;
+	uint32_t        m_statsQueryNum;
+
+	const uint32_t  m_bufferSize;
+	bool            m_canQuery;
+
+	bool											m_timestampsSupported;
+	uint64_t										m_timestampMask;
+	double											m_timestampPeriod; //nanoseconds per tick
+	std::array<TimestampFrame, TIMESTAMP_FRAMES>	m_timestampFrames;
+	uint32_t										m_timestampFrame;
+	uint32_t										m_openScopes;
+	uint64_t										m_frameNumber;
+	uint64_t										m_firstTick;
+	std::deque<FrameTimestamps>						m_resolvedFrames;
+};
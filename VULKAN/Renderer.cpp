@@ -1,4 +1,7 @@
 #include "Renderer.h"
+#include "PipelineCache.h"
+#include "QueryManager.h"
+#include "CommandRecorder.h"
 
 ResourceTable   g_commonResources;
 
@@ -326,7 +329,7 @@ void CGraphicPipeline::CreatePipeline()
     gpci.basePipelineHandle = VK_NULL_HANDLE;
     gpci.basePipelineIndex = -1;
 
-	VULKAN_ASSERT(vk::CreateGraphicsPipelines(vk::g_vulkanContext.m_device, VK_NULL_HANDLE, 1, &gpci, nullptr, &m_solidPipeline));
+	VULKAN_ASSERT(vk::CreateGraphicsPipelines(vk::g_vulkanContext.m_device, PipelineCache::GetInstance()->Get(), 1, &gpci, nullptr, &m_solidPipeline));
 	
 	if (m_allowWireframe)
 	{
@@ -337,7 +340,7 @@ void CGraphicPipeline::CreatePipeline()
 		gpci.pRasterizationState = &wireRasterizationInfo;
 		gpci.basePipelineHandle = m_solidPipeline;
 
-		VULKAN_ASSERT(vk::CreateGraphicsPipelines(vk::g_vulkanContext.m_device, VK_NULL_HANDLE, 1, &gpci, nullptr, &m_wireframePipeline));
+		VULKAN_ASSERT(vk::CreateGraphicsPipelines(vk::g_vulkanContext.m_device, PipelineCache::GetInstance()->Get(), 1, &gpci, nullptr, &m_wireframePipeline));
 	}
 
 	SwitchWireframe(m_isWireframe);
@@ -687,7 +690,7 @@ void CComputePipeline::CreatePipeline()
     crtInfo.stage = CreatePipelineStage(m_computeShader, VK_SHADER_STAGE_COMPUTE_BIT);
     crtInfo.layout = m_pipelineLayout;
 
-    VULKAN_ASSERT(vk::CreateComputePipelines(vk::g_vulkanContext.m_device, VK_NULL_HANDLE, 1, &crtInfo, nullptr, &m_pipeline));
+    VULKAN_ASSERT(vk::CreateComputePipelines(vk::g_vulkanContext.m_device, PipelineCache::GetInstance()->Get(), 1, &crtInfo, nullptr, &m_pipeline));
 }
 
 void CComputePipeline::CleanInternal()
@@ -709,7 +712,7 @@ CRenderer::CRenderer(VkRenderPass renderPass, std::string renderPassMarker)
     , m_ownFramebuffer(true)
     , m_descriptorPool(VK_NULL_HANDLE)
     , m_renderPassMarker(renderPassMarker)
-
+    , m_timestampScope(QueryManager::InvalidScope)
 {
     ms_Renderers.push_back(this);
 }
@@ -725,7 +728,7 @@ void CRenderer::CreateFramebuffer(FramebufferDescription& fbDesc, unsigned int w
     UpdateResourceTable();
 }
 
-void CRenderer::StartRenderPass()
+void CRenderer::StartRenderPass(VkSubpassContents contents)
 {
     VkRect2D renderArea = m_framebuffer->GetRenderArea();  
     const std::vector<VkClearValue>& clearValues = m_framebuffer->GetClearValues();
@@ -743,16 +746,38 @@ void CRenderer::StartRenderPass()
     if (!m_renderPassMarker.empty())
         StartDebugMarker(m_renderPassMarker);
 
-    vk::CmdBeginRenderPass(vk::g_vulkanContext.m_mainCommandBuffer, &renderBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+    m_timestampScope = QueryManager::GetInstance().BeginTimestamp(GetTimestampName());
+    vk::CmdBeginRenderPass(vk::g_vulkanContext.m_mainCommandBuffer, &renderBeginInfo, contents);
+
+    if (contents == VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS)
+        CommandRecorder::GetInstance()->BeginSubpass(m_renderPass, 0, m_framebuffer->Get());
 }
 
 void CRenderer::EndRenderPass()
 {
+    if (CommandRecorder::GetInstance()->IsRecordingSubpass())
+        CommandRecorder::GetInstance()->ExecuteSubpass();
+
     vk::CmdEndRenderPass(vk::g_vulkanContext.m_mainCommandBuffer);
+    QueryManager::GetInstance().EndTimestamp(m_timestampScope);
+    m_timestampScope = QueryManager::InvalidScope;
+
     if (!m_renderPassMarker.empty())
         EndDebugMarker(m_renderPassMarker);
 }
 
+void CRenderer::Dispatch(VkCommandBuffer cmdBuffer, uint32_t groupCountX, uint32_t groupCountY, uint32_t groupCountZ)
+{
+    uint32_t scope = QueryManager::GetInstance().BeginTimestamp(GetTimestampName() + "Dispatch");
+    vk::CmdDispatch(cmdBuffer, groupCountX, groupCountY, groupCountZ);
+    QueryManager::GetInstance().EndTimestamp(scope);
+}
+
+std::string CRenderer::GetTimestampName() const
+{
+    return (m_renderPassMarker.empty()) ? std::string("UnnamedRenderPass") : m_renderPassMarker;
+}
+
 CRenderer::~CRenderer()
 {
     VkDevice dev = vk::g_vulkanContext.m_device;
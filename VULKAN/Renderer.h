@@ -377,7 +377,8 @@ public:
 	virtual void PreRender(){};
 	virtual void RenderShadows() {} //need to refactor this thing
 
-    void StartRenderPass();
+    //with VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS the draws are added as jobs of the CommandRecorder, executed by EndRenderPass
+    void StartRenderPass(VkSubpassContents contents = VK_SUBPASS_CONTENTS_INLINE);
     void EndRenderPass();
 
     virtual void CreateFramebuffer(FramebufferDescription& fbDesc, unsigned int width, unsigned int height, unsigned int layers = 1);
@@ -404,6 +405,11 @@ protected:
     void UpdateResourceTableForColor(unsigned int fbIndex, EResourceType tableType);
     void UpdateResourceTableForDepth( EResourceType tableType);
 
+    //vkCmdDispatch measured by the gpu profiler
+    void Dispatch(VkCommandBuffer cmdBuffer, uint32_t groupCountX, uint32_t groupCountY, uint32_t groupCountZ);
+private:
+    std::string GetTimestampName() const;
+
 protected:
     CFrameBuffer*                                       m_framebuffer;
     VkRenderPass                                        m_renderPass;
@@ -413,6 +419,7 @@ private:
     bool                                                m_initialized;
     bool                                                m_ownFramebuffer;
     std::string                                         m_renderPassMarker;
+    uint32_t                                            m_timestampScope;
 
     std::unordered_set<CPipeline*>                      m_ownPipelines;
     static std::vector<CRenderer*>						ms_Renderers;
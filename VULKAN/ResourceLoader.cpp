@@ -3,7 +3,10 @@
 #include "Texture.h"
 #include "Mesh.h"
 
+#include <iostream>
+
 ResourceLoader::ResourceLoader()
+	: m_fallbackTexture(nullptr)
 {
 
 }
@@ -25,12 +28,35 @@ void ResourceLoader::LoadTexture(CTexture** pText)
 		return;
 	}
 
+	//created first, so it has memory when a texture doesn't
+	CTexture* fallbackTexture = GetFallbackTexture();
+
 	SImageData imgData;
 	Read2DTextureData(imgData, std::string(TEXTDIR) + filename, (*pText)->GetIsSRGB());
-	(*pText)->CreateTexture(imgData, true);//hmmmmmmmmmmmmmmmmm
+	if (!(*pText)->CreateTexture(imgData, true))//hmmmmmmmmmmmmmmmmm
+	{
+		std::cout << "No memory for texture " << filename << ", it's replaced by a grey one" << std::endl;
+		delete *pText;
+		*pText = fallbackTexture;
+	}
 	m_texturesMap.emplace(filename, (*pText));
 }
 
+//grey, with all the mips of a scene texture
+CTexture* ResourceLoader::GetFallbackTexture()
+{
+	if (m_fallbackTexture)
+		return m_fallbackTexture;
+
+	const unsigned int size = 1 << (DEFAULT_MIPLEVELS - 1);
+	SImageData imgData(size, size, 1, VK_FORMAT_B8G8R8A8_UNORM, new unsigned char[size * size * 4]);
+	memset(imgData.data, 128, size * size * 4);
+	imgData.fileName = "fallback";
+
+	m_fallbackTexture = new CTexture(imgData, true);
+	return m_fallbackTexture;
+}
+
 void ResourceLoader::LoadMesh(Mesh** mesh)
 {
 	const std::string filename = (*mesh)->GetFilename();
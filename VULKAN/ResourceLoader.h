@@ -3,6 +3,7 @@
 #include "Singleton.h"
 
 #include <unordered_map>
+#include <string>
 
 class Mesh;
 class CTexture;
@@ -17,6 +18,9 @@ private:
 	ResourceLoader();
 	virtual ~ResourceLoader();
 
+	CTexture* GetFallbackTexture();
+
 	std::unordered_map<std::string, CTexture*>      m_texturesMap;
+	CTexture*										m_fallbackTexture; //for the textures there is no memory for
 	std::unordered_map<std::string, Mesh*>          m_meshMap;
 };
\ No newline at end of file
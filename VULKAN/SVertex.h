@@ -1,6 +1,7 @@
 #pragma once
 
 #include "glm/glm.hpp"
+#include <cstdint>
 
 struct SVertex
 {
@@ -25,3 +26,13 @@ struct SVertex
 		color |= r;
 	}
 };
+
+//24 bytes instead of the 60 of SVertex. The batched meshes are stored and drawn in this format, see VertexCompression.h
+struct SCompactVertex
+{
+	uint16_t pos[4]; //unorm, relative to the bounds of the mesh. w - the sign of the bitangent (0 - negative, 1 - positive)
+	uint16_t uv[2]; //half floats
+	int16_t normal[2]; //snorm, octahedral encoded
+	int16_t tangent[2]; //snorm, octahedral encoded
+	unsigned int color;
+};
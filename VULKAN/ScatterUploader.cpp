@@ -0,0 +1,193 @@
+#include "ScatterUploader.h"
+
+#include "MemoryManager.h"
+#include "QueryManager.h"
+#include "Utils.h"
+
+struct ScatterParams
+{
+	uint32_t	UpdatesCount;
+	uint32_t	EntryWords;
+};
+
+static const uint32_t s_scatterGroupSize = 64; //local_size_x in scatter.comp
+
+ScatterUploader::ScatterUploader()
+	: m_frameIndex(0)
+{
+}
+
+ScatterUploader::~ScatterUploader()
+{
+	for (auto pool : m_descPools)
+		delete pool;
+}
+
+void ScatterUploader::Initialize(CRenderer* renderer)
+{
+	m_descLayout.AddBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT); //updates, from the frame allocator
+	m_descLayout.AddBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT); //table
+	m_descLayout.Construct();
+
+	VkPushConstantRange pushConstRange;
+	pushConstRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstRange.offset = 0;
+	pushConstRange.size = sizeof(ScatterParams);
+
+	m_pipeline.SetComputeShaderFile("scatter.comp");
+	m_pipeline.AddPushConstant(pushConstRange);
+	m_pipeline.CreatePipelineLayout(m_descLayout.Get());
+	m_pipeline.Init(renderer, VK_NULL_HANDLE, -1);
+}
+
+void ScatterUploader::BeginFrame(uint32_t frameIndex)
+{
+	m_frameIndex = frameIndex;
+
+	for (auto descSet : m_frameDescSets[frameIndex])
+	{
+		for (auto pool : m_descPools)
+		{
+			if (pool->FreeDescriptorSet(descSet))
+				break;
+		}
+	}
+	m_frameDescSets[frameIndex].clear();
+}
+
+void ScatterUploader::AddUpdate(BufferHandle* table, uint32_t entrySize, uint32_t index, const void* payload)
+{
+	TRAP(entrySize % sizeof(uint32_t) == 0);
+	uint32_t entryWords = entrySize / sizeof(uint32_t);
+	TRAP((VkDeviceSize)(index + 1) * entrySize <= table->GetSize());
+
+	TableUpdates& updates = m_updates[table];
+	if (updates.Words.empty())
+	{
+		updates.EntryWords = entryWords;
+		updates.Count = 0;
+	}
+	TRAP(updates.EntryWords == entryWords);
+
+	const uint32_t* payloadWords = (const uint32_t*)payload;
+	if (!updates.KeptUpdates.empty())
+	{
+		auto keptIt = updates.KeptUpdates.find(index);
+		if (keptIt != updates.KeptUpdates.end())
+		{
+			std::copy(payloadWords, payloadWords + entryWords, updates.Words.begin() + keptIt->second + 1);
+			return;
+		}
+	}
+
+	updates.Words.push_back(index);
+	updates.Words.insert(updates.Words.end(), payloadWords, payloadWords + entryWords);
+	++updates.Count;
+}
+
+void ScatterUploader::Record(VkCommandBuffer cmdBuffer)
+{
+	if (m_updates.empty())
+		return;
+
+	StartDebugMarker("ScatterUploads");
+	uint32_t timestampScope = QueryManager::GetInstance().BeginTimestamp("ScatterUploads");
+
+	//the previous frames can still read the tables (write after read, only the execution has to wait)
+	vk::CmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+	vk::CmdBindPipeline(cmdBuffer, m_pipeline.GetBindPoint(), m_pipeline.Get());
+
+	//a big set (a scene load) is split over frames by what the frame allocator has left
+	for (auto it = m_updates.begin(); it != m_updates.end();)
+	{
+		TableUpdates& updates = it->second;
+		uint32_t recordedCount = RecordTableUpdates(cmdBuffer, it->first, updates);
+		if (recordedCount == updates.Count)
+		{
+			it = m_updates.erase(it);
+			continue;
+		}
+
+		uint32_t updateWords = updates.EntryWords + 1;
+		updates.Words.erase(updates.Words.begin(), updates.Words.begin() + recordedCount * updateWords);
+		updates.Count -= recordedCount;
+
+		updates.KeptUpdates.clear();
+		for (uint32_t i = 0; i < updates.Count; ++i)
+			updates.KeptUpdates[updates.Words[i * updateWords]] = i * updateWords;
+		++it;
+	}
+
+	//the culling and the draws of this frame read the tables
+	VkMemoryBarrier scatterBarrier;
+	cleanStructure(scatterBarrier);
+	scatterBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	scatterBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	scatterBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	vk::CmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 1, &scatterBarrier, 0, nullptr, 0, nullptr);
+
+	QueryManager::GetInstance().EndTimestamp(timestampScope);
+	EndDebugMarker("ScatterUploads");
+}
+
+uint32_t ScatterUploader::RecordTableUpdates(VkCommandBuffer cmdBuffer, BufferHandle* table, const TableUpdates& updates)
+{
+	FrameAllocator* frameAllocator = MemoryManager::GetInstance()->GetFrameAllocator();
+	VkDeviceSize updateSize = (updates.EntryWords + 1) * sizeof(uint32_t);
+	uint32_t count = (uint32_t)glm::min<VkDeviceSize>(updates.Count, frameAllocator->GetFreeSize(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT) / updateSize);
+	if (count == 0)
+		return 0;
+
+	VkDeviceSize updatesSize = count * updateSize;
+	FrameAllocator::Allocation alloc;
+	bool allocated = frameAllocator->Allocate(updatesSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, alloc);
+	TRAP(allocated);
+	memcpy(alloc.m_ptr, updates.Words.data(), (size_t)updatesSize);
+
+	VkDescriptorBufferInfo updatesBuffInfo = CreateDescriptorBufferInfo(frameAllocator->GetBuffer(), alloc.m_offset, updatesSize);
+	VkDescriptorBufferInfo tableBuffInfo = table->GetDescriptor();
+
+	VkDescriptorSet descSet = AllocDescriptorSet();
+	std::vector<VkWriteDescriptorSet> wDesc;
+	wDesc.push_back(InitUpdateDescriptor(descSet, 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, &updatesBuffInfo));
+	wDesc.push_back(InitUpdateDescriptor(descSet, 1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, &tableBuffInfo));
+	vk::UpdateDescriptorSets(vk::g_vulkanContext.m_device, (uint32_t)wDesc.size(), wDesc.data(), 0, nullptr);
+
+	ScatterParams params;
+	params.UpdatesCount = count;
+	params.EntryWords = updates.EntryWords;
+
+	//a thread per copied word
+	uint32_t wordsCount = params.UpdatesCount * params.EntryWords;
+	uint32_t groupsCount = wordsCount / s_scatterGroupSize + ((wordsCount % s_scatterGroupSize != 0) ? 1 : 0);
+
+	vk::CmdBindDescriptorSets(cmdBuffer, m_pipeline.GetBindPoint(), m_pipeline.GetLayout(), 0, 1, &descSet, 0, nullptr);
+	vk::CmdPushConstants(cmdBuffer, m_pipeline.GetLayout(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ScatterParams), &params);
+	vk::CmdDispatch(cmdBuffer, groupsCount, 1, 1);
+
+	return count;
+}
+
+VkDescriptorSet ScatterUploader::AllocDescriptorSet()
+{
+	DescriptorPool* pool = nullptr;
+	for (auto descPool : m_descPools)
+	{
+		if (descPool->CanAllocate(m_descLayout))
+		{
+			pool = descPool;
+			break;
+		}
+	}
+
+	if (!pool)
+	{
+		pool = new DescriptorPool();
+		pool->Construct(m_descLayout, 32);
+		m_descPools.push_back(pool);
+	}
+
+	VkDescriptorSet descSet = pool->AllocateDescriptorSet(m_descLayout);
+	m_frameDescSets[m_frameIndex].push_back(descSet);
+	return descSet;
+}
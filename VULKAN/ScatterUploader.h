@@ -0,0 +1,61 @@
+#pragma once
+
+#include "VulkanLoader.h"
+#include "Renderer.h"
+#include "DescriptorsUtils.h"
+#include "Singleton.h"
+#include "defines.h"
+
+#include <array>
+#include <unordered_map>
+#include <vector>
+
+class BufferHandle;
+
+//Writes the changed entries of the persistent device local tables (the object data of the batches, the material parameters).
+//The cpu writes only (index, payload) pairs in the frame allocator and scatter.comp copies every payload at its index in the table,
+//so the tables are never written by the cpu and the frames in flight don't need their own copies
+class ScatterUploader : public Singleton<ScatterUploader>
+{
+	friend class Singleton<ScatterUploader>;
+public:
+	void Initialize(CRenderer* renderer);
+	//the frame that used this slot is finished
+	void BeginFrame(uint32_t frameIndex);
+
+	//entrySize is a multiple of 4 bytes, the payload is copied now. An entry must be updated at most once per frame,
+	//the copies of the same table run in parallel
+	void AddUpdate(BufferHandle* table, uint32_t entrySize, uint32_t index, const void* payload);
+	//the copies of the updates added this frame. Must be recorded outside a render pass, before the tables are read.
+	//The updates that don't fit in the frame allocator are kept for the next frame
+	void Record(VkCommandBuffer cmdBuffer);
+	//after Record, the table still has updates kept for the next frames, so some of its entries are old or not written yet
+	bool HasPendingUpdates(BufferHandle* table) const { return m_updates.find(table) != m_updates.end(); }
+	//call it before the table is freed
+	void DiscardUpdates(BufferHandle* table) { m_updates.erase(table); }
+private:
+	ScatterUploader();
+	virtual ~ScatterUploader();
+
+	struct TableUpdates
+	{
+		uint32_t				EntryWords;
+		uint32_t				Count;
+		std::vector<uint32_t>	Words; //per update, the index followed by the payload
+		//index -> position in Words, only for the updates kept from the previous frames. A newer update of the same entry
+		//replaces the payload, so an entry is still written once by the copies
+		std::unordered_map<uint32_t, uint32_t>	KeptUpdates;
+	};
+
+	//records the first updates of the table that fit in the frame allocator, returns how many
+	uint32_t RecordTableUpdates(VkCommandBuffer cmdBuffer, BufferHandle* table, const TableUpdates& updates);
+	VkDescriptorSet AllocDescriptorSet();
+private:
+	CComputePipeline										m_pipeline;
+	DescriptorSetLayout										m_descLayout;
+	std::vector<DescriptorPool*>							m_descPools;
+	std::array<std::vector<VkDescriptorSet>, FRAMES_IN_FLIGHT>	m_frameDescSets; //freed when the frame slot is reused
+	uint32_t												m_frameIndex;
+
+	std::unordered_map<BufferHandle*, TableUpdates>			m_updates;
+};
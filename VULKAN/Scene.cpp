@@ -28,35 +28,82 @@ Scene::~Scene()
 
 void Scene::AddObject(Object* obj)
 {
-	auto result = m_sceneObjects.insert(obj);
+	obj->GetModelMatrix(); //computes the world bounding box
+	int proxy = m_objectsTree.Insert(obj->GetBoundingBox(), obj);
+
+	auto result = m_sceneObjects.insert(std::make_pair(obj, proxy));
 	TRAP(result.second == true);
 
 	UpdateBoundingBox();
 }
 
-void Scene::UpdateBoundingBox()
+void Scene::RemoveObject(Object* obj)
 {
-	m_sceneBoundingBox.Max = m_sceneBoundingBox.Min = glm::vec3();
-	if (m_sceneObjects.empty())
-		return;
+	auto it = m_sceneObjects.find(obj);
+	TRAP(it != m_sceneObjects.end());
+
+	m_objectsTree.Remove(it->second);
+	m_sceneObjects.erase(it);
+	m_movedObjects.erase(obj);
+
+	UpdateBoundingBox();
+}
+
+void Scene::OnObjectMoved(Object* obj)
+{
+	if (m_sceneObjects.find(obj) != m_sceneObjects.end())
+		m_movedObjects.insert(obj);
+}
 
-	glm::vec3 maxLimits(std::numeric_limits<float>::min());
-	glm::vec3 minLimits(std::numeric_limits<float>::max());
+void Scene::RefitMovedObjects()
+{
+	if (m_movedObjects.empty())
+		return;
 
-	for (auto o = m_sceneObjects.begin(); o != m_sceneObjects.end(); ++o)
+	for (auto obj : m_movedObjects)
 	{
-		BoundingBox3D bb = (*o)->GetBoundingBox();
-		std::vector<glm::vec3> bbPoints;
-		bb.Transform((*o)->GetModelMatrix(), bbPoints);
-		for (unsigned int i = 0; i < bbPoints.size(); ++i)
-		{
-			maxLimits = glm::max(maxLimits, bbPoints[i]);
-			minLimits = glm::min(minLimits, bbPoints[i]);
-		}
+		obj->GetModelMatrix();
+		m_objectsTree.Update(m_sceneObjects[obj], obj->GetBoundingBox());
 	}
+	m_movedObjects.clear();
 
-	m_sceneBoundingBox.Max = maxLimits;
-	m_sceneBoundingBox.Min = minLimits;
+	UpdateBoundingBox();
+}
+
+void Scene::UpdateBoundingBox()
+{
+	//the root of the tree contains all the objects
+	m_sceneBoundingBox = m_objectsTree.GetBoundingBox();
+}
+
+void Scene::FrustumCulling(const CFrustum& frustum, std::vector<Object*>& outVisibleObjects) const
+{
+	std::vector<void*> objects;
+	m_objectsTree.QueryFrustum(frustum, objects);
+
+	outVisibleObjects.reserve(outVisibleObjects.size() + objects.size());
+	for (auto obj : objects)
+		outVisibleObjects.push_back(static_cast<Object*>(obj));
+}
+
+void Scene::QueryOverlap(const BoundingBox3D& bb, std::vector<Object*>& outObjects) const
+{
+	std::vector<void*> objects;
+	m_objectsTree.QueryOverlap(bb, objects);
+
+	outObjects.reserve(outObjects.size() + objects.size());
+	for (auto obj : objects)
+		outObjects.push_back(static_cast<Object*>(obj));
+}
+
+void Scene::RayCast(const glm::vec3& origin, const glm::vec3& dir, float maxDistance, std::vector<Object*>& outObjects) const
+{
+	std::vector<AABBTree::RayHit> hits;
+	m_objectsTree.RayCast(origin, dir, maxDistance, hits);
+
+	outObjects.reserve(outObjects.size() + hits.size());
+	for (const auto& hit : hits)
+		outObjects.push_back(static_cast<Object*>(hit.UserData));
 }
 
 void Scene::CalculatePlantsPositions(glm::uvec2 vegetationGridSize, const std::vector<uint32_t>& plantsPerCell, std::vector<glm::vec3>& outPositions)
@@ -108,8 +155,8 @@ void Scene::CalculatePlantsPositions(glm::uvec2 vegetationGridSize, const std::v
 
 void Scene::Update(float dt)
 {
-	if (ms_camera.GetIsDirty())
-		FrustumCulling();
+	//before the frame is rendered, BatchManager::Cull rejects the batches out of the camera frustum with the tree
+	RefitMovedObjects();
 }
 
 bool Scene::OnDebugKey(const KeyInput& key)
@@ -118,7 +165,7 @@ bool Scene::OnDebugKey(const KeyInput& key)
 	{
 		m_debugBoundigBoxes.reserve(m_sceneObjects.size());
 		for (auto obj : m_sceneObjects)
-			m_debugBoundigBoxes.push_back(CUIManager::GetInstance()->CreateDebugBoundingBox(obj->GetBoundingBox()));
+			m_debugBoundigBoxes.push_back(CUIManager::GetInstance()->CreateDebugBoundingBox(obj.first->GetBoundingBox()));
 	}
 	else
 	{
@@ -128,22 +175,4 @@ bool Scene::OnDebugKey(const KeyInput& key)
 		m_debugBoundigBoxes.clear();
 	}
 	return true;
-}
-
-void Scene::FrustumCulling()
-{
-	CFrustum frustum = ms_camera.GetFrustum();
-	std::for_each(m_sceneObjects.begin(), m_sceneObjects.end(), [&frustum](Object* obj)
-	{
-		BoundingBox3D bb = obj->GetBoundingBox();
-		if (frustum.Collision(bb) == CollisionResult::Outside)
-			obj->ResetVisibility(VisibilityType::InCameraFrustum);
-		else
-			obj->SetVisibility(VisibilityType::InCameraFrustum);
-
-		if (obj->GetIsShadowCaster())
-			obj->SetVisibility(VisibilityType::InShadowFrustum);
-		else
-			obj->ResetVisibility(VisibilityType::InShadowFrustum);
-	});
 }
\ No newline at end of file
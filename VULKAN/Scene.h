@@ -2,7 +2,9 @@
 
 #include "Geometry.h"
 #include "Singleton.h"
+#include "AABBTree.h"
 
+#include <unordered_map>
 #include <unordered_set>
 class Object;
 class KeyInput;
@@ -17,7 +19,16 @@ public:
 	const static glm::vec3 TerrainTranslate; //lel
 
 	void AddObject(Object* obj);
+	void RemoveObject(Object* obj);
+	//the object is refitted in the tree on the next Update
+	void OnObjectMoved(Object* obj);
 	BoundingBox3D GetBoundingBox() { return m_sceneBoundingBox; };
+
+	//spatial queries. They use the fat bounding boxes from the tree, so the results are conservative
+	void FrustumCulling(const CFrustum& frustum, std::vector<Object*>& outVisibleObjects) const;
+	void QueryOverlap(const BoundingBox3D& bb, std::vector<Object*>& outObjects) const;
+	//objects are sorted front to back
+	void RayCast(const glm::vec3& origin, const glm::vec3& dir, float maxDistance, std::vector<Object*>& outObjects) const;
 	void CalculatePlantsPositions(glm::uvec2 vegetationGridSize, const std::vector<uint32_t>& plantsPerCell, std::vector<glm::vec3>& outPositions);
 
 	void Update(float dt);
@@ -28,9 +39,11 @@ private:
 	virtual ~Scene();
 
 	void UpdateBoundingBox();
-	void FrustumCulling();
+	void RefitMovedObjects();
 private:
-	std::unordered_set<Object*>			m_sceneObjects;
+	std::unordered_map<Object*, int>	m_sceneObjects; //object -> proxy in m_objectsTree
+	std::unordered_set<Object*>			m_movedObjects;
+	AABBTree							m_objectsTree;
 	BoundingBox3D						m_sceneBoundingBox;
 
 
@@ -31,7 +31,7 @@ enum
 
 ScreenSpaceReflectionsRenderer::ScreenSpaceReflectionsRenderer(VkRenderPass renderPass)
 	: CRenderer(renderPass, "SSR")
-	, m_ssrConstantsBuffer(nullptr)
+	, m_ssrConstantsOffset(FrameAllocator::InvalidOffset)
 	, m_ssrSampler(VK_NULL_HANDLE)
 	, m_resolveSampler(VK_NULL_HANDLE)
 	, m_linearSampler(VK_NULL_HANDLE)
@@ -85,8 +85,6 @@ void ScreenSpaceReflectionsRenderer::Init()
 	CreatePipelines();
 	CreateImages();
 
-	m_ssrConstantsBuffer = MemoryManager::GetInstance()->CreateBuffer(EMemoryContextType::UniformBuffers, sizeof(SSRConstants), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
-
 	PerspectiveMatrix(m_projMatrix);
 	ConvertToProjMatrix(m_projMatrix);
 
@@ -102,7 +100,15 @@ void ScreenSpaceReflectionsRenderer::Init()
 
 void ScreenSpaceReflectionsRenderer::PreRender()
 {
-	SSRConstants* consts = m_ssrConstantsBuffer->GetPtr<SSRConstants*>();
+	FrameAllocator::Allocation constsAlloc;
+	if (!MemoryManager::GetInstance()->GetFrameAllocator()->Allocate(sizeof(SSRConstants), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, constsAlloc))
+	{
+		m_ssrConstantsOffset = FrameAllocator::InvalidOffset;
+		return;
+	}
+	m_ssrConstantsOffset = constsAlloc.m_offset;
+
+	SSRConstants* consts = (SSRConstants*)constsAlloc.m_ptr;
 	consts->ProjMatrix = m_projMatrix;
 	consts->ViewMatrix = ms_camera.GetViewMatrix();
 	consts->InvProjMatrix = glm::inverse(m_projMatrix);
@@ -113,13 +119,16 @@ void ScreenSpaceReflectionsRenderer::PreRender()
 void ScreenSpaceReflectionsRenderer::Render()
 {
 	return;
+	if (m_ssrConstantsOffset == FrameAllocator::InvalidOffset)
+		return;
+
 	VkCommandBuffer cmdBuff = vk::g_vulkanContext.m_mainCommandBuffer;
 
 	StartDebugMarker("SSRCompute");
 	ClearImages();
 	vk::CmdBindPipeline(cmdBuff, m_ssrPipeline.GetBindPoint(), m_ssrPipeline.Get());
-	vk::CmdBindDescriptorSets(cmdBuff, m_ssrPipeline.GetBindPoint(), m_ssrPipeline.GetLayout(), 0, 1, &m_ssrDescSet, 0, nullptr);
-	vk::CmdDispatch(cmdBuff, m_resolutionX / m_cellSize + ((m_resolutionX % m_cellSize == 0) ? 0 : 1), m_resolutionY / m_cellSize + ((m_resolutionY / m_cellSize == 0) ? 0 : 1), 1);
+	vk::CmdBindDescriptorSets(cmdBuff, m_ssrPipeline.GetBindPoint(), m_ssrPipeline.GetLayout(), 0, 1, &m_ssrDescSet, 1, &m_ssrConstantsOffset);
+	Dispatch(cmdBuff, m_resolutionX / m_cellSize + ((m_resolutionX % m_cellSize == 0) ? 0 : 1), m_resolutionY / m_cellSize + ((m_resolutionY / m_cellSize == 0) ? 0 : 1), 1);
 	EndDebugMarker("SSRCompute");
 
 	StartRenderPass();
@@ -150,7 +159,7 @@ void ScreenSpaceReflectionsRenderer::CreateDescriptorSetLayout()
 	{
 		std::vector<VkDescriptorSetLayoutBinding> bindings;
 
-		bindings.push_back(CreateDescriptorBinding(SSRBinding_InConstants, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT));
+		bindings.push_back(CreateDescriptorBinding(SSRBinding_InConstants, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_COMPUTE_BIT));
 		bindings.push_back(CreateDescriptorBinding(SSRBinding_InPosition, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT));
 		bindings.push_back(CreateDescriptorBinding(SSRBinding_InNormal, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT));
 		bindings.push_back(CreateDescriptorBinding(SSRBinding_InDepth, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT));
@@ -309,9 +318,9 @@ void ScreenSpaceReflectionsRenderer::UpdateGraphicInterface()
 	VkDescriptorImageInfo blurFinal = CreateDescriptorImageInfo(m_ssrSampler, m_framebuffer->GetColorImageView(3), VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
 	VkDescriptorImageInfo ssrRayTrace = CreateDescriptorImageInfo(m_resolveSampler, m_ssrOutputImage->GetView(), VK_IMAGE_LAYOUT_GENERAL);
 
-	VkDescriptorBufferInfo constants = m_ssrConstantsBuffer->GetDescriptor();
+	VkDescriptorBufferInfo constants = MemoryManager::GetInstance()->GetFrameAllocator()->GetDescriptor(sizeof(SSRConstants));
 
-	wDesc.push_back(InitUpdateDescriptor(m_ssrDescSet, SSRBinding_InConstants, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, &constants));
+	wDesc.push_back(InitUpdateDescriptor(m_ssrDescSet, SSRBinding_InConstants, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, &constants));
 	wDesc.push_back(InitUpdateDescriptor(m_ssrDescSet, SSRBinding_InNormal, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &normals));
 	wDesc.push_back(InitUpdateDescriptor(m_ssrDescSet, SSRBinding_InPosition, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &positions));
 	wDesc.push_back(InitUpdateDescriptor(m_ssrDescSet, SSRBinding_InDepth, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &depth));
@@ -332,7 +341,7 @@ void ScreenSpaceReflectionsRenderer::UpdateGraphicInterface()
 
 void ScreenSpaceReflectionsRenderer::PopulatePoolInfo(std::vector<VkDescriptorPoolSize>& poolSize, unsigned int& maxSets)
 {
-	AddDescriptorType(poolSize, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1);
+	AddDescriptorType(poolSize, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1);
 	AddDescriptorType(poolSize, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 10);
 	AddDescriptorType(poolSize, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 2);
 
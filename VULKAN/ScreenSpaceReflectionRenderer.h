@@ -34,7 +34,7 @@ private:
 	CGraphicPipeline		m_ssrResolvePipeline;
 
 	//CGraphicPipeline		m_ssrPipeline; //try to use compute for this
-	BufferHandle*			m_ssrConstantsBuffer;
+	uint32_t				m_ssrConstantsOffset; //dynamic offset in the frame allocator
 	ImageHandle*			m_ssrOutputImage;
 	ImageHandle*			m_ssrDebugImage;
 
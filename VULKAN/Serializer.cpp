@@ -2,13 +2,138 @@
 
 #include <fstream>
 #include <iostream>
+#include <cstring>
+#include <algorithm>
+#include <sys/stat.h>
 #include "rapidxml/rapidxml_print.hpp"
 #include "Utils.h"
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+struct SnapshotHeader
+{
+	char		Magic[4];
+	uint32_t	Version;
+	uint64_t	DataSize; //bytes after the header
+};
+
+static const char SnapshotMagic[4] = { 'S', 'N', 'A', 'P' };
+
+struct SnapshotLayout
+{
+	const char*							ClassName;
+	const std::vector<PropertyGeneric*>*	PropertiesMap;
+};
+
+//filled by the static initializers of the property maps, so it must be constructed on first use
+static std::vector<SnapshotLayout>& GetSnapshotLayouts()
+{
+	static std::vector<SnapshotLayout> layouts;
+	return layouts;
+}
+
+//FNV-1a
+static uint32_t HashString(const std::string& str, uint32_t hash)
+{
+	for (char c : str)
+	{
+		hash ^= (uint8_t)c;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+//read only view of a whole file
+class MappedFile
+{
+public:
+	MappedFile()
+		: m_data(nullptr)
+		, m_size(0)
+#ifdef _WIN32
+		, m_file(INVALID_HANDLE_VALUE)
+		, m_mapping(NULL)
+#endif
+	{}
+
+	~MappedFile()
+	{
+#ifdef _WIN32
+		if (m_data)
+			UnmapViewOfFile(m_data);
+		if (m_mapping)
+			CloseHandle(m_mapping);
+		if (m_file != INVALID_HANDLE_VALUE)
+			CloseHandle(m_file);
+#else
+		if (m_data)
+			munmap((void*)m_data, m_size);
+#endif
+	}
+
+	bool Open(const std::string& filename)
+	{
+#ifdef _WIN32
+		m_file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (m_file == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(m_file, &size) || size.QuadPart == 0)
+			return false;
+		m_size = (size_t)size.QuadPart;
+
+		m_mapping = CreateFileMappingA(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (!m_mapping)
+			return false;
+
+		m_data = (const char*)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+		int fd = open(filename.c_str(), O_RDONLY);
+		if (fd < 0)
+			return false;
+
+		struct stat fileStat;
+		if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0)
+		{
+			close(fd);
+			return false;
+		}
+		m_size = (size_t)fileStat.st_size;
+
+		void* data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd); //the mapping keeps the file alive
+		m_data = (data == MAP_FAILED) ? nullptr : (const char*)data;
+#endif
+		return m_data != nullptr;
+	}
+
+	const char* GetData() const { return m_data; }
+	size_t GetSize() const { return m_size; }
+private:
+	const char*		m_data;
+	size_t			m_size;
+#ifdef _WIN32
+	HANDLE			m_file;
+	HANDLE			m_mapping;
+#endif
+};
+
 Serializer::Serializer()
 	: m_isSaving(true)
 	, m_HasReachedEoF(false)
 	, m_currentNode(nullptr)
+	, m_isBinary(false)
+	, m_binaryDepth(0)
+	, m_readPtr(nullptr)
+	, m_readEnd(nullptr)
+	, m_hasBinaryError(false)
 {
 }
 
@@ -19,6 +144,15 @@ Serializer::~Serializer()
 
 void Serializer::SerializeProperty(PropertyGeneric* prop, ISeriable* obj)
 {
+	if (m_isBinary)
+	{
+		if (m_isSaving)
+			prop->SaveBinary(this, obj);
+		else
+			prop->LoadBinary(this, obj);
+		return;
+	}
+
 	if (m_isSaving)
 		prop->Save(m_currentNode, this, obj);
 	else
@@ -28,6 +162,31 @@ void Serializer::SerializeProperty(PropertyGeneric* prop, ISeriable* obj)
 
 bool Serializer::BeginSerializing(ISeriable* obj)
 {
+	if (m_isBinary)
+	{
+		//every object starts with its name, so a snapshot that doesn't match the property maps is caught early
+		if (m_isSaving)
+		{
+			WriteBinaryString(obj->GetName());
+		}
+		else
+		{
+			if (m_hasBinaryError || (m_binaryDepth == 0 && m_readPtr >= m_readEnd))
+				return false;
+
+			std::string name;
+			ReadBinaryString(name);
+			if (name != obj->GetName())
+			{
+				SetBinaryError("expected " + obj->GetName() + " found " + name);
+				return false;
+			}
+		}
+
+		++m_binaryDepth;
+		return true;
+	}
+
 	if (m_isSaving)
 	{
 		auto newNode = GetNewNode(obj->GetName().c_str());
@@ -61,6 +220,27 @@ bool Serializer::BeginSerializing(ISeriable* obj)
 
 void Serializer::EndSerializing(ISeriable* obj)
 {
+	if (m_isBinary)
+	{
+		TRAP(m_binaryDepth > 0);
+		--m_binaryDepth;
+
+		if (m_isSaving)
+		{
+			obj->OnSave();
+		}
+		else
+		{
+			if (m_hasBinaryError)
+				return;
+
+			obj->OnLoad();
+			if (m_binaryDepth == 0)
+				m_HasReachedEoF = m_readPtr >= m_readEnd;
+		}
+		return;
+	}
+
 	TRAP(!m_nodeStack.empty());
 	auto last = m_nodeStack.back();
 	TRAP(last == m_currentNode); //sanity check
@@ -119,6 +299,162 @@ void Serializer::Load(const std::string& filename)
 	m_document.clear();
 }
 
+void Serializer::SaveBinary(const std::string& filename)
+{
+	m_isSaving = true;
+	m_isBinary = true;
+	m_binaryDepth = 0;
+	m_binaryData.clear();
+
+	SaveContent();
+
+	SnapshotHeader header;
+	memcpy(header.Magic, SnapshotMagic, sizeof(header.Magic));
+	header.Version = GetLayoutVersion();
+	header.DataSize = m_binaryData.size();
+
+	std::ofstream f(filename, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+	if (f.is_open())
+	{
+		f.write((const char*)&header, sizeof(header));
+		f.write(m_binaryData.data(), m_binaryData.size());
+	}
+	else
+	{
+		std::cout << "Failed to write snapshot " << filename << std::endl;
+	}
+
+	m_binaryData.clear();
+	m_binaryData.shrink_to_fit();
+	m_isBinary = false;
+}
+
+bool Serializer::LoadBinary(const std::string& filename)
+{
+	MappedFile file;
+	if (!file.Open(filename))
+	{
+		std::cout << "Failed to open snapshot " << filename << std::endl;
+		return false;
+	}
+
+	SnapshotHeader header;
+	if (file.GetSize() < sizeof(header))
+		return false;
+
+	memcpy(&header, file.GetData(), sizeof(header));
+	if (memcmp(header.Magic, SnapshotMagic, sizeof(header.Magic)) != 0 || header.Version != GetLayoutVersion()
+		|| header.DataSize != file.GetSize() - sizeof(header))
+	{
+		std::cout << "Snapshot " << filename << " is invalid or has another version" << std::endl;
+		return false;
+	}
+
+	m_isSaving = false;
+	m_isBinary = true;
+	m_binaryDepth = 0;
+	m_readPtr = file.GetData() + sizeof(header);
+	m_readEnd = m_readPtr + header.DataSize;
+	m_HasReachedEoF = m_readPtr >= m_readEnd;
+	m_hasBinaryError = false;
+
+	LoadContent();
+
+	m_readPtr = m_readEnd = nullptr;
+	m_isBinary = false;
+	return !m_hasBinaryError;
+}
+
+bool Serializer::IsSnapshotUpToDate(const std::string& snapshotFile, const std::string& xmlFile)
+{
+	struct stat snapshotStat;
+	if (stat(snapshotFile.c_str(), &snapshotStat) != 0)
+		return false;
+
+	struct stat xmlStat;
+	if (stat(xmlFile.c_str(), &xmlStat) != 0)
+		return true;
+
+	return xmlStat.st_mtime <= snapshotStat.st_mtime;
+}
+
+void Serializer::RegisterLayout(const char* className, const std::vector<PropertyGeneric*>* propertiesMap)
+{
+	GetSnapshotLayouts().push_back({ className, propertiesMap });
+}
+
+uint32_t Serializer::GetLayoutVersion()
+{
+	static uint32_t version = 0;
+	if (version != 0)
+		return version;
+
+	//the maps are registered in the static initialization order, which changes between builds. Sort them by name
+	std::vector<SnapshotLayout> layouts = GetSnapshotLayouts();
+	std::sort(layouts.begin(), layouts.end(), [](const SnapshotLayout& a, const SnapshotLayout& b)
+	{
+		return strcmp(a.ClassName, b.ClassName) < 0;
+	});
+
+	uint32_t hash = 2166136261u;
+	for (const SnapshotLayout& layout : layouts)
+	{
+		hash = HashString(layout.ClassName, hash);
+		for (PropertyGeneric* prop : *layout.PropertiesMap)
+			hash = HashString(";" + prop->GetLayoutTag(), hash);
+		hash = HashString("|", hash);
+	}
+
+	version = (hash != 0) ? hash : 1;
+	return version;
+}
+
+void Serializer::SetBinaryError(const std::string& error)
+{
+	if (!m_hasBinaryError)
+		std::cout << "Snapshot error: " << error << std::endl;
+	m_hasBinaryError = true;
+}
+
+void Serializer::WriteBinary(const void* data, size_t size)
+{
+	const char* bytes = (const char*)data;
+	m_binaryData.insert(m_binaryData.end(), bytes, bytes + size);
+}
+
+void Serializer::ReadBinary(void* data, size_t size)
+{
+	if (m_hasBinaryError || m_readPtr + size > m_readEnd)
+	{
+		SetBinaryError("unexpected end of data");
+		memset(data, 0, size);
+		return;
+	}
+	memcpy(data, m_readPtr, size);
+	m_readPtr += size;
+}
+
+void Serializer::WriteBinaryString(const std::string& str)
+{
+	uint32_t length = (uint32_t)str.size();
+	WriteBinaryValue(length);
+	WriteBinary(str.data(), length);
+}
+
+void Serializer::ReadBinaryString(std::string& str)
+{
+	uint32_t length;
+	ReadBinaryValue(length);
+	if (m_hasBinaryError || m_readPtr + length > m_readEnd)
+	{
+		SetBinaryError("unexpected end of data");
+		str.clear();
+		return;
+	}
+	str.assign(m_readPtr, length);
+	m_readPtr += length;
+}
+
 
 rapidxml::xml_attribute<char>*	Serializer::GetNewAttribute(const char* name, const char* val)
 {
@@ -6,6 +6,7 @@
 
 #include <string>
 #include <vector>
+#include <typeinfo>
 
 class Serializer;
 class ISeriable;
@@ -15,6 +16,13 @@ class PropertyGeneric
 public:
 	virtual void Save(rapidxml::xml_node<char>* objNode, Serializer* serializer, ISeriable* obj) = 0;
 	virtual void Load(rapidxml::xml_node<char>* objNode, Serializer* serializer, ISeriable* obj) = 0;
+
+	//binary snapshot. Values are stored raw, in the order of the property map
+	virtual void SaveBinary(Serializer* serializer, ISeriable* obj) = 0;
+	virtual void LoadBinary(Serializer* serializer, ISeriable* obj) = 0;
+
+	//label and type of the property. Hashed into the snapshot version
+	virtual std::string GetLayoutTag() const = 0;
 };
 
 class ISeriable
@@ -57,6 +65,30 @@ public:
 	void Save(const std::string& filename);
 	void Load(const std::string& filename);
 
+	//binary snapshot. The file is memory mapped on load and the values are copied out without any parsing
+	void SaveBinary(const std::string& filename);
+	bool LoadBinary(const std::string& filename);
+	//true if the snapshot exists and it's not older than the source xml (a missing xml counts as up to date)
+	static bool IsSnapshotUpToDate(const std::string& snapshotFile, const std::string& xmlFile);
+
+	//the snapshot version is a hash of all the property maps, so any change of their layout invalidates the old snapshots
+	static void RegisterLayout(const char* className, const std::vector<PropertyGeneric*>* propertiesMap);
+	static uint32_t GetLayoutVersion();
+
+	//a snapshot that doesn't match the property maps stops the load. LoadBinary returns false and the caller should use the xml
+	void SetBinaryError(const std::string& error);
+	bool HasBinaryError() const { return m_hasBinaryError; }
+
+	void WriteBinary(const void* data, size_t size);
+	void ReadBinary(void* data, size_t size);
+	void WriteBinaryString(const std::string& str);
+	void ReadBinaryString(std::string& str);
+
+	template<typename T>
+	void WriteBinaryValue(const T& value) { WriteBinary(&value, sizeof(T)); }
+	template<typename T>
+	void ReadBinaryValue(T& value) { ReadBinary(&value, sizeof(T)); }
+
 protected:
 	virtual void LoadContent() = 0;
 	virtual void SaveContent() = 0;
@@ -67,6 +99,13 @@ protected:
 	rapidxml::xml_document<char>			m_document;
 	bool									m_isSaving;
 	bool									m_HasReachedEoF;
+
+	bool									m_isBinary;
+	unsigned int							m_binaryDepth; //how many objects are being serialized. Same as m_nodeStack for xml
+	std::vector<char>						m_binaryData; //saving
+	const char*								m_readPtr; //loading, points in the mapped file
+	const char*								m_readEnd;
+	bool									m_hasBinaryError;
 };
 
 template<class T>
@@ -85,9 +124,10 @@ public:
 				serializer->SerializeProperty(prop, this);
 
 			serializer->EndSerializing(this);
-			return true;
+			//a record cut inside one of the properties leaves the object half read
+			return !serializer->HasBinaryError();
 		}
-		TRAP(false);
+		TRAP(serializer->HasBinaryError());
 		return false;
 	}
 
@@ -97,9 +137,18 @@ public:
 };
 
 
-#define BEGIN_PROPERTY_MAP(CLASSTYPE) std::vector<PropertyGeneric*> SeriableImpl<CLASSTYPE>::PropertiesMap = {
+struct SnapshotLayoutRegistrar
+{
+	SnapshotLayoutRegistrar(const char* className, const std::vector<PropertyGeneric*>* propertiesMap)
+	{
+		Serializer::RegisterLayout(className, propertiesMap);
+	}
+};
+
+#define BEGIN_PROPERTY_MAP(CLASSTYPE) template<> std::vector<PropertyGeneric*> SeriableImpl<CLASSTYPE>::PropertiesMap = {
 
-#define END_PROPERTY_MAP(CLASSTYPE) };
+#define END_PROPERTY_MAP(CLASSTYPE) }; \
+									static SnapshotLayoutRegistrar s_snapshotLayout##CLASSTYPE(#CLASSTYPE, &SeriableImpl<CLASSTYPE>::PropertiesMap);
 
 #define IMPLEMENT_PROPERTY(PTYPE, PNAME, PLABEL, CLASSTYPE) new Property<PTYPE, CLASSTYPE>(CLASSTYPE::GetMember##PNAME(), PLABEL)
 
@@ -140,6 +189,23 @@ public:
 		cobj->*m_ptm = std::stoi(prop->value());
 
 	};
+
+	virtual void SaveBinary(Serializer* serializer, ISeriable* obj)
+	{
+		BASE* cobj = static_cast<BASE*>(obj);
+		serializer->WriteBinaryValue(cobj->*m_ptm);
+	};
+
+	virtual void LoadBinary(Serializer* serializer, ISeriable* obj)
+	{
+		BASE* cobj = static_cast<BASE*>(obj);
+		serializer->ReadBinaryValue(cobj->*m_ptm);
+	};
+
+	virtual std::string GetLayoutTag() const
+	{
+		return m_label + ":" + typeid(T).name();
+	};
 private:
 	PtmType						m_ptm;
 	std::string					m_label;
@@ -178,6 +244,26 @@ public:
 			cobj->*m_ptm = std::string(prop->value()) == std::string("true");
 
 	};
+
+	virtual void SaveBinary(Serializer* serializer, ISeriable* obj)
+	{
+		BASE* cobj = static_cast<BASE*>(obj);
+		uint8_t value = (cobj->*m_ptm) ? 1 : 0;
+		serializer->WriteBinaryValue(value);
+	};
+
+	virtual void LoadBinary(Serializer* serializer, ISeriable* obj)
+	{
+		BASE* cobj = static_cast<BASE*>(obj);
+		uint8_t value;
+		serializer->ReadBinaryValue(value);
+		cobj->*m_ptm = value != 0;
+	};
+
+	virtual std::string GetLayoutTag() const
+	{
+		return m_label + ":" + typeid(bool).name();
+	};
 private:
 	PtmType						m_ptm;
 	std::string					m_label;
@@ -216,6 +302,23 @@ public:
 			cobj->*m_ptm = 0.0f;
 
 	};
+
+	virtual void SaveBinary(Serializer* serializer, ISeriable* obj)
+	{
+		BASE* cobj = static_cast<BASE*>(obj);
+		serializer->WriteBinaryValue(cobj->*m_ptm);
+	};
+
+	virtual void LoadBinary(Serializer* serializer, ISeriable* obj)
+	{
+		BASE* cobj = static_cast<BASE*>(obj);
+		serializer->ReadBinaryValue(cobj->*m_ptm);
+	};
+
+	virtual std::string GetLayoutTag() const
+	{
+		return m_label + ":" + typeid(float).name();
+	};
 private:
 	PtmType						m_ptm;
 	std::string					m_label;
@@ -267,6 +370,23 @@ public:
 			(cobj->*m_ptm)[1] = getValue("y");
 		}
 	};
+
+	virtual void SaveBinary(Serializer* serializer, ISeriable* obj)
+	{
+		BASE* cobj = static_cast<BASE*>(obj);
+		serializer->WriteBinaryValue(cobj->*m_ptm);
+	};
+
+	virtual void LoadBinary(Serializer* serializer, ISeriable* obj)
+	{
+		BASE* cobj = static_cast<BASE*>(obj);
+		serializer->ReadBinaryValue(cobj->*m_ptm);
+	};
+
+	virtual std::string GetLayoutTag() const
+	{
+		return m_label + ":" + typeid(glm::vec2).name();
+	};
 private:
 	PtmType						m_ptm;
 	std::string					m_label;
@@ -322,6 +442,23 @@ public:
 			cobj->*m_ptm = glm::vec3(0.0f);
 		}
 	};
+
+	virtual void SaveBinary(Serializer* serializer, ISeriable* obj)
+	{
+		BASE* cobj = static_cast<BASE*>(obj);
+		serializer->WriteBinaryValue(cobj->*m_ptm);
+	};
+
+	virtual void LoadBinary(Serializer* serializer, ISeriable* obj)
+	{
+		BASE* cobj = static_cast<BASE*>(obj);
+		serializer->ReadBinaryValue(cobj->*m_ptm);
+	};
+
+	virtual std::string GetLayoutTag() const
+	{
+		return m_label + ":" + typeid(glm::vec3).name();
+	};
 private:
 	PtmType						m_ptm;
 	std::string					m_label;
@@ -355,6 +492,23 @@ public:
 		TRAP(cobj);
 		cobj->*m_ptm = (prop)? std::string(prop->value()) : "";
 	};
+
+	virtual void SaveBinary(Serializer* serializer, ISeriable* obj)
+	{
+		BASE* cobj = static_cast<BASE*>(obj);
+		serializer->WriteBinaryString(cobj->*m_ptm);
+	};
+
+	virtual void LoadBinary(Serializer* serializer, ISeriable* obj)
+	{
+		BASE* cobj = static_cast<BASE*>(obj);
+		serializer->ReadBinaryString(cobj->*m_ptm);
+	};
+
+	virtual std::string GetLayoutTag() const
+	{
+		return m_label + ":" + typeid(std::string).name();
+	};
 private:
 	PtmType						m_ptm;
 	std::string					m_label;
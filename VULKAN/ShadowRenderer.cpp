@@ -7,6 +7,7 @@
 #include "Batch.h"
 #include "Input.h"
 #include "UI.h"
+#include "CommandRecorder.h"
 
 #include <random>
 
@@ -22,7 +23,7 @@ struct ShadowParams
 
 ShadowMapRenderer::ShadowMapRenderer(VkRenderPass renderPass)
 	: CRenderer(renderPass, "ShadowmapRenderPass")
-	, m_splitsBuffer(nullptr)
+	, m_splitsOffset(FrameAllocator::InvalidOffset)
 	, m_splitsDescSet(VK_NULL_HANDLE)
 	, m_splitsAlphaFactor(0.15f)
 	, m_isDebugMode(false)
@@ -33,7 +34,6 @@ ShadowMapRenderer::ShadowMapRenderer(VkRenderPass renderPass)
 
 ShadowMapRenderer::~ShadowMapRenderer()
 {
-	MemoryManager::GetInstance()->FreeHandle(m_splitsBuffer);
 }
 
 void ShadowMapRenderer::Init()
@@ -41,8 +41,6 @@ void ShadowMapRenderer::Init()
     CRenderer::Init();
 	g_commonResources.SetAs<VkRenderPass>(&m_renderPass, EResourceType_ShadowRenderPass); //kinda tricky if i forgot that the order of renderers matters.
 
-	m_splitsBuffer = MemoryManager::GetInstance()->CreateBuffer(EMemoryContextType::UniformBuffers, sizeof(ShadowParams), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
-
 	AllocDescriptorSets(m_descriptorPool, m_splitDescLayout.Get(), &m_splitsDescSet);
 
 	VkPushConstantRange pushConstRange;
@@ -50,7 +48,7 @@ void ShadowMapRenderer::Init()
 	pushConstRange.offset = 0;
 	pushConstRange.size = 256; //max push constant range(can get it from limits)
 
-    m_pipeline.SetVertexInputState(Mesh::GetVertexDesc());
+    m_pipeline.SetVertexInputState(Mesh::GetCompactVertexDesc());
     m_pipeline.SetViewport(SHADOWW, SHADOWH);
     m_pipeline.SetScissor(SHADOWW, SHADOWH);
     m_pipeline.SetCullMode(VK_CULL_MODE_BACK_BIT);
@@ -177,10 +175,10 @@ void ShadowMapRenderer::ComputeCascadeProjMatrix(const CFrustum& splitFrustum, c
 
 void ShadowMapRenderer::UpdateGraphicInterface()
 {
-	VkDescriptorBufferInfo splitBuffer = m_splitsBuffer->GetDescriptor();
+	VkDescriptorBufferInfo splitBuffer = MemoryManager::GetInstance()->GetFrameAllocator()->GetDescriptor(sizeof(ShadowParams));
 
 	std::vector<VkWriteDescriptorSet> wDesc;
-	wDesc.push_back(InitUpdateDescriptor(m_splitsDescSet, 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, &splitBuffer));
+	wDesc.push_back(InitUpdateDescriptor(m_splitsDescSet, 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, &splitBuffer));
 
 	vk::UpdateDescriptorSets(vk::g_vulkanContext.m_device, (uint32_t)wDesc.size(), wDesc.data(), 0, nullptr);
 }
@@ -226,24 +224,41 @@ void ShadowMapRenderer::PreRender()
 
 	m_shadowViewProj = m_splitProjMatrix[0].ProjViewMatrix;
 
-	ShadowParams* params = m_splitsBuffer->GetPtr<ShadowParams*>();
+	//the shadow map stays empty this frame if the frame allocator is full
+	FrameAllocator::Allocation paramsAlloc;
+	if (!MemoryManager::GetInstance()->GetFrameAllocator()->Allocate(sizeof(ShadowParams), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, paramsAlloc))
+	{
+		m_splitsOffset = FrameAllocator::InvalidOffset;
+		return;
+	}
+	m_splitsOffset = paramsAlloc.m_offset;
+
+	ShadowParams* params = (ShadowParams*)paramsAlloc.m_ptr;
 	params->NSplits = glm::ivec4(SHADOWSPLITS);
 	params->Splits = m_splitProjMatrix;
 }
 
 void ShadowMapRenderer::Render()
 {
-    VkCommandBuffer cmd = vk::g_vulkanContext.m_mainCommandBuffer;
+	if (m_splitsOffset == FrameAllocator::InvalidOffset)
+		return;
 
-	vk::CmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline.Get());
-	vk::CmdBindDescriptorSets(cmd, m_pipeline.GetBindPoint(), m_pipeline.GetLayout(), 1, 1, &m_splitsDescSet, 0, nullptr);
+	//a job per split, recorded in parallel. The render pass was started with secondary command buffers
+	for (uint32_t s = 0; s < SHADOWSPLITS; ++s)
+	{
+		CommandRecorder::GetInstance()->AddJob([this, s](VkCommandBuffer cmdBuffer)
+		{
+			vk::CmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline.Get());
+			vk::CmdBindDescriptorSets(cmdBuffer, m_pipeline.GetBindPoint(), m_pipeline.GetLayout(), 1, 1, &m_splitsDescSet, 1, &m_splitsOffset);
 
-	BatchManager::GetInstance()->RenderShadows();
+			BatchManager::GetInstance()->RenderShadows(cmdBuffer, s);
+		});
+	}
 }
 
 void ShadowMapRenderer::PopulatePoolInfo(std::vector<VkDescriptorPoolSize>& poolSize, unsigned int& maxSets)
 {
-    AddDescriptorType(poolSize, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1);
+    AddDescriptorType(poolSize, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1);
     maxSets = 1;
 }
 
@@ -261,12 +276,13 @@ void ShadowMapRenderer::UpdateResourceTable()
 void ShadowMapRenderer::CreateDescriptorSetLayout()
 {
     std::vector<VkDescriptorSetLayoutBinding> descCnt;
-    descCnt.resize(1);
+    descCnt.resize(2);
 	descCnt[0] = CreateDescriptorBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT);
+	descCnt[1] = CreateDescriptorBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT); //must match the batch common layout
 
     NewDescriptorSetLayout(descCnt, &m_descriptorSetLayout);
 
-	m_splitDescLayout.AddBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_GEOMETRY_BIT, 1);
+	m_splitDescLayout.AddBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_GEOMETRY_BIT, 1);
 	m_splitDescLayout.Construct();
 }
 
@@ -286,11 +302,11 @@ CShadowResolveRenderer::CShadowResolveRenderer(VkRenderPass renderpass)
     : CRenderer(renderpass, "ShadowFactorRenderPass")
     , m_quad(nullptr)
     , m_depthSampler(VK_NULL_HANDLE)
-    , m_descriptorLayout(VK_NULL_HANDLE)
-    , m_descriptorSet(VK_NULL_HANDLE)
-    , m_uniformBuffer(VK_NULL_HANDLE)
     , m_linearSampler(VK_NULL_HANDLE)
     , m_nearSampler(VK_NULL_HANDLE)
+    , m_descriptorLayout(VK_NULL_HANDLE)
+    , m_descriptorSet(VK_NULL_HANDLE)
+    , m_paramsOffset(FrameAllocator::InvalidOffset)
     , m_blockerDistrText(nullptr)
     , m_PCFDistrText(nullptr)
 #ifdef USE_SHADOW_BLUR
@@ -313,7 +329,6 @@ CShadowResolveRenderer::~CShadowResolveRenderer()
 #ifdef USE_SHADOW_BLUR
     vk::DestroyDescriptorSetLayout(dev, m_blurSetLayout, nullptr);
 #endif
-	MemoryManager::GetInstance()->FreeHandle(m_uniformBuffer);
 
     delete m_PCFDistrText;
     delete m_blockerDistrText;
@@ -351,7 +366,6 @@ void CShadowResolveRenderer::Init()
 
     VULKAN_ASSERT(vk::CreateSampler(vk::g_vulkanContext.m_device, &samplerDepthCreateInfo, nullptr, &m_depthSampler));
 
-	m_uniformBuffer = MemoryManager::GetInstance()->CreateBuffer(EMemoryContextType::UniformBuffers, sizeof(ShadowResolveParameters), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
     m_quad = CreateFullscreenQuad();
 
     unsigned int width = m_framebuffer->GetWidth();
@@ -385,9 +399,16 @@ void CShadowResolveRenderer::PreRender()
 void CShadowResolveRenderer::Render()
 {
     StartRenderPass();
+    //only cleared if the frame allocator had no room for the parameters
+    if (m_paramsOffset == FrameAllocator::InvalidOffset)
+    {
+        EndRenderPass();
+        return;
+    }
+
     VkCommandBuffer cmdBuff = vk::g_vulkanContext.m_mainCommandBuffer;
     vk::CmdBindPipeline(cmdBuff, m_pipeline.GetBindPoint(), m_pipeline.Get());
-    vk::CmdBindDescriptorSets(cmdBuff, m_pipeline.GetBindPoint(), m_pipeline.GetLayout(), 0, 1, &m_descriptorSet, 0, nullptr);
+    vk::CmdBindDescriptorSets(cmdBuff, m_pipeline.GetBindPoint(), m_pipeline.GetLayout(), 0, 1, &m_descriptorSet, 1, &m_paramsOffset);
 
     m_quad->Render();
 #ifdef USE_SHADOW_BLUR
@@ -410,7 +431,15 @@ void CShadowResolveRenderer::UpdateShaderParams()
 {
     glm::mat4 shadowProj = g_commonResources.GetAs<glm::mat4>(EResourceType_ShadowProjViewMat);
 
-    ShadowResolveParameters* params = m_uniformBuffer->GetPtr<ShadowResolveParameters*>();
+    FrameAllocator::Allocation paramsAlloc;
+    if (!MemoryManager::GetInstance()->GetFrameAllocator()->Allocate(sizeof(ShadowResolveParameters), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, paramsAlloc))
+    {
+        m_paramsOffset = FrameAllocator::InvalidOffset;
+        return;
+    }
+    m_paramsOffset = paramsAlloc.m_offset;
+
+    ShadowResolveParameters* params = (ShadowResolveParameters*)paramsAlloc.m_ptr;
     params->ShadowProjMatrix = shadowProj;
     params->LightDirection = directionalLight.GetDirection();
     params->CameraPosition = glm::vec4(ms_camera.GetPos(), 1.0f);
@@ -429,14 +458,14 @@ void CShadowResolveRenderer::UpdateGraphicInterface()
     VkDescriptorImageInfo posInfo = CreateDescriptorImageInfo(m_nearSampler, positionImage->GetView(), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
     VkDescriptorImageInfo shadowhInfo = CreateDescriptorImageInfo(m_depthSampler, shadowMapImage->GetView(), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 	//VkDescriptorImageInfo shadowhInfo = CreateDescriptorImageInfo(m_depthSampler, shadowMapImage->GetLayerView(0), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
-	VkDescriptorBufferInfo constInfo = m_uniformBuffer->GetDescriptor();
+	VkDescriptorBufferInfo constInfo = MemoryManager::GetInstance()->GetFrameAllocator()->GetDescriptor(sizeof(ShadowResolveParameters));
     VkDescriptorImageInfo shadowText = CreateDescriptorImageInfo(m_nearSampler, shadowMapImage->GetView(), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
     VkDescriptorImageInfo blockerDistText = CreateDescriptorImageInfo(m_nearSampler, m_blockerDistrText->GetImageView(), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
     VkDescriptorImageInfo pcfDistText = CreateDescriptorImageInfo(m_nearSampler, m_PCFDistrText->GetImageView(), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 	VkDescriptorImageInfo depthText = CreateDescriptorImageInfo(m_nearSampler, depthImage->GetView(), VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
 
     std::vector<VkWriteDescriptorSet> wDesc;
-    wDesc.push_back(InitUpdateDescriptor(m_descriptorSet, 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, &constInfo));
+    wDesc.push_back(InitUpdateDescriptor(m_descriptorSet, 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, &constInfo));
     wDesc.push_back(InitUpdateDescriptor(m_descriptorSet, 1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &shadowhInfo));
     wDesc.push_back(InitUpdateDescriptor(m_descriptorSet, 2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &posInfo));
     wDesc.push_back(InitUpdateDescriptor(m_descriptorSet, 3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &normalInfo));
@@ -460,7 +489,7 @@ void CShadowResolveRenderer::CreateDescriptorSetLayout()
 {
     {
         std::vector<VkDescriptorSetLayoutBinding> bindings;
-        bindings.push_back(CreateDescriptorBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT));
+        bindings.push_back(CreateDescriptorBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_FRAGMENT_BIT));
         bindings.push_back(CreateDescriptorBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT));
         bindings.push_back(CreateDescriptorBinding(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT));
         bindings.push_back(CreateDescriptorBinding(3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT));
@@ -497,7 +526,7 @@ void CShadowResolveRenderer::CreateDescriptorSetLayout()
 void CShadowResolveRenderer::PopulatePoolInfo(std::vector<VkDescriptorPoolSize>& poolSize, unsigned int& maxSets)
 {
     maxSets = 3;
-    AddDescriptorType(poolSize, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1);
+    AddDescriptorType(poolSize, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1);
     AddDescriptorType(poolSize, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 9);
 }
 
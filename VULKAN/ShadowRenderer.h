@@ -52,7 +52,7 @@ private:
     CGraphicPipeline                m_pipeline;
     VkDescriptorSetLayout           m_descriptorSetLayout;
 
-	BufferHandle*					m_splitsBuffer;
+	uint32_t						m_splitsOffset; //dynamic offset in the frame allocator
 	VkDescriptorSet					m_splitsDescSet;
 	DescriptorSetLayout				m_splitDescLayout;
 
@@ -98,7 +98,7 @@ private:
     VkDescriptorSetLayout   m_descriptorLayout;
     VkDescriptorSet         m_descriptorSet;
 
-    BufferHandle*           m_uniformBuffer;
+    uint32_t                m_paramsOffset; //dynamic offset in the frame allocator
 
     CTexture*               m_blockerDistrText;
     CTexture*               m_PCFDistrText;
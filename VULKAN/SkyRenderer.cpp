@@ -6,18 +6,19 @@
 CSunRenderer::CSunRenderer(VkRenderPass renderPass)
     : CRenderer(renderPass, "SunRenderPass")
     , m_blurSetLayout(VK_NULL_HANDLE)
-    , m_blurRadialDescSet(VK_NULL_HANDLE)
-    , m_radialBlurSetLayout(VK_NULL_HANDLE)
     , m_sunDescriptorSetLayout(VK_NULL_HANDLE)
-    , m_sunDescriptorSet(VK_NULL_HANDLE)
-    , m_sunParamsBuffer(VK_NULL_HANDLE)
-    , m_radialBlurParamsBuffer(VK_NULL_HANDLE)
-    , m_blurHDescSet(VK_NULL_HANDLE)
+    , m_radialBlurSetLayout(VK_NULL_HANDLE)
+    , m_sunParamsOffset(FrameAllocator::InvalidOffset)
+    , m_radialBlurParamsOffset(FrameAllocator::InvalidOffset)
     , m_blurVDescSet(VK_NULL_HANDLE)
+    , m_blurHDescSet(VK_NULL_HANDLE)
+    , m_blurRadialDescSet(VK_NULL_HANDLE)
+    , m_sunDescriptorSet(VK_NULL_HANDLE)
     , m_quad(nullptr)
+    , m_sunTexture(nullptr)
     , m_sampler(VK_NULL_HANDLE)
     , m_neareastSampler(VK_NULL_HANDLE)
-    , m_sunTexture(nullptr)
+    , m_renderSun(false)
     , m_isEditMode(false)
     //, m_editInfo(nullptr)
 {
@@ -40,8 +41,6 @@ CSunRenderer::~CSunRenderer()
     vk::DestroyDescriptorSetLayout(dev, m_sunDescriptorSetLayout, nullptr);
     vk::DestroySampler(dev, m_sampler, nullptr);
 
-	MemoryManager::GetInstance()->FreeHandle( m_sunParamsBuffer->GetRootParent()); //i dont like this style. 
-
     //delete m_quad;
 }
 
@@ -56,11 +55,6 @@ void CSunRenderer::Init()
     AllocDescriptorSets(m_descriptorPool, m_blurSetLayout, &m_blurHDescSet);
     AllocDescriptorSets(m_descriptorPool, m_radialBlurSetLayout, &m_blurRadialDescSet);
 
-	VkDeviceSize totalSize = sizeof(SSunParams) + sizeof(SRadialBlurParams);
-	BufferHandle* bigBuffer = MemoryManager::GetInstance()->CreateBuffer(EMemoryContextType::UniformBuffers, { sizeof(SSunParams), sizeof(SRadialBlurParams) }, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
-	m_sunParamsBuffer = bigBuffer->CreateSubbuffer(sizeof(SSunParams));
-	m_radialBlurParamsBuffer = bigBuffer->CreateSubbuffer(sizeof(SRadialBlurParams));
-
     unsigned int width = m_framebuffer->GetWidth();
     unsigned int height = m_framebuffer->GetHeight();
 
@@ -100,32 +94,32 @@ void CSunRenderer::Render()
 {
     StartRenderPass();
     VkCommandBuffer cmdBuf = vk::g_vulkanContext.m_mainCommandBuffer;
-    auto renderPipeline = [&](CGraphicPipeline& pipline, VkDescriptorSet& set) {
+    auto renderPipeline = [&](CGraphicPipeline& pipline, VkDescriptorSet& set, const uint32_t* paramsOffset) {
         if(!m_renderSun)
             return;
         vk::CmdBindPipeline(cmdBuf, pipline.GetBindPoint(), pipline.Get());
-        vk::CmdBindDescriptorSets(cmdBuf, pipline.GetBindPoint(), pipline.GetLayout(), 0, 1, &set, 0, nullptr);
+        vk::CmdBindDescriptorSets(cmdBuf, pipline.GetBindPoint(), pipline.GetLayout(), 0, 1, &set, (paramsOffset) ? 1 : 0, paramsOffset);
 
         m_quad->Render();
     };
 
     BeginMarkerSection("RenderSunSprite");
-    renderPipeline(m_sunPipeline, m_sunDescriptorSet);
+    renderPipeline(m_sunPipeline, m_sunDescriptorSet, &m_sunParamsOffset);
     EndMarkerSection();
 
     BeginMarkerSection("BlurVertical");
     vk::CmdNextSubpass(cmdBuf, VK_SUBPASS_CONTENTS_INLINE);
-    renderPipeline(m_blurVPipeline, m_blurVDescSet);
+    renderPipeline(m_blurVPipeline, m_blurVDescSet, nullptr);
     EndMarkerSection();
 
     BeginMarkerSection("BlurHorizontal");
     vk::CmdNextSubpass(cmdBuf, VK_SUBPASS_CONTENTS_INLINE);
-    renderPipeline(m_blurHPipeline, m_blurHDescSet);
+    renderPipeline(m_blurHPipeline, m_blurHDescSet, nullptr);
     EndMarkerSection();
 
     BeginMarkerSection("RadialBlur");
     vk::CmdNextSubpass(cmdBuf, VK_SUBPASS_CONTENTS_INLINE);
-    renderPipeline(m_blurRadialPipeline, m_blurRadialDescSet);
+    renderPipeline(m_blurRadialPipeline, m_blurRadialDescSet, &m_radialBlurParamsOffset);
     EndMarkerSection();
 
     EndRenderPass();
@@ -155,13 +149,13 @@ void CSunRenderer::UpdateGraphicInterface()
 	depthImg.imageView = depthBuffer->GetView();
     depthImg.sampler = m_neareastSampler;
 
-	VkDescriptorBufferInfo rbBuff = m_radialBlurParamsBuffer->GetDescriptor();
+	VkDescriptorBufferInfo rbBuff = MemoryManager::GetInstance()->GetFrameAllocator()->GetDescriptor(sizeof(SRadialBlurParams));
 
     std::vector<VkWriteDescriptorSet> wDesc;
     wDesc.push_back(InitUpdateDescriptor(m_blurVDescSet, 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &wSuntImg));
     wDesc.push_back(InitUpdateDescriptor(m_blurHDescSet, 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &wBlurVImg));
     wDesc.push_back(InitUpdateDescriptor(m_blurRadialDescSet, 1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &wBlurHImg));
-    wDesc.push_back(InitUpdateDescriptor(m_blurRadialDescSet, 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, &rbBuff));
+    wDesc.push_back(InitUpdateDescriptor(m_blurRadialDescSet, 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, &rbBuff));
     wDesc.push_back(InitUpdateDescriptor(m_sunDescriptorSet, 2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &depthImg));
 
     vk::UpdateDescriptorSets(vk::g_vulkanContext.m_device, (uint32_t)wDesc.size(), wDesc.data(), 0, nullptr);
@@ -262,7 +256,7 @@ void CSunRenderer::CreateDescriptorSetLayout()
     
     {
         std::vector<VkDescriptorSetLayoutBinding> bindings;
-        bindings.push_back(CreateDescriptorBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT));
+        bindings.push_back(CreateDescriptorBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT));
         bindings.push_back(CreateDescriptorBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT));
         bindings.push_back(CreateDescriptorBinding(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT));
 
@@ -277,7 +271,7 @@ void CSunRenderer::CreateDescriptorSetLayout()
 
     {
         std::vector<VkDescriptorSetLayoutBinding> bindings;
-        bindings.push_back(CreateDescriptorBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT));
+        bindings.push_back(CreateDescriptorBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_FRAGMENT_BIT));
         bindings.push_back(CreateDescriptorBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT));
 
         VkDescriptorSetLayoutCreateInfo crtInfo;
@@ -292,12 +286,12 @@ void CSunRenderer::CreateDescriptorSetLayout()
 
 void CSunRenderer::UpdateSunDescriptors()
 {
-    VkDescriptorBufferInfo wBuffer = m_sunParamsBuffer->GetDescriptor();
+    VkDescriptorBufferInfo wBuffer = MemoryManager::GetInstance()->GetFrameAllocator()->GetDescriptor(sizeof(SSunParams));
 
     VkDescriptorImageInfo wImg = m_sunTexture->GetTextureDescriptor();
 
     std::vector<VkWriteDescriptorSet> writeDesc;
-    writeDesc.push_back(InitUpdateDescriptor(m_sunDescriptorSet, 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, &wBuffer));
+    writeDesc.push_back(InitUpdateDescriptor(m_sunDescriptorSet, 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, &wBuffer));
     writeDesc.push_back(InitUpdateDescriptor(m_sunDescriptorSet, 1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &wImg));
 
     vk::UpdateDescriptorSets(vk::g_vulkanContext.m_device, (uint32_t)writeDesc.size(), writeDesc.data(), 0, nullptr);
@@ -313,7 +307,20 @@ void CSunRenderer::UpdateShaderParams()
     //proj = glm::ortho(-5.0f, 5.0f, -5.0f, 5.0f, 0.1f, 50.0f);
     ConvertToProjMatrix(proj);
 
-    SSunParams* sunParams = m_sunParamsBuffer->GetPtr<SSunParams*>();
+    //the sun isn't drawn this frame if the frame allocator is full
+    FrameAllocator* frameAllocator = MemoryManager::GetInstance()->GetFrameAllocator();
+    FrameAllocator::Allocation sunAlloc;
+    FrameAllocator::Allocation rbAlloc;
+    if (!frameAllocator->Allocate(sizeof(SSunParams), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, sunAlloc) ||
+        !frameAllocator->Allocate(sizeof(SRadialBlurParams), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, rbAlloc))
+    {
+        m_renderSun = false;
+        return;
+    }
+    m_sunParamsOffset = sunAlloc.m_offset;
+    m_radialBlurParamsOffset = rbAlloc.m_offset;
+
+    SSunParams* sunParams = (SSunParams*)sunAlloc.m_ptr;
     sunParams->Scale = glm::vec4(m_sunScale, 0.0f, fbWidth, fbHeight);
     sunParams->LightDir = -directionalLight.GetDirection();
     sunParams->LightColor = directionalLight.GetLightIradiance();
@@ -328,7 +335,7 @@ void CSunRenderer::UpdateShaderParams()
     sunPos = sunPos / sunPos.w;
 	sunPos.z = 1.0f;
 
-    SRadialBlurParams* rbParams = m_radialBlurParamsBuffer->GetPtr<SRadialBlurParams*>();
+    SRadialBlurParams* rbParams = (SRadialBlurParams*)rbAlloc.m_ptr;
     rbParams->ProjSunPos = sunPos;
     rbParams->LightDensity = glm::vec4(m_lightShaftDensity);
     rbParams->LightDecay = glm::vec4(m_lightShaftDecay);
@@ -343,7 +350,7 @@ void CSunRenderer::PopulatePoolInfo(std::vector<VkDescriptorPoolSize>& poolSize,
 {
     maxSets = 4;
     AddDescriptorType(poolSize, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 5);
-    AddDescriptorType(poolSize, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2);
+    AddDescriptorType(poolSize, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 2);
 }
 
 void CSunRenderer::UpdateResourceTable()
@@ -76,8 +76,9 @@ protected:
     VkDescriptorSetLayout       m_sunDescriptorSetLayout;
     VkDescriptorSetLayout       m_radialBlurSetLayout;
 
-    BufferHandle*               m_sunParamsBuffer;
-	BufferHandle*               m_radialBlurParamsBuffer;
+    //dynamic offsets in the frame allocator
+    uint32_t                    m_sunParamsOffset;
+    uint32_t                    m_radialBlurParamsOffset;
 
     VkDescriptorSet             m_blurVDescSet;
     VkDescriptorSet             m_blurHDescSet;
@@ -27,15 +27,15 @@ struct ShadowTerrainParams
 
 TerrainRenderer::TerrainRenderer(VkRenderPass renderPass)
 	: CRenderer(renderPass, "TerrainRenderPass")
+	, m_activePipeline(nullptr)
+	, m_terrainParamsOffset(FrameAllocator::InvalidOffset)
+	, m_shadowSplitsOffset(FrameAllocator::InvalidOffset)
 	, m_grid(nullptr)
+	, m_splatterTexture(nullptr)
 	, m_descSet(VK_NULL_HANDLE)
 	, m_shadowDescSet(VK_NULL_HANDLE)
-	, m_terrainParamsBuffer(nullptr)
-	, m_shadowSplitsBuffer(nullptr)
-	, m_splatterTexture(nullptr)
-	, m_activePipeline(nullptr)
-	, m_editMode(false)
 	, m_tesselationParameters(13.0f, 7.0f, 0.8f, 0.0f)
+	, m_editMode(false)
 {
 
 }
@@ -53,9 +53,6 @@ void TerrainRenderer::Init()
 
 	CRenderer::Init();
 
-	m_terrainParamsBuffer = MemoryManager::GetInstance()->CreateBuffer(EMemoryContextType::UniformBuffers, sizeof(TerrainParams), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
-	m_shadowSplitsBuffer = MemoryManager::GetInstance()->CreateBuffer(EMemoryContextType::UniformBuffers, sizeof(ShadowTerrainParams), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
-
 	AllocDescriptorSets(m_descriptorPool, m_descriptorLayout.Get(), &m_descSet);
 	AllocDescriptorSets(m_descriptorPool, m_shadowDescLayout.Get(), &m_shadowDescSet);
 
@@ -72,16 +69,23 @@ void TerrainRenderer::Render()
 
 	StartRenderPass();
 
-	vk::CmdBindPipeline(cmd, m_activePipeline->GetBindPoint(), m_activePipeline->Get());
-	vk::CmdBindDescriptorSets(cmd, m_activePipeline->GetBindPoint(), m_activePipeline->GetLayout(), 0, 1, &m_descSet, 0, nullptr);
+	//only cleared if the frame allocator had no room for the parameters
+	if (m_terrainParamsOffset != FrameAllocator::InvalidOffset)
+	{
+		vk::CmdBindPipeline(cmd, m_activePipeline->GetBindPoint(), m_activePipeline->Get());
+		vk::CmdBindDescriptorSets(cmd, m_activePipeline->GetBindPoint(), m_activePipeline->GetLayout(), 0, 1, &m_descSet, 1, &m_terrainParamsOffset);
 
-	m_grid->Render();
+		m_grid->Render();
+	}
 
 	EndRenderPass();
 }
 
 void TerrainRenderer::RenderShadows()
 {
+	if (m_shadowSplitsOffset == FrameAllocator::InvalidOffset)
+		return;
+
 	glm::mat4 proj;
 	PerspectiveMatrix(proj);
 	ConvertToProjMatrix(proj);
@@ -91,7 +95,7 @@ void TerrainRenderer::RenderShadows()
 
 	vk::CmdBindPipeline(cmdBuffer, m_shadowPipeline.GetBindPoint(), m_shadowPipeline.Get());
 	vk::CmdPushConstants(cmdBuffer, m_shadowPipeline.GetLayout(), VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_GEOMETRY_BIT, 0, sizeof(ShadowPushConstants), &m_pushConstants);
-	vk::CmdBindDescriptorSets(cmdBuffer, m_shadowPipeline.GetBindPoint(), m_shadowPipeline.GetLayout(), 0, 1, &m_shadowDescSet, 0, nullptr);
+	vk::CmdBindDescriptorSets(cmdBuffer, m_shadowPipeline.GetBindPoint(), m_shadowPipeline.GetLayout(), 0, 1, &m_shadowDescSet, 1, &m_shadowSplitsOffset);
 
 	m_grid->Render();
 }
@@ -101,7 +105,19 @@ void TerrainRenderer::PreRender()
 	glm::mat4 modelMatrix = glm::scale(glm::translate(glm::mat4(1.0f), Scene::TerrainTranslate), glm::vec3(1.0f));
 	m_pushConstants.ModelMatrix = modelMatrix;
 	
-	ShadowTerrainParams* shadowParams = m_shadowSplitsBuffer->GetPtr<ShadowTerrainParams*>();
+	FrameAllocator* frameAllocator = MemoryManager::GetInstance()->GetFrameAllocator();
+	FrameAllocator::Allocation shadowAlloc;
+	FrameAllocator::Allocation paramsAlloc;
+	if (!frameAllocator->Allocate(sizeof(ShadowTerrainParams), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, shadowAlloc) ||
+		!frameAllocator->Allocate(sizeof(TerrainParams), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, paramsAlloc))
+	{
+		m_shadowSplitsOffset = m_terrainParamsOffset = FrameAllocator::InvalidOffset;
+		return;
+	}
+	m_shadowSplitsOffset = shadowAlloc.m_offset;
+	m_terrainParamsOffset = paramsAlloc.m_offset;
+
+	ShadowTerrainParams* shadowParams = (ShadowTerrainParams*)shadowAlloc.m_ptr;
 	shadowParams->NSplits = glm::ivec4(SHADOWSPLITS);
 	shadowParams->Splits = g_commonResources.GetAs<ShadowMapRenderer::SplitsArrayType>(EResourceType_ShadowMapSplits);
 
@@ -109,7 +125,7 @@ void TerrainRenderer::PreRender()
 	PerspectiveMatrix(projMatrix);
 	ConvertToProjMatrix(projMatrix);
 	
-	TerrainParams* params = m_terrainParamsBuffer->GetPtr<TerrainParams*>();
+	TerrainParams* params = (TerrainParams*)paramsAlloc.m_ptr;
 
 	params->MaterialProp = glm::vec4(0.90, 0.1, 0.5, 0.0f);
 	params->WorldMatrix = modelMatrix;
@@ -121,13 +137,13 @@ void TerrainRenderer::PreRender()
 
 void TerrainRenderer::CreateDescriptorSetLayout()
 {
-	m_descriptorLayout.AddBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT | VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 1);
+	m_descriptorLayout.AddBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT | VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 1);
 	m_descriptorLayout.AddBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 1);
 	m_descriptorLayout.AddBinding(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, (uint32_t)m_terrainTextures.size());
 
 	m_descriptorLayout.Construct();
 
-	m_shadowDescLayout.AddBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_GEOMETRY_BIT, 1);
+	m_shadowDescLayout.AddBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_GEOMETRY_BIT, 1);
 	m_shadowDescLayout.Construct(); 
 }
 
@@ -432,10 +448,10 @@ bool TerrainRenderer::OnMouseInput(const MouseInput& mouseInput)
 void TerrainRenderer::PopulatePoolInfo(std::vector<VkDescriptorPoolSize>& poolSize, unsigned int& maxSets)
 {
 	maxSets = 2;
-	AddDescriptorType(poolSize, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1);
+	AddDescriptorType(poolSize, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1);
 	AddDescriptorType(poolSize, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1);
 	AddDescriptorType(poolSize, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, (uint32_t)m_terrainTextures.size());
-	AddDescriptorType(poolSize, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1); //shadow
+	AddDescriptorType(poolSize, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1); //shadow
 }
 
 void TerrainRenderer::UpdateResourceTable()
@@ -447,17 +463,18 @@ void TerrainRenderer::UpdateGraphicInterface()
 {
 	std::vector<VkWriteDescriptorSet> wDesc;
 
-	VkDescriptorBufferInfo buffInfo = m_terrainParamsBuffer->GetDescriptor();
-	VkDescriptorBufferInfo splitsInfo = m_shadowSplitsBuffer->GetDescriptor();
+	FrameAllocator* frameAllocator = MemoryManager::GetInstance()->GetFrameAllocator();
+	VkDescriptorBufferInfo buffInfo = frameAllocator->GetDescriptor(sizeof(TerrainParams));
+	VkDescriptorBufferInfo splitsInfo = frameAllocator->GetDescriptor(sizeof(ShadowTerrainParams));
 	std::vector<VkDescriptorImageInfo> textInfos;
 
 	for (auto text : m_terrainTextures)
 		textInfos.push_back(text->GetTextureDescriptor());
 
-	wDesc.push_back(InitUpdateDescriptor(m_descSet, 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, &buffInfo));
+	wDesc.push_back(InitUpdateDescriptor(m_descSet, 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, &buffInfo));
 	wDesc.push_back(InitUpdateDescriptor(m_descSet, 1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &m_splatterTexture->GetTextureDescriptor()));
 	wDesc.push_back(InitUpdateDescriptor(m_descSet, 2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 0, textInfos));
-	wDesc.push_back(InitUpdateDescriptor(m_shadowDescSet, 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, &splitsInfo));
+	wDesc.push_back(InitUpdateDescriptor(m_shadowDescSet, 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, &splitsInfo));
 
 	vk::UpdateDescriptorSets(vk::g_vulkanContext.m_device, (uint32_t)wDesc.size(), wDesc.data(), 0, nullptr);
 }
@@ -54,8 +54,9 @@ private:
 	CGraphicPipeline*				m_activePipeline;
 	CGraphicPipeline				m_shadowPipeline;
 
-	BufferHandle*					m_terrainParamsBuffer;
-	BufferHandle*					m_shadowSplitsBuffer;
+	//dynamic offsets in the frame allocator
+	uint32_t						m_terrainParamsOffset;
+	uint32_t						m_shadowSplitsOffset;
 
 	Mesh*							m_grid;
 	std::vector<CTexture*>			m_terrainTextures;
@@ -78,80 +78,64 @@ void CTextureManager::RegisterTextureForCreation(TextureCreator* tc)
 	m_updateTextureCreators.push_back(tc);
 }
 
-VkDeviceSize CTextureManager::EstimateMemory()
-{
-	VkDeviceSize totalSize = 0;
-	for (unsigned int i = 0; i < m_updateTextureCreators.size(); ++i)
-		totalSize += m_updateTextureCreators[i]->GetDataSize();
-
-	totalSize += m_updateTextureCreators.size() * vk::g_vulkanContext.m_limits.minUniformBufferOffsetAlignment; //add some padding
-	return totalSize;
-}
-
 void CTextureManager::Update()
 {
-    if(!m_freeTextureCreators.empty())
-    {
-		for (unsigned int i = 0; i < m_freeTextureCreators.size(); ++i)
-			delete m_freeTextureCreators[i];
-
-		m_freeTextureCreators.clear();
-		MemoryManager::GetInstance()->FreeMemory(EMemoryContextType::StaggingTextures);
-    }
-
     if (m_updateTextureCreators.empty())
        return;
 
-	CopyFirstMip();
-	GenerateMips();
+	//in order, as much as the stagging ring has room for. A texture that doesn't fit is split over frames
+	unsigned int copiedCount = 0;
+	for (; copiedCount < m_updateTextureCreators.size(); ++copiedCount)
+	{
+		TextureCreator* creator = m_updateTextureCreators[copiedCount];
+		if (!creator->CopyNextPart() || !creator->IsCopied())
+			break;
+	}
 
-	m_freeTextureCreators = m_updateTextureCreators;
-	m_updateTextureCreators.clear();
-}
+	if (copiedCount == 0)
+		return;
 
-void CTextureManager::CopyFirstMip()
-{
-	VkDeviceSize estimatedSize = EstimateMemory();
-	MemoryManager::GetInstance()->AllocMemory(EMemoryContextType::StaggingTextures, estimatedSize);
+	std::vector<TextureCreator*> copiedCreators(m_updateTextureCreators.begin(), m_updateTextureCreators.begin() + copiedCount);
+	m_updateTextureCreators.erase(m_updateTextureCreators.begin(), m_updateTextureCreators.begin() + copiedCount);
 
-	for (unsigned int i = 0; i < m_updateTextureCreators.size(); ++i)
-		m_updateTextureCreators[i]->Prepare();
+	AcquireFirstMips(copiedCreators);
+	GenerateMips(copiedCreators);
 
-	VkCommandBuffer cmdBuffer = vk::g_vulkanContext.m_mainCommandBuffer;
+	//the data is in the stagging ring already, the ring keeps it until the transfer is done
+	for (unsigned int i = 0; i < copiedCreators.size(); ++i)
+		delete copiedCreators[i];
+}
 
-	std::vector<VkImageMemoryBarrier> imgBarries(m_updateTextureCreators.size());
-	std::vector<VkBufferMemoryBarrier> buffBarriers(m_updateTextureCreators.size());
-	MemoryManager::GetInstance()->MapMemoryContext(EMemoryContextType::StaggingTextures);
+void CTextureManager::AcquireFirstMips(const std::vector<TextureCreator*>& creators)
+{
+	//the first mip is copied on the transfer queue, the mips are generated on the graphic queue (blits need graphic capabilities)
+	TransferQueue* transferQueue = TransferQueue::GetInstance();
+	VkCommandBuffer cmdBuffer = transferQueue->GetCommandBuffer();
 
-	for (unsigned int i = 0; i < m_updateTextureCreators.size(); ++i)
+	std::vector<VkImageMemoryBarrier> imgBarries(creators.size());
+	for (unsigned int i = 0; i < creators.size(); ++i)
 	{
-		m_updateTextureCreators[i]->CopyLocalData();
-		buffBarriers[i] = m_updateTextureCreators[i]->GetBuffer()->CreateMemoryBarrier(VK_ACCESS_HOST_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT);
-		imgBarries[i] = m_updateTextureCreators[i]->GetImage()->CreateMemoryBarrier(VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_ASPECT_COLOR_BIT);
+		imgBarries[i] = creators[i]->GetImage()->CreateMemoryBarrier(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT, VK_IMAGE_ASPECT_COLOR_BIT);
 	}
 
-	vk::CmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_HOST_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr,
-		(uint32_t)buffBarriers.size(), buffBarriers.data(), (uint32_t)imgBarries.size(), imgBarries.data());
-
-	MemoryManager::GetInstance()->UnmapMemoryContext(EMemoryContextType::StaggingTextures);
-
-	for (unsigned int i = 0; i < m_updateTextureCreators.size(); ++i)
+	std::vector<VkImageMemoryBarrier> acquireBarriers(imgBarries);
+	for (unsigned int i = 0; i < imgBarries.size(); ++i)
 	{
-		m_updateTextureCreators[i]->AddCopyCommand();
-		imgBarries[i] = m_updateTextureCreators[i]->GetImage()->CreateMemoryBarrier(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-			VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT, VK_IMAGE_ASPECT_COLOR_BIT);
+		transferQueue->ReleaseBarrier(imgBarries[i]);
+		transferQueue->AcquireBarrier(acquireBarriers[i]);
 	}
 
-	vk::CmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, (uint32_t)imgBarries.size(), imgBarries.data());
+	vk::CmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, (uint32_t)imgBarries.size(), imgBarries.data());
+
+	vk::CmdPipelineBarrier(vk::g_vulkanContext.m_mainCommandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, (uint32_t)acquireBarriers.size(), acquireBarriers.data());
+	transferQueue->WaitOnGraphics(transferQueue->GetCurrentBatch(), VK_PIPELINE_STAGE_TRANSFER_BIT);
 }
 
-void CTextureManager::GenerateMips()
+void CTextureManager::GenerateMips(const std::vector<TextureCreator*>& creators)
 {
-	//VkCommandBuffer cmdBuffer = vk::g_vulkanContext.m_mainCommandBuffer;
-
-	std::vector<VkImageMemoryBarrier> mipsBarriers;
-	for (unsigned int i = 0; i < m_updateTextureCreators.size(); ++i)
-		m_updateTextureCreators[i]->GenerateMips();
+	for (unsigned int i = 0; i < creators.size(); ++i)
+		creators[i]->GenerateMips();
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -162,15 +146,12 @@ TextureCreator::TextureCreator(CTexture* text, const SImageData& imgData, bool o
 	: m_texture(text)
 	, m_data(imgData)
 	, m_ownData(ownData)
-	, m_staggingBuffer(nullptr)
+	, m_copiedRows(0)
 {
 }
 
 TextureCreator::~TextureCreator()
 {
-	VkDevice dev = vk::g_vulkanContext.m_device;
-	MemoryManager::GetInstance()->FreeHandle(m_staggingBuffer);
-	
 	if (m_ownData)
 		delete[] m_data.data;
 }
@@ -180,19 +161,53 @@ ImageHandle* TextureCreator::GetImage()
     return m_texture->m_image;
 }
 
-BufferHandle* TextureCreator::GetBuffer()
+uint32_t TextureCreator::GetRowsCount() const
 {
-	return m_staggingBuffer;
+	return (m_data.depth > 1) ? m_data.depth : m_data.height;
 }
 
-VkDeviceSize TextureCreator::GetDataSize()
+bool TextureCreator::IsCopied() const
 {
-	return m_data.GetDataSize();
+	return m_copiedRows == GetRowsCount();
 }
 
-void TextureCreator::AddCopyCommand()
+bool TextureCreator::CopyNextPart()
 {
-    VkCommandBuffer cmdBuff =  vk::g_vulkanContext.m_mainCommandBuffer;
+	StagingRing* stagingRing = MemoryManager::GetInstance()->GetStagingRing();
+	TransferQueue* transferQueue = TransferQueue::GetInstance();
+	bool isVolume = m_data.depth > 1;
+
+	uint32_t rowsCount = GetRowsCount();
+	VkDeviceSize rowSize = m_data.GetDataSize() / rowsCount;
+	VkDeviceSize texelSize = GetBytesFromFormat(m_data.format);
+	VkDeviceSize alignment = glm::max(glm::max(texelSize, VkDeviceSize(4)), vk::g_vulkanContext.m_limits.optimalBufferCopyOffsetAlignment);
+
+	//a part that doesn't reach the end of the image must be aligned to the transfer granularity of the queue
+	const VkExtent3D& granularity = transferQueue->GetImageGranularity();
+	uint32_t rowsStep = (isVolume) ? granularity.depth : granularity.height;
+	if (rowsStep == 0)
+		rowsStep = rowsCount;
+	TRAP(glm::min(rowsStep, rowsCount) * rowSize <= stagingRing->GetSize() && "The texture can't be split in parts that fit in the stagging ring");
+
+	uint32_t remainingRows = rowsCount - m_copiedRows;
+	uint32_t rows = (uint32_t)glm::min(stagingRing->GetMaxAllocation(alignment) / rowSize, (VkDeviceSize)remainingRows);
+	if (rows < remainingRows)
+		rows -= rows % rowsStep;
+	if (rows == 0)
+		return false;
+
+	StagingRing::Allocation stagging;
+	bool allocated = stagingRing->Allocate(rows * rowSize, alignment, stagging);
+	TRAP(allocated);
+	memcpy(stagging.m_ptr, m_data.data + m_copiedRows * rowSize, (size_t)(rows * rowSize));
+
+	VkCommandBuffer cmdBuff = transferQueue->GetCommandBuffer();
+	ImageHandle* textureImg = m_texture->m_image;
+	if (m_copiedRows == 0)
+	{
+		VkImageMemoryBarrier toTransferDst = textureImg->CreateMemoryBarrier(VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_ASPECT_COLOR_BIT);
+		vk::CmdPipelineBarrier(cmdBuff, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &toTransferDst);
+	}
 
     VkImageSubresourceLayers subResourceLayers;
     cleanStructure(subResourceLayers);
@@ -209,16 +224,28 @@ void TextureCreator::AddCopyCommand()
     extent.height = m_data.height;
     extent.depth = m_data.depth;
 
+    if (isVolume)
+    {
+        offset.z = m_copiedRows;
+        extent.depth = rows;
+    }
+    else
+    {
+        offset.y = m_copiedRows;
+        extent.height = rows;
+    }
+
     VkBufferImageCopy copy;
     cleanStructure(copy);
     copy.imageOffset = offset;
-    copy.bufferOffset = 0;
+    copy.bufferOffset = stagging.m_offset;
     copy.imageExtent = extent;
     copy.imageSubresource = subResourceLayers;
 
+	vk::CmdCopyBufferToImage(cmdBuff, stagingRing->GetBuffer(), textureImg->Get(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy);
 
-	ImageHandle* textureImg = m_texture->m_image;
-	vk::CmdCopyBufferToImage(cmdBuff, m_staggingBuffer->Get(), textureImg->Get(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy);
+	m_copiedRows += rows;
+	return true;
 }
 
 void TextureCreator::GenerateMips()
@@ -284,17 +311,6 @@ void TextureCreator::GenerateMips()
 	vk::CmdPipelineBarrier(cmdBuff, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &finalTransition);
 }
 
-void TextureCreator::Prepare()
-{
-	m_staggingBuffer = MemoryManager::GetInstance()->CreateBuffer(EMemoryContextType::StaggingTextures, m_data.GetDataSize(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
-}
-
-void TextureCreator::CopyLocalData()
-{
-	void* dst = m_staggingBuffer->GetPtr<void*>();
-	memcpy(dst, (void*)m_data.data, m_data.GetDataSize());
-}
-
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //CTexture
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -309,7 +325,8 @@ CTexture::CTexture(const SImageData& image, bool ownData)
 	, SeriableImpl<CTexture>("texture")
 	, m_filter(VK_FILTER_LINEAR)
 {
-    CreateTexture(image, ownData);
+    bool created = CreateTexture(image, ownData);
+    TRAP(created && "No memory for the texture");
 }
 
 CTexture::CTexture()
@@ -355,7 +372,7 @@ CTexture::~CTexture()
 
 }
 
-void CTexture::CreateTexture(const SImageData& imageData, bool ownData)
+bool CTexture::CreateTexture(const SImageData& imageData, bool ownData)
 {
     TRAP(imageData.data);
     VkImageType type = (imageData.height > 1)? VK_IMAGE_TYPE_2D : VK_IMAGE_TYPE_1D;
@@ -387,6 +404,12 @@ void CTexture::CreateTexture(const SImageData& imageData, bool ownData)
     imgTextInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
 	m_image = MemoryManager::GetInstance()->CreateImage(EMemoryContextType::Textures, imgTextInfo, imageData.fileName);
+	if (!m_image)
+	{
+		if (ownData)
+			delete[] imageData.data;
+		return false;
+	}
 
 	if (m_filter == VK_FILTER_LINEAR)
 		CreateLinearSampler(m_textSampler);
@@ -400,6 +423,7 @@ void CTexture::CreateTexture(const SImageData& imageData, bool ownData)
     m_textureInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 
     CTextureManager::GetInstance()->RegisterTextureForCreation(new TextureCreator(this, imageData, ownData));
+    return true;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
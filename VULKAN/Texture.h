@@ -9,6 +9,7 @@
 #include "Singleton.h"
 #include "Serializer.h"
 #include "ResourceLoader.h"
+#include "TransferQueue.h"
 
 #define TEXTDIR "text/"
 
@@ -87,16 +88,15 @@ public:
 	void RegisterTextureForCreation(TextureCreator* text);
 
     void Update();
+    bool HasTransfersInProgress() const { return !m_updateTextureCreators.empty(); }
 private:
     CTextureManager();
 	virtual ~CTextureManager();
 
-	VkDeviceSize EstimateMemory();
-	void CopyFirstMip();
-	void GenerateMips();
+	void AcquireFirstMips(const std::vector<TextureCreator*>& creators);
+	void GenerateMips(const std::vector<TextureCreator*>& creators);
 private:
 	std::vector<TextureCreator*>  m_updateTextureCreators;
-	std::vector<TextureCreator*>  m_freeTextureCreators;
 };
 
 class TextureCreator
@@ -106,21 +106,22 @@ public:
 	virtual ~TextureCreator();
 
     ImageHandle*		GetImage();
-	BufferHandle*		GetBuffer();
-	VkDeviceSize		GetDataSize();
 
-	void				Prepare(); //kinda shitty
-    void				AddCopyCommand();
-	void				CopyLocalData();
+	//stages the next rows (slices for 3D textures) of the first mip and records their copy on the transfer queue.
+	//Returns false if the stagging ring has no room now
+	bool				CopyNextPart();
+	bool				IsCopied() const;
 	void				GenerateMips();
 private:
 	TextureCreator(CTexture* text, const SImageData& imgData, bool ownData);
+
+	uint32_t			GetRowsCount() const;
 private:
 	CTexture*				m_texture;
-	BufferHandle*			m_staggingBuffer;
 
     SImageData              m_data;
     bool                    m_ownData;
+	uint32_t				m_copiedRows;
 };
 
 class CTexture : public SeriableImpl<CTexture>
@@ -135,7 +136,8 @@ public:
     const VkDescriptorImageInfo& GetTextureDescriptor() const;
     VkDescriptorImageInfo& GetTextureDescriptor();
 	VkImageView  GetImageView() const;
-	void CreateTexture(const SImageData& imageData, bool ownData);
+	//returns false if there is no memory for the image. The data is freed anyway if it's owned
+	bool CreateTexture(const SImageData& imageData, bool ownData);
 
 	void SetSamplerFilter(VkFilter filter) { m_filter = filter; };
 protected:
@@ -215,6 +217,36 @@ public:
 
 		ResourceLoader::GetInstance()->LoadTexture(&(cobj->*m_ptm));
 	};
+
+	virtual void SaveBinary(Serializer* serializer, ISeriable* obj)
+	{
+		BASE* cobj = static_cast<BASE*>(obj);
+
+		(cobj->*m_ptm)->SetName(m_label);
+		(cobj->*m_ptm)->Serialize(serializer);
+	};
+
+	virtual void LoadBinary(Serializer* serializer, ISeriable* obj)
+	{
+		BASE* cobj = static_cast<BASE*>(obj);
+
+		cobj->*m_ptm = new CTexture();
+
+		(cobj->*m_ptm)->SetName(m_label);
+		if (!(cobj->*m_ptm)->Serialize(serializer))
+		{
+			delete (cobj->*m_ptm);
+			cobj->*m_ptm = nullptr;
+			return;
+		}
+
+		ResourceLoader::GetInstance()->LoadTexture(&(cobj->*m_ptm));
+	};
+
+	virtual std::string GetLayoutTag() const
+	{
+		return m_label + ":" + typeid(CTexture*).name();
+	};
 private:
 	PtmType						m_ptm;
 	std::string					m_label;
@@ -0,0 +1,263 @@
+#include "TransferQueue.h"
+
+#include "defines.h"
+#include "MemoryManager.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//TransferQueue
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TransferQueue::TransferQueue()
+	: m_commandPool(VK_NULL_HANDLE)
+	, m_familyIndex(vk::g_vulkanContext.m_transferQueueFamilyIndex)
+	, m_recordingBatch(-1)
+	, m_nextId(InvalidBatch + 1)
+	, m_frameCounter(0)
+{
+	TRAP(vk::g_vulkanContext.m_transferQueue != VK_NULL_HANDLE);
+
+	uint32_t queuePropCnt = 0;
+	vk::GetPhysicalDeviceQueueFamilyProperties(vk::g_vulkanContext.m_physicalDevice, &queuePropCnt, nullptr);
+	std::vector<VkQueueFamilyProperties> queueProperties(queuePropCnt);
+	vk::GetPhysicalDeviceQueueFamilyProperties(vk::g_vulkanContext.m_physicalDevice, &queuePropCnt, queueProperties.data());
+	m_imageGranularity = queueProperties[m_familyIndex].minImageTransferGranularity;
+
+	VkCommandPoolCreateInfo cmdPoolCi;
+	cleanStructure(cmdPoolCi);
+	cmdPoolCi.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	cmdPoolCi.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+	cmdPoolCi.queueFamilyIndex = m_familyIndex;
+
+	VULKAN_ASSERT(vk::CreateCommandPool(vk::g_vulkanContext.m_device, &cmdPoolCi, nullptr, &m_commandPool));
+}
+
+TransferQueue::~TransferQueue()
+{
+	VkDevice dev = vk::g_vulkanContext.m_device;
+	for (auto& batch : m_batches)
+	{
+		if (batch.Submitted)
+			vk::WaitForFences(dev, 1, &batch.Fence, VK_TRUE, UINT64_MAX);
+
+		vk::DestroyFence(dev, batch.Fence, nullptr);
+		vk::DestroySemaphore(dev, batch.Semaphore, nullptr);
+	}
+
+	vk::DestroyCommandPool(dev, m_commandPool, nullptr);
+}
+
+VkCommandBuffer TransferQueue::GetCommandBuffer()
+{
+	if (m_recordingBatch != -1)
+		return m_batches[m_recordingBatch].CommandBuffer;
+
+	for (unsigned int i = 0; i < m_batches.size(); ++i)
+	{
+		if (CanReuse(m_batches[i]))
+		{
+			m_recordingBatch = i;
+			break;
+		}
+	}
+
+	if (m_recordingBatch == -1)
+	{
+		CreateBatch();
+		m_recordingBatch = (int)m_batches.size() - 1;
+	}
+
+	Batch& batch = m_batches[m_recordingBatch];
+	MemoryManager::GetInstance()->GetStagingRing()->Update(); //the ring may not have seen this fence signaled yet
+	VULKAN_ASSERT(vk::ResetFences(vk::g_vulkanContext.m_device, 1, &batch.Fence));
+	batch.Id = m_nextId++;
+	batch.WaitStage = 0;
+	batch.Submitted = false;
+	batch.Waited = false;
+
+	VkCommandBufferBeginInfo beginInfo;
+	cleanStructure(beginInfo);
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	VULKAN_ASSERT(vk::BeginCommandBuffer(batch.CommandBuffer, &beginInfo));
+	return batch.CommandBuffer;
+}
+
+TransferQueue::BatchId TransferQueue::GetCurrentBatch() const
+{
+	return (m_recordingBatch != -1) ? m_batches[m_recordingBatch].Id : InvalidBatch;
+}
+
+TransferQueue::BatchId TransferQueue::Submit()
+{
+	if (m_recordingBatch == -1)
+		return InvalidBatch;
+
+	Batch& batch = m_batches[m_recordingBatch];
+	m_recordingBatch = -1;
+
+	VULKAN_ASSERT(vk::EndCommandBuffer(batch.CommandBuffer));
+	MemoryManager::GetInstance()->GetStagingRing()->Flush();
+
+	VkSubmitInfo submitInfo;
+	cleanStructure(submitInfo);
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &batch.CommandBuffer;
+	submitInfo.signalSemaphoreCount = 1;
+	submitInfo.pSignalSemaphores = &batch.Semaphore;
+
+	VULKAN_ASSERT(vk::QueueSubmit(vk::g_vulkanContext.m_transferQueue, 1, &submitInfo, batch.Fence));
+	batch.Submitted = true;
+	//the stagging allocated since the last retire was for this batch
+	MemoryManager::GetInstance()->GetStagingRing()->Retire(batch.Fence);
+
+	return batch.Id;
+}
+
+bool TransferQueue::IsFinished(BatchId id) const
+{
+	const Batch* batch = FindBatch(id);
+	if (!batch) //the slot was reused, so it finished long ago
+		return true;
+
+	return batch->Submitted && IsFenceSignaled(*batch);
+}
+
+void TransferQueue::WaitOnGraphics(BatchId id, VkPipelineStageFlags stage)
+{
+	Batch* batch = FindBatch(id);
+	TRAP(batch);
+
+	batch->WaitStage |= stage;
+}
+
+void TransferQueue::GetWaitSemaphores(std::vector<VkSemaphore>& outSemaphores, std::vector<VkPipelineStageFlags>& outStages)
+{
+	TRAP(m_recordingBatch == -1 && "Submit the transfers before the graphic queue");
+
+	for (auto& batch : m_batches)
+	{
+		if (!batch.Submitted || batch.Waited)
+			continue;
+
+		//a signaled semaphore has to be waited before the batch can be submitted again. Nobody asked for the finished ones, so they don't stall anything
+		if (batch.WaitStage == 0 && !IsFenceSignaled(batch))
+			continue;
+
+		outSemaphores.push_back(batch.Semaphore);
+		outStages.push_back((batch.WaitStage != 0) ? batch.WaitStage : VkPipelineStageFlags(VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT));
+		batch.Waited = true;
+		batch.WaitFrame = m_frameCounter;
+	}
+
+	++m_frameCounter;
+}
+
+void TransferQueue::ReleaseBarrier(VkBufferMemoryBarrier& barrier) const
+{
+	barrier.dstAccessMask = 0;
+	if (IsDedicated())
+	{
+		barrier.srcQueueFamilyIndex = m_familyIndex;
+		barrier.dstQueueFamilyIndex = vk::g_vulkanContext.m_queueFamilyIndex;
+	}
+}
+
+void TransferQueue::ReleaseBarrier(VkImageMemoryBarrier& barrier) const
+{
+	barrier.dstAccessMask = 0;
+	if (IsDedicated())
+	{
+		barrier.srcQueueFamilyIndex = m_familyIndex;
+		barrier.dstQueueFamilyIndex = vk::g_vulkanContext.m_queueFamilyIndex;
+	}
+}
+
+void TransferQueue::AcquireBarrier(VkBufferMemoryBarrier& barrier) const
+{
+	barrier.srcAccessMask = 0;
+	if (IsDedicated())
+	{
+		barrier.srcQueueFamilyIndex = m_familyIndex;
+		barrier.dstQueueFamilyIndex = vk::g_vulkanContext.m_queueFamilyIndex;
+	}
+}
+
+void TransferQueue::AcquireBarrier(VkImageMemoryBarrier& barrier) const
+{
+	barrier.srcAccessMask = 0;
+	if (IsDedicated())
+	{
+		barrier.srcQueueFamilyIndex = m_familyIndex;
+		barrier.dstQueueFamilyIndex = vk::g_vulkanContext.m_queueFamilyIndex;
+	}
+	else
+	{
+		barrier.oldLayout = barrier.newLayout; //the release already did the transition
+	}
+}
+
+TransferQueue::Batch* TransferQueue::FindBatch(BatchId id)
+{
+	for (auto& batch : m_batches)
+		if (batch.Id == id)
+			return &batch;
+
+	return nullptr;
+}
+
+const TransferQueue::Batch* TransferQueue::FindBatch(BatchId id) const
+{
+	for (auto& batch : m_batches)
+		if (batch.Id == id)
+			return &batch;
+
+	return nullptr;
+}
+
+bool TransferQueue::IsFenceSignaled(const Batch& batch) const
+{
+	return vk::GetFenceStatus(vk::g_vulkanContext.m_device, batch.Fence) == VK_SUCCESS;
+}
+
+//the fence tells that the transfer is done, but the semaphore is free only when the graphic submit that waited it is done too
+bool TransferQueue::CanReuse(const Batch& batch) const
+{
+	if (!batch.Submitted)
+		return true;
+
+	return batch.Waited && m_frameCounter - batch.WaitFrame >= FRAMES_IN_FLIGHT && IsFenceSignaled(batch);
+}
+
+void TransferQueue::CreateBatch()
+{
+	VkDevice dev = vk::g_vulkanContext.m_device;
+
+	Batch batch;
+	batch.Id = InvalidBatch;
+	batch.WaitStage = 0;
+	batch.Submitted = false;
+	batch.Waited = false;
+	batch.WaitFrame = 0;
+
+	VkCommandBufferAllocateInfo cmdAlocInfo;
+	cleanStructure(cmdAlocInfo);
+	cmdAlocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	cmdAlocInfo.commandPool = m_commandPool;
+	cmdAlocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	cmdAlocInfo.commandBufferCount = 1;
+	VULKAN_ASSERT(vk::AllocateCommandBuffers(dev, &cmdAlocInfo, &batch.CommandBuffer));
+
+	VkFenceCreateInfo fenceCreateInfo;
+	cleanStructure(fenceCreateInfo);
+	fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	VULKAN_ASSERT(vk::CreateFence(dev, &fenceCreateInfo, nullptr, &batch.Fence));
+
+	VkSemaphoreCreateInfo semaphoreCreateInfo;
+	cleanStructure(semaphoreCreateInfo);
+	semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	VULKAN_ASSERT(vk::CreateSemaphore(dev, &semaphoreCreateInfo, nullptr, &batch.Semaphore));
+
+	m_batches.push_back(batch);
+}
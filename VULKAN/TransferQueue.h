@@ -0,0 +1,72 @@
+#pragma once
+
+#include "VulkanLoader.h"
+#include "Singleton.h"
+
+#include <vector>
+
+//Uploads recorded here are submitted on the dedicated transfer queue of the device (or on the graphic queue when there is none).
+//Every submit is a batch with its own fence, so the cpu can poll it, and its own semaphore, that is waited by the graphic submit of the frame.
+//Resources written here must be released with the Release* barriers and acquired on the graphic queue with the Acquire* barriers
+class TransferQueue : public Singleton<TransferQueue>
+{
+	friend class Singleton<TransferQueue>;
+public:
+	typedef uint64_t BatchId;
+	static const BatchId InvalidBatch = 0;
+
+	//begins a new batch if there is none in recording
+	VkCommandBuffer GetCommandBuffer();
+	//the batch that GetCommandBuffer records into. InvalidBatch if there is none
+	BatchId GetCurrentBatch() const;
+	//returns InvalidBatch if nothing was recorded since the last submit. Has to be called before the graphic submit of the frame
+	BatchId Submit();
+
+	//doesn't block
+	bool IsFinished(BatchId batch) const;
+	//the graphic submit of this frame waits for the batch at stage. The batch can still be in recording
+	void WaitOnGraphics(BatchId batch, VkPipelineStageFlags stage);
+	//called once per frame, by the graphic submit
+	void GetWaitSemaphores(std::vector<VkSemaphore>& outSemaphores, std::vector<VkPipelineStageFlags>& outStages);
+
+	bool IsDedicated() const { return m_familyIndex != vk::g_vulkanContext.m_queueFamilyIndex; }
+	unsigned int GetFamilyIndex() const { return m_familyIndex; }
+	//image copies that don't cover the whole mip must be aligned to it. (0, 0, 0) means whole mips only
+	const VkExtent3D& GetImageGranularity() const { return m_imageGranularity; }
+
+	//ownership transfer. On the same family the release does the layout transition and the acquire is only an execution dependency
+	void ReleaseBarrier(VkBufferMemoryBarrier& barrier) const;
+	void ReleaseBarrier(VkImageMemoryBarrier& barrier) const;
+	void AcquireBarrier(VkBufferMemoryBarrier& barrier) const;
+	void AcquireBarrier(VkImageMemoryBarrier& barrier) const;
+private:
+	TransferQueue();
+	virtual ~TransferQueue();
+
+	struct Batch
+	{
+		VkCommandBuffer			CommandBuffer;
+		VkFence					Fence;
+		VkSemaphore				Semaphore;
+		BatchId					Id;
+		VkPipelineStageFlags	WaitStage; //0 if the graphic queue didn't ask for it yet
+		bool					Submitted;
+		bool					Waited;
+		uint64_t				WaitFrame;
+	};
+
+	Batch* FindBatch(BatchId id);
+	const Batch* FindBatch(BatchId id) const;
+	bool IsFenceSignaled(const Batch& batch) const;
+	bool CanReuse(const Batch& batch) const;
+	void CreateBatch();
+private:
+	VkCommandPool				m_commandPool;
+	unsigned int				m_familyIndex;
+	VkExtent3D					m_imageGranularity;
+
+	std::vector<Batch>			m_batches;
+	int							m_recordingBatch; //-1 if no batch is in recording
+	BatchId						m_nextId;
+	uint64_t					m_frameCounter;
+};
@@ -159,8 +159,6 @@ CUIRenderer::~CUIRenderer()
 
 void CUIRenderer::PreRender()
 {
-	MemoryManager::GetInstance()->MapMemoryContext(EMemoryContextType::UI);
-
 	UIGlobals* globals = m_globalsBuffer->GetPtr<UIGlobals*>();
 	globals->ScreenSize = glm::vec4(WIDTH, HEIGHT, 0.0f, 0.0f);
 
@@ -187,8 +185,6 @@ void CUIRenderer::PreRender()
 		}
 
 	}
-
-	MemoryManager::GetInstance()->UnmapMemoryContext(EMemoryContextType::UI);
 }
 
 void CUIRenderer::Render()
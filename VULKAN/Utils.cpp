@@ -637,19 +637,9 @@ void ReadXmlFile(const std::string& xmlFile, char** fileContent)
     std::streamoff size = hXml.tellg();
     hXml.seekg(0, std::ios_base::beg);
     *fileContent = new char[size + 1];
-    char* line = new char[512];
-    uint64_t offset = 0;
-    while(true)
-    {
-        hXml.getline(line, 512);
-        if(hXml.eof())
-            break;
-
-        TRAP(!hXml.fail());
-        std::streamoff bytes = hXml.gcount();
-        memcpy(*fileContent + offset, line, bytes - 1); //exclude \0
-        offset += bytes - 1; //gcount count delim too
-    }
-    (*fileContent)[offset] = '\0';
+
+    //one read for the whole file. In text mode the line endings are converted, so gcount can be smaller than size
+    hXml.read(*fileContent, size);
+    (*fileContent)[hXml.gcount()] = '\0';
     hXml.close();
 }
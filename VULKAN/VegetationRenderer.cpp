@@ -13,6 +13,7 @@
 
 #include <random>
 #include <functional>
+#include <chrono>
 
 class VegetationTemplate : public SeriableImpl<VegetationTemplate>
 {
@@ -340,7 +341,6 @@ void QuadTree::Traverse(PartitionNode* startNode, std::function<void(PartitionNo
 
 VegetationRenderer::VegetationRenderer(VkRenderPass renderPass)
 	: CRenderer(renderPass, "VegetationPass")
-	, m_staggingBuffer(nullptr)
 	, m_paramsBuffer(nullptr)
 	, m_renderDescSet(VK_NULL_HANDLE)
 	, m_maxTextures(4)
@@ -370,7 +370,6 @@ void VegetationRenderer::Init()
 	
 	GenerateVegetation();
 	AllocDescriptorSets(m_descriptorPool, m_renderDescSetLayout.Get(), &m_renderDescSet);
-	//CreateBuffers();
 	CreateBuffers2();
 
 	//m_quad = new Mesh("obj\\veg_plane.mb");
@@ -396,20 +395,6 @@ void VegetationRenderer::Init()
 
 void VegetationRenderer::Render()
 {
-	//if (!m_isReady)
-	//{
-	//	CopyBuffers();
-	//	m_isReady = true; //kinda iffy. We know that the data will be on the gpu next frame
-	//	return;
-	//}
-
-	if (m_isReady && m_staggingBuffer)
-	{
-		MemoryManager::GetInstance()->FreeHandle(m_staggingBuffer);
-		m_staggingBuffer = nullptr;
-		UpdateTextures();
-	}
-
 	StartRenderPass();
 	VkCommandBuffer cmdBuff = vk::g_vulkanContext.m_mainCommandBuffer;
 
@@ -435,7 +420,7 @@ void VegetationRenderer::PreRender()
 	m_globals.CameraPosition = glm::vec4(ms_camera.GetPos(), 1.0f);
 	m_globals.LightDirection = glm::vec4(directionalLight.GetDirection());
 
-	ULONG64 start = GetTickCount64();
+	auto start = std::chrono::steady_clock::now();
 	std::vector<PlantDescription> cullingResult;
 	cullingResult.reserve(64);
 
@@ -445,8 +430,8 @@ void VegetationRenderer::PreRender()
 	memcpy(shaderParams, cullingResult.data(), sizeof(PlantDescription) * cullingResult.size());
 	m_visibleInstances = uint32_t(cullingResult.size());
 
-	ULONG64 end = GetTickCount64();
-	SetFrustrumDebugText(uint32_t(cullingResult.size()), end - start);
+	auto end = std::chrono::steady_clock::now();
+	SetFrustrumDebugText(uint32_t(cullingResult.size()), std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count());
 
 }
 
@@ -564,44 +549,6 @@ void VegetationRenderer::GenerateVegetation()
 
 }
 
-void VegetationRenderer::CopyBuffers()
-{
-	TRAP(m_staggingBuffer && m_paramsBuffer);
-
-	StartDebugMarker("VegetationCopyBuffers");
-	VkBufferCopy region;
-	region.srcOffset = m_staggingBuffer->GetOffset();
-	region.dstOffset = m_paramsBuffer->GetOffset();
-	region.size = m_staggingBuffer->GetSize();
-
-	vk::CmdCopyBuffer(vk::g_vulkanContext.m_mainCommandBuffer, m_staggingBuffer->Get(), m_paramsBuffer->Get(), 1, &region);
-
-	EndDebugMarker("VegetationCopyBuffers");
-}
-
-void VegetationRenderer::CreateBuffers()
-{
-	TRAP(!m_plants.empty() && "Heeey maybe put some plants you dumb fuck");
-
-	if (m_plants.empty())
-		return;
-
-	VkDeviceSize totalSize = m_plants.size() * sizeof(PlantDescription);
-	m_staggingBuffer = MemoryManager::GetInstance()->CreateBuffer(EMemoryContextType::StagginBuffer, totalSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
-	m_paramsBuffer = MemoryManager::GetInstance()->CreateBuffer(EMemoryContextType::DeviceLocalBuffer, totalSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
-
-	bool wasMemMapped = MemoryManager::GetInstance()->IsMemoryMapped(EMemoryContextType::StagginBuffer);
-	if (!wasMemMapped)
-		MemoryManager::GetInstance()->MapMemoryContext(EMemoryContextType::StagginBuffer);
-
-	PlantDescription* memPtr = m_staggingBuffer->GetPtr<PlantDescription*>();
-	memcpy(memPtr, m_plants.data(), totalSize);
-
-	if (!wasMemMapped)
-		MemoryManager::GetInstance()->UnmapMemoryContext(EMemoryContextType::StagginBuffer);
-
-}
-
 void VegetationRenderer::CreateBuffers2()
 {
 	TRAP(!m_plants.empty() && "Heeey maybe put some plants you dumb fuck");
@@ -36,11 +36,9 @@ private:
 	void UpdateGraphicInterface() override;
 
 	void GenerateVegetation();
-	void CreateBuffers();
 	void CreateBuffers2();
 
 	void UpdateTextures();
-	void CopyBuffers();
 
 	void WindVariation();
 
@@ -59,7 +57,6 @@ private:
 	} m_globals;
 
 	CGraphicPipeline				m_renderPipeline;
-	BufferHandle*					m_staggingBuffer;
 	BufferHandle*					m_paramsBuffer;
 
 	DescriptorSetLayout				m_renderDescSetLayout;
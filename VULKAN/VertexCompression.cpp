@@ -0,0 +1,105 @@
+#include "VertexCompression.h"
+
+#include "glm/gtc/packing.hpp"
+
+//maps the unit sphere to the [-1, 1] square: the upper half on the inner diamond, the lower half folded on the corners
+static glm::vec2 OctahedralEncode(const glm::vec3& n)
+{
+	float length = glm::abs(n.x) + glm::abs(n.y) + glm::abs(n.z);
+	if (length == 0.0f)
+		return glm::vec2(0.0f);
+
+	glm::vec3 p = n / length;
+	glm::vec2 e(p.x, p.y);
+	if (p.z < 0.0f)
+	{
+		glm::vec2 signs(e.x >= 0.0f ? 1.0f : -1.0f, e.y >= 0.0f ? 1.0f : -1.0f);
+		e = (1.0f - glm::abs(glm::vec2(e.y, e.x))) * signs;
+	}
+	return e;
+}
+
+//same as OctahedralDecode in VertexUtils.h.spv
+static glm::vec3 OctahedralDecode(const glm::vec2& e)
+{
+	glm::vec3 n(e.x, e.y, 1.0f - glm::abs(e.x) - glm::abs(e.y));
+	float t = glm::max(-n.z, 0.0f);
+	n.x += (n.x >= 0.0f) ? -t : t;
+	n.y += (n.y >= 0.0f) ? -t : t;
+	return glm::normalize(n);
+}
+
+static int16_t PackSnorm(float v)
+{
+	return (int16_t)glm::round(glm::clamp(v, -1.0f, 1.0f) * 32767.0f);
+}
+
+static float UnpackSnorm(int16_t v)
+{
+	return glm::max(v / 32767.0f, -1.0f);
+}
+
+void CompressVertexes(const std::vector<SVertex>& vertexes, std::vector<SCompactVertex>& outVertexes, glm::vec3& outBoundsMin, glm::vec3& outBoundsMax)
+{
+	outBoundsMin = outBoundsMax = glm::vec3(0.0f);
+	if (!vertexes.empty())
+		outBoundsMin = outBoundsMax = vertexes[0].pos;
+
+	for (const auto& vertex : vertexes)
+	{
+		outBoundsMin = glm::min(outBoundsMin, vertex.pos);
+		outBoundsMax = glm::max(outBoundsMax, vertex.pos);
+	}
+
+	//a flat axis is quantized to 0
+	glm::vec3 extent = outBoundsMax - outBoundsMin;
+	glm::vec3 invExtent(extent.x > 0.0f ? 1.0f / extent.x : 0.0f, extent.y > 0.0f ? 1.0f / extent.y : 0.0f, extent.z > 0.0f ? 1.0f / extent.z : 0.0f);
+
+	outVertexes.resize(vertexes.size());
+	for (size_t i = 0; i < vertexes.size(); ++i)
+	{
+		const SVertex& vertex = vertexes[i];
+		SCompactVertex& compact = outVertexes[i];
+
+		glm::vec3 quantPos = glm::round(glm::clamp((vertex.pos - outBoundsMin) * invExtent, 0.0f, 1.0f) * 65535.0f);
+		compact.pos[0] = (uint16_t)quantPos.x;
+		compact.pos[1] = (uint16_t)quantPos.y;
+		compact.pos[2] = (uint16_t)quantPos.z;
+		compact.pos[3] = (glm::dot(glm::cross(vertex.normal, vertex.tangent), vertex.bitangent) < 0.0f) ? 0 : 0xFFFF;
+
+		uint32_t uv = glm::packHalf2x16(vertex.uv);
+		compact.uv[0] = (uint16_t)(uv & 0xFFFF);
+		compact.uv[1] = (uint16_t)(uv >> 16);
+
+		glm::vec2 normal = OctahedralEncode(vertex.normal);
+		compact.normal[0] = PackSnorm(normal.x);
+		compact.normal[1] = PackSnorm(normal.y);
+
+		glm::vec2 tangent = OctahedralEncode(vertex.tangent);
+		compact.tangent[0] = PackSnorm(tangent.x);
+		compact.tangent[1] = PackSnorm(tangent.y);
+
+		compact.color = vertex.color;
+	}
+}
+
+void DecompressVertexes(const std::vector<SCompactVertex>& vertexes, const glm::vec3& boundsMin, const glm::vec3& boundsMax, std::vector<SVertex>& outVertexes)
+{
+	glm::vec3 extent = boundsMax - boundsMin;
+
+	outVertexes.resize(vertexes.size());
+	for (size_t i = 0; i < vertexes.size(); ++i)
+	{
+		const SCompactVertex& compact = vertexes[i];
+		SVertex& vertex = outVertexes[i];
+
+		vertex.pos = boundsMin + glm::vec3(compact.pos[0], compact.pos[1], compact.pos[2]) / 65535.0f * extent;
+		vertex.uv = glm::unpackHalf2x16(uint32_t(compact.uv[0]) | (uint32_t(compact.uv[1]) << 16));
+		vertex.normal = OctahedralDecode(glm::vec2(UnpackSnorm(compact.normal[0]), UnpackSnorm(compact.normal[1])));
+		vertex.tangent = OctahedralDecode(glm::vec2(UnpackSnorm(compact.tangent[0]), UnpackSnorm(compact.tangent[1])));
+
+		float bitangentSign = (compact.pos[3] == 0) ? -1.0f : 1.0f;
+		vertex.bitangent = glm::cross(vertex.normal, vertex.tangent) * bitangentSign;
+		vertex.color = compact.color;
+	}
+}
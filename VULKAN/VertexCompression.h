@@ -0,0 +1,28 @@
+#pragma once
+
+#include <vector>
+
+#include "SVertex.h"
+
+//"MBC1". The compact .mb files start with this header, followed by the SCompactVertex array and the indices.
+//The old files start with the vertex count written as text, so they can still be told apart
+static const uint32_t COMPACT_MESH_MAGIC = 0x3143424D;
+//"MBC2". A MBC1 file (indexCount is the index count of LOD 0) followed by the LOD chain: the count of the other LODs,
+//their index counts and their indices. All the LODs index the same vertexes
+static const uint32_t COMPACT_MESH_LOD_MAGIC = 0x3243424D;
+
+struct SCompactMeshHeader
+{
+	uint32_t	magic;
+	uint32_t	vertexCount;
+	uint32_t	indexCount;
+	glm::vec3	boundsMin; //the positions are quantized relative to these bounds
+	glm::vec3	boundsMax;
+};
+
+//The positions are quantized to 16 bits in the bounds of the mesh, the uvs are converted to half floats and the normal
+//and the tangent are octahedral encoded in 2 x 16 bits. The bitangent is rebuilt from them and the sign stored in pos.w.
+//The vertex shaders decode them with the functions in VertexUtils.h.spv
+void CompressVertexes(const std::vector<SVertex>& vertexes, std::vector<SCompactVertex>& outVertexes, glm::vec3& outBoundsMin, glm::vec3& outBoundsMax);
+//for the meshes that are not batched, the other pipelines use SVertex
+void DecompressVertexes(const std::vector<SCompactVertex>& vertexes, const glm::vec3& boundsMin, const glm::vec3& boundsMax, std::vector<SVertex>& outVertexes);
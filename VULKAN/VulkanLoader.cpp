@@ -5,9 +5,16 @@
 #include <algorithm>
 #include <iostream>
 #include <cstdlib>
+#ifndef _WIN32
+#include <dlfcn.h>
+#endif
 
 namespace vk {
     SVUlkanContext      g_vulkanContext;
+    //no window, no surface and no swapchain. The validation layer is used only if it is installed
+    bool                ms_headless = false;
+    //the instance has VK_KHR_get_physical_device_properties2, the optional features can be queried
+    bool                ms_physicalDeviceProperties2 = false;
 
     PFN_vkCreateInstance CreateInstance;
     PFN_vkDestroyInstance DestroyInstance;
@@ -190,6 +197,7 @@ namespace vk {
     PFN_vkCreateDebugReportCallbackEXT CreateDebugReportCallbackEXT;
     PFN_vkDestroyDebugReportCallbackEXT DestroyDebugReportCallbackEXT;
     PFN_vkDebugReportMessageEXT DebugReportMessageEXT;
+    PFN_vkGetPhysicalDeviceFeatures2KHR GetPhysicalDeviceFeatures2KHR;
     
     PFN_vkCmdDebugMarkerBeginEXT CmdDebugMarkerBeginEXT;
     PFN_vkCmdDebugMarkerEndEXT CmdDebugMarkerEndEXT;
@@ -268,6 +276,7 @@ namespace vk {
         CreateDebugReportCallbackEXT = reinterpret_cast<PFN_vkCreateDebugReportCallbackEXT>(GetInstanceProcAddr(instance, "vkCreateDebugReportCallbackEXT"));
         DestroyDebugReportCallbackEXT = reinterpret_cast<PFN_vkDestroyDebugReportCallbackEXT>(GetInstanceProcAddr(instance, "vkDestroyDebugReportCallbackEXT"));
         DebugReportMessageEXT = reinterpret_cast<PFN_vkDebugReportMessageEXT>(GetInstanceProcAddr(instance, "vkDebugReportMessageEXT"));
+        GetPhysicalDeviceFeatures2KHR = reinterpret_cast<PFN_vkGetPhysicalDeviceFeatures2KHR>(GetInstanceProcAddr(instance, "vkGetPhysicalDeviceFeatures2KHR"));
 #ifdef VK_EXT_debug_marker
         CmdDebugMarkerBeginEXT = reinterpret_cast<PFN_vkCmdDebugMarkerBeginEXT>(GetInstanceProcAddr(instance, "vkCmdDebugMarkerBeginEXT"));
         CmdDebugMarkerEndEXT = reinterpret_cast<PFN_vkCmdDebugMarkerEndEXT>(GetInstanceProcAddr(instance, "vkCmdDebugMarkerEndEXT"));
@@ -435,8 +444,13 @@ namespace vk {
         extensions.resize(extCnt);
         EnumerateInstanceExtensionProperties(nullptr, &extCnt, extensions.data());
 
-        mandatoryExtensions.push_back(VK_KHR_WIN32_SURFACE_EXTENSION_NAME);
-        mandatoryExtensions.push_back(VK_KHR_SURFACE_EXTENSION_NAME);
+        if(!ms_headless)
+        {
+#ifdef VK_USE_PLATFORM_WIN32_KHR
+            mandatoryExtensions.push_back(VK_KHR_WIN32_SURFACE_EXTENSION_NAME);
+#endif
+            mandatoryExtensions.push_back(VK_KHR_SURFACE_EXTENSION_NAME);
+        }
         mandatoryExtensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
 
         for(unsigned int i = 0; i < mandatoryExtensions.size(); ++i)
@@ -453,6 +467,15 @@ namespace vk {
             }
         }
 
+        //optional, only to query the features of the extensions we can live without
+        auto properties2 = std::find_if(extensions.begin(), extensions.end(), [](VkExtensionProperties ext)
+        {
+            return (strcmp(ext.extensionName, VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME) == 0);
+        });
+        ms_physicalDeviceProperties2 = properties2 != extensions.end();
+        if(ms_physicalDeviceProperties2)
+            mandatoryExtensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+
         unsigned layersCnt;
         std::vector<VkLayerProperties> layers;
         EnumerateInstanceLayerProperties(&layersCnt, nullptr);
@@ -461,13 +484,30 @@ namespace vk {
 
         return true;
     }
+
+    bool HasValidationLayer()
+    {
+        uint32_t count = 0;
+        EnumerateInstanceLayerProperties(&count, nullptr);
+        std::vector<VkLayerProperties> layers(count);
+        EnumerateInstanceLayerProperties(&count, layers.data());
+
+        for(auto it = layers.begin(); it != layers.end(); ++it)
+            if(strcmp(it->layerName, "VK_LAYER_LUNARG_standard_validation") == 0)
+                return true;
+
+        return false;
+    }
+
     unsigned int ms_inst = 0;
     void InitInstance()
     {
         std::vector<const char*> mandatoryExtensions;
         CheckInstanceForNeededExtension(mandatoryExtensions);
 
-        std::vector<char*> layersName(1, "VK_LAYER_LUNARG_standard_validation");
+        std::vector<const char*> layersName;
+        if(!ms_headless || HasValidationLayer())
+            layersName.push_back("VK_LAYER_LUNARG_standard_validation");
         //layersName.push_back("VK_LAYER_RENDERDOC_Capture");
 
         VkInstanceCreateInfo instCrtInfo;
@@ -508,9 +548,37 @@ namespace vk {
         return queueIndex;
     }
 
+    //a family with transfer only (DMA engine) is preferred. Then one without graphics. Fallback to the graphic family
+    unsigned int GetTransferQueueFamilyIndex()
+    {
+        VkPhysicalDevice& physicalDevice = g_vulkanContext.m_physicalDevice;
+        std::vector<VkQueueFamilyProperties> queueProperties;
+        unsigned int queuePropCnt;
+        GetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queuePropCnt, nullptr);
+        queueProperties.resize(queuePropCnt);
+        GetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queuePropCnt, queueProperties.data());
+
+        unsigned int queueIndex = ~0;
+        for(unsigned int i = 0; i < queueProperties.size(); ++i)
+        {
+            VkQueueFlags flags = queueProperties[i].queueFlags;
+            if((flags & VK_QUEUE_TRANSFER_BIT) == 0 || (flags & VK_QUEUE_GRAPHICS_BIT) != 0)
+                continue;
+
+            if((flags & VK_QUEUE_COMPUTE_BIT) == 0)
+                return i;
+
+            if(queueIndex == ~0u)
+                queueIndex = i;
+        }
+
+        return (queueIndex != ~0u) ? queueIndex : g_vulkanContext.m_queueFamilyIndex;
+    }
+
     bool CheckDeviceExtentions(std::vector<const char*>& deviceMandatoryExt)
     {
-        deviceMandatoryExt.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+        if(!ms_headless)
+            deviceMandatoryExt.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
         //deviceMandatoryExt.push_back(VK_EXT_DEBUG_MARKER_EXTENSION_NAME);
 		deviceMandatoryExt.push_back("VK_KHR_shader_draw_parameters");
 		
@@ -543,13 +611,68 @@ namespace vk {
         return true;
     }
 
+    //bindless textures for the materials. If something is missing the batches use a small texture array each
+    bool CheckDescriptorIndexing(std::vector<const char*>& deviceExt, VkPhysicalDeviceDescriptorIndexingFeaturesEXT& outEnabledFeatures)
+    {
+        if(!ms_physicalDeviceProperties2 || !GetPhysicalDeviceFeatures2KHR)
+            return false;
+
+        std::vector<VkExtensionProperties> deviceExtProperties;
+        unsigned int devExtCnt;
+        EnumerateDeviceExtensionProperties(g_vulkanContext.m_physicalDevice, nullptr, &devExtCnt, nullptr);
+        deviceExtProperties.resize(devExtCnt);
+        EnumerateDeviceExtensionProperties(g_vulkanContext.m_physicalDevice, nullptr, &devExtCnt, deviceExtProperties.data());
+
+        const char* neededExt[] = { VK_KHR_MAINTENANCE3_EXTENSION_NAME, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME };
+        for(auto extName : neededExt)
+        {
+            auto found = std::find_if(deviceExtProperties.begin(), deviceExtProperties.end(), [&](VkExtensionProperties ext)
+            {
+                return (strcmp(ext.extensionName, extName) == 0);
+            });
+
+            if(found == deviceExtProperties.end())
+                return false;
+        }
+
+        VkPhysicalDeviceDescriptorIndexingFeaturesEXT supported;
+        cleanStructure(supported);
+        supported.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+
+        VkPhysicalDeviceFeatures2 features;
+        cleanStructure(features);
+        features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features.pNext = &supported;
+        GetPhysicalDeviceFeatures2KHR(g_vulkanContext.m_physicalDevice, &features);
+
+        //new textures are written in the array while the older frames still use it
+        if(!supported.shaderSampledImageArrayNonUniformIndexing || !supported.runtimeDescriptorArray || 
+            !supported.descriptorBindingPartiallyBound || !supported.descriptorBindingUpdateUnusedWhilePending)
+            return false;
+
+        cleanStructure(outEnabledFeatures);
+        outEnabledFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+        outEnabledFeatures.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+        outEnabledFeatures.runtimeDescriptorArray = VK_TRUE;
+        outEnabledFeatures.descriptorBindingPartiallyBound = VK_TRUE;
+        outEnabledFeatures.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+
+        for(auto extName : neededExt)
+            deviceExt.push_back(extName);
+
+        return true;
+    }
+
     void InitDevice()
     {
         VkInstance& instance = g_vulkanContext.m_instance;
         unsigned int physDevCnt;
         EnumeratePhysicalDevices(instance, &physDevCnt, nullptr);
 
-        TRAP(physDevCnt == 1); //just a fast working version. if the machine has multiple devices we have get the right one
+        //just a fast working version. if the machine has multiple devices we have get the right one.
+        //Headless takes the first one, select the driver with VK_ICD_FILENAMES (ex: lavapipe)
+        TRAP(physDevCnt == 1 || (ms_headless && physDevCnt > 0));
+        physDevCnt = 1;
         EnumeratePhysicalDevices(instance, &physDevCnt, &g_vulkanContext.m_physicalDevice);
         
         VkPhysicalDevice& physicalDevice = g_vulkanContext.m_physicalDevice;
@@ -561,31 +684,45 @@ namespace vk {
 
         VkPhysicalDeviceFeatures devFeatures;
         GetPhysicalDeviceFeatures(physicalDevice, &devFeatures);
+        g_vulkanContext.m_features = devFeatures;
 
         std::vector<const char*> deviceMandatoryExt;
         //deviceMandatoryExt.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
         g_vulkanContext.m_queueFamilyIndex = GetQueueFamilyIndex();
         TRAP(g_vulkanContext.m_queueFamilyIndex != ~0);
         CheckDeviceExtentions(deviceMandatoryExt);
-        TRAP(GetPhysicalDeviceWin32PresentationSupportKHR(physicalDevice, g_vulkanContext.m_queueFamilyIndex) == VK_TRUE); //supports win32 surface?  
+
+        VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures;
+        g_vulkanContext.m_descriptorIndexing = CheckDescriptorIndexing(deviceMandatoryExt, indexingFeatures);
+#ifdef VK_USE_PLATFORM_WIN32_KHR
+        if(!ms_headless)
+            TRAP(GetPhysicalDeviceWin32PresentationSupportKHR(physicalDevice, g_vulkanContext.m_queueFamilyIndex) == VK_TRUE); //supports win32 surface?  
+#endif
+
+        g_vulkanContext.m_transferQueueFamilyIndex = GetTransferQueueFamilyIndex();
 
         float queuePriority = 0.0f;
-        VkDeviceQueueCreateInfo devQueueCrtInfo;
+        VkDeviceQueueCreateInfo devQueueCrtInfo[2];
         cleanStructure(devQueueCrtInfo);
-        devQueueCrtInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-        devQueueCrtInfo.pNext = nullptr;
-        devQueueCrtInfo.flags = 0;
-        devQueueCrtInfo.queueFamilyIndex = g_vulkanContext.m_queueFamilyIndex;
-        devQueueCrtInfo.queueCount = 1;
-        devQueueCrtInfo.pQueuePriorities = &queuePriority;
+        for(unsigned int i = 0; i < 2; ++i)
+        {
+            devQueueCrtInfo[i].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+            devQueueCrtInfo[i].pNext = nullptr;
+            devQueueCrtInfo[i].flags = 0;
+            devQueueCrtInfo[i].queueCount = 1;
+            devQueueCrtInfo[i].pQueuePriorities = &queuePriority;
+        }
+        devQueueCrtInfo[0].queueFamilyIndex = g_vulkanContext.m_queueFamilyIndex;
+        devQueueCrtInfo[1].queueFamilyIndex = g_vulkanContext.m_transferQueueFamilyIndex;
+        unsigned int queueCrtInfoCnt = (g_vulkanContext.m_transferQueueFamilyIndex != g_vulkanContext.m_queueFamilyIndex) ? 2 : 1;
 
         VkDeviceCreateInfo devCrtInfo;
         cleanStructure(devCrtInfo);
         devCrtInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-        devCrtInfo.pNext = nullptr;
+        devCrtInfo.pNext = (g_vulkanContext.m_descriptorIndexing) ? &indexingFeatures : nullptr;
         devCrtInfo.flags = 0;
-        devCrtInfo.queueCreateInfoCount = 1;
-        devCrtInfo.pQueueCreateInfos = &devQueueCrtInfo;
+        devCrtInfo.queueCreateInfoCount = queueCrtInfoCnt;
+        devCrtInfo.pQueueCreateInfos = devQueueCrtInfo;
         devCrtInfo.enabledLayerCount = 0;
         devCrtInfo.ppEnabledLayerNames = nullptr;
         devCrtInfo.enabledExtensionCount = (unsigned int)deviceMandatoryExt.size();
@@ -611,29 +748,20 @@ namespace vk {
         std::string typeStr = (isError)? "Error " : "Warning ";
         typeStr += msg;
         typeStr += "\n";
+#ifdef _WIN32
         OutputDebugString(typeStr.data());
+#else
+        std::cerr << typeStr;
+#endif
         TRAP(!isError);
         return false;
     }
 
     void RegisterDebugInfo()
     {
-        std::vector<VkLayerProperties> layer_props;
-        uint32_t count = 0;
-        vk::EnumerateInstanceLayerProperties(&count, nullptr);
-
-        layer_props.resize(count);
-        EnumerateInstanceLayerProperties(&count, layer_props.data());
-
-        bool ok = false;
-        for(auto it = layer_props.begin(); it != layer_props.end(); ++it)
-        {
-            if(strcmp(it->layerName, "VK_LAYER_LUNARG_standard_validation") == 0)
-            {
-                ok = true;
-                break;
-            }
-        }
+        bool ok = HasValidationLayer();
+        if(ms_headless && !ok)
+            return;
 
         TRAP(ok);
 
@@ -650,8 +778,10 @@ namespace vk {
             &debug_report_info, nullptr, &g_vulkanContext.m_debugReport));
     }
 
-    void Load()
+    void Load(bool headless)
     {
+        ms_headless = headless;
+#ifdef _WIN32
         const char library[] = "vulkan-1.dll";
         const char renderDoc[] = "renderdoc.dll";
 
@@ -660,6 +790,12 @@ namespace vk {
        
         
         GetInstanceProcAddr = reinterpret_cast<PFN_vkGetInstanceProcAddr>(GetProcAddress(vulkanDll, "vkGetInstanceProcAddr"));
+#else
+        void* vulkanLib = dlopen("libvulkan.so.1", RTLD_NOW | RTLD_LOCAL);
+        TRAP(vulkanLib);
+
+        GetInstanceProcAddr = reinterpret_cast<PFN_vkGetInstanceProcAddr>(dlsym(vulkanLib, "vkGetInstanceProcAddr"));
+#endif
         TRAP(GetInstanceProcAddr)
         //init instance
 
@@ -676,7 +812,8 @@ namespace vk {
 
     void Unload()
     {
-        DestroyDebugReportCallbackEXT(g_vulkanContext.m_instance, g_vulkanContext.m_debugReport, nullptr);
+        if(g_vulkanContext.m_debugReport != VK_NULL_HANDLE)
+            DestroyDebugReportCallbackEXT(g_vulkanContext.m_instance, g_vulkanContext.m_debugReport, nullptr);
         DestroyDevice(g_vulkanContext.m_device, nullptr);
         DestroyInstance(g_vulkanContext.m_instance, nullptr);
     }
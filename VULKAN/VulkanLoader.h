@@ -11,10 +11,13 @@ namespace vk {
             : m_device(VK_NULL_HANDLE)
             , m_physicalDevice(VK_NULL_HANDLE)
             , m_instance(VK_NULL_HANDLE)
-            , m_queueFamilyIndex(~0)
             , m_debugReport(VK_NULL_HANDLE)
             , m_mainCommandBuffer(VK_NULL_HANDLE)
             , m_graphicQueue(VK_NULL_HANDLE)
+            , m_transferQueue(VK_NULL_HANDLE)
+            , m_queueFamilyIndex(~0)
+            , m_transferQueueFamilyIndex(~0)
+            , m_descriptorIndexing(false)
         {
         }
 
@@ -22,12 +25,16 @@ namespace vk {
         VkPhysicalDevice					m_physicalDevice;
         VkInstance							m_instance;
         VkPhysicalDeviceLimits				m_limits;
+        VkPhysicalDeviceFeatures			m_features; //the enabled ones, all that the device supports
         VkPhysicalDeviceMemoryProperties	m_memProperties;
         VkDebugReportCallbackEXT			m_debugReport;
         VkCommandBuffer                     m_mainCommandBuffer;
         VkQueue                             m_graphicQueue;
+        VkQueue                             m_transferQueue; //same as m_graphicQueue if the device has no dedicated transfer queue
 
         unsigned int                        m_queueFamilyIndex;
+        unsigned int                        m_transferQueueFamilyIndex;
+        bool                                m_descriptorIndexing; //VK_EXT_descriptor_indexing, partially bound texture arrays indexed per instance
 
         static unsigned int     GetMemTypeIndex(uint32_t bitsType, VkFlags reqMask =  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT); 
 
@@ -239,6 +246,9 @@ namespace vk {
     extern PFN_vkDestroyDebugReportCallbackEXT DestroyDebugReportCallbackEXT;
     extern PFN_vkDebugReportMessageEXT DebugReportMessageEXT;
 
+    // VK_KHR_get_physical_device_properties2
+    extern PFN_vkGetPhysicalDeviceFeatures2KHR GetPhysicalDeviceFeatures2KHR;
+
     //VK_EXT_debug_marker
     extern PFN_vkCmdDebugMarkerBeginEXT CmdDebugMarkerBeginEXT;
     extern PFN_vkCmdDebugMarkerEndEXT CmdDebugMarkerEndEXT;
@@ -246,7 +256,8 @@ namespace vk {
     extern PFN_vkDebugMarkerSetObjectNameEXT DebugMarkerSetObjectNameEXT;
     extern PFN_vkDebugMarkerSetObjectTagEXT DebugMarkerSetObjectTagEXT;
 
-    void Load();
+    //headless creates no surface and no swapchain, for offscreen rendering
+    void Load(bool headless = false);
     void Unload();
 
 }; // namespace vk
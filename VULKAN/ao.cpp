@@ -34,13 +34,13 @@ enum Bindings
 
 CAORenderer::CAORenderer(VkRenderPass renderPass)
     : CRenderer(renderPass, "AmbientOcclussionRenderPass")
-    , m_quad(nullptr)
     , m_constParamsBuffer(nullptr)
-    , m_varParamsBuffer(nullptr)
+    , m_varParamsOffset(FrameAllocator::InvalidOffset)
     , m_sampler(VK_NULL_HANDLE)
     , m_constDescSetLayout(VK_NULL_HANDLE)
     , m_varDescSetLayout(VK_NULL_HANDLE)
     , m_blurDescSetLayout(VK_NULL_HANDLE)
+    , m_quad(nullptr)
 {
 }
 
@@ -48,7 +48,7 @@ CAORenderer::~CAORenderer()
 {
     VkDevice dev = vk::g_vulkanContext.m_device;
 
-	MemoryManager::GetInstance()->FreeHandle(m_constParamsBuffer->GetRootParent()); //free the parrent buffer, that frees the memory for varParamBuffer too
+	MemoryManager::GetInstance()->FreeHandle(m_constParamsBuffer);
 
 
     vk::DestroySampler(dev, m_sampler, nullptr);
@@ -66,12 +66,8 @@ void CAORenderer::Init()
 
     AllocDescriptors();
 
-	//Alloc Memory
-	{
-		BufferHandle* bigBuffer = MemoryManager::GetInstance()->CreateBuffer(EMemoryContextType::UniformBuffers, { sizeof(SSAOConstParams), sizeof(SSAOVarParams) }, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
-		m_constParamsBuffer = bigBuffer->CreateSubbuffer(sizeof(SSAOConstParams));
-		m_varParamsBuffer = bigBuffer->CreateSubbuffer(sizeof(SSAOVarParams));
-	}
+	//the varying params are in the frame allocator
+	m_constParamsBuffer = MemoryManager::GetInstance()->CreateBuffer(EMemoryContextType::UniformBuffers, sizeof(SSAOConstParams), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
 
 
     InitSSAOParams();
@@ -123,11 +119,15 @@ void CAORenderer::Render()
     StartRenderPass();
     VkCommandBuffer cmdBuff = vk::g_vulkanContext.m_mainCommandBuffer;
 
-    BeginMarkerSection("ResolveAO");
-    vk::CmdBindPipeline(cmdBuff, m_mainPipeline.GetBindPoint(), m_mainPipeline.Get());
-    vk::CmdBindDescriptorSets(cmdBuff, m_mainPipeline.GetBindPoint(), m_mainPipeline.GetLayout(), 0, (uint32_t)m_mainPassSets.size(), m_mainPassSets.data(), 0, nullptr);
-    m_quad->Render();
-    EndMarkerSection();
+    //only cleared if the frame allocator had no room for the parameters
+    if (m_varParamsOffset != FrameAllocator::InvalidOffset)
+    {
+        BeginMarkerSection("ResolveAO");
+        vk::CmdBindPipeline(cmdBuff, m_mainPipeline.GetBindPoint(), m_mainPipeline.Get());
+        vk::CmdBindDescriptorSets(cmdBuff, m_mainPipeline.GetBindPoint(), m_mainPipeline.GetLayout(), 0, (uint32_t)m_mainPassSets.size(), m_mainPassSets.data(), 1, &m_varParamsOffset);
+        m_quad->Render();
+        EndMarkerSection();
+    }
 
     BeginMarkerSection("BlurHorizontal");
     vk::CmdNextSubpass(cmdBuff, VK_SUBPASS_CONTENTS_INLINE);
@@ -169,7 +169,7 @@ void CAORenderer::UpdateGraphicInterface()
     depthImgInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 
     VkDescriptorBufferInfo constBuffInfo = m_constParamsBuffer->GetDescriptor();
-    VkDescriptorBufferInfo varBuffInfo = m_varParamsBuffer->GetDescriptor();
+    VkDescriptorBufferInfo varBuffInfo = MemoryManager::GetInstance()->GetFrameAllocator()->GetDescriptor(sizeof(SSAOVarParams));
     VkDescriptorImageInfo blurImgInfo;
     blurImgInfo.sampler = m_sampler;
     blurImgInfo.imageView =  m_framebuffer->GetColorImageView(0);
@@ -184,7 +184,7 @@ void CAORenderer::UpdateGraphicInterface()
     wDescSets.push_back(InitUpdateDescriptor(m_mainPassSets[0], Bindings_Positions, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &positionsImgInfo));
     wDescSets.push_back(InitUpdateDescriptor(m_mainPassSets[0], Bindings_Depth, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &depthImgInfo));
     wDescSets.push_back(InitUpdateDescriptor(m_mainPassSets[0], Bindings_Uniform, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, &constBuffInfo));
-    wDescSets.push_back(InitUpdateDescriptor(m_mainPassSets[1], 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, &varBuffInfo));
+    wDescSets.push_back(InitUpdateDescriptor(m_mainPassSets[1], 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, &varBuffInfo));
     wDescSets.push_back(InitUpdateDescriptor(m_blurPassSets[0], 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &blurImgInfo));
     wDescSets.push_back(InitUpdateDescriptor(m_blurPassSets[1], 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &blurImgInfo2));
 
@@ -212,7 +212,7 @@ void CAORenderer::CreateDescriptorSetLayout()
 
     //this is reserved for varying params
     {
-        VkDescriptorSetLayoutBinding binding = CreateDescriptorBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT);
+        VkDescriptorSetLayoutBinding binding = CreateDescriptorBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_FRAGMENT_BIT);
 
         VkDescriptorSetLayoutCreateInfo crtInfo;
         cleanStructure(crtInfo);
@@ -242,7 +242,8 @@ void CAORenderer::CreateDescriptorSetLayout()
 void CAORenderer::PopulatePoolInfo(std::vector<VkDescriptorPoolSize>& poolSize, unsigned int& maxSets)
 {
     AddDescriptorType(poolSize, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 5);
-    AddDescriptorType(poolSize, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2);
+    AddDescriptorType(poolSize, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1);
+    AddDescriptorType(poolSize, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1);
     maxSets = 4;
 }
 
@@ -312,7 +313,15 @@ void CAORenderer::AllocDescriptors()
      PerspectiveMatrix(projMat);
      ConvertToProjMatrix(projMat);
 
-	 SSAOVarParams* params = m_varParamsBuffer->GetPtr<SSAOVarParams*>();
+	 FrameAllocator::Allocation paramsAlloc;
+	 if (!MemoryManager::GetInstance()->GetFrameAllocator()->Allocate(sizeof(SSAOVarParams), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, paramsAlloc))
+	 {
+		 m_varParamsOffset = FrameAllocator::InvalidOffset;
+		 return;
+	 }
+	 m_varParamsOffset = paramsAlloc.m_offset;
+
+	 SSAOVarParams* params = (SSAOVarParams*)paramsAlloc.m_ptr;
      params->ProjMatrix = projMat;
      params->ViewMatrix = ms_camera.GetViewMatrix();
  }
\ No newline at end of file
@@ -40,7 +40,7 @@ protected:
 private:
     //buffers
     BufferHandle*           m_constParamsBuffer;
-	BufferHandle*           m_varParamsBuffer;
+	uint32_t                m_varParamsOffset; //dynamic offset in the frame allocator
 
     VkSampler               m_sampler;
 
@@ -1,5 +1,10 @@
 #pragma once
+#ifdef _WIN32
 #include <intrin.h>
+#else
+#define __debugbreak() __builtin_trap()
+#endif
+#include <cstring>
 
 #define TRAP(cond) { \
         if(!(cond)) \
@@ -27,4 +32,17 @@
 #define MSGSHADERCOMPILED 1
 
 #define BATCH_MAX_TEXTURE 12
+//objects of a batch. The batches are culled and sorted on CPU, fewer objects make their bounds tighter
+#define BATCH_MAX_OBJECTS 256
+//size of the texture array of a material template when the device has descriptor indexing (capped by the device limits)
+#define BINDLESS_MAX_TEXTURE 4096
+//materials of a material template, their parameters are in one table indexed with the material index
+#define MATERIAL_TABLE_SIZE 16384
+
+//initial size of the geometry pool, it grows when a mesh doesn't fit
+#define GEOMETRY_POOL_VERTICES (1 << 20)
+#define GEOMETRY_POOL_INDICES (4 << 20)
+
+//every frame in flight has its own command buffer, sync objects and copy of the per frame data. Use 2 or 3
+#define FRAMES_IN_FLIGHT 2
 #define DEFAULT_MIPLEVELS 5
@@ -5,7 +5,9 @@
 
 #include "VulkanLoader.h"
 #include "defines.h"
+#ifdef _WIN32
 #include <windowsx.h>
+#endif
 #include <cstdio>
 #include <functional>
 #include <vector>
@@ -40,7 +42,13 @@
 #include "TerrainRenderer.h"
 #include "VegetationRenderer.h"
 #include "Batch.h"
+#include "CommandRecorder.h"
 #include "Material.h"
+#include "ScatterUploader.h"
+#include "PipelineCache.h"
+#include "TransferQueue.h"
+#include "QueryManager.h"
+#include "Benchmark.h"
 #include "Scene.h"
 #include "TestRenderer.h"
 
@@ -71,133 +79,6 @@ void CleanUp()
     delete cube;
 }
 
-class QueryManager
-{
-public:
-    static QueryManager& GetInstance()
-    {
-        static QueryManager instance;
-        return instance;
-    }
-     
-public:
-    QueryManager()
-        : m_queryBuffer(VK_NULL_HANDLE)
-        , m_queryMemory(VK_NULL_HANDLE)
-        , m_queryBufferPtr(nullptr)
-        , m_bufferSize(256)
-        , m_occlusionQueryPool(VK_NULL_HANDLE)
-        , m_statisticsQueryPool(VK_NULL_HANDLE)
-        , m_registerQueries(0)
-    {
-        VkDevice device = vk::g_vulkanContext.m_device;
-
-        VkQueryPipelineStatisticFlags  pipeStatsFlags = VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT;
-        std::bitset<32> bitSet (pipeStatsFlags);
-        m_statsQueryNum = (uint32_t)bitSet.count();
-
-        uint32_t stride = 2 * sizeof(uint32_t);
-        m_occlusionQueryOffset = stride * m_statsQueryNum;
-        m_maxQueries = (m_bufferSize - stride * m_statsQueryNum ) / stride;
-
-        VkQueryPoolCreateInfo queryPoolInfo;
-        cleanStructure(queryPoolInfo);
-        queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
-        queryPoolInfo.pNext = nullptr;
-        queryPoolInfo.pipelineStatistics = pipeStatsFlags;
-        queryPoolInfo.queryCount =  1;
-        queryPoolInfo.flags = 0;
-        queryPoolInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
-        VULKAN_ASSERT(vk::CreateQueryPool(device, &queryPoolInfo, nullptr, &m_statisticsQueryPool));
-
-        queryPoolInfo.queryType = VK_QUERY_TYPE_OCCLUSION;
-        queryPoolInfo.pipelineStatistics = 0;
-        queryPoolInfo.queryCount = m_maxQueries;
-        VULKAN_ASSERT(vk::CreateQueryPool(device, &queryPoolInfo, nullptr, &m_occlusionQueryPool));
-
-        AllocBufferMemory(m_queryBuffer, m_queryMemory, m_bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT);
-        VULKAN_ASSERT(vk::MapMemory(device,  m_queryMemory, 0, m_bufferSize, 0, &m_queryBufferPtr));
-    }
-
-    ~QueryManager()
-    {
-        //vk::UnmapMemory(vk::g_vulkanContext.m_device, m_queryMemory);
-    }
-
-    void Reset()
-    {
-        VkCommandBuffer cmdBuffer = vk::g_vulkanContext.m_mainCommandBuffer;
-        vk::CmdResetQueryPool(cmdBuffer, m_statisticsQueryPool, 0, m_statsQueryNum);
-        vk::CmdResetQueryPool(cmdBuffer, m_occlusionQueryPool, 0, m_registerQueries);
-
-        vk::CmdFillBuffer(cmdBuffer, m_queryBuffer, 0, m_bufferSize, 0);
-
-        m_registerQueries = 0;
-        m_canQuery = false;
-    }
-
-    uint32_t BeginQuery()
-    {
-        VkCommandBuffer cmdBuffer = vk::g_vulkanContext.m_mainCommandBuffer;
-        vk::CmdBeginQuery(cmdBuffer, m_occlusionQueryPool, m_registerQueries, 0);
-        ++m_registerQueries;
-    }
-
-    void EndQuery(uint32_t index)
-    {
-        VkCommandBuffer cmdBuffer = vk::g_vulkanContext.m_mainCommandBuffer;
-        vk::CmdEndQuery(cmdBuffer, m_occlusionQueryPool, index);
-    }
-
-    void GetQueries()
-    {
-        VkCommandBuffer cmdBuffer = vk::g_vulkanContext.m_mainCommandBuffer;
-
-        vk::CmdCopyQueryPoolResults(cmdBuffer, m_statisticsQueryPool, 0, m_statsQueryNum, m_queryBuffer, 0, 2 * sizeof(uint32_t), VK_QUERY_RESULT_WITH_AVAILABILITY_BIT | VK_QUERY_RESULT_WAIT_BIT );
-        vk::CmdCopyQueryPoolResults(cmdBuffer, m_occlusionQueryPool, 0, m_registerQueries, m_queryBuffer, m_occlusionQueryOffset, 2 * sizeof(uint32_t), VK_QUERY_RESULT_WITH_AVAILABILITY_BIT | VK_QUERY_RESULT_WAIT_BIT );
-        m_canQuery = true;
-    }
-
-    uint32_t GetResult(uint32_t index)
-    {
-        TRAP(m_canQuery);
-        uint32_t* occlusionPtr = (uint32_t*)((uint8_t*)m_queryBufferPtr + m_occlusionQueryOffset);
-        bool isAvailable = (*(occlusionPtr + index + 1) != 0);
-        TRAP(isAvailable);
-        return *(occlusionPtr + index);
-    }
-
-    void StartStatistics()
-    {
-        VkCommandBuffer cmdBuffer = vk::g_vulkanContext.m_mainCommandBuffer;
-        vk::CmdBeginQuery(cmdBuffer, m_statisticsQueryPool, 0, 0);
-    }
-
-    void EndStatistics()
-    {
-        VkCommandBuffer cmdBuffer = vk::g_vulkanContext.m_mainCommandBuffer;
-        vk::CmdEndQuery(cmdBuffer, m_statisticsQueryPool, 0);
-    }
-
-private:
-    VkBuffer        m_queryBuffer;
-    VkDeviceMemory  m_queryMemory;
-    void*           m_queryBufferPtr;
-
-    VkQueryPool     m_occlusionQueryPool;
-    VkQueryPool     m_statisticsQueryPool;
-
-    uint32_t        m_maxQueries;
-    uint32_t        m_registerQueries;
-    uint32_t        m_occlusionQueryOffset;
-    uint32_t        m_statsQueryNum;
-
-    const uint32_t  m_bufferSize;
-    bool            m_canQuery;
-};
-
-
-
 class ScreenshotManager
 {
 public:
@@ -307,9 +188,7 @@ public:
         
         time_t time = std::time(nullptr);
         unsigned int clampTime = (unsigned int)(0x0000000000FFFFFF & time);
-        char timeStr[15];
-        _itoa_s(clampTime, timeStr, 10);
-        std::string screenshotFName = std::string( "screenshot") +  std::string(timeStr ) +  std::string(".png");
+        std::string screenshotFName = std::string( "screenshot") +  std::to_string(clampTime) +  std::string(".png");
 
         //outImg = FreeImage_Rotate(outImg, 0);
         FreeImage_FlipVertical(outImg);
@@ -364,8 +243,8 @@ public:
     CLightRenderer(VkRenderPass renderPass)
         : CRenderer(renderPass, "LightRenderPass")
         , m_sampler(VK_NULL_HANDLE)
-        , m_shaderUniformBuffer(nullptr)
         , m_depthSampler(VK_NULL_HANDLE)
+        , m_paramsOffset(FrameAllocator::InvalidOffset)
         , m_descriptorSetLayout(VK_NULL_HANDLE)
         , m_descriptorSet(VK_NULL_HANDLE)
     {
@@ -375,7 +254,6 @@ public:
     {
         VkDevice dev = vk::g_vulkanContext.m_device;
         vk::DestroySampler(dev, m_sampler, nullptr);
-		MemoryManager::GetInstance()->FreeHandle(m_shaderUniformBuffer);
         vk::DestroyDescriptorSetLayout(dev, m_descriptorSetLayout, nullptr);
     }
 
@@ -396,17 +274,29 @@ public:
     {
         VkCommandBuffer cmdBuffer = vk::g_vulkanContext.m_mainCommandBuffer;
         StartRenderPass();
-        vk::CmdBindPipeline(cmdBuffer, m_pipeline.GetBindPoint(), m_pipeline.Get());
+        //only cleared if the frame allocator had no room for the parameters
+        if (m_paramsOffset != FrameAllocator::InvalidOffset)
+        {
+            vk::CmdBindPipeline(cmdBuffer, m_pipeline.GetBindPoint(), m_pipeline.Get());
 
-        vk::CmdBindDescriptorSets(cmdBuffer, m_pipeline.GetBindPoint(), m_pipeline.GetLayout(), 0, 1, &m_descriptorSet, 0, nullptr);
+            vk::CmdBindDescriptorSets(cmdBuffer, m_pipeline.GetBindPoint(), m_pipeline.GetLayout(), 0, 1, &m_descriptorSet, 1, &m_paramsOffset);
 
-        vk::CmdDraw(cmdBuffer, 4, 1, 0, 0);
+            vk::CmdDraw(cmdBuffer, 4, 1, 0, 0);
+        }
         EndRenderPass();
     }
 
 	void PreRender() override
     {
-        LightShaderParams* newParams = m_shaderUniformBuffer->GetPtr<LightShaderParams*>();
+        FrameAllocator::Allocation paramsAlloc;
+        if (!MemoryManager::GetInstance()->GetFrameAllocator()->Allocate(sizeof(LightShaderParams), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, paramsAlloc))
+        {
+            m_paramsOffset = FrameAllocator::InvalidOffset;
+            return;
+        }
+        m_paramsOffset = paramsAlloc.m_offset;
+
+        LightShaderParams* newParams = (LightShaderParams*)paramsAlloc.m_ptr;
         newParams->dirLight = directionalLight.GetDirection();
         newParams->cameraPos = glm::vec4(ms_camera.GetPos(), 1);
         newParams->lightIradiance = directionalLight.GetLightIradiance();
@@ -418,7 +308,7 @@ public:
         maxSets = 1;
 
         AddDescriptorType(poolSize, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, GBuffer_InputCnt + 2); //shadow map and aomap
-        AddDescriptorType(poolSize, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1);
+        AddDescriptorType(poolSize, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1);
     }
 
     virtual void Init() override
@@ -430,8 +320,6 @@ public:
 
         CreateNearestSampler(m_depthSampler);
 
-		m_shaderUniformBuffer = MemoryManager::GetInstance()->CreateBuffer(EMemoryContextType::UniformBuffers, sizeof(LightShaderParams), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
-
         m_pipeline.SetTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_FAN);
         m_pipeline.AddBlendState(CGraphicPipeline::CreateDefaultBlendState(), 2);
         m_pipeline.SetVertexShaderFile("light.vert");
@@ -478,8 +366,8 @@ protected:
         writeSets[0].descriptorCount = descSize; //this is a little risky. There is no array of sampler in shader. this just work
         writeSets[0].pImageInfo = imgInfo;
 
-        VkDescriptorBufferInfo buffInfo = m_shaderUniformBuffer->GetDescriptor();
-        writeSets[1] = InitUpdateDescriptor(m_descriptorSet, GBuffer_InputCnt, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, &buffInfo);
+        VkDescriptorBufferInfo buffInfo = MemoryManager::GetInstance()->GetFrameAllocator()->GetDescriptor(sizeof(LightShaderParams));
+        writeSets[1] = InitUpdateDescriptor(m_descriptorSet, GBuffer_InputCnt, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, &buffInfo);
 
         VkDescriptorImageInfo shadowMapDesc;
         shadowMapDesc.sampler = m_depthSampler;
@@ -508,7 +396,7 @@ protected:
         descCnt[GBuffer_Normals] = CreateDescriptorBinding(GBuffer_Normals, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
         descCnt[GBuffer_Position] = CreateDescriptorBinding(GBuffer_Position, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
         descCnt[GBuffer_Specular] = CreateDescriptorBinding(GBuffer_Specular, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
-        descCnt[GBuffer_InputCnt] = CreateDescriptorBinding(GBuffer_InputCnt, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT);
+        descCnt[GBuffer_InputCnt] = CreateDescriptorBinding(GBuffer_InputCnt, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_FRAGMENT_BIT);
 
         VkDescriptorSetLayoutBinding shadowMapDesc = CreateDescriptorBinding(GBuffer_InputCnt + 1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
         descCnt.push_back(shadowMapDesc);
@@ -531,7 +419,7 @@ protected:
     VkSampler                       m_sampler;
     VkSampler                       m_depthSampler;
 
-    BufferHandle*                   m_shaderUniformBuffer;
+    uint32_t                        m_paramsOffset; //dynamic offset in the frame allocator
 
     VkDescriptorSetLayout           m_descriptorSetLayout;
     VkDescriptorSet                 m_descriptorSet;
@@ -545,13 +433,13 @@ public:
     CSkyRenderer(VkRenderPass renderPass)
         : CRenderer(renderPass, "SkyRenderPass")
         , m_quadMesh(nullptr)
+        , m_boxParamsOffset(FrameAllocator::InvalidOffset)
         , m_skyTexture(nullptr)
-        , m_boxParamsBuffer(VK_NULL_HANDLE)
         , m_boxDescriptorSet(VK_NULL_HANDLE)
         , m_boxDescriptorSetLayout(VK_NULL_HANDLE)
-        , m_sampler(VK_NULL_HANDLE)
-        , m_sunDescriptorSet(VK_NULL_HANDLE)
         , m_sunDescriptorSetLayout(VK_NULL_HANDLE)
+        , m_sunDescriptorSet(VK_NULL_HANDLE)
+        , m_sampler(VK_NULL_HANDLE)
     {
     }
 
@@ -559,8 +447,6 @@ public:
     {
         VkDevice dev = vk::g_vulkanContext.m_device;
         vk::DestroyDescriptorSetLayout(dev, m_boxDescriptorSetLayout, nullptr);
-
-		MemoryManager::GetInstance()->FreeHandle(m_boxParamsBuffer);
     }
 
     virtual void Render()
@@ -570,9 +456,12 @@ public:
         StartRenderPass();
 
         BeginMarkerSection("SkyBox");
-        vk::CmdBindPipeline(cmdBuffer, m_boxPipeline.GetBindPoint(), m_boxPipeline.Get());
-        vk::CmdBindDescriptorSets(cmdBuffer, m_boxPipeline.GetBindPoint(), m_boxPipeline.GetLayout(), 0, 1, &m_boxDescriptorSet, 0, nullptr);
-        m_quadMesh->Render();
+        if (m_boxParamsOffset != FrameAllocator::InvalidOffset)
+        {
+            vk::CmdBindPipeline(cmdBuffer, m_boxPipeline.GetBindPoint(), m_boxPipeline.Get());
+            vk::CmdBindDescriptorSets(cmdBuffer, m_boxPipeline.GetBindPoint(), m_boxPipeline.GetLayout(), 0, 1, &m_boxDescriptorSet, 1, &m_boxParamsOffset);
+            m_quadMesh->Render();
+        }
         EndMarkerSection();
 
         BeginMarkerSection("BlendSun");
@@ -594,7 +483,6 @@ public:
         AllocDescriptorSets(m_descriptorPool, m_boxDescriptorSetLayout, &m_boxDescriptorSet);
         AllocDescriptorSets(m_descriptorPool, m_sunDescriptorSetLayout, &m_sunDescriptorSet);
 
-		m_boxParamsBuffer = MemoryManager::GetInstance()->CreateBuffer(EMemoryContextType::UniformBuffers, sizeof(SSkyParams), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
         m_quadMesh = CreateFullscreenQuad();
 
         m_boxPipeline.SetVertexShaderFile("skybox.vert");
@@ -651,7 +539,7 @@ private:
     
     virtual void PopulatePoolInfo(std::vector<VkDescriptorPoolSize>& poolSize, unsigned int& maxSets) override
     {
-        AddDescriptorType(poolSize, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1);
+        AddDescriptorType(poolSize, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1);
         AddDescriptorType(poolSize, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2);
 
         maxSets = 2;
@@ -661,7 +549,7 @@ private:
     {
         std::vector<VkDescriptorSetLayoutBinding> bindings;
         bindings.resize(2);
-        bindings[0] = CreateDescriptorBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT);
+        bindings[0] = CreateDescriptorBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_VERTEX_BIT);
         bindings[1] = CreateDescriptorBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
 
         VkDescriptorSetLayoutCreateInfo crtInfo;
@@ -688,7 +576,15 @@ private:
 
     void PreRender()
     {
-        SSkyParams* newParams = m_boxParamsBuffer->GetPtr<SSkyParams*>();
+        FrameAllocator::Allocation paramsAlloc;
+        if (!MemoryManager::GetInstance()->GetFrameAllocator()->Allocate(sizeof(SSkyParams), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, paramsAlloc))
+        {
+            m_boxParamsOffset = FrameAllocator::InvalidOffset;
+            return;
+        }
+        m_boxParamsOffset = paramsAlloc.m_offset;
+
+        SSkyParams* newParams = (SSkyParams*)paramsAlloc.m_ptr;
         newParams->CameraDir = glm::vec4(ms_camera.GetFrontVector(), 0.0f);
         newParams->CameraUp = glm::vec4(ms_camera.GetUpVector(), 0.0f);
         newParams->CameraRight = glm::vec4(ms_camera.GetRightVector(), 0.0f);
@@ -698,14 +594,14 @@ private:
 
     void UpdateDescriptors()
     {
-        VkDescriptorBufferInfo wBuffer = m_boxParamsBuffer->GetDescriptor();
+        VkDescriptorBufferInfo wBuffer = MemoryManager::GetInstance()->GetFrameAllocator()->GetDescriptor(sizeof(SSkyParams));
 
         //VkDescriptorImageInfo wImage = m_cubeMapText->GetCubeMapDescriptor();
         VkDescriptorImageInfo wImage = m_skyTexture->GetTextureDescriptor();
 
         std::vector<VkWriteDescriptorSet> writeDesc;
         writeDesc.resize(2);
-        writeDesc[0] = InitUpdateDescriptor(m_boxDescriptorSet, 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, &wBuffer); 
+        writeDesc[0] = InitUpdateDescriptor(m_boxDescriptorSet, 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, &wBuffer); 
         writeDesc[1] = InitUpdateDescriptor(m_boxDescriptorSet, 1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &wImage);
 
         vk::UpdateDescriptorSets(vk::g_vulkanContext.m_device, (uint32_t)writeDesc.size(), writeDesc.data(), 0, nullptr);
@@ -714,7 +610,7 @@ private:
 private:
     Mesh* m_quadMesh;
 
-    BufferHandle*       m_boxParamsBuffer;
+    uint32_t            m_boxParamsOffset; //dynamic offset in the frame allocator
 
     CTexture*           m_skyTexture;
     //CTexture*           m_sunTexture;
@@ -894,7 +790,8 @@ private:
 class CApplication
 {
 public:
-    CApplication();
+    //with benchmark settings the app runs headless: no window, no swapchain, and exits when the benchmark is done
+    CApplication(const BenchmarkSettings* benchmarkSettings = nullptr);
     virtual ~CApplication();
 
     void Run();
@@ -902,17 +799,25 @@ public:
     void SwapBuffers();
 
 	static float GetDeltaTime() { return ms_dt; }
+    bool IsHeadless() const { return m_benchmark != nullptr; }
 private:
+#ifdef _WIN32
+    //the window and the mouse are win32 only. Off Windows only the headless benchmark runs
     void InitWindow();
     void CenterCursor();
     void HideCursor(bool hide);
+    void CreateSurface();
+#endif
 
     VkImage GetFinalOutput();
     void TransferToPresentImage();
     void BeginFrame();
 
-    void CreateSurface();
     void CreateSwapChains();
+    //the window changed and the swapchain images don't match it anymore. Returns false if the window has no area (minimized)
+    bool RecreateSwapChain();
+    void CreateOffscreenImage();
+    void RunBenchmark();
 
     void SetupDeferredRendering();
     void SetupAORendering();
@@ -963,6 +868,9 @@ private:
 
     void StartCommandBuffer();
     void EndCommandBuffer();
+    void RecordFrameUploads();
+    void WaitForFrame(unsigned int frameIndex);
+    void WaitForAllFrames();
     //pipeline
     void GetQueue();
     void CreateSynchronizationHelpers();
@@ -972,6 +880,9 @@ private:
 	void RegisterSpecialInputListeners(); //TODO find a better solution at refactoring
 
     void CreateResources();
+    void Reset();
+
+#ifdef _WIN32
     void UpdateCameraRotation();
     static LRESULT CALLBACK WindowProc(
         HWND   hwnd,
@@ -980,15 +891,16 @@ private:
         LPARAM lParam
         );
 
-    void Reset();
-
     void ProcMsg(UINT uMsg, WPARAM wParam,LPARAM lParam);
+#endif
     //void TransferPickData();
     //window paramsm_
     const char* m_windowName;
     const char* m_windowClass;
+#ifdef _WIN32
     HWND        m_windowHandle;
     HINSTANCE   m_appInstance;
+#endif
     //rendering context
     VkSurfaceKHR                m_surface;
     VkSwapchainKHR              m_swapChain;
@@ -1015,16 +927,26 @@ private:
     VkQueue                     m_queue;
 
     VkCommandPool               m_commandPool;
-    VkCommandBuffer             m_mainCommandBuffer;
+    VkCommandBuffer             m_mainCommandBuffer; //command buffer of the current frame
 
     std::vector<VkImage>            m_presentImages;
+    VkExtent2D                      m_presentExtent;
+    bool                            m_isSwapChainSuboptimal; //recreated after the present
+    VkDeviceMemory                  m_offscreenMemory; //headless only, the single "present" image
 
     unsigned int                    m_currentBuffer;
 
-    //synchronization objects
-    VkFence                     m_aquireImageFence;
-    VkFence                     m_renderFence;
-    VkSemaphore                 m_renderSemaphore;
+    //everything a frame in flight needs for itself
+    struct FrameData
+    {
+        VkCommandBuffer         m_commandBuffer;
+        VkCommandBuffer         m_uploadCommandBuffer; //recorded after the frame, but executed before it
+        VkFence                 m_renderFence;
+        VkSemaphore             m_imageAcquiredSemaphore;
+        VkSemaphore             m_renderFinishedSemaphore;
+    };
+    std::array<FrameData, FRAMES_IN_FLIGHT> m_frames;
+    unsigned int                m_frameIndex;
 
     //CCubeMapTexture*            m_skyTextureCube;
     CTexture*                   m_skyTexture2D;
@@ -1070,6 +992,8 @@ private:
     static float                ms_dt;
 
     bool                        m_needReset;
+
+    Benchmark*                  m_benchmark;
 };
 
 float GetDeltaTime()
@@ -1079,9 +1003,11 @@ float GetDeltaTime()
 
 float CApplication::ms_dt = 0.0f;
 
-CApplication::CApplication()
-	: m_windowClass(WNDCLASSNAME)
-	, m_windowName(WNDNAME)
+CApplication::CApplication(const BenchmarkSettings* benchmarkSettings)
+	: m_windowName(WNDNAME)
+	, m_windowClass(WNDCLASSNAME)
+	, m_surface(VK_NULL_HANDLE)
+	, m_swapChain(VK_NULL_HANDLE)
 	, m_deferredRenderPass(VK_NULL_HANDLE)
 	, m_aoRenderPass(VK_NULL_HANDLE)
 	, m_dirLightRenderPass(VK_NULL_HANDLE)
@@ -1098,24 +1024,22 @@ CApplication::CApplication()
 	, m_ssrRenderPass(VK_NULL_HANDLE)
 	, m_terrainRenderPass(VK_NULL_HANDLE)
 	, m_vegetationRenderPass(VK_NULL_HANDLE)
-	, m_swapChain(VK_NULL_HANDLE)
-	, m_surface(VK_NULL_HANDLE)
 	, m_queue(VK_NULL_HANDLE)
-	, m_mainCommandBuffer(VK_NULL_HANDLE)
 	, m_commandPool(VK_NULL_HANDLE)
-	, m_aquireImageFence(VK_NULL_HANDLE)
-	, m_renderSemaphore(VK_NULL_HANDLE)
-	, m_renderFence(VK_NULL_HANDLE)
+	, m_mainCommandBuffer(VK_NULL_HANDLE)
+	, m_isSwapChainSuboptimal(false)
+	, m_offscreenMemory(VK_NULL_HANDLE)
 	, m_currentBuffer(-1)
+	, m_frameIndex(0)
 	//, m_skyTextureCube(nullptr)
 	, m_skyTexture2D(nullptr)
 	, m_sunTexture(nullptr)
 	, m_smokeTexture(nullptr)
+	, m_objectRenderer(nullptr)
+	, m_aoRenderer(nullptr)
 	, m_lightRenderer(nullptr)
 	, m_pointLightRenderer2(nullptr)
 	, m_particlesRenderer(nullptr)
-	, m_objectRenderer(nullptr)
-	, m_aoRenderer(nullptr)
 	, m_shadowRenderer(nullptr)
 	, m_shadowResolveRenderer(nullptr)
 	, m_skyRenderer(nullptr)
@@ -1126,28 +1050,50 @@ CApplication::CApplication()
 	, m_sunRenderer(nullptr)
 	, m_uiRenderer(nullptr)
 	, m_ssrRenderer(nullptr)
-	, m_vegetationRenderer(nullptr)
 	, m_terrainRenderer(nullptr)
+	, m_vegetationRenderer(nullptr)
     , m_screenshotRequested(false)
     , m_centerCursor(true)
-    , m_mouseMoved(true)
     , m_hideCursor(false)
+    , m_mouseMoved(true)
     , m_normMouseDX(0.0f)
     , m_normMouseDY(0.0f)
     , m_needReset(false)
+    , m_benchmark(nullptr)
 {
-    vk::Load();
-    InitWindow();
-    GetQueue();
-    CreateSurface();
-    CreateSwapChains();
+    if (benchmarkSettings)
+        m_benchmark = new Benchmark(*benchmarkSettings);
+
+    vk::Load(IsHeadless());
+    if (IsHeadless())
+    {
+        GetQueue();
+        CreateOffscreenImage();
+    }
+    else
+    {
+#ifdef _WIN32
+        InitWindow();
+        GetQueue();
+        CreateSurface();
+        CreateSwapChains();
+#else
+        TRAP(false && "There is no window off Windows, run with -benchmark");
+#endif
+    }
 
 	InputManager::CreateInstance();
+	PipelineCache::CreateInstance();
+	PipelineCache::GetInstance()->Load("pipeline_cache.bin");
 	MemoryManager::CreateInstance();
+	TransferQueue::CreateInstance();
+	CommandRecorder::CreateInstance();
+	CommandRecorder::GetInstance()->Init();
 	MeshManager::CreateInstance();
 	CTextureManager::CreateInstance();
 	ResourceLoader::CreateInstance();
 	BatchManager::CreateInstance();
+	ScatterUploader::CreateInstance();
 	MaterialLibrary::CreateInstance();
 	CUIManager::CreateInstance();
 	Scene::CreateInstance();
@@ -1155,9 +1101,16 @@ CApplication::CApplication()
     CreateCommandBuffer();
     CPickManager::CreateInstance();
 	ObjectSerializer::CreateInstance();
-	ObjectSerializer::GetInstance()->Load("scene.xml");
-
-	MemoryManager::GetInstance()->MapMemoryContext(EMemoryContextType::UniformBuffers);
+	//scene.xml is the authoring format. A binary snapshot is baked from it and used while it's up to date
+	if (IsHeadless())
+	{
+		ObjectSerializer::GetInstance()->Load(m_benchmark->GetSettings().SceneFile);
+	}
+	else if (!Serializer::IsSnapshotUpToDate("scene.bin", "scene.xml") || !ObjectSerializer::GetInstance()->LoadBinary("scene.bin"))
+	{
+		ObjectSerializer::GetInstance()->Load("scene.xml");
+		ObjectSerializer::GetInstance()->SaveBinary("scene.bin");
+	}
 
     SetupDeferredRendering();
     SetupAORendering();
@@ -1180,8 +1133,6 @@ CApplication::CApplication()
 
     GetPickManager()->Setup();
 
-	MemoryManager::GetInstance()->UnmapMemoryContext(EMemoryContextType::UniformBuffers);
-
     CreateSynchronizationHelpers();
     srand((unsigned int)time(NULL));
 
@@ -1191,6 +1142,7 @@ CApplication::CApplication()
 CApplication::~CApplication()
 {
     FreeImage_DeInitialise();
+    WaitForAllFrames();
 
 
 	delete m_smokeTexture;
@@ -1211,11 +1163,20 @@ CApplication::~CApplication()
     delete m_volumetricRenderer;
 
     VkDevice dev = vk::g_vulkanContext.m_device;
-    vk::DestroySemaphore(dev, m_renderSemaphore, nullptr);
-    vk::DestroyFence(dev, m_renderFence, nullptr);
-    vk::DestroyFence(dev, m_aquireImageFence, nullptr);
+    for (auto& frame : m_frames)
+    {
+        vk::DestroySemaphore(dev, frame.m_imageAcquiredSemaphore, nullptr);
+        vk::DestroySemaphore(dev, frame.m_renderFinishedSemaphore, nullptr);
+        vk::DestroyFence(dev, frame.m_renderFence, nullptr);
+    }
 
-    vk::DestroySwapchainKHR(dev, m_swapChain, nullptr);
+    if (m_swapChain != VK_NULL_HANDLE)
+        vk::DestroySwapchainKHR(dev, m_swapChain, nullptr);
+    if (m_offscreenMemory != VK_NULL_HANDLE)
+    {
+        vk::DestroyImage(dev, m_presentImages[0], nullptr);
+        vk::FreeMemory(dev, m_offscreenMemory, nullptr);
+    }
     vk::DestroyRenderPass(dev, m_deferredRenderPass, nullptr);
     vk::DestroyRenderPass(dev, m_aoRenderPass, nullptr);
     vk::DestroyRenderPass(dev, m_dirLightRenderPass, nullptr);
@@ -1238,15 +1199,22 @@ CApplication::~CApplication()
 	ObjectSerializer::DestroyInstance();
 	MaterialLibrary::DestroyInstance();
 	BatchManager::DestroyInstance();
+	ScatterUploader::DestroyInstance(); //the batches discard their pending updates
 	ResourceLoader::DestroyInstance();
 	CTextureManager::DestroyInstance();
 	MeshManager::DestroyInstance();
+	TransferQueue::DestroyInstance();
+	CommandRecorder::DestroyInstance();
 	MemoryManager::DestroyInstance();
+	PipelineCache::GetInstance()->Save();
+	PipelineCache::DestroyInstance();
 	InputManager::DestroyInstance();
 
     vk::DestroyCommandPool(dev, m_commandPool, nullptr);
-    vk::DestroySurfaceKHR(vk::g_vulkanContext.m_instance, m_surface, nullptr);
+    if (m_surface != VK_NULL_HANDLE)
+        vk::DestroySurfaceKHR(vk::g_vulkanContext.m_instance, m_surface, nullptr);
 
+    delete m_benchmark;
     CleanUp();
     vk::Unload();
 }
@@ -1256,11 +1224,20 @@ void CApplication::Run()
 {
     bool isRunning = true;
 	MaterialLibrary::GetInstance()->Initialize(m_objectRenderer);
+	BatchManager::GetInstance()->Initialize(m_objectRenderer);
+	ScatterUploader::GetInstance()->Initialize(m_objectRenderer);
     CreateResources();
     CreateQueryPools();
 	RegisterSpecialInputListeners();
 	//RenderCameraFrustrum();
 
+    if (IsHeadless())
+    {
+        RunBenchmark();
+        return;
+    }
+
+#ifdef _WIN32
     DWORD start;
     DWORD stop;
     DWORD dtMs;
@@ -1291,6 +1268,7 @@ void CApplication::Run()
         HideCursor(m_centerCursor);
         if(m_screenshotRequested)
         {
+            WaitForAllFrames();
             m_screenshotManager.WriteScreenshot();
             m_screenshotRequested = false;
         }
@@ -1306,8 +1284,33 @@ void CApplication::Run()
 
         ms_dt = (float)(dtMs) / 1000.0f;
     };
+#endif
 }
 
+//fixed time step and a scripted camera, so every run renders the same frames
+void CApplication::RunBenchmark()
+{
+    ms_dt = m_benchmark->GetFrameTime();
+    while (!m_benchmark->IsFinished())
+    {
+        m_benchmark->BeginFrame();
+
+        Scene::GetInstance()->Update(ms_dt);
+        BoundingBox3D sceneBox = Scene::GetInstance()->GetBoundingBox();
+        m_benchmark->PlaceCamera(ms_camera, sceneBox.Min, sceneBox.Max);
+        ms_camera.Update();
+
+        Render();
+
+        m_benchmark->EndFrame();
+    }
+
+    WaitForAllFrames();
+    bool written = m_benchmark->WriteResults();
+    TRAP(written);
+}
+
+#ifdef _WIN32
 void CApplication::InitWindow()
 {
     UINT width = WIDTH;
@@ -1393,6 +1396,7 @@ void CApplication::CreateSurface()
     vk::GetPhysicalDeviceSurfaceSupportKHR(vk::g_vulkanContext.m_physicalDevice, vk::g_vulkanContext.m_queueFamilyIndex, m_surface, &support);
     TRAP(support);
 }
+#endif
 
 
 VkImage CApplication::GetFinalOutput()
@@ -1421,9 +1425,10 @@ void CApplication::TransferToPresentImage()
     VkOffset3D offset;
     offset.x = offset.y = offset.z = 0;
 
+    //the window can be smaller than the frame after a resize
     VkExtent3D extent;
-    extent.width = WIDTH;
-    extent.height = HEIGHT;
+    extent.width = glm::min((uint32_t)WIDTH, m_presentExtent.width);
+    extent.height = glm::min((uint32_t)HEIGHT, m_presentExtent.height);
     extent.depth = 1;
 
     VkImageCopy imgCopy;
@@ -1458,7 +1463,7 @@ void CApplication::TransferToPresentImage()
     prePresentBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
     prePresentBarrier.dstAccessMask =  VK_ACCESS_MEMORY_READ_BIT;
     prePresentBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-    prePresentBarrier.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    prePresentBarrier.newLayout = (IsHeadless()) ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
     prePresentBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
     prePresentBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
     prePresentBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
@@ -1553,7 +1558,7 @@ void CApplication::CreateSwapChains()
     swapChainCrtInfo.pNext = nullptr;
     swapChainCrtInfo.flags = 0;
     swapChainCrtInfo.surface = m_surface;
-    swapChainCrtInfo.minImageCount = 2;
+    swapChainCrtInfo.minImageCount = glm::max(2u, capabilities.minImageCount);
     swapChainCrtInfo.imageFormat = formatUsed.format;
     swapChainCrtInfo.imageColorSpace = formatUsed.colorSpace;
     swapChainCrtInfo.imageExtent = extent;
@@ -1566,14 +1571,20 @@ void CApplication::CreateSwapChains()
     swapChainCrtInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
     swapChainCrtInfo.presentMode = VK_PRESENT_MODE_FIFO_KHR;
     swapChainCrtInfo.clipped = VK_TRUE;
-    swapChainCrtInfo.oldSwapchain = VK_NULL_HANDLE;
+    swapChainCrtInfo.oldSwapchain = m_swapChain;
 
+    VkSwapchainKHR oldSwapChain = m_swapChain;
     res = vk::CreateSwapchainKHR(context.m_device, &swapChainCrtInfo, nullptr, &m_swapChain);
     TRAP(res >= VK_SUCCESS);
+    if (oldSwapChain != VK_NULL_HANDLE)
+        vk::DestroySwapchainKHR(context.m_device, oldSwapChain, nullptr);
+
+    m_presentExtent = extent;
+    m_isSwapChainSuboptimal = false;
     
     unsigned int imageCnt;
     VULKAN_ASSERT(vk::GetSwapchainImagesKHR(vk::g_vulkanContext.m_device, m_swapChain, &imageCnt, nullptr));
-    TRAP(imageCnt == 2);
+    TRAP(imageCnt >= 2);
 
     m_presentImages.resize(imageCnt);
 
@@ -1581,6 +1592,44 @@ void CApplication::CreateSwapChains()
 }
 
 
+//headless stand-in for the swapchain. The frame is still copied in it, so the benchmark pays for the same copy as a present
+void CApplication::CreateOffscreenImage()
+{
+    VkImageCreateInfo imgInfo;
+    cleanStructure(imgInfo);
+    imgInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imgInfo.imageType = VK_IMAGE_TYPE_2D;
+    imgInfo.format = VK_FORMAT_B8G8R8A8_UNORM; //same as the post process output, CmdCopyImage needs it
+    imgInfo.extent.width = WIDTH;
+    imgInfo.extent.height = HEIGHT;
+    imgInfo.extent.depth = 1;
+    imgInfo.mipLevels = 1;
+    imgInfo.arrayLayers = 1;
+    imgInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imgInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imgInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    imgInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imgInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    m_presentImages.resize(1);
+    AllocImageMemory(imgInfo, m_presentImages[0], m_offscreenMemory, "OffscreenOutput");
+    m_presentExtent.width = WIDTH;
+    m_presentExtent.height = HEIGHT;
+}
+
+bool CApplication::RecreateSwapChain()
+{
+    VkSurfaceCapabilitiesKHR capabilities;
+    VULKAN_ASSERT(vk::GetPhysicalDeviceSurfaceCapabilitiesKHR(vk::g_vulkanContext.m_physicalDevice, m_surface, &capabilities));
+    if (capabilities.currentExtent.width == 0 || capabilities.currentExtent.height == 0)
+        return false;
+
+    //the frames in flight can still present the old images
+    WaitForAllFrames();
+    CreateSwapChains();
+    return true;
+}
+
 void CApplication::SetupDeferredRendering()
 {
     FramebufferDescription fbDesc;
@@ -2543,8 +2592,13 @@ void CApplication::CreateCommandBuffer()
     cmdAlocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
     cmdAlocInfo.commandBufferCount = 1;
 
-    VULKAN_ASSERT(vk::AllocateCommandBuffers(vk::g_vulkanContext.m_device, &cmdAlocInfo, &m_mainCommandBuffer));
+    for (auto& frame : m_frames)
+    {
+        VULKAN_ASSERT(vk::AllocateCommandBuffers(vk::g_vulkanContext.m_device, &cmdAlocInfo, &frame.m_commandBuffer));
+        VULKAN_ASSERT(vk::AllocateCommandBuffers(vk::g_vulkanContext.m_device, &cmdAlocInfo, &frame.m_uploadCommandBuffer));
+    }
 
+    m_mainCommandBuffer = m_frames[m_frameIndex].m_commandBuffer;
     vk::g_vulkanContext.m_mainCommandBuffer = m_mainCommandBuffer;
 }
 
@@ -2554,6 +2608,9 @@ void CApplication::GetQueue()
     TRAP(m_queue != VK_NULL_HANDLE);
 
     vk::g_vulkanContext.m_graphicQueue = m_queue;
+
+    vk::GetDeviceQueue(vk::g_vulkanContext.m_device, vk::g_vulkanContext.m_transferQueueFamilyIndex, 0, &vk::g_vulkanContext.m_transferQueue);
+    TRAP(vk::g_vulkanContext.m_transferQueue != VK_NULL_HANDLE);
 }
 
 void CApplication::CreateSynchronizationHelpers()
@@ -2562,10 +2619,7 @@ void CApplication::CreateSynchronizationHelpers()
     cleanStructure(fenceCreateInfo);
     fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
     fenceCreateInfo.pNext = nullptr;
-    fenceCreateInfo.flags = 0;
-
-    VULKAN_ASSERT(vk::CreateFence(vk::g_vulkanContext.m_device, &fenceCreateInfo, nullptr, &m_aquireImageFence));
-    VULKAN_ASSERT(vk::CreateFence(vk::g_vulkanContext.m_device, &fenceCreateInfo, nullptr, &m_renderFence));
+    fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT; //so the first wait on every frame slot doesn't block
 
     VkSemaphoreCreateInfo semaphoreCreateInfo;
     cleanStructure(semaphoreCreateInfo);
@@ -2573,7 +2627,23 @@ void CApplication::CreateSynchronizationHelpers()
     semaphoreCreateInfo.pNext = nullptr;
     semaphoreCreateInfo.flags = 0;
 
-    VULKAN_ASSERT(vk::CreateSemaphore(vk::g_vulkanContext.m_device, &semaphoreCreateInfo, nullptr, &m_renderSemaphore));
+    for (auto& frame : m_frames)
+    {
+        VULKAN_ASSERT(vk::CreateFence(vk::g_vulkanContext.m_device, &fenceCreateInfo, nullptr, &frame.m_renderFence));
+        VULKAN_ASSERT(vk::CreateSemaphore(vk::g_vulkanContext.m_device, &semaphoreCreateInfo, nullptr, &frame.m_imageAcquiredSemaphore));
+        VULKAN_ASSERT(vk::CreateSemaphore(vk::g_vulkanContext.m_device, &semaphoreCreateInfo, nullptr, &frame.m_renderFinishedSemaphore));
+    }
+}
+
+void CApplication::WaitForFrame(unsigned int frameIndex)
+{
+    vk::WaitForFences(vk::g_vulkanContext.m_device, 1, &m_frames[frameIndex].m_renderFence, VK_TRUE, UINT64_MAX);
+}
+
+void CApplication::WaitForAllFrames()
+{
+    for (unsigned int i = 0; i < FRAMES_IN_FLIGHT; ++i)
+        WaitForFrame(i);
 }
 
 void CApplication::CreateQueryPools()
@@ -2686,6 +2756,7 @@ void CApplication::CreateResources()
     //SetupPointLights();
 }
 
+#ifdef _WIN32
 void CApplication::UpdateCameraRotation()
 {
     if(!m_centerCursor)
@@ -2729,29 +2800,58 @@ LRESULT CApplication::WindowProc(
 
     return DefWindowProc(hwnd, uMsg, wParam, lParam);
 }
+#endif
 
 void CApplication::Render()
 {
-    //PULA
-    vk::AcquireNextImageKHR(vk::g_vulkanContext.m_device, m_swapChain, 0, VK_NULL_HANDLE, m_aquireImageFence, &m_currentBuffer);
-    vk::WaitForFences(vk::g_vulkanContext.m_device, 1, &m_aquireImageFence,VK_TRUE, UINT64_MAX);
-    vk::ResetFences(vk::g_vulkanContext.m_device, 1, &m_aquireImageFence);
+    VkDevice dev = vk::g_vulkanContext.m_device;
+    FrameData& frame = m_frames[m_frameIndex];
+
+    //wait only for the frame that used this slot. The others can still be in flight
+    WaitForFrame(m_frameIndex);
+
+    if (IsHeadless())
+        m_currentBuffer = 0;
+    else
+    {
+        //nothing is recorded yet and the fence is still signaled, so the frame can be skipped. It's drawn in the new swapchain next time
+        VkResult res = vk::AcquireNextImageKHR(dev, m_swapChain, UINT64_MAX, frame.m_imageAcquiredSemaphore, VK_NULL_HANDLE, &m_currentBuffer);
+        if (res == VK_ERROR_OUT_OF_DATE_KHR)
+        {
+            RecreateSwapChain();
+            return;
+        }
+
+        //the image is acquired and the semaphore signaled, the frame goes on and the swapchain is recreated after the present
+        TRAP(res == VK_SUCCESS || res == VK_SUBOPTIMAL_KHR);
+        m_isSwapChainSuboptimal = (res == VK_SUBOPTIMAL_KHR);
+    }
+
+    MemoryManager::GetInstance()->BeginFrame(m_frameIndex); //before the reset, the stagging ring retires by this fence too
+    CommandRecorder::GetInstance()->BeginFrame(m_frameIndex);
+    ScatterUploader::GetInstance()->BeginFrame(m_frameIndex);
+    vk::ResetFences(dev, 1, &frame.m_renderFence);
+
+    m_mainCommandBuffer = frame.m_commandBuffer;
+    vk::g_vulkanContext.m_mainCommandBuffer = m_mainCommandBuffer;
 
-	MemoryManager::GetInstance()->MapMemoryContext(EMemoryContextType::UniformBuffers);
 	CRenderer::PrepareAll();
 	BatchManager::GetInstance()->PreRender();
-	MemoryManager::GetInstance()->UnmapMemoryContext(EMemoryContextType::UniformBuffers);
 
     StartCommandBuffer();
+    QueryManager::GetInstance().Reset(); //first, the timestamps of the frame start here
+    uint32_t frameScope = QueryManager::GetInstance().BeginTimestamp("Frame");
+	ScatterUploader::GetInstance()->Record(m_mainCommandBuffer); //the object and material data written by PreRender
+	BatchManager::GetInstance()->Cull(); //before Update, so only the batches written by PreRender are culled
 	
     CTextureManager::GetInstance()->Update();
 	MeshManager::GetInstance()->Update();
 	BatchManager::GetInstance()->Update();
+	TransferQueue::GetInstance()->Submit();
 
 	CRenderer::ComputeAll();
 
     //BeginFrame();
-    QueryManager::GetInstance().Reset();
     QueryManager::GetInstance().StartStatistics();
     RenderShadows();
 
@@ -2791,30 +2891,61 @@ void CApplication::Render()
 
     TransferToPresentImage();
 
+    QueryManager::GetInstance().EndTimestamp(frameScope);
     QueryManager::GetInstance().EndStatistics();
     QueryManager::GetInstance().GetQueries();
     EndCommandBuffer();
 
+    //all the cpu writes for this frame are done, now we know what to upload
+    RecordFrameUploads();
+
+    VkCommandBuffer cmdBuffers[] = { frame.m_uploadCommandBuffer, frame.m_commandBuffer };
+    std::vector<VkSemaphore> waitSemaphores;
+    std::vector<VkPipelineStageFlags> waitStages;
+    if (!IsHeadless())
+    {
+        waitSemaphores.push_back(frame.m_imageAcquiredSemaphore);
+        waitStages.push_back(VK_PIPELINE_STAGE_TRANSFER_BIT); //first use of the present image is the copy in TransferToPresentImage
+    }
+    TransferQueue::GetInstance()->GetWaitSemaphores(waitSemaphores, waitStages);
+
     VkSubmitInfo submitInfo;
     cleanStructure(submitInfo);
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
     submitInfo.pNext = nullptr;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &m_mainCommandBuffer;
-    VULKAN_ASSERT(vk::QueueSubmit(m_queue, 1, &submitInfo, m_renderFence)); 
-
-    vk::WaitForFences(vk::g_vulkanContext.m_device, 1, &m_renderFence, VK_TRUE, UINT64_MAX);
-    vk::ResetFences(vk::g_vulkanContext.m_device, 1, &m_renderFence);
+    submitInfo.waitSemaphoreCount = (uint32_t)waitSemaphores.size();
+    submitInfo.pWaitSemaphores = waitSemaphores.data();
+    submitInfo.pWaitDstStageMask = waitStages.data();
+    submitInfo.commandBufferCount = 2;
+    submitInfo.pCommandBuffers = cmdBuffers;
+    submitInfo.signalSemaphoreCount = (IsHeadless()) ? 0 : 1; //nobody presents, nobody would wait it
+    submitInfo.pSignalSemaphores = &frame.m_renderFinishedSemaphore;
+    VULKAN_ASSERT(vk::QueueSubmit(m_queue, 1, &submitInfo, frame.m_renderFence)); 
+    MemoryManager::GetInstance()->EndFrame(frame.m_renderFence);
+
+    if (IsHeadless())
+    {
+        m_frameIndex = (m_frameIndex + 1) % FRAMES_IN_FLIGHT;
+        return;
+    }
 
     VkPresentInfoKHR presentInfo;
     cleanStructure(presentInfo);
     presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
     presentInfo.pNext = nullptr;
+    presentInfo.waitSemaphoreCount = 1;
+    presentInfo.pWaitSemaphores = &frame.m_renderFinishedSemaphore;
     presentInfo.swapchainCount = 1;
     presentInfo.pSwapchains = &m_swapChain;
     presentInfo.pImageIndices = &m_currentBuffer;
 
-    VULKAN_ASSERT(vk::QueuePresentKHR(m_queue, &presentInfo));
+    VkResult res = vk::QueuePresentKHR(m_queue, &presentInfo);
+    TRAP(res == VK_SUCCESS || res == VK_SUBOPTIMAL_KHR || res == VK_ERROR_OUT_OF_DATE_KHR);
+
+    m_frameIndex = (m_frameIndex + 1) % FRAMES_IN_FLIGHT;
+
+    if (res != VK_SUCCESS || m_isSwapChainSuboptimal)
+        RecreateSwapChain();
 }
 
 
@@ -2829,9 +2960,10 @@ void CApplication::StartDeferredRender()
 
 void CApplication::RenderShadows()
 {
-    m_shadowRenderer->StartRenderPass();
+    //the batches are recorded on the worker threads, the terrain on this thread, in the same subpass
+    m_shadowRenderer->StartRenderPass(VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
     m_shadowRenderer->Render();
-	m_terrainRenderer->RenderShadows();
+    CommandRecorder::GetInstance()->RecordOnMainThread([this]() { m_terrainRenderer->RenderShadows(); });
     m_shadowRenderer->EndRenderPass();
 }
 
@@ -2872,12 +3004,28 @@ void CApplication::EndCommandBuffer()
     vk::EndCommandBuffer(m_mainCommandBuffer);
 }
 
+void CApplication::RecordFrameUploads()
+{
+    VkCommandBuffer uploadCmdBuffer = m_frames[m_frameIndex].m_uploadCommandBuffer;
+
+    VkCommandBufferBeginInfo bufferBeginInfo;
+    cleanStructure(bufferBeginInfo);
+    bufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    bufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    vk::BeginCommandBuffer(uploadCmdBuffer, &bufferBeginInfo);
+    MemoryManager::GetInstance()->RecordFrameUploads(uploadCmdBuffer);
+    vk::EndCommandBuffer(uploadCmdBuffer);
+}
+
 void CApplication::Reset()
 {
+    WaitForAllFrames(); //pipelines and framebuffers are recreated
     CRenderer::ReloadAll();
     m_needReset = false;
 }
 
+#ifdef _WIN32
 void CApplication::ProcMsg(UINT uMsg, WPARAM wParam,LPARAM lParam)
 {
     if(uMsg == WM_CLOSE)
@@ -2957,6 +3105,12 @@ void CApplication::ProcMsg(UINT uMsg, WPARAM wParam,LPARAM lParam)
             m_screenshotRequested = true;
         }
 
+        if (wParam == VK_F6)
+        {
+            if (QueryManager::GetInstance().ExportChromeTrace("gpu_trace.json"))
+                std::cout << "GPU trace written to gpu_trace.json" << std::endl;
+        }
+
        /* if (wParam == VK_TAB)
         {
             m_uiManager->ToggleDisplayInfo();
@@ -2965,6 +3119,7 @@ void CApplication::ProcMsg(UINT uMsg, WPARAM wParam,LPARAM lParam)
 		InputManager::GetInstance()->RegisterKeyboardEvent(wParam);
     }
 }
+#endif
 
 
 glm::vec4 GetPlaneFrom(glm::vec4 p1, glm::vec4 p2, glm::vec4 p3)
@@ -2977,7 +3132,17 @@ glm::vec4 GetPlaneFrom(glm::vec4 p1, glm::vec4 p2, glm::vec4 p3)
 
 int main(int argc, char* arg[])
 {
-	CApplication app;
+    BenchmarkSettings benchmarkSettings;
+    bool benchmark = benchmarkSettings.Parse(argc, arg);
+#ifndef _WIN32
+    if (!benchmark)
+    {
+        std::cout << "Only the benchmark runs off Windows: " << arg[0] << " -benchmark scene.xml [-frames N] [-warmup N] [-camera path.txt] [-out file]" << std::endl;
+        return 1;
+    }
+#endif
+
+	CApplication app((benchmark) ? &benchmarkSettings : nullptr);
 
     app.Run();
     return 0;